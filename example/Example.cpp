@@ -171,13 +171,28 @@ void Example::setupVk()
   checkShaderBuild(vkShader2->addShaderSPIRV(VulkanShaderProgram::ST_VERTEX, "glsl/lightingTex.vert.spv"));
   checkShaderBuild(vkShader2->addShaderSPIRV(VulkanShaderProgram::ST_FRAGMENT, "glsl/lightingTex.frag.spv"));
 
-  vkVbo = make_shared<VulkanBufferGroup>(device, (VkCommandPool)VK_NULL_HANDLE, (VkQueue)VK_NULL_HANDLE, 3);
-  vkVbo->data(0, modelVerts, sizeof(modelVerts), transferCb);
-  vkVbo->data(1, modelNorms, sizeof(modelNorms), transferCb);
-  vkVbo->data(2, modelTexcoords, sizeof(modelTexcoords), transferCb);
-  vkEbo = make_shared<VulkanBufferGroup>(device, (VkCommandPool)VK_NULL_HANDLE, (VkQueue)VK_NULL_HANDLE, 1);
-  vkEbo->setUsageType(VulkanBufferGroup::UT_INDEX);
-  vkEbo->data(0, modelIndices, sizeof(modelIndices), transferCb);
+  //the same model can also be loaded from a binary mesh file (written with VulkanMeshFile::write()), which is streamed straight from disk
+  VulkanMeshFile meshFile;
+  if(meshFile.open("model.vglmesh") && meshFile.getHeader().streamCount == 3 && meshFile.getHeader().indexSize == sizeof(uint32_t))
+  {
+    vkVbo = make_shared<VulkanBufferGroup>(device, transferPool, queue, 3);
+    vkEbo = make_shared<VulkanBufferGroup>(device, transferPool, queue, 1);
+    vkEbo->setUsageType(VulkanBufferGroup::UT_INDEX);
+    meshFile.upload(vkVbo.get(), vkEbo.get());
+    modelIndexCount = meshFile.getHeader().indexCount;
+    meshFile.close();
+  }
+  else
+  {
+    vkVbo = make_shared<VulkanBufferGroup>(device, (VkCommandPool)VK_NULL_HANDLE, (VkQueue)VK_NULL_HANDLE, 3);
+    vkVbo->data(0, modelVerts, sizeof(modelVerts), transferCb);
+    vkVbo->data(1, modelNorms, sizeof(modelNorms), transferCb);
+    vkVbo->data(2, modelTexcoords, sizeof(modelTexcoords), transferCb);
+    vkEbo = make_shared<VulkanBufferGroup>(device, (VkCommandPool)VK_NULL_HANDLE, (VkQueue)VK_NULL_HANDLE, 1);
+    vkEbo->setUsageType(VulkanBufferGroup::UT_INDEX);
+    vkEbo->data(0, modelIndices, sizeof(modelIndices), transferCb);
+    modelIndexCount = sizeof(modelIndices)/sizeof(uint32_t);
+  }
 
   vkVao = make_shared<VulkanVertexArray>(instance.getDefaultDevice());
   vkVao->setAttribute(0, vkVbo.get(), 0, VK_FORMAT_R32G32B32_SFLOAT, 0, sizeof(float)*3);
@@ -355,7 +370,7 @@ void Example::doRender()
     renderer->updateShaderDynamicUBO(0, 0, &uboData1, sizeof(uboData1));
     renderer->prepareToDraw();
 
-    renderer->drawIndexedPrimitives(PT_TRIANGLES, sizeof(modelIndices)/sizeof(uint32_t));
+    renderer->drawIndexedPrimitives(PT_TRIANGLES, modelIndexCount);
   }
 
   renderer->endFrame();
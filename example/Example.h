@@ -37,6 +37,7 @@ protected:
   ExampleRenderer *renderer = nullptr;
   std::shared_ptr<vgl::core::VulkanShaderProgram> vkShader1, vkShader2;
   std::shared_ptr<vgl::core::VulkanBufferGroup> vkVbo, vkEbo, vkUbo;
+  size_t modelIndexCount = 0;
   std::shared_ptr<vgl::core::VulkanVertexArray> vkVao;
   std::shared_ptr<vgl::core::VulkanTexture> vkTexture;
 };
@@ -26,6 +26,7 @@ limitations under the License.
 #include "VulkanPipeline.h"
 #include "VulkanDescriptorSetLayout.h"
 #include "VulkanDescriptorPool.h"
+#include "VulkanMemoryManager.h"
 
 //shut up a you face... (https://www.youtube.com/watch?v=jqHg4w7qi0o&feature=youtu.be&t=9)
 #ifdef _MSC_VER
@@ -784,6 +785,17 @@ void ExampleRenderer::beginFrame()
     assert(instance->getSwapChain()->acquireNextImage(i));
   }
 
+  //keep device local heaps under budget by demoting the least recently used resources to host memory (and promoting them back later),
+  //this has to happen after acquiring so that the moved resources are retained until this frame completes
+  auto memoryManager = instance->getMemoryManager();
+  if(memoryManager->residencyBalanceNeeded())
+    memoryManager->balanceResidency(getSetupCommandBuffer(), (32<<20));
+
+  //finer mip levels of streaming textures trickle in under the streamer's per frame budget
+  auto textureStreamer = instance->getTextureStreamer();
+  if(!textureStreamer->isIdle())
+    textureStreamer->pump(getSetupCommandBuffer());
+
   auto commandBuffer = swapchainFramebuffers->getCommandBuffer(i);
 
   currentRenderPool = swapchainFramebuffers->getCurrentDescriptorPool(i);
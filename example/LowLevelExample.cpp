@@ -224,6 +224,9 @@ void VGLPPVkDemo::setupVk()
   ubo.view = toMat4(translation_matrix(vec<float, 3>{ 0.0f, 0.0f, -2.0f }));
   ubo.proj = toMat4(perspective_matrix((float)(M_PI/4.0f), screenW/(float)screenH, 0.1f, 1000.0f, linalg::neg_z, linalg::zero_to_one));
 
+  //every upload below goes out in one submit
+  vkInstance->getUploadBatcher()->begin();
+
   vkVbo = make_shared<VulkanBufferGroup>(device, transferPool, queue, 2);
   vkVbo->data(0, vertices, sizeof(vertices));
   vkVbo->data(1, texcoords, sizeof(texcoords));
@@ -280,6 +283,8 @@ void VGLPPVkDemo::setupVk()
   };
   createTex();
 
+  vkInstance->getUploadBatcher()->end();
+
   vkDescriptorPool = make_shared<VulkanDescriptorPool>(device, 32, 0, 16, 16, 0);
 
   VulkanDescriptorSetLayout::Binding vtxUbo = { 0, 1 }, txtSampler = { 1, 1 }, none = {};
@@ -19,6 +19,7 @@ limitations under the License.
 #include <chrono>
 #include <thread>
 #include "VulkanAsyncResourceHandle.h"
+#include "VulkanInstance.h"
 #ifndef VGL_VULKAN_CORE_STANDALONE
 #include "System.h"
 #endif
@@ -156,6 +157,16 @@ namespace vgl
       return handle;
     }
 
+    VulkanAsyncResourceHandle *VulkanAsyncResourceHandle::newImportedBuffer(VulkanAsyncResourceMonitor *monitor, VkDevice device, VkBuffer buffer, VkDeviceMemory memory)
+    {
+      auto handle = new VulkanAsyncResourceHandle(monitor, IMPORTED_BUFFER, device);
+
+      handle->buffer = buffer;
+      handle->importedMemory = memory;
+      handle->alloc = nullptr;
+      return handle;
+    }
+
     VulkanAsyncResourceHandle *VulkanAsyncResourceHandle::newImage(VulkanAsyncResourceMonitor *monitor, VkDevice device, VkImage image, VkImageView imageView, VulkanMemoryManager::Suballocation alloc)
     {
       auto handle = new VulkanAsyncResourceHandle(monitor, IMAGE, device);
@@ -203,6 +214,25 @@ namespace vgl
       return handle;
     }
 
+    VulkanAsyncResourceHandle *VulkanAsyncResourceHandle::newSemaphore(VulkanAsyncResourceMonitor *monitor, VkDevice device, VkSemaphore semaphore)
+    {
+      auto handle = new VulkanAsyncResourceHandle(monitor, SEMAPHORE, device);
+
+      handle->semaphore = semaphore;
+      handle->alloc = nullptr;
+      return handle;
+    }
+
+    VulkanAsyncResourceHandle *VulkanAsyncResourceHandle::newUploadRange(VulkanAsyncResourceMonitor *monitor, VkDevice device, VulkanUploadRing *ring, uint64_t rangeId)
+    {
+      auto handle = new VulkanAsyncResourceHandle(monitor, UPLOAD_RANGE, device);
+
+      handle->uploadRing = ring;
+      handle->uploadRangeId = rangeId;
+      handle->alloc = nullptr;
+      return handle;
+    }
+
     VulkanAsyncResourceHandle *VulkanAsyncResourceHandle::newFunction(VulkanAsyncResourceMonitor *monitor, VkDevice device, std::function<void()> func)
     {
       auto handle = new VulkanAsyncResourceHandle(monitor, FUNCTION, device);
@@ -236,9 +266,17 @@ namespace vgl
         case FENCE: 
           vkDestroyFence(device, fence, nullptr);
         break;
+        case SEMAPHORE:
+          vkDestroySemaphore(device, semaphore, nullptr);
+        break;
         case BUFFER: 
           vkDestroyBuffer(device, buffer, nullptr);
         break;
+        case IMPORTED_BUFFER:
+          //imported host memory isn't suballocated, so it's freed right along with its buffer
+          vkDestroyBuffer(device, buffer, nullptr);
+          monitor->memoryManager->freeImportedMemory(importedMemory);
+        break;
         case IMAGE:
           vkDestroyImage(device, image, nullptr);
           if(imageView)
@@ -282,6 +320,9 @@ namespace vgl
 #endif
         }
         break;
+        case UPLOAD_RANGE:
+          uploadRing->release(uploadRangeId);
+        break;
       }
 
       if(alloc)
@@ -31,6 +31,7 @@ namespace vgl
   {
     struct VulkanAsyncResourceMonitor;
     struct VulkanAsyncResourceHandle;
+    class VulkanUploadRing;
 
     struct VulkanAsyncResourceCollection
     {
@@ -78,24 +79,28 @@ namespace vgl
       union
       {
         VkFence fence;
+        VkSemaphore semaphore;
         VkBuffer buffer;
         VkImage image;
         VkSampler sampler;
         VkCommandBuffer commandBuffer;
         VkDescriptorPool descriptorPool;
         std::function<void()> *function;
+        VulkanUploadRing *uploadRing;
       };
       union
       {
         VkImageView imageView;
         VkCommandPool commandPool;
+        VkDeviceMemory importedMemory;
+        uint64_t uploadRangeId;
       };
       VulkanMemoryManager::Suballocation alloc;
       VkDevice device;
 
       enum Type
       {
-        FENCE, BUFFER, IMAGE, SAMPLER, COMMAND_BUFFER, DESCRIPTOR_POOL, FUNCTION
+        FENCE, BUFFER, IMAGE, SAMPLER, COMMAND_BUFFER, DESCRIPTOR_POOL, FUNCTION, UPLOAD_RANGE, SEMAPHORE, IMPORTED_BUFFER
       };
 
       VulkanAsyncResourceHandle(VulkanAsyncResourceMonitor *monitor, Type type, VkDevice device);
@@ -105,7 +110,10 @@ namespace vgl
       static VulkanAsyncResourceHandle *newSampler(VulkanAsyncResourceMonitor *monitor, VkDevice device, VkSampler sampler);
       static VulkanAsyncResourceHandle *newCommandBuffer(VulkanAsyncResourceMonitor *monitor, VkDevice device, VkCommandBuffer commandBuffer, VkCommandPool pool);
       static VulkanAsyncResourceHandle *newFence(VulkanAsyncResourceMonitor *monitor, VkDevice device, VkFence fence);
+      static VulkanAsyncResourceHandle *newSemaphore(VulkanAsyncResourceMonitor *monitor, VkDevice device, VkSemaphore semaphore);
       static VulkanAsyncResourceHandle *newDescriptorPool(VulkanAsyncResourceMonitor *monitor, VkDevice device, VkDescriptorPool pool);
+      static VulkanAsyncResourceHandle *newImportedBuffer(VulkanAsyncResourceMonitor *monitor, VkDevice device, VkBuffer buffer, VkDeviceMemory memory);
+      static VulkanAsyncResourceHandle *newUploadRange(VulkanAsyncResourceMonitor *monitor, VkDevice device, VulkanUploadRing *ring, uint64_t rangeId);
 
       ///The nuclear option:  Unlike the others, this one will call the given function on the main thread when the resource is to be freed
       static VulkanAsyncResourceHandle *newFunction(VulkanAsyncResourceMonitor *monitor, VkDevice device, std::function<void()> function);
@@ -21,6 +21,7 @@ limitations under the License.
 #include "VulkanBufferGroup.h"
 #include "VulkanMemoryManager.h"
 #include "VulkanAsyncResourceHandle.h"
+#include "VulkanExtensionLoader.h"
 #include "VulkanFrameBuffer.h"
 
 using namespace std;
@@ -37,6 +38,7 @@ namespace vgl
         device = instance->getDefaultDevice();
       buffers = new PerBuffer[numBuffers];
       memset(buffers, 0, sizeof(PerBuffer)*numBuffers);
+      dirtyRanges.resize(numBuffers);
     }
 
     VulkanBufferGroup::~VulkanBufferGroup()
@@ -47,24 +49,25 @@ namespace vgl
       {
         if(buffers[i].buffer)
         {
+          mm.setRelocationDelegate(buffers[i].bufferAllocation, nullptr);
           if(buffers[i].bufferHandle->release())
             delete buffers[i].bufferHandle;
         }
         if(buffers[i].stagingBuffer)
         {
-          if(persistentlyMappedHostMemoryAddress)
-          {
-            auto alloc = buffers[i].stagingBufferAllocation;           
-            auto allocInfo = instance->getMemoryManager()->getAllocationInfo(alloc);
-
-            vkUnmapMemory(device, allocInfo.memory);
-            persistentlyMappedHostMemoryAddress = nullptr;
-          }
-
+          //the memory manager owns the mapping, so there's nothing to unmap here
           if(buffers[i].stagingBufferHandle->release())
             delete buffers[i].stagingBufferHandle;
         }
       }
+      for(auto &copies : streamingCopies)
+      {
+        for(auto &copy : copies) if(copy.handle)
+        {
+          if(copy.handle->release())
+            delete copy.handle;
+        }
+      }
       delete []buffers;
     }
 
@@ -81,6 +84,17 @@ namespace vgl
       stageToDevice = local;
     }
 
+    void VulkanBufferGroup::setStreaming(bool streaming)
+    {
+      this->streaming = streaming;
+      if(streaming)
+      {
+        //the copies are written in place by the host, so they're never staged to device local memory
+        stageToDevice = false;
+        streamingCopies.resize(bufferCount);
+      }
+    }
+
     bool VulkanBufferGroup::isDeviceLocal()
     {
       return (stageToDevice || stagingBufferDeviceLocal);
@@ -132,6 +146,12 @@ namespace vgl
 
     void VulkanBufferGroup::data(int bufferIndex, const void *data, size_t numBytes, VkCommandBuffer transferCommandBuffer, bool frame)
     {
+      if(streaming && !dedicatedAllocation && !readbackEnabled && instance->getSwapChain())
+      {
+        streamingData(bufferIndex, data, numBytes);
+        return;
+      }
+
       auto memoryManager = instance->getMemoryManager();
       bool emptyBuffer = false;
 
@@ -142,32 +162,51 @@ namespace vgl
         emptyBuffer = true;
       }
 
-      if(buffers[bufferIndex].buffer)
-      {
-        if(buffers[bufferIndex].bufferHandle->release())
-          delete buffers[bufferIndex].bufferHandle;
-        buffers[bufferIndex].buffer = VK_NULL_HANDLE;
-      }
-      if(buffers[bufferIndex].stagingBuffer)
+      auto &perBuffer = buffers[bufferIndex];
+      discardSubData(bufferIndex);
+
+      const VkBufferUsageFlags stagingUsage = finalStagingUsage();
+
+      //staging & host visible buffers are written right away, so they're only reused once nothing pending holds their handles
+      prepareDeviceBuffer(bufferIndex, numBytes);
+      if(perBuffer.stagingBuffer)
       {
-        if(buffers[bufferIndex].stagingBufferHandle->release())
-          delete buffers[bufferIndex].stagingBufferHandle;
-        buffers[bufferIndex].stagingBuffer = VK_NULL_HANDLE;
+        //ring ranges & imported host memory (neither has an allocation of ours) are never written in place
+        if(perBuffer.stagingRingData || !perBuffer.stagingBufferAllocation || perBuffer.stagingUsage != stagingUsage || !fitsCapacity(perBuffer.stagingCapacity, numBytes) || 
+          perBuffer.stagingBufferHandle->refCount > 1)
+        {
+          if(perBuffer.stagingBufferHandle->release())
+            delete perBuffer.stagingBufferHandle;
+          perBuffer.stagingBuffer = VK_NULL_HANDLE;
+        }
       }
 
-      auto setFinalBufferUsage = [=](VkBufferCreateInfo &bufferInfo) {
-        if(usageType == UT_VERTEX)
-          bufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
-        else if(usageType == UT_INDEX)
-          bufferInfo.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
-        else if(usageType == UT_UNIFORM || usageType == UT_UNIFORM_DYNAMIC)
-          bufferInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
-        else if(usageType == UT_SHADER_STORAGE)
-          bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
-      };
-
       VkBufferCreateInfo bufferInfo = {};
       VulkanMemoryManager::Suballocation alloc;
+      auto swapChain = instance->getSwapChain();
+
+      //staging released right after a copy whose completion is tracked (by frame or fence) can be a range of the shared upload ring, 
+      //which skips creating & allocating a buffer altogether
+      if(!perBuffer.stagingBuffer && stageToDevice && autoReleaseStaging && !readbackEnabled && !dedicatedAllocation && 
+        (frame || !transferCommandBuffer || transferCommandBuffer == instance->getCurrentTransferCommandBuffer()))
+      {
+        auto uploadRing = instance->getUploadRing();
+
+        if(uploadRing)
+        {
+          if(auto range = uploadRing->allocate(numBytes))
+          {
+            perBuffer.stagingBuffer = range.buffer;
+            perBuffer.stagingBufferHandle = range.handle;
+            perBuffer.stagingBufferAllocation = nullptr;
+            perBuffer.stagingOffset = range.offset;
+            perBuffer.stagingRingData = range.mappedData;
+            perBuffer.stagingCapacity = numBytes;
+            perBuffer.stagingUsage = stagingUsage;
+            perBuffer.persistentlyMappedAddress = nullptr;
+          }
+        }
+      }
 
       if(!buffers[bufferIndex].stagingBuffer)
       {
@@ -175,15 +214,15 @@ namespace vgl
 
         auto stagingBufferMemoryFlags = (dedicatedHostAllocationId) ? dedicatedHostAllocationMemoryFlags : (VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 
+        //staging that's released right after this call has no use for extra capacity, and dedicated allocations have a fixed size
+        perBuffer.stagingCapacity = ((stageToDevice && autoReleaseStaging) || dedicatedAllocation) ? numBytes : grownCapacity(perBuffer.stagingCapacity, numBytes);
+        perBuffer.stagingUsage = stagingUsage;
+        perBuffer.stagingOffset = 0;
+        perBuffer.stagingRingData = nullptr;
+
         bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-        bufferInfo.size = numBytes;
-        if(!stageToDevice)
-          setFinalBufferUsage(bufferInfo);
-        else
-          bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-        
-        if(readbackEnabled)
-          bufferInfo.usage |= VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        bufferInfo.size = perBuffer.stagingCapacity;
+        bufferInfo.usage = stagingUsage;
 
         if(vkCreateBuffer(device, &bufferInfo, nullptr, &buffers[bufferIndex].stagingBuffer) != VK_SUCCESS)
         {
@@ -227,7 +266,17 @@ namespace vgl
           dedicatedHostAllocationMemoryFlags = (VkMemoryPropertyFlagBits)stagingBufferMemoryFlags;
         }
 
-        alloc = memoryManager->allocateBuffer(stagingBufferMemoryFlags, buffers[bufferIndex].stagingBuffer, dedicatedHostAllocationId);
+        //staging released right after a copy that's submitted now (or recorded into this frame) only has to outlive the 
+        //current frame, so it can come from the frame's linear allocator instead of the general one
+        alloc = nullptr;
+        if(stageToDevice && autoReleaseStaging && !readbackEnabled && !dedicatedAllocation && swapChain && (frame || !transferCommandBuffer))
+          alloc = memoryManager->allocateTransientBuffer(stagingBufferMemoryFlags, buffers[bufferIndex].stagingBuffer, swapChain->getCurrentFrameId());
+        if(!alloc)
+        {
+          //staging that's released after the copy is short lived, otherwise it lives as long as the buffer itself
+          auto stagingLifetime = (stageToDevice && autoReleaseStaging && !readbackEnabled) ? VulkanMemoryManager::LT_TRANSIENT : lifetime;
+          alloc = memoryManager->allocateBuffer(stagingBufferMemoryFlags, buffers[bufferIndex].stagingBuffer, dedicatedHostAllocationId, stagingLifetime);
+        }
 
         buffers[bufferIndex].stagingBufferAllocation = alloc;
         memoryManager->bindBufferMemory(buffers[bufferIndex].stagingBuffer, alloc);
@@ -238,24 +287,393 @@ namespace vgl
           throw vgl_runtime_error("Failed to allocate vulkan buffer!");
       }
 
-      if(stageToDevice && !buffers[bufferIndex].buffer)
+      buffers[bufferIndex].size = numBytes;
+
+      if(data)
       {
-        setFinalBufferUsage(bufferInfo);
-        bufferInfo.usage |= VK_BUFFER_USAGE_TRANSFER_DST_BIT;
-        
-        if(readbackEnabled)
-          bufferInfo.usage |= VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+        alloc = buffers[bufferIndex].stagingBufferAllocation;
+
+        if(perBuffer.stagingRingData)
+        {
+          if(!emptyBuffer)
+          {
+            memcpy(perBuffer.stagingRingData, data, numBytes);
+            instance->getUploadRing()->flush(perBuffer.stagingOffset, numBytes);
+          }
+        }
+        else
+        {
+          auto allocInfo = memoryManager->getAllocationInfo(alloc);
+          if(!allocInfo.mappedData)
+          {
+            throw vgl_runtime_error("Unable to map staging buffer in VulkanBufferGroup::data()!");
+          }
+          if(!emptyBuffer)
+          {
+            memcpy(allocInfo.mappedData, data, numBytes);
+            memoryManager->flushAllocation(alloc, 0, numBytes);
+          }
+        }
+
+        retainUpload(bufferIndex, frame);
+        if(stageToDevice)
+          copyFromStaging(bufferIndex, transferCommandBuffer);
+      }
+      
+      if(autoReleaseStaging)
+        releaseStagingBuffers();
+    }
+
+    bool VulkanBufferGroup::importHostData(int bufferIndex, void *hostPointer, size_t numBytes, VkCommandBuffer transferCommandBuffer, bool frame)
+    {
+      VkDeviceSize alignment = instance->getHostImportAlignment();
+
+      //dedicated allocations & readback targets need staging memory of their own
+      if(!alignment || dedicatedAllocation || readbackEnabled || !numBytes || ((uintptr_t)hostPointer % alignment) || (numBytes % alignment))
+        return false;
+
+      VkMemoryHostPointerPropertiesEXT pointerProperties = {};
+      pointerProperties.sType = VK_STRUCTURE_TYPE_MEMORY_HOST_POINTER_PROPERTIES_EXT;
+      if(VulkanExtensionLoader::vkGetMemoryHostPointerPropertiesEXT(device, VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT, hostPointer, 
+        &pointerProperties) != VK_SUCCESS)
+        return false;
+
+      const VkBufferUsageFlags stagingUsage = finalStagingUsage();
+
+      VkExternalMemoryBufferCreateInfoKHR externalInfo = {};
+      externalInfo.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO_KHR;
+      externalInfo.handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
+
+      VkBufferCreateInfo bufferInfo = {};
+      bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+      bufferInfo.pNext = &externalInfo;
+      bufferInfo.size = numBytes;
+      bufferInfo.usage = stagingUsage;
+
+      VkBuffer importedBuffer = VK_NULL_HANDLE;
+      if(vkCreateBuffer(device, &bufferInfo, nullptr, &importedBuffer) != VK_SUCCESS)
+        return false;
+
+      VkMemoryRequirements memRequirements;
+      vkGetBufferMemoryRequirements(device, importedBuffer, &memRequirements);
+      uint32_t memoryTypeBits = memRequirements.memoryTypeBits & pointerProperties.memoryTypeBits;
+
+      //nothing flushes the host's writes, so the memory has to be coherent (otherwise the data goes through regular staging)
+      VkDeviceMemory importedMemory = VK_NULL_HANDLE;
+      if(memoryTypeBits && memRequirements.size <= numBytes)
+        importedMemory = instance->getMemoryManager()->importHostMemory(memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 
+          hostPointer, numBytes);
+      if(!importedMemory)
+      {
+        vkDestroyBuffer(device, importedBuffer, nullptr);
+        return false;
+      }
+      vkBindBufferMemory(device, importedBuffer, importedMemory, 0);
+
+      auto &perBuffer = buffers[bufferIndex];
+      discardSubData(bufferIndex);
+
+      //the imported memory stands in for the staging buffer, which is the buffer itself for host visible groups
+      if(perBuffer.stagingBuffer)
+      {
+        if(perBuffer.stagingBufferHandle->release())
+          delete perBuffer.stagingBufferHandle;
+      }
+      perBuffer.stagingBuffer = importedBuffer;
+      perBuffer.stagingBufferHandle = VulkanAsyncResourceHandle::newImportedBuffer(instance->getResourceMonitor(), device, importedBuffer, importedMemory);
+      perBuffer.stagingBufferAllocation = nullptr;
+      perBuffer.stagingOffset = 0;
+      perBuffer.stagingRingData = nullptr;
+      perBuffer.stagingCapacity = numBytes;
+      perBuffer.stagingUsage = stagingUsage;
+      perBuffer.persistentlyMappedAddress = nullptr;
+
+      prepareDeviceBuffer(bufferIndex, numBytes);
+      perBuffer.size = numBytes;
+
+      retainUpload(bufferIndex, frame);
+      if(stageToDevice)
+      {
+        copyFromStaging(bufferIndex, transferCommandBuffer);
+        if(autoReleaseStaging)
+          releaseStagingBuffers();
+      }
+
+      return true;
+    }
+
+    void VulkanBufferGroup::streamData(int bufferIndex, const void *source, size_t numBytes, size_t chunkBytes)
+    {
+      auto uploadRing = instance->getUploadRing();
+      auto batcher = instance->getUploadBatcher();
+
+      //only device local buffers are filled by copies, and the ring keeps a few chunks in flight at once
+      if(uploadRing)
+        chunkBytes = min(chunkBytes, (size_t)uploadRing->getSize() / 4);
+      if(!stageToDevice || !uploadRing || dedicatedAllocation || readbackEnabled || numBytes <= chunkBytes || !chunkBytes)
+      {
+        data(bufferIndex, source, numBytes);
+        return;
+      }
+
+      batcher->begin();
+      if(!batcher->isBatching(queue))
+      {
+        batcher->end();
+        data(bufferIndex, source, numBytes);
+        return;
+      }
+
+      auto &perBuffer = buffers[bufferIndex];
+      auto memoryManager = instance->getMemoryManager();
+      auto resourceMonitor = instance->getResourceMonitor();
+      const uint8_t *bytes = (const uint8_t *)source;
+
+      discardSubData(bufferIndex);
+      if(perBuffer.stagingBuffer && !persistentlyMappedHostMemoryAddress)
+      {
+        if(perBuffer.stagingBufferHandle->release())
+          delete perBuffer.stagingBufferHandle;
+        perBuffer.stagingBuffer = VK_NULL_HANDLE;
+        perBuffer.stagingBufferHandle = nullptr;
+      }
+
+      prepareDeviceBuffer(bufferIndex, numBytes);
+      perBuffer.size = numBytes;
+
+      //a buffer nothing has used yet can be filled on the transfer queue, until a flush hands it over to the graphics queue
+      bool unused = !perBuffer.overwriting, ordered = false;
+      perBuffer.overwriting = false;
+
+      //used only when the ring stays full after draining this stream's own chunks (held by other work in flight)
+      VkBuffer fallbackBuffer = VK_NULL_HANDLE;
+      VulkanAsyncResourceHandle *fallbackHandle = nullptr;
+      VulkanMemoryManager::Suballocation fallbackAlloc = nullptr;
+      uint8_t *fallbackData = nullptr;
+
+      for(size_t offset = 0; offset < numBytes;)
+      {
+        size_t chunk = min(chunkBytes, numBytes - offset);
+        VkBuffer src;
+        VkDeviceSize srcOffset = 0;
+        VulkanAsyncResourceHandle *srcHandle;
+
+        auto range = uploadRing->allocate(chunk);
+        if(!range)
+        {
+          //the ring is full of earlier chunks, so submit them & let the ring drain before going on
+          batcher->flush(true);
+          resourceMonitor->poll(device);
+          unused = ordered = false;
+          range = uploadRing->allocate(chunk);
+        }
+
+        if(range)
+        {
+          memcpy(range.mappedData, bytes + offset, chunk);
+          uploadRing->flush(range.offset, chunk);
+          src = range.buffer;
+          srcOffset = range.offset;
+          srcHandle = range.handle;
+        }
+        else
+        {
+          if(!fallbackBuffer)
+          {
+            VkBufferCreateInfo bufferInfo = {};
+            bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+            bufferInfo.size = chunkBytes;
+            bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+
+            if(vkCreateBuffer(device, &bufferInfo, nullptr, &fallbackBuffer) != VK_SUCCESS)
+              throw vgl_runtime_error("Failed to create vertex buffer!");
+
+            fallbackAlloc = memoryManager->allocateBuffer(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, fallbackBuffer, 
+              VulkanMemoryManager::Any, VulkanMemoryManager::LT_TRANSIENT);
+            fallbackHandle = VulkanAsyncResourceHandle::newBuffer(resourceMonitor, device, fallbackBuffer, fallbackAlloc);
+            if(!fallbackAlloc)
+            {
+              fallbackHandle->release();
+              delete fallbackHandle;
+              throw vgl_runtime_error("Failed to allocate vulkan buffer!");
+            }
+            memoryManager->bindBufferMemory(fallbackBuffer, fallbackAlloc);
+            fallbackData = (uint8_t *)memoryManager->getAllocationInfo(fallbackAlloc).mappedData;
+            if(!fallbackData)
+              throw vgl_runtime_error("Unable to map staging buffer in VulkanBufferGroup::streamData()!");
+          }
+          else
+          {
+            //the previous chunk staged here has to be copied out before it's overwritten
+            batcher->flush(true);
+            unused = ordered = false;
+          }
+
+          memcpy(fallbackData, bytes + offset, chunk);
+          memoryManager->flushAllocation(fallbackAlloc, 0, chunk);
+          src = fallbackBuffer;
+          srcHandle = fallbackHandle;
+          srcHandle->retain();
+        }
+
+        auto copyCommandBuffer = batcher->recordUpload(perBuffer.buffer, unused);
+        if(!ordered)
+        {
+          //chunks write disjoint ranges, so only the first one of each batch needs ordering against earlier transfers
+          batcher->orderTransfer(copyCommandBuffer, VK_NULL_HANDLE, perBuffer.buffer);
+          ordered = true;
+        }
+
+        VkBufferCopy copyRegion = {};
+        copyRegion.srcOffset = srcOffset;
+        copyRegion.dstOffset = offset;
+        copyRegion.size = chunk;
+        vkCmdCopyBuffer(copyCommandBuffer, src, perBuffer.buffer, 1, &copyRegion);
+
+        batcher->track({ srcHandle, perBuffer.bufferHandle });
+        if(srcHandle->release())
+          delete srcHandle;
+
+        offset += chunk;
+      }
+
+      if(fallbackHandle && fallbackHandle->release())
+        delete fallbackHandle;
+
+      batcher->end();
+    }
+
+    void VulkanBufferGroup::streamingData(int bufferIndex, const void *data, size_t numBytes)
+    {
+      auto memoryManager = instance->getMemoryManager();
+      auto &perBuffer = buffers[bufferIndex];
+      auto &copies = streamingCopies[bufferIndex];
+      uint64_t frameId = instance->getSwapChain()->getCurrentFrameId();
+
+      //the copy written this frame was last read by the frame that many frames ago, which has completed by now
+      if(copies.empty())
+        copies.resize(VulkanSwapChain::getMaxFramesInFlight() + 1);
+      auto &copy = copies[frameId % copies.size()];
+
+      discardSubData(bufferIndex);
+      VGL_CORE_PERF_WARNING_DEBUG(copy.frameId && copy.frameId != frameId && copy.frameId > instance->getResourceMonitor()->completedFrame.load(),
+        "VulkanBufferGroup streaming buffer rewritten before the frame that last used it completed");
+
+      if(!copy.buffer || copy.capacity < max(numBytes, (size_t)1))
+      {
+        if(copy.handle && copy.handle->release())
+          delete copy.handle;
+
+        copy.capacity = grownCapacity(copy.capacity, max(numBytes, (size_t)1));
+
+        VkBufferCreateInfo bufferInfo = {};
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.size = copy.capacity;
+        bufferInfo.usage = finalStagingUsage();
+
+        if(vkCreateBuffer(device, &bufferInfo, nullptr, &copy.buffer) != VK_SUCCESS)
+          throw vgl_runtime_error("Failed to create vertex buffer!");
+
+        //device local host visible memory saves the GPU reading these across the bus every frame, when there's any to spare
+        copy.allocation = memoryManager->allocateBuffer(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | 
+          VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, copy.buffer, VulkanMemoryManager::Any, VulkanMemoryManager::LT_DYNAMIC);
+        if(!copy.allocation)
+          copy.allocation = memoryManager->allocateBuffer(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, copy.buffer, 
+            VulkanMemoryManager::Any, VulkanMemoryManager::LT_DYNAMIC);
+
+        copy.handle = VulkanAsyncResourceHandle::newBuffer(instance->getResourceMonitor(), device, copy.buffer, copy.allocation);
+        if(!copy.allocation)
+        {
+          copy.handle->release();
+          delete copy.handle;
+          copy = StreamingCopy();
+          throw vgl_runtime_error("Failed to allocate vulkan buffer!");
+        }
+
+        memoryManager->bindBufferMemory(copy.buffer, copy.allocation);
+        copy.mappedData = (uint8_t *)memoryManager->getAllocationInfo(copy.allocation).mappedData;
+        if(!copy.mappedData)
+          throw vgl_runtime_error("Unable to map staging buffer in VulkanBufferGroup::data()!");
+      }
+      copy.frameId = frameId;
+
+      if(data && numBytes)
+        memcpy(copy.mappedData, data, numBytes);
+
+      if(perBuffer.stagingBufferHandle != copy.handle)
+      {
+        if(perBuffer.stagingBuffer && perBuffer.stagingBufferHandle->release())
+          delete perBuffer.stagingBufferHandle;
+        copy.handle->retain();
+        perBuffer.stagingBuffer = copy.buffer;
+        perBuffer.stagingBufferHandle = copy.handle;
+        perBuffer.stagingBufferAllocation = copy.allocation;
+        perBuffer.stagingOffset = 0;
+        perBuffer.stagingRingData = nullptr;
+        perBuffer.stagingUsage = finalStagingUsage();
+        perBuffer.persistentlyMappedAddress = nullptr;
+      }
+      perBuffer.stagingCapacity = copy.capacity;
+      perBuffer.size = max(numBytes, (size_t)1);
+      lastUsedFrameId = max(lastUsedFrameId, frameId);
+    }
+
+    void VulkanBufferGroup::discardSubData(int bufferIndex)
+    {
+      if(!dirtyRanges[bufferIndex].empty())
+      {
+        for(auto &range : dirtyRanges[bufferIndex])
+          pendingSubDataBytes -= range.second.size();
+        dirtyRanges[bufferIndex].clear();
+      }
+    }
+
+    void VulkanBufferGroup::prepareDeviceBuffer(int bufferIndex, size_t numBytes)
+    {
+      auto &perBuffer = buffers[bufferIndex];
+      auto memoryManager = instance->getMemoryManager();
+
+      //transfer source is always needed so that defragment() can copy this buffer elsewhere
+      const VkBufferUsageFlags deviceUsage = finalBufferUsage() | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+
+      //device local buffers are only written by copies that are ordered after earlier reads (see overwriteBarrier()), so they can be reused 
+      //while in flight
+      if(perBuffer.buffer)
+      {
+        if(stageToDevice && perBuffer.usage == deviceUsage && fitsCapacity(perBuffer.capacity, numBytes))
+        {
+          perBuffer.overwriting = true;
+        }
+        else
+        {
+          memoryManager->setRelocationDelegate(perBuffer.bufferAllocation, nullptr);
+          if(perBuffer.bufferHandle->release())
+            delete perBuffer.bufferHandle;
+          perBuffer.buffer = VK_NULL_HANDLE;
+        }
+      }
+
+      if(stageToDevice && !perBuffer.buffer)
+      {
+        perBuffer.capacity = grownCapacity(perBuffer.capacity, numBytes);
+        perBuffer.usage = deviceUsage;
+        perBuffer.overwriting = false;
+
+        VkBufferCreateInfo bufferInfo = {};
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.size = perBuffer.capacity;
+        bufferInfo.usage = deviceUsage;
         
-        if(vkCreateBuffer(device, &bufferInfo, nullptr, &buffers[bufferIndex].buffer) != VK_SUCCESS)
+        if(vkCreateBuffer(device, &bufferInfo, nullptr, &perBuffer.buffer) != VK_SUCCESS)
         {
           throw vgl_runtime_error("Failed to create vertex buffer!");
         }
 
-        alloc = memoryManager->allocateBuffer(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffers[bufferIndex].buffer);
+        auto alloc = memoryManager->allocateBuffer(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, perBuffer.buffer, VulkanMemoryManager::Any, lifetime);
         if(!alloc)
         {
           //must be out of GPU memory, fallback on whatever we can use
-          alloc = memoryManager->allocateBuffer(0, buffers[bufferIndex].buffer);
+          alloc = memoryManager->allocateBuffer(0, perBuffer.buffer, VulkanMemoryManager::Any, lifetime);
           isResident = false;
           
           if(!alloc)
@@ -265,56 +683,274 @@ namespace vgl
         {
           isResident = true;
         }
-        buffers[bufferIndex].bufferAllocation = alloc;
+        perBuffer.bufferAllocation = alloc;
+
+        memoryManager->bindBufferMemory(perBuffer.buffer, alloc);
+        perBuffer.bufferHandle = VulkanAsyncResourceHandle::newBuffer(instance->getResourceMonitor(), device, perBuffer.buffer, alloc);
+
+        VkMemoryRequirements memRequirements;
+        vkGetBufferMemoryRequirements(device, perBuffer.buffer, &memRequirements);
+        memoryManager->setRelocationDelegate(alloc, this, memRequirements.alignment, memRequirements.memoryTypeBits);
 
-        memoryManager->bindBufferMemory(buffers[bufferIndex].buffer, alloc);
-        buffers[bufferIndex].bufferHandle = VulkanAsyncResourceHandle::newBuffer(instance->getResourceMonitor(), device, buffers[bufferIndex].buffer, alloc);
+        if(auto swapChain = instance->getSwapChain())
+          lastUsedFrameId = swapChain->getCurrentFrameId();
       }
+    }
 
-      buffers[bufferIndex].size = numBytes;
+    void VulkanBufferGroup::retainUpload(int bufferIndex, bool frame)
+    {
+      if(frame)
+      {
+        uint64_t frame = instance->getSwapChain()->getCurrentFrameId();
+        auto resourceMonitor = instance->getResourceMonitor();
+        VulkanAsyncResourceCollection frameResources(resourceMonitor, frame, {
+          buffers[bufferIndex].stagingBufferHandle, buffers[bufferIndex].bufferHandle,
+          });
+        resourceMonitor->append(move(frameResources));
+      }
+      else if(instance->getCurrentTransferCommandBuffer())
+      {
+        //by passing a null fence, we mark these resources as committed to a command buffer that hasn't
+        //been submitted yet, and the fence will be provided when the transfer buffer is finally submitted
+        auto resourceMonitor = instance->getResourceMonitor();
+        VulkanAsyncResourceCollection frameResources(resourceMonitor, (VulkanAsyncResourceHandle *)nullptr, {
+          buffers[bufferIndex].stagingBufferHandle, buffers[bufferIndex].bufferHandle,
+          });
+        resourceMonitor->append(move(frameResources));
+      }
+    }
+  
+    void VulkanBufferGroup::subData(int bufferIndex, size_t offset, size_t numBytes, const void *data)
+    {
+      if(!numBytes)
+        return;
+      if(!get(bufferIndex) || offset+numBytes > buffers[bufferIndex].size)
+        throw vgl_runtime_error("VulkanBufferGroup::subData() range is outside of the buffer's data!");
+
+      auto &ranges = dirtyRanges[bufferIndex];
+      size_t start = offset, end = offset+numBytes;
+
+      //absorb every pending range that overlaps or touches this one
+      auto first = ranges.upper_bound(start);
+      if(first != ranges.begin() && prev(first)->first+prev(first)->second.size() >= start)
+        first--;
+      auto last = first;
+      while(last != ranges.end() && last->first <= end)
+      {
+        start = min(start, last->first);
+        end = max(end, last->first+last->second.size());
+        last++;
+      }
 
-      if(data)
+      vector<uint8_t> bytes(end-start);
+      for(auto it = first; it != last; it++)
       {
-        alloc = buffers[bufferIndex].stagingBufferAllocation;
+        memcpy(bytes.data()+(it->first-start), it->second.data(), it->second.size());
+        pendingSubDataBytes -= it->second.size();
+      }
+      memcpy(bytes.data()+(offset-start), data, numBytes);
+
+      ranges.erase(first, last);
+      pendingSubDataBytes += bytes.size();
+      ranges[start] = move(bytes);
+    }
+
+    void VulkanBufferGroup::flushSubData(VkCommandBuffer transferCommandBuffer, bool frame, bool wait)
+    {
+      if(!pendingSubDataBytes)
+        return;
+
+      auto memoryManager = instance->getMemoryManager();
+      auto swapChain = instance->getSwapChain();
+      auto resourceMonitor = instance->getResourceMonitor();
+
+      //vkCmdUpdateBuffer needs 4 byte aligned offsets & sizes, anything else goes through staging too
+      auto isInline = [](size_t offset, const vector<uint8_t> &bytes) {
+        return (bytes.size() <= inlineUpdateLimit && offset % 4 == 0 && bytes.size() % 4 == 0);
+      };
+
+      VkDeviceSize stagingSize = 0;
+      for(auto &ranges : dirtyRanges)
+      {
+        for(auto &range : ranges) if(!isInline(range.first, range.second))
+          stagingSize += range.second.size();
+      }
+
+      VkBuffer stagingBuffer = VK_NULL_HANDLE;
+      VulkanAsyncResourceHandle *stagingBufferHandle = nullptr;
+      VulkanMemoryManager::Suballocation alloc = nullptr;
+      uint8_t *stagingData = nullptr;
+      VkDeviceSize stagingBase = 0;
+      auto uploadRing = (stagingSize) ? instance->getUploadRing() : nullptr;
 
-        auto allocInfo = memoryManager->getAllocationInfo(alloc);
-        void *mappedPtr;
-        if(vkMapMemory(device, allocInfo.memory, allocInfo.offset, buffers[bufferIndex].size, 0, &mappedPtr) != VK_SUCCESS)
+      if(uploadRing)
+      {
+        if(auto range = uploadRing->allocate(stagingSize))
         {
-          throw vgl_runtime_error("Unable to map staging buffer in VulkanBufferGroup::data()!");
+          stagingBuffer = range.buffer;
+          stagingBufferHandle = range.handle;
+          stagingData = range.mappedData;
+          stagingBase = range.offset;
+        }
+        else
+        {
+          uploadRing = nullptr;
         }
-        if(!emptyBuffer)
-          memcpy(mappedPtr, data, numBytes);
-        vkUnmapMemory(device, allocInfo.memory);
+      }
+
+      if(stagingSize && !stagingBuffer)
+      {
+        VkBufferCreateInfo bufferInfo = {};
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.size = stagingSize;
+        bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+
+        if(vkCreateBuffer(device, &bufferInfo, nullptr, &stagingBuffer) != VK_SUCCESS)
+          throw vgl_runtime_error("Failed to create vertex buffer!");
+
+        const VkMemoryPropertyFlags stagingBufferMemoryFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+        if(swapChain)
+          alloc = memoryManager->allocateTransientBuffer(stagingBufferMemoryFlags, stagingBuffer, swapChain->getCurrentFrameId());
+        if(!alloc)
+          alloc = memoryManager->allocateBuffer(stagingBufferMemoryFlags, stagingBuffer, VulkanMemoryManager::Any, VulkanMemoryManager::LT_TRANSIENT);
+        memoryManager->bindBufferMemory(stagingBuffer, alloc);
+        stagingBufferHandle = VulkanAsyncResourceHandle::newBuffer(resourceMonitor, device, stagingBuffer, alloc);
+
+        if(!alloc)
+          throw vgl_runtime_error("Failed to allocate vulkan buffer!");
+
+        stagingData = (uint8_t *)memoryManager->getAllocationInfo(alloc).mappedData;
+        if(!stagingData)
+          throw vgl_runtime_error("Unable to map staging buffer in VulkanBufferGroup::flushSubData()!");
+      }
+
+      auto batcher = instance->getUploadBatcher();
+      bool batched = (!transferCommandBuffer && batcher->isBatching(queue));
+      auto copyCommandBuffer = (batched) ? batcher->record() : transferCommandBuffer;
+
+      if(!copyCommandBuffer)
+      {
+        VkCommandBufferAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandPool = commandPool;
+        allocInfo.commandBufferCount = 1;
+
+        VkCommandBuffer commandBuffer;
+        vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer);
+
+        VkCommandBufferBeginInfo beginInfo = {};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+        vkBeginCommandBuffer(commandBuffer, &beginInfo);
+        copyCommandBuffer = commandBuffer;
+      }
 
-        if(frame)
+      vector<VulkanAsyncResourceHandle *> handles;
+      vector<VkBufferCopy> copyRegions;
+      VkDeviceSize stagingOffset = stagingBase;
+
+      if(stagingBufferHandle)
+        handles.push_back(stagingBufferHandle);
+
+      for(int i = 0; i < bufferCount; i++) if(!dirtyRanges[i].empty())
+      {
+        VkBuffer target = get(i);
+
+        if(batched)
         {
-          uint64_t frame = instance->getSwapChain()->getCurrentFrameId();
-          auto resourceMonitor = instance->getResourceMonitor();
-          VulkanAsyncResourceCollection frameResources(resourceMonitor, frame, {
-            buffers[bufferIndex].stagingBufferHandle, buffers[bufferIndex].bufferHandle,
-            });
-          resourceMonitor->append(move(frameResources));
+          batcher->orderTransfer(copyCommandBuffer, stagingBuffer, target);
         }
-        else if(instance->getCurrentTransferCommandBuffer())
+        else
         {
-          //by passing a null fence, we mark these resources as committed to a command buffer that hasn't
-          //been submitted yet, and the fence will be provided when the transfer buffer is finally submitted
-          auto resourceMonitor = instance->getResourceMonitor();
-          VulkanAsyncResourceCollection frameResources(resourceMonitor, (VulkanAsyncResourceHandle *)nullptr, {
-            buffers[bufferIndex].stagingBufferHandle, buffers[bufferIndex].bufferHandle,
-            });
-          resourceMonitor->append(move(frameResources));
+          buffers[i].overwriting = true;
+          overwriteBarrier(i, copyCommandBuffer);
         }
 
-        if(stageToDevice)
-          copyFromStaging(bufferIndex, transferCommandBuffer);
+        copyRegions.clear();
+        for(auto &range : dirtyRanges[i])
+        {
+          if(isInline(range.first, range.second))
+          {
+            vkCmdUpdateBuffer(copyCommandBuffer, target, range.first, range.second.size(), range.second.data());
+          }
+          else
+          {
+            memcpy(stagingData+(stagingOffset-stagingBase), range.second.data(), range.second.size());
+            copyRegions.push_back({ stagingOffset, range.first, range.second.size() });
+            stagingOffset += range.second.size();
+          }
+        }
+        if(!copyRegions.empty())
+          vkCmdCopyBuffer(copyCommandBuffer, stagingBuffer, target, (uint32_t)copyRegions.size(), copyRegions.data());
+
+        if(!batched)
+          pipelineWriteBarrier(i, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, copyCommandBuffer);
+        handles.push_back((stageToDevice) ? buffers[i].bufferHandle : buffers[i].stagingBufferHandle);
+        dirtyRanges[i].clear();
       }
-      
-      if(autoReleaseStaging)
-        releaseStagingBuffers();
+      pendingSubDataBytes = 0;
+
+      if(uploadRing)
+        uploadRing->flush(stagingBase, stagingSize);
+      else if(stagingData)
+        memoryManager->flushAllocation(alloc, 0, stagingSize);
+
+      if(batched)
+      {
+        batcher->track(handles);
+        if(wait)
+          batcher->flush(true);
+      }
+      else if(transferCommandBuffer && frame)
+      {
+        VulkanAsyncResourceCollection frameResources(resourceMonitor, swapChain->getCurrentFrameId(), handles);
+        resourceMonitor->append(move(frameResources));
+      }
+      else if(transferCommandBuffer)
+      {
+        //as in data(), the fence is provided when the transfer command buffer is finally submitted
+        VulkanAsyncResourceCollection transferResources(resourceMonitor, (VulkanAsyncResourceHandle *)nullptr, handles);
+        resourceMonitor->append(move(transferResources));
+      }
+      else
+      {
+        VkFence transferFence;
+        VkFenceCreateInfo fenceInfo = {};
+        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+        if(vkCreateFence(device, &fenceInfo, nullptr, &transferFence) != VK_SUCCESS)
+          throw vgl_runtime_error("Could not create Vulkan Fence!");
+
+        vkEndCommandBuffer(copyCommandBuffer);
+
+        VkSubmitInfo submitInfo = {};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &copyCommandBuffer;
+
+        vkQueueSubmit(queue, 1, &submitInfo, transferFence);
+
+        //just a note, fences must always be the LAST entry in these collections
+        auto fenceHandle = VulkanAsyncResourceHandle::newFence(resourceMonitor, device, transferFence);
+        auto cmdBufHandle = VulkanAsyncResourceHandle::newCommandBuffer(resourceMonitor, device, copyCommandBuffer, commandPool);
+        handles.push_back(cmdBufHandle);
+        handles.push_back(fenceHandle);
+        VulkanAsyncResourceCollection transferResources(resourceMonitor, fenceHandle, handles);
+        resourceMonitor->append(move(transferResources));
+        fenceHandle->release();
+        cmdBufHandle->release();
+
+        if(wait)
+          vkWaitForFences(device, 1, &transferFence, VK_TRUE, numeric_limits<uint64_t>::max());
+      }
+
+      //the collection above keeps the staging buffer alive until the copies complete
+      if(stagingBufferHandle && stagingBufferHandle->release())
+        delete stagingBufferHandle;
     }
-  
+
     void VulkanBufferGroup::setAutomaticallyReleaseStagingMemory(bool b)
     {
       autoReleaseStaging = b;
@@ -351,25 +987,50 @@ namespace vgl
       if(!readbackEnabled)
         throw vgl_runtime_error("You cannot call VulkanBufferGroup::readData() if readback has not been explicitly enabled!");
       
-      if(stageToDevice)
+      if(stageToDevice || pendingSubDataBytes)
       {
         if(!commandPool)
         {
           commandPool = instance->getTransferCommandPool();
           queue = instance->getGraphicsQueue();
         }
-        copyToStaging(bufferIndex, VK_NULL_HANDLE);
+        //host visible buffers are read right after this, so their updates have to land first
+        flushSubData(VK_NULL_HANDLE, false, !stageToDevice);
+        if(stageToDevice)
+          copyToStaging(bufferIndex, VK_NULL_HANDLE);
       }
       
       auto memoryManager = instance->getMemoryManager();
       auto alloc = buffers[bufferIndex].stagingBufferAllocation;
       auto allocInfo = memoryManager->getAllocationInfo(alloc);
-      void *mappedPtr;
-      if(vkMapMemory(device, allocInfo.memory, allocInfo.offset, buffers[bufferIndex].size, 0, &mappedPtr) != VK_SUCCESS)
-        throw vgl_runtime_error("Unable to map staging buffer in VulkanBufferGroup::data()!");
+      if(!allocInfo.mappedData)
+        throw vgl_runtime_error("Unable to map staging buffer in VulkanBufferGroup::readData()!");
       if(numBytes)
-        memcpy(data, mappedPtr, numBytes);
-      vkUnmapMemory(device, allocInfo.memory);
+      {
+        memoryManager->invalidateAllocation(alloc, 0, numBytes);
+        memcpy(data, allocInfo.mappedData, numBytes);
+      }
+    }
+
+    shared_ptr<VulkanReadback> VulkanBufferGroup::readDataAsync(int bufferIndex, size_t offset, size_t numBytes, VkCommandBuffer transferCommandBuffer, bool frame)
+    {
+      auto &perBuffer = buffers[bufferIndex];
+      auto srcBuffer = (stageToDevice) ? perBuffer.buffer : perBuffer.stagingBuffer;
+      auto srcHandle = (stageToDevice) ? perBuffer.bufferHandle : perBuffer.stagingBufferHandle;
+
+      if(!srcBuffer || offset + numBytes > perBuffer.size)
+        throw vgl_runtime_error("VulkanBufferGroup::readDataAsync() called with an invalid buffer range!");
+
+      //pending updates are recorded ahead of the copy so it reads them
+      if(pendingSubDataBytes)
+        flushSubData(transferCommandBuffer, frame);
+
+      return instance->getReadbackPool()->read(numBytes, transferCommandBuffer, frame, { srcHandle }, [=](VkCommandBuffer commandBuffer, VkBuffer dst) {
+        VkBufferCopy copyRegion = {};
+        copyRegion.srcOffset = offset;
+        copyRegion.size = numBytes;
+        vkCmdCopyBuffer(commandBuffer, srcBuffer, dst, 1, &copyRegion);
+      });
     }
 
     void VulkanBufferGroup::copyData(VulkanBufferGroup *srcGroup, int srcBufferIndex, int bufferIndex, size_t numBytes,
@@ -398,16 +1059,13 @@ namespace vgl
       auto alloc = buffers[bufferIndex].stagingBufferAllocation;
       auto allocInfo = memoryManager->getAllocationInfo(alloc);
 
-      if(!persistentlyMappedHostMemoryAddress)
-      {
-        if(vkMapMemory(device, allocInfo.memory, 0, dedicatedAllocationSize, 0, &persistentlyMappedHostMemoryAddress) != VK_SUCCESS)
-        {
-          throw vgl_runtime_error("Unable to map staging buffer in VulkanBufferGroup::getPersistentlyMappedAddress()!");
-        }        
-      }
+      //host visible blocks are already mapped by the memory manager, this just keeps the staging buffers from being released
+      if(!allocInfo.mappedData)
+        throw vgl_runtime_error("Unable to map staging buffer in VulkanBufferGroup::getPersistentlyMappedAddress()!");
+      persistentlyMappedHostMemoryAddress = allocInfo.mappedData;
 
       //only using this feature for dedicated for now
-      return (uint8_t *)persistentlyMappedHostMemoryAddress+allocInfo.offset;
+      return allocInfo.mappedData;
     }
 
     void VulkanBufferGroup::retainResourcesUntilFrameCompletion(uint64_t frameId)
@@ -425,6 +1083,129 @@ namespace vgl
       auto resourceMonitor = instance->getResourceMonitor();
       VulkanAsyncResourceCollection transferResources(resourceMonitor, frameId, handles);
       resourceMonitor->append(move(transferResources));
+
+      lastUsedFrameId = max(lastUsedFrameId, frameId);
+    }
+
+    bool VulkanBufferGroup::fitsCapacity(size_t capacity, size_t numBytes)
+    {
+      //much smaller data gets a new buffer, so memory isn't held onto indefinitely
+      return (numBytes <= capacity && numBytes >= capacity/4);
+    }
+
+    size_t VulkanBufferGroup::grownCapacity(size_t capacity, size_t numBytes)
+    {
+      if(capacityGrowthFactor <= 1.0f || numBytes < capacity)
+        return numBytes;
+      return max(numBytes, (size_t)(capacity*capacityGrowthFactor));
+    }
+
+    void VulkanBufferGroup::overwriteBarrier(int bufferIndex, VkCommandBuffer transferCommandBuffer)
+    {
+      if(!buffers[bufferIndex].overwriting)
+        return;
+      buffers[bufferIndex].overwriting = false;
+
+      //the buffer may still be read (or written) by work submitted earlier on this queue
+      VkBufferMemoryBarrier barrier = {};
+      barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+      barrier.buffer = get(bufferIndex);
+      barrier.size = VK_WHOLE_SIZE;
+      barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+      barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+      vkCmdPipelineBarrier(transferCommandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+    }
+
+    VkBufferUsageFlags VulkanBufferGroup::finalStagingUsage()
+    {
+      VkBufferUsageFlags usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+
+      //host visible buffers are transfer destinations for flushSubData()
+      if(!stageToDevice)
+        usage |= finalBufferUsage() | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+      if(readbackEnabled)
+        usage |= VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+      return usage;
+    }
+
+    VkBufferUsageFlags VulkanBufferGroup::finalBufferUsage()
+    {
+      switch(usageType)
+      {
+        case UT_VERTEX: return VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+        case UT_INDEX: return VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+        case UT_UNIFORM: 
+        case UT_UNIFORM_DYNAMIC: return VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+        case UT_SHADER_STORAGE: return VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+      }
+
+      return 0;
+    }
+
+    bool VulkanBufferGroup::relocate(const VulkanMemoryManager::Suballocation &oldSuballocation, const VulkanMemoryManager::Suballocation &newSuballocation, 
+      VkCommandBuffer commandBuffer)
+    {
+      int bufferIndex = -1;
+      for(int i = 0; i < bufferCount; i++)
+      {
+        if(buffers[i].buffer && buffers[i].bufferAllocation == oldSuballocation)
+        {
+          bufferIndex = i;
+          break;
+        }
+      }
+
+      if(bufferIndex == -1)
+        return false;
+
+      auto memoryManager = instance->getMemoryManager();
+      auto &perBuffer = buffers[bufferIndex];
+      VkBuffer newBuffer = VK_NULL_HANDLE;
+
+      VkBufferCreateInfo bufferInfo = {};
+      bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+      bufferInfo.size = perBuffer.capacity;
+      bufferInfo.usage = perBuffer.usage;
+
+      if(vkCreateBuffer(device, &bufferInfo, nullptr, &newBuffer) != VK_SUCCESS)
+        return false;
+      memoryManager->bindBufferMemory(newBuffer, newSuballocation);
+
+      pipelineReadBarrier(bufferIndex, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, commandBuffer);
+
+      VkBufferCopy copyRegion = {};
+      copyRegion.size = perBuffer.size;
+      vkCmdCopyBuffer(commandBuffer, perBuffer.buffer, newBuffer, 1, &copyRegion);
+
+      auto oldBufferHandle = perBuffer.bufferHandle;
+      perBuffer.buffer = newBuffer;
+      perBuffer.bufferAllocation = newSuballocation;
+      perBuffer.bufferHandle = VulkanAsyncResourceHandle::newBuffer(instance->getResourceMonitor(), device, newBuffer, newSuballocation);
+
+      pipelineWriteBarrier(bufferIndex, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, commandBuffer);
+
+      //balanceResidency() may have moved this buffer in or out of device local memory, and the group is only resident if all of its buffers are
+      isResident = true;
+      for(int i = 0; i < bufferCount; i++) if(buffers[i].buffer && !memoryManager->isAllocationDeviceLocal(buffers[i].bufferAllocation))
+        isResident = false;
+
+      //the old buffer (and its memory) goes away once the frame recording this copy completes
+      uint64_t frameId = instance->getSwapChain()->getCurrentFrameId();
+      auto resourceMonitor = instance->getResourceMonitor();
+      VulkanAsyncResourceCollection frameResources(resourceMonitor, frameId, { oldBufferHandle, perBuffer.bufferHandle });
+      resourceMonitor->append(move(frameResources));
+
+      if(oldBufferHandle->release())
+        delete oldBufferHandle;
+
+      if(relocationCallback)
+        relocationCallback(bufferIndex);
+
+      return true;
     }
 
     void VulkanBufferGroup::flush(int bufferIndex)
@@ -434,22 +1215,21 @@ namespace vgl
       {
         auto memoryManager = instance->getMemoryManager();
         auto alloc = buffers[bufferIndex].stagingBufferAllocation;
-        auto allocInfo = memoryManager->getAllocationInfo(alloc);
-
-        VkMappedMemoryRange range = { VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE };
-        range.memory = allocInfo.memory;
-        range.offset = allocInfo.offset;
-        range.size = allocInfo.size;
 
-        vkFlushMappedMemoryRanges(device, 1, &range);
+        //rounds the range out to nonCoherentAtomSize, which the raw suballocation range doesn't respect
+        memoryManager->flushAllocation(alloc);
       }
     }
 
     void VulkanBufferGroup::copyFromStaging(int bufferIndex, VkCommandBuffer transferCommandBuffer)
     {
-      auto copyCommandBuffer = transferCommandBuffer;
+      auto batcher = instance->getUploadBatcher();
+      bool batched = (!transferCommandBuffer && batcher->isBatching(queue));
+      //buffers data() just created haven't been used on the graphics queue, so the batch can fill them on a transfer queue
+      auto copyCommandBuffer = (batched) ? batcher->recordUpload(buffers[bufferIndex].buffer, !buffers[bufferIndex].overwriting && autoReleaseStaging) : 
+        transferCommandBuffer;
 
-      if(!transferCommandBuffer)
+      if(!copyCommandBuffer)
       {
         VkCommandBufferAllocateInfo allocInfo = {};
         allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
@@ -468,13 +1248,28 @@ namespace vgl
         copyCommandBuffer = commandBuffer;
       }
 
+      if(batched)
+      {
+        //the batch is already ordered after earlier work, only transfers within it need ordering
+        buffers[bufferIndex].overwriting = false;
+        batcher->orderTransfer(copyCommandBuffer, buffers[bufferIndex].stagingBuffer, buffers[bufferIndex].buffer);
+      }
+      else
+      {
+        overwriteBarrier(bufferIndex, copyCommandBuffer);
+      }
+
       VkBufferCopy copyRegion = {};
+      copyRegion.srcOffset = buffers[bufferIndex].stagingOffset;
       copyRegion.size = buffers[bufferIndex].size;
       vkCmdCopyBuffer(copyCommandBuffer, buffers[bufferIndex].stagingBuffer, buffers[bufferIndex].buffer, 1, &copyRegion);
       
-      pipelineWriteBarrier(bufferIndex, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, copyCommandBuffer);
+      if(batched)
+        batcher->track({ buffers[bufferIndex].stagingBufferHandle, buffers[bufferIndex].bufferHandle });
+      else
+        pipelineWriteBarrier(bufferIndex, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, copyCommandBuffer);
 
-      if(!transferCommandBuffer)
+      if(!transferCommandBuffer && !batched)
       {
         VkFence transferFence;
         VkFenceCreateInfo fenceInfo = {};
@@ -508,9 +1303,11 @@ namespace vgl
   
     void VulkanBufferGroup::copyToStaging(int bufferIndex, VkCommandBuffer transferCommandBuffer)
     {
-      auto copyCommandBuffer = transferCommandBuffer;
+      auto batcher = instance->getUploadBatcher();
+      bool batched = (!transferCommandBuffer && batcher->isBatching(queue));
+      auto copyCommandBuffer = (batched) ? batcher->record() : transferCommandBuffer;
 
-      if(!transferCommandBuffer)
+      if(!copyCommandBuffer)
       {
         VkCommandBufferAllocateInfo allocInfo = {};
         allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
@@ -529,13 +1326,23 @@ namespace vgl
         copyCommandBuffer = commandBuffer;
       }
 
+      if(batched)
+        batcher->orderTransfer(copyCommandBuffer, buffers[bufferIndex].buffer, buffers[bufferIndex].stagingBuffer);
+
       VkBufferCopy copyRegion = {};
       copyRegion.size = buffers[bufferIndex].size;
       vkCmdCopyBuffer(copyCommandBuffer, buffers[bufferIndex].buffer, buffers[bufferIndex].stagingBuffer, 1, &copyRegion);
       
       pipelineWriteBarrier(bufferIndex, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, copyCommandBuffer);
 
-      if(!transferCommandBuffer)
+      if(batched)
+      {
+        //the host reads this right after, so the batch (and everything gathered before it) has to go now
+        batcher->track({ buffers[bufferIndex].stagingBufferHandle, buffers[bufferIndex].bufferHandle });
+        batcher->flush(true);
+      }
+
+      if(!transferCommandBuffer && !batched)
       {
         VkFence transferFence;
         VkFenceCreateInfo fenceInfo = {};
@@ -571,9 +1378,11 @@ namespace vgl
 
     void VulkanBufferGroup::copyFromBuffer(VulkanBufferGroup *srcBufferGroup, int srcBufferIndex, int bufferIndex, VkCommandBuffer transferCommandBuffer)
     {
-      auto copyCommandBuffer = transferCommandBuffer;
+      auto batcher = instance->getUploadBatcher();
+      bool batched = (!transferCommandBuffer && batcher->isBatching(queue));
+      auto copyCommandBuffer = (batched) ? batcher->record() : transferCommandBuffer;
 
-      if(!transferCommandBuffer)
+      if(!copyCommandBuffer)
       {
         VkCommandBufferAllocateInfo allocInfo = {};
         allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
@@ -591,25 +1400,41 @@ namespace vgl
         vkBeginCommandBuffer(commandBuffer, &beginInfo);
         copyCommandBuffer = commandBuffer;
       }
+
+      auto &src = srcBufferGroup->buffers[srcBufferIndex];
+      if(batched)
+      {
+        buffers[bufferIndex].overwriting = false;
+        batcher->orderTransfer(copyCommandBuffer, (src.stagingBuffer) ? src.stagingBuffer : src.buffer, buffers[bufferIndex].buffer);
+      }
+      else
+      {
+        overwriteBarrier(bufferIndex, copyCommandBuffer);
+      }
       
       if(srcBufferGroup->buffers[srcBufferIndex].stagingBuffer)
       {
         VkBufferCopy copyRegion = {};
+        copyRegion.srcOffset = srcBufferGroup->buffers[srcBufferIndex].stagingOffset;
         copyRegion.size = buffers[bufferIndex].size;
         vkCmdCopyBuffer(copyCommandBuffer, srcBufferGroup->buffers[srcBufferIndex].stagingBuffer, buffers[bufferIndex].buffer, 1, &copyRegion);
       }
       else
       {
-        srcBufferGroup->pipelineReadBarrier(srcBufferIndex, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, copyCommandBuffer);
+        if(!batched)
+          srcBufferGroup->pipelineReadBarrier(srcBufferIndex, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, copyCommandBuffer);
         
         VkBufferCopy copyRegion = {};
         copyRegion.size = buffers[bufferIndex].size;
         vkCmdCopyBuffer(copyCommandBuffer, srcBufferGroup->buffers[srcBufferIndex].buffer, buffers[bufferIndex].buffer, 1, &copyRegion);
       }
       
-      pipelineWriteBarrier(bufferIndex, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, copyCommandBuffer);
+      if(batched)
+        batcher->track({ (src.stagingBuffer) ? src.stagingBufferHandle : src.bufferHandle, buffers[bufferIndex].bufferHandle });
+      else
+        pipelineWriteBarrier(bufferIndex, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, copyCommandBuffer);
 
-      if(!transferCommandBuffer)
+      if(!transferCommandBuffer && !batched)
       {
         VkFence transferFence;
         VkFenceCreateInfo fenceInfo = {};
@@ -648,7 +1473,7 @@ namespace vgl
       VkPipelineStageFlags destinationStage = dstStage;
 
       barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
-      barrier.buffer = buffers[bufferIndex].buffer;
+      barrier.buffer = get(bufferIndex);
       barrier.size = VK_WHOLE_SIZE;
       barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
       barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
@@ -692,7 +1517,8 @@ namespace vgl
       VkPipelineStageFlags sourceStage = srcStage;
       VkPipelineStageFlags destinationStage = dstStage;
 
-      barrier.buffer = buffers[bufferIndex].buffer;
+      barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+      barrier.buffer = get(bufferIndex);
       barrier.size = VK_WHOLE_SIZE;
       barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
       barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
@@ -17,6 +17,9 @@ limitations under the License.
 #pragma once
 
 #include <vector>
+#include <map>
+#include <memory>
+#include <functional>
 #include "vulkan.h"
 #include "VulkanMemoryManager.h"
 #include "VulkanAsyncResourceHandle.h"
@@ -26,11 +29,12 @@ namespace vgl
   namespace core
   {
     class VulkanInstance;
+    class VulkanReadback;
 
     ///The idea behind vgl core buffer groups is that they are lower level facilities
     ///for hinting at how to manage memory allocations for multiple "grouped" buffers
     ///The higher level vgl::BufferArray abstraction will use this class directly
-    class VulkanBufferGroup
+    class VulkanBufferGroup : public VulkanMemoryManager::RelocationDelegate
     {
     public:
       VulkanBufferGroup(VkDevice device, VkCommandPool commandPool, VkQueue queue, int numBuffers);
@@ -42,8 +46,18 @@ namespace vgl
       enum UsageType { UT_VERTEX=0, UT_INDEX, UT_UNIFORM, UT_UNIFORM_DYNAMIC, UT_SHADER_STORAGE };
       inline void setUsageType(UsageType ut) { usageType = ut; }
 
+      ///Hints how long this group's buffers live, so buffers that are frequently recreated are kept out of the memory of long lived ones.
+      ///This must be set BEFORE data() is called to have an effect.  Currently, the default is LT_STATIC
+      inline void setLifetime(VulkanMemoryManager::Lifetime lt) { lifetime = lt; }
+
       inline int getNumBuffers() { return bufferCount; }
       inline size_t getSize(int bufferIndex) { return buffers[bufferIndex].size; }
+      inline size_t getCapacity(int bufferIndex) { return (stageToDevice) ? buffers[bufferIndex].capacity : buffers[bufferIndex].stagingCapacity; }
+
+      ///data() reuses a buffer in place whenever the new data fits its capacity (and still fills at least a quarter of it).  
+      ///When a larger buffer is needed, its capacity grows to at least factor times the old capacity (like std::vector) so that 
+      ///buffers that keep growing aren't recreated on every call.  Currently, the default factor is 1 (buffers are made exactly as large as their data)
+      inline void setCapacityGrowthFactor(float factor) { capacityGrowthFactor = factor; }
 
       ///If set to true, this buffer will prefer device local memory for its final storage location
       ///This must be set BEFORE data() is called to have an effect
@@ -52,7 +66,7 @@ namespace vgl
       ///Returns whether or not the buffer returned by get() is device local or not
       bool isDeviceLocal();
 
-      ///True if this texture is currently resident on the device
+      ///True if this buffer group is currently resident on the device (the memory manager may demote it to host memory under memory pressure)
       inline bool isDeviceResident() { return isResident; }
       
       ///Tentative API for auto-reclaiming staging memory after used by data().
@@ -67,6 +81,13 @@ namespace vgl
       ///Dedicated allocations should be reserved for limited occuring things such as Dynamc Uniform Buffers
       void setDedicatedAllocation(bool dedicated, size_t allocationSize);
 
+      ///Streaming buffers are for data that's rewritten every frame (gizmos, selection outlines, animated previews..).  Each buffer keeps one 
+      ///persistently mapped host visible copy per frame in flight (plus one) and data() writes the current swapchain frame's copy in place, so it 
+      ///neither allocates (once the copies are large enough) nor waits on the GPU.  get() returns the current frame's copy, so bind after data().
+      ///Write each buffer at most once per frame, subData() only touches the current copy.  This must be set BEFORE data() is called
+      void setStreaming(bool streaming);
+      inline bool isStreaming() { return streaming; }
+
       ///When using this buffer as a shader resource, it must be included in a descriptor set
       void putDescriptor(int bufferIndex, VkDescriptorSet set, uint32_t binding, VkDeviceSize offset=0, 
         VkDeviceSize range=VK_WHOLE_SIZE, uint32_t arrayElement=0);
@@ -74,15 +95,45 @@ namespace vgl
                          VkDescriptorSet set, uint32_t binding, VkDeviceSize offset=0, VkDeviceSize range=VK_WHOLE_SIZE,
                          uint32_t arrayElement=0);
       
-      ///Supplies data to a buffer via first mapping to staging buffer, then copying to device.  
+      ///Supplies data to a buffer via first writing to the (already mapped) staging buffer, then copying to device.  
+      ///Automatically released staging comes from the instance's upload ring whenever it has room.
       ///Pass a non-null command buffer to use it (instead of creating one from command pool) to transfer.  
-      ///Pass frame=true to attach resources to the current framebuffer/swapchain frame
+      ///Pass frame=true to attach resources to the current framebuffer/swapchain frame.
+      ///A reused device local buffer is overwritten after all previously submitted work reading it, but before work that's recorded and 
+      ///not yet submitted, while host visible buffers are only reused once no pending work holds them
       void data(int bufferIndex, const void *data, size_t numBytes, VkCommandBuffer transferCommandBuffer=nullptr, bool frame=false);
+
+      ///Like data(), but imports the given host memory (VK_EXT_external_memory_host) instead of copying it into staging.  The pointer & size
+      ///must be multiples of VulkanInstance::getHostImportAlignment() (page aligned, e.g. a mapped file) and the memory must stay valid until this 
+      ///buffer's data is replaced or the group is destroyed.  Device local groups copy straight out of it, host visible ones draw from it directly.
+      ///Returns false (leaving the buffer untouched) when the memory can't be imported into a host coherent memory type, use data() then
+      bool importHostData(int bufferIndex, void *hostPointer, size_t numBytes, VkCommandBuffer transferCommandBuffer=nullptr, bool frame=false);
+
+      ///Like data() for large sources (such as a memory mapped file), copies them through the instance's upload ring chunkBytes at a time 
+      ///instead of staging the whole buffer at once.  Chunks are recorded into the upload batcher, which is flushed (and waited on) whenever the 
+      ///ring fills up, so only a few chunks of staging memory are ever in use.  Falls back on data() for host visible buffers & small sources
+      void streamData(int bufferIndex, const void *source, size_t numBytes, size_t chunkBytes=4*1024*1024);
+
+      ///Updates part of a buffer that already has its data().  The bytes are copied right away but only reach the buffer at the next flushSubData(), 
+      ///overlapping & adjacent updates are coalesced until then (later bytes win) and a whole buffer data() discards pending ones
+      void subData(int bufferIndex, size_t offset, size_t numBytes, const void *data);
+
+      ///Records every pending subData() range.  Ranges up to 64 KB are written with vkCmdUpdateBuffer, larger ones are packed into a
+      ///single staging range (of the instance's upload ring when it has room) and copied with one vkCmdCopyBuffer per buffer.  Call once per frame (before recording the frame's draws) 
+      ///with the setup command buffer, or pass null to submit the updates right away (waiting for them to complete if wait is true)
+      void flushSubData(VkCommandBuffer transferCommandBuffer=nullptr, bool frame=false, bool wait=false);
+      inline bool hasPendingSubData() { return pendingSubDataBytes > 0; }
       
       ///Gets data back from a buffer by copying it to host memory (exposing only this for now instead of direct mapped ptr access)
       ///readback must be explicitly enabled prior to calling data() before this can be used.
       void readData(int bufferIndex, void *data, size_t numBytes);
 
+      ///Like readData() without stalling:  the copy is recorded and the returned readback resolves once it completes.  Pass the instance's
+      ///transfer command buffer to record into it (frame=true to tie it to the current frame), otherwise it's submitted right away.
+      ///Readback doesn't have to be enabled for this, the copy lands in the instance's pooled readback memory
+      std::shared_ptr<VulkanReadback> readDataAsync(int bufferIndex, size_t offset, size_t numBytes, VkCommandBuffer transferCommandBuffer=nullptr, 
+        bool frame=false);
+
       ///Readback must be enabled before data() if getData() will be called on this buffer group
       void setReadbackEnabled(bool enabled);
 
@@ -93,8 +144,8 @@ namespace vgl
       ///Binds a buffer from this group for use as an index buffer for indexed-rendering 
       void bindIndices(int bufferIndex, VkCommandBuffer graphicsCommandBuffer, bool shortIndices = false, VkDeviceSize offset=0);
 
-      ///The first call to this function will persistently map the buffer until its desttuction.  
-      ///Subsequent calls will simply return the mapped address
+      ///Returns the buffer's address within its persistently mapped host memory (the memory manager maps host visible blocks once).  
+      ///After the first call, the staging memory is kept until the buffer group's destruction
       void *getPersistentlyMappedAddress(int bufferIndex);
 
       ///Explicitly retains the async resource handles this class manages for the given frame id (you should never need to call this)
@@ -106,6 +157,14 @@ namespace vgl
       ///This only has an affect if the given allocation is host visible AND non coherent (needs to be flushed)
       void flush(int bufferIndex);
 
+      ///Device local buffers may be moved by VulkanMemoryManager::defragment(), after which get(bufferIndex) returns a new buffer.
+      ///Use this to rewrite any descriptor sets that reference the moved buffer
+      inline void setRelocationCallback(std::function<void(int bufferIndex)> callback) { relocationCallback = callback; }
+
+      ///Called by VulkanMemoryManager::defragment() & balanceResidency() (you should never need to call this)
+      bool relocate(const VulkanMemoryManager::Suballocation &oldSuballocation, const VulkanMemoryManager::Suballocation &newSuballocation, VkCommandBuffer commandBuffer) override;
+      inline uint64_t getLastUsedFrameId() override { return lastUsedFrameId; }
+
       ///It won't be necessary to manually call these methods for most circumstances
       void pipelineWriteBarrier(int bufferIndex, VkPipelineStageFlags srcStage, VkPipelineStageFlags dstStage, VkCommandBuffer transferCommandBuffer);
       void pipelineReadBarrier(int bufferIndex, VkPipelineStageFlags srcStage, VkPipelineStageFlags dstStage, VkCommandBuffer transferCommandBuffer);
@@ -121,24 +180,60 @@ namespace vgl
         VulkanAsyncResourceHandle *bufferHandle, *stagingBufferHandle;
         VkBuffer buffer, stagingBuffer;
         VulkanMemoryManager::Suballocation bufferAllocation, stagingBufferAllocation;
-        size_t size;
+        size_t size, capacity, stagingCapacity; //capacities are the sizes the vulkan buffers were created with
+        VkDeviceSize stagingOffset; //nonzero when the staging data is a range of the instance's upload ring
+        uint8_t *stagingRingData; //mapped upload ring range, null for staging buffers of our own
+        VkBufferUsageFlags usage, stagingUsage;
+        bool overwriting; //reused by data() with earlier reads possibly still pending, the next copy into it must wait on them
         void *persistentlyMappedAddress;
       };
       PerBuffer *buffers;
 
+      //pending subData() ranges of each buffer, keyed by offset & never overlapping or adjacent
+      static const VkDeviceSize inlineUpdateLimit = 65536;
+      std::vector<std::map<size_t, std::vector<uint8_t>>> dirtyRanges;
+      size_t pendingSubDataBytes = 0;
+
+      //per frame copies of each streaming buffer, the current one is also held (retained) as the buffer's staging buffer
+      struct StreamingCopy
+      {
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VulkanAsyncResourceHandle *handle = nullptr;
+        VulkanMemoryManager::Suballocation allocation = nullptr;
+        uint8_t *mappedData = nullptr;
+        size_t capacity = 0;
+        uint64_t frameId = 0;
+      };
+      std::vector<std::vector<StreamingCopy>> streamingCopies;
+      bool streaming = false;
+
       bool stageToDevice = true, stagingBufferDeviceLocal = false;
       bool autoReleaseStaging = true;
       bool readbackEnabled = false;
       bool isResident = false;
+      uint64_t lastUsedFrameId = 0;
       int bufferCount;
       UsageType usageType = UT_VERTEX;
+      float capacityGrowthFactor = 1.0f;
+      VulkanMemoryManager::Lifetime lifetime = VulkanMemoryManager::LT_STATIC;
       uint64_t allocationId = 0, dedicatedHostAllocationId = 0;
 
       bool dedicatedAllocation = false, hostAllocationNeedsFlush = false;
       size_t dedicatedAllocationSize = 0, dedicatedAllocationEnd = 0;
       VkMemoryPropertyFlagBits dedicatedHostAllocationMemoryFlags;
       void *persistentlyMappedHostMemoryAddress = nullptr;
-
+      std::function<void(int bufferIndex)> relocationCallback;
+
+      VkBufferUsageFlags finalBufferUsage();
+      VkBufferUsageFlags finalStagingUsage();
+      bool fitsCapacity(size_t capacity, size_t numBytes);
+      size_t grownCapacity(size_t capacity, size_t numBytes);
+      void overwriteBarrier(int bufferIndex, VkCommandBuffer transferCommandBuffer);
+
+      void streamingData(int bufferIndex, const void *data, size_t numBytes);
+      void discardSubData(int bufferIndex);
+      void prepareDeviceBuffer(int bufferIndex, size_t numBytes);
+      void retainUpload(int bufferIndex, bool frame);
       void copyFromStaging(int bufferIndex, VkCommandBuffer transferCommandBuffer);
       void copyToStaging(int bufferIndex, VkCommandBuffer transferCommandBuffer);
       void copyFromBuffer(VulkanBufferGroup *srcBufferGroup, int srcBufferIndex, int destBufferIndex, VkCommandBuffer transferCommandBuffer);
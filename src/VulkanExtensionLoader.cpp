@@ -25,6 +25,8 @@ namespace vgl
     PFN_vkGetPhysicalDeviceSurfaceSupportKHR VulkanExtensionLoader::vkGetPhysicalDeviceSurfaceSupportKHR = nullptr;
     PFN_vkGetPhysicalDeviceSurfaceCapabilitiesKHR VulkanExtensionLoader::vkGetPhysicalDeviceSurfaceCapabilitiesKHR = nullptr;
     PFN_vkGetPhysicalDeviceSurfacePresentModesKHR VulkanExtensionLoader::vkGetPhysicalDeviceSurfacePresentModesKHR = nullptr;
+    PFN_vkGetPhysicalDeviceMemoryProperties2KHR VulkanExtensionLoader::vkGetPhysicalDeviceMemoryProperties2KHR = nullptr;
+    PFN_vkGetPhysicalDeviceProperties2KHR VulkanExtensionLoader::vkGetPhysicalDeviceProperties2KHR = nullptr;
 
     PFN_vkCreateDebugReportCallbackEXT VulkanExtensionLoader::vkCreateDebugReportCallbackEXT = nullptr;
     PFN_vkDebugReportMessageEXT VulkanExtensionLoader::vkDebugReportMessageEXT = nullptr;
@@ -35,6 +37,7 @@ namespace vgl
     PFN_vkAcquireNextImageKHR VulkanExtensionLoader::vkAcquireNextImageKHR = nullptr;
     PFN_vkQueuePresentKHR VulkanExtensionLoader::vkQueuePresentKHR = nullptr;
     PFN_vkDestroySwapchainKHR VulkanExtensionLoader::vkDestroySwapchainKHR = nullptr;
+    PFN_vkGetMemoryHostPointerPropertiesEXT VulkanExtensionLoader::vkGetMemoryHostPointerPropertiesEXT = nullptr;
 
     template <typename M>
     void getProc(VkInstance instance, M &method, const char *name)
@@ -54,6 +57,8 @@ namespace vgl
       getProc(instance, vkGetPhysicalDeviceSurfaceSupportKHR, "vkGetPhysicalDeviceSurfaceSupportKHR");
       getProc(instance, vkGetPhysicalDeviceSurfaceCapabilitiesKHR, "vkGetPhysicalDeviceSurfaceCapabilitiesKHR");
       getProc(instance, vkGetPhysicalDeviceSurfacePresentModesKHR, "vkGetPhysicalDeviceSurfacePresentModesKHR");
+      getProc(instance, vkGetPhysicalDeviceMemoryProperties2KHR, "vkGetPhysicalDeviceMemoryProperties2KHR");
+      getProc(instance, vkGetPhysicalDeviceProperties2KHR, "vkGetPhysicalDeviceProperties2KHR");
 
       getProc(instance, vkCreateDebugReportCallbackEXT, "vkCreateDebugReportCallbackEXT");
       getProc(instance, vkDebugReportMessageEXT, "vkDebugReportMessageEXT");
@@ -67,6 +72,7 @@ namespace vgl
       getProc(device, vkAcquireNextImageKHR, "vkAcquireNextImageKHR");
       getProc(device, vkQueuePresentKHR, "vkQueuePresentKHR");
       getProc(device, vkDestroySwapchainKHR, "vkDestroySwapchainKHR");
+      getProc(device, vkGetMemoryHostPointerPropertiesEXT, "vkGetMemoryHostPointerPropertiesEXT");
     }
   }
 }
\ No newline at end of file
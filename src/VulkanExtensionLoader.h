@@ -32,6 +32,8 @@ namespace vgl
       static PFN_vkGetPhysicalDeviceSurfaceSupportKHR vkGetPhysicalDeviceSurfaceSupportKHR;
       static PFN_vkGetPhysicalDeviceSurfaceCapabilitiesKHR vkGetPhysicalDeviceSurfaceCapabilitiesKHR;
       static PFN_vkGetPhysicalDeviceSurfacePresentModesKHR vkGetPhysicalDeviceSurfacePresentModesKHR;
+      static PFN_vkGetPhysicalDeviceMemoryProperties2KHR vkGetPhysicalDeviceMemoryProperties2KHR;
+      static PFN_vkGetPhysicalDeviceProperties2KHR vkGetPhysicalDeviceProperties2KHR;
 
       static PFN_vkCreateDebugReportCallbackEXT vkCreateDebugReportCallbackEXT;
       static PFN_vkDebugReportMessageEXT vkDebugReportMessageEXT;
@@ -45,6 +47,7 @@ namespace vgl
       static PFN_vkGetSwapchainImagesKHR vkGetSwapchainImagesKHR;
       static PFN_vkAcquireNextImageKHR vkAcquireNextImageKHR;
       static PFN_vkQueuePresentKHR vkQueuePresentKHR;
+      static PFN_vkGetMemoryHostPointerPropertiesEXT vkGetMemoryHostPointerPropertiesEXT;
     };
   }
 }
\ No newline at end of file
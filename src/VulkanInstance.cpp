@@ -22,11 +22,13 @@ limitations under the License.
 #include <iterator>
 #include <map>
 #include <set>
+#include <algorithm>
 #include "VulkanInstance.h"
 #include "VulkanExtensionLoader.h"
 #include "VulkanSwapChain.h"
 #include "VulkanMemoryManager.h"
 #include "VulkanAsyncResourceHandle.h"
+#include "VulkanTexture.h"
 #ifndef VGL_VULKAN_CORE_STANDALONE
 #include "FileManager.h"
 #endif
@@ -86,6 +88,22 @@ namespace vgl
       if(validationEnabled)
         instanceExtensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
 
+      uint32_t availableExtensionCount = 0;
+      vkEnumerateInstanceExtensionProperties(nullptr, &availableExtensionCount, nullptr);
+      vector<VkExtensionProperties> availableExtensions(availableExtensionCount);
+      vkEnumerateInstanceExtensionProperties(nullptr, &availableExtensionCount, availableExtensions.data());
+
+      for(const auto &extension : availableExtensions)
+      {
+        //needed to query heap budgets
+        if((string)extension.extensionName == VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME)
+          instanceExtensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+
+        //needed to import host memory
+        if((string)extension.extensionName == VK_KHR_EXTERNAL_MEMORY_CAPABILITIES_EXTENSION_NAME)
+          instanceExtensions.push_back(VK_KHR_EXTERNAL_MEMORY_CAPABILITIES_EXTENSION_NAME);
+      }
+
 #ifdef VGLPP_VR
       vector<string> vrInstanceExtensions;
       if(auto steamVrCompositor = vr::VRCompositor())
@@ -183,6 +201,15 @@ namespace vgl
         requiredDeviceExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
       requiredDeviceExtensions.push_back(VK_KHR_MAINTENANCE1_EXTENSION_NAME);
       //requiredDeviceExtensions.push_back(VK_EXT_VERTEX_ATTRIBUTE_DIVISOR_EXTENSION_NAME);
+
+      if(isInstanceExtensionEnabled(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME))
+        optionalDeviceExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+      if(isInstanceExtensionEnabled(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME) && 
+        isInstanceExtensionEnabled(VK_KHR_EXTERNAL_MEMORY_CAPABILITIES_EXTENSION_NAME))
+      {
+        optionalDeviceExtensions.push_back(VK_KHR_EXTERNAL_MEMORY_EXTENSION_NAME);
+        optionalDeviceExtensions.push_back(VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME);
+      }
         
       //disabling for now (these cause validation errors with my buffers, will look into later..)
       //optionalDeviceExtensions.push_back(VK_KHR_GET_MEMORY_REQUIREMENTS_2_EXTENSION_NAME);
@@ -333,7 +360,9 @@ namespace vgl
         }
 
         physicalDevice = candidates.rbegin()->second.device;
-        graphicsQueueFamily = findQueueFamilies(physicalDevice);
+        graphicsQueueFamily = findQueueFamilies(physicalDevice, (!launchConfig.disableTransferQueue) ? &transferQueueFamily : nullptr);
+        if(transferQueueFamily < 0)
+          transferQueueFamily = graphicsQueueFamily;
 
         vkGetPhysicalDeviceProperties(physicalDevice, &physicalDeviceProperties);
         vkGetPhysicalDeviceFeatures(physicalDevice, &physicalDeviceFeatures);
@@ -344,6 +373,22 @@ namespace vgl
 
         //init system-wide memory manager
         memoryManager = new VulkanMemoryManager(physicalDevice, device);
+        if(isDeviceExtensionEnabled(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) && VulkanExtensionLoader::vkGetPhysicalDeviceMemoryProperties2KHR)
+          memoryManager->enableMemoryBudget(VulkanExtensionLoader::vkGetPhysicalDeviceMemoryProperties2KHR);
+
+        if(isDeviceExtensionEnabled(VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME) && VulkanExtensionLoader::vkGetPhysicalDeviceProperties2KHR && 
+          VulkanExtensionLoader::vkGetMemoryHostPointerPropertiesEXT)
+        {
+          VkPhysicalDeviceExternalMemoryHostPropertiesEXT hostProperties = {};
+          hostProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_MEMORY_HOST_PROPERTIES_EXT;
+
+          VkPhysicalDeviceProperties2KHR properties = {};
+          properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR;
+          properties.pNext = &hostProperties;
+          VulkanExtensionLoader::vkGetPhysicalDeviceProperties2KHR(physicalDevice, &properties);
+
+          hostImportAlignment = hostProperties.minImportedHostPointerAlignment;
+        }
 
         //init system-wide resource monitor
         resourceMonitor = new VulkanAsyncResourceMonitor(memoryManager);
@@ -357,6 +402,18 @@ namespace vgl
         if(vkCreateCommandPool(device, &poolInfo, nullptr, &transferCommandPool) != VK_SUCCESS)
           throw vgl_runtime_error("Unable to create Vulkan command pool");
 
+        //uploads on a separate transfer queue family need a pool of their own
+        if(hasDedicatedTransferQueue())
+        {
+          poolInfo.queueFamilyIndex = transferQueueFamily;
+          if(vkCreateCommandPool(device, &poolInfo, nullptr, &transferQueueCommandPool) != VK_SUCCESS)
+            throw vgl_runtime_error("Unable to create Vulkan command pool");
+          vout << "Uploading on transfer queue family " << transferQueueFamily << endl;
+        }
+
+        uploadBatcher = new VulkanUploadBatcher(device, graphicsQueue, graphicsQueueFamily, transferCommandPool, transferQueue, transferQueueFamily,
+          (transferQueueCommandPool) ? transferQueueCommandPool : transferCommandPool, resourceMonitor);
+
         //create main pipeline cache
         setupPipelineCache();
 
@@ -371,13 +428,17 @@ namespace vgl
 
     void VulkanInstance::setupLogicalDevice()
     {
-      VkDeviceQueueCreateInfo queueCreateInfo = {};
-      queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-      queueCreateInfo.queueFamilyIndex = graphicsQueueFamily;
-      queueCreateInfo.queueCount = 1;
-
+      VkDeviceQueueCreateInfo queueCreateInfos[2] = {};
+      uint32_t queueCreateInfoCount = (transferQueueFamily != graphicsQueueFamily) ? 2 : 1;
       float queuePriority = 1.0f;
-      queueCreateInfo.pQueuePriorities = &queuePriority;
+
+      queueCreateInfos[0].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+      queueCreateInfos[0].queueFamilyIndex = graphicsQueueFamily;
+      queueCreateInfos[0].queueCount = 1;
+      queueCreateInfos[0].pQueuePriorities = &queuePriority;
+
+      queueCreateInfos[1] = queueCreateInfos[0];
+      queueCreateInfos[1].queueFamilyIndex = transferQueueFamily;
 
       VkPhysicalDeviceFeatures deviceFeatures = {};
       if(physicalDeviceFeatures.samplerAnisotropy)
@@ -393,8 +454,8 @@ namespace vgl
 
       VkDeviceCreateInfo createInfo = {};
       createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-      createInfo.pQueueCreateInfos = &queueCreateInfo;
-      createInfo.queueCreateInfoCount = 1;
+      createInfo.pQueueCreateInfos = queueCreateInfos;
+      createInfo.queueCreateInfoCount = queueCreateInfoCount;
       createInfo.pEnabledFeatures = &deviceFeatures;
 
       checkOptionalDeviceExtensions();
@@ -419,6 +480,7 @@ namespace vgl
       VulkanExtensionLoader::resolveDeviceExtensions(instance, device);
 
       vkGetDeviceQueue(device, graphicsQueueFamily, 0, &graphicsQueue);
+      vkGetDeviceQueue(device, transferQueueFamily, 0, &transferQueue);
     }
 
     void VulkanInstance::setupSurface()
@@ -495,7 +557,7 @@ namespace vgl
       return true;
     }
 
-    int VulkanInstance::findQueueFamilies(VkPhysicalDevice device)
+    int VulkanInstance::findQueueFamilies(VkPhysicalDevice device, int *transferFamily)
     {
       int result = -1;
       uint32_t queueFamilyCount = 0;
@@ -514,6 +576,28 @@ namespace vgl
         i++;
       }
 
+      if(transferFamily)
+      {
+        //a transfer only family is usually the DMA engine, failing that an async compute family can transfer without tying up graphics
+        *transferFamily = -1;
+        int bestScore = 0;
+
+        for(i = 0; i < (int)queueFamilies.size(); i++) if(queueFamilies[i].queueCount > 0 && !(queueFamilies[i].queueFlags & VK_QUEUE_GRAPHICS_BIT))
+        {
+          int score = 0;
+          if(!(queueFamilies[i].queueFlags & VK_QUEUE_COMPUTE_BIT) && (queueFamilies[i].queueFlags & VK_QUEUE_TRANSFER_BIT))
+            score = 2;
+          else if(queueFamilies[i].queueFlags & VK_QUEUE_COMPUTE_BIT)
+            score = 1;
+
+          if(score > bestScore)
+          {
+            bestScore = score;
+            *transferFamily = i;
+          }
+        }
+      }
+
       return result;
     }
 
@@ -552,14 +636,34 @@ namespace vgl
         }
       }
 
+      if(textureStreamer)
+        delete textureStreamer;
+
+      if(mipmapGenerator)
+        delete mipmapGenerator;
+
+      //any transfers still gathered are submitted (and handed to the monitor) here
+      if(uploadBatcher)
+        delete uploadBatcher;
+
       if(resourceMonitor)
         delete resourceMonitor;
 
+      //the monitor hands its remaining ranges back to the ring above, so this goes after it
+      if(uploadRing)
+        delete uploadRing;
+
+      //same goes for readbacks still pending, which resolve into the pool as the monitor goes away
+      if(readbackPool)
+        delete readbackPool;
+
       if(memoryManager)
         delete memoryManager;
 
       if(transferCommandPool)
         vkDestroyCommandPool(device, transferCommandPool, nullptr);
+      if(transferQueueCommandPool)
+        vkDestroyCommandPool(device, transferQueueCommandPool, nullptr);
 
       if(device)
       {
@@ -658,6 +762,65 @@ namespace vgl
       currentTransferCommandBuffer = { VK_NULL_HANDLE, VK_NULL_HANDLE };
     }
 
+    VulkanUploadRing *VulkanInstance::getUploadRing()
+    {
+      if(!uploadRing && uploadRingSize)
+      {
+        //with a separate transfer queue, ranges of the ring are read by both queue families
+        vector<uint32_t> queueFamilies = { (uint32_t)graphicsQueueFamily };
+        if(hasDedicatedTransferQueue())
+          queueFamilies.push_back((uint32_t)transferQueueFamily);
+        uploadRing = new VulkanUploadRing(device, memoryManager, resourceMonitor, uploadRingSize, queueFamilies);
+      }
+      return uploadRing;
+    }
+
+    VulkanTextureStreamer *VulkanInstance::getTextureStreamer()
+    {
+      if(!textureStreamer)
+        textureStreamer = new VulkanTextureStreamer();
+      return textureStreamer;
+    }
+
+    VulkanReadbackPool *VulkanInstance::getReadbackPool()
+    {
+      if(!readbackPool)
+        readbackPool = new VulkanReadbackPool(device, memoryManager, resourceMonitor, uploadBatcher);
+      return readbackPool;
+    }
+
+    VulkanMipmapGenerator *VulkanInstance::getMipmapGenerator()
+    {
+      if(!mipmapGenerator)
+        mipmapGenerator = new VulkanMipmapGenerator(device);
+      return mipmapGenerator;
+    }
+
+    VkFormatFeatureFlags VulkanInstance::getFormatFeatures(VkFormat format)
+    {
+      lock_guard<mutex> locker(formatFeaturesLock);
+
+      auto it = formatFeatures.find(format);
+      if(it == formatFeatures.end())
+      {
+        VkFormatProperties formatProperties;
+        vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &formatProperties);
+        it = formatFeatures.insert({ format, formatProperties.optimalTilingFeatures }).first;
+      }
+
+      return it->second;
+    }
+
+    void VulkanInstance::setUploadRingSize(VkDeviceSize size)
+    {
+      if(uploadRing)
+      {
+        verr << "Vulkan Warning:  VulkanInstance::setUploadRingSize() called after the upload ring was created" << endl;
+        return;
+      }
+      uploadRingSize = size;
+    }
+
     void VulkanInstance::waitForDeviceIdle()
     {
       if(device)
@@ -669,6 +832,20 @@ namespace vgl
       return string(physicalDeviceProperties.deviceName);
     }
 
+    bool VulkanInstance::isInstanceExtensionEnabled(const char *extension)
+    {
+      return find_if(instanceExtensions.begin(), instanceExtensions.end(), [extension](const char *ext) {
+        return ((string)ext == extension);
+      }) != instanceExtensions.end();
+    }
+
+    bool VulkanInstance::isDeviceExtensionEnabled(const char *extension)
+    {
+      return find_if(deviceExtensions.begin(), deviceExtensions.end(), [extension](const char *ext) {
+        return ((string)ext == extension);
+      }) != deviceExtensions.end();
+    }
+
     void VulkanInstance::enableValidationReports(bool b)
     {
       validationReportingEnabled = b;
@@ -21,7 +21,12 @@ limitations under the License.
 #include "VulkanSwapChain.h"
 #include "VulkanMemoryManager.h"
 #include "VulkanAsyncResourceHandle.h"
+#include "VulkanUploadRing.h"
+#include "VulkanUploadBatcher.h"
+#include "VulkanReadback.h"
 #include <vector>
+#include <map>
+#include <mutex>
 
 #ifdef VGL_VULKAN_CORE_STANDALONE
 #define VGLINLINE inline
@@ -31,12 +36,18 @@ namespace vgl
 {
   namespace core
   {
+    class VulkanTextureStreamer;
+    class VulkanMipmapGenerator;
+
     class VulkanInstance
     {
     public:
       struct VulkanConfig
       {
         bool headless;
+
+        ///Keeps every upload on the graphics queue even if the device has a separate transfer queue family
+        bool disableTransferQueue;
       };
       
       VulkanInstance(VulkanConfig config={});
@@ -54,11 +65,40 @@ namespace vgl
       inline VkPhysicalDeviceProperties getPhysicalDeviceProperties() { return physicalDeviceProperties; }
       inline int getGraphicsQueueFamily() { return graphicsQueueFamily; }
       inline VkQueue getGraphicsQueue() { return graphicsQueue; }
+
+      ///These are the graphics queue (family) when the device has no separate transfer queue family
+      inline int getTransferQueueFamily() { return transferQueueFamily; }
+      inline VkQueue getTransferQueue() { return transferQueue; }
+      inline bool hasDedicatedTransferQueue() { return transferQueueFamily != graphicsQueueFamily; }
       inline VkPipelineCache getPipelineCache() { return pipelineCache; }
 
       inline VulkanMemoryManager *getMemoryManager() { return memoryManager; }
       inline VulkanAsyncResourceMonitor *getResourceMonitor() { return resourceMonitor; }
 
+      ///The shared staging ring used by buffer & texture uploads, created on first use (returns null if the ring is disabled)
+      VulkanUploadRing *getUploadRing();
+
+      ///Must be called before the first upload to have any effect, 0 disables the ring
+      void setUploadRingSize(VkDeviceSize size);
+
+      ///Wrap bulk loading in getUploadBatcher()->begin() & end() to turn its per upload submits into one
+      inline VulkanUploadBatcher *getUploadBatcher() { return uploadBatcher; }
+
+      ///Schedules the uploads of textures given to VulkanTexture::streamImageData(), created on first use
+      VulkanTextureStreamer *getTextureStreamer();
+
+      ///Staging memory for async readbacks, created on first use
+      VulkanReadbackPool *getReadbackPool();
+
+      ///Builds the mip chains of textures, created on first use
+      VulkanMipmapGenerator *getMipmapGenerator();
+
+      ///Optimal tiling features of a format on this device, queried once per format
+      VkFormatFeatureFlags getFormatFeatures(VkFormat format);
+
+      ///Host pointers & sizes given to VulkanBufferGroup::importHostData() must be multiples of this (0 when the device can't import host memory)
+      inline VkDeviceSize getHostImportAlignment() { return hostImportAlignment; }
+
       inline VulkanSwapChain *getSwapChain() { return swapChain; }
 
       ///Used to handle window resizing
@@ -94,6 +134,8 @@ namespace vgl
       ///Find out which instance/device extensions have been enabled for vulkan
       inline const std::vector<const char *> &getEnabledInstanceExtensions() { return instanceExtensions; }
       inline const std::vector<const char *> &getEnabledDeviceExtensions() { return deviceExtensions; }
+      bool isInstanceExtensionEnabled(const char *extension);
+      bool isDeviceExtensionEnabled(const char *extension);
 
       ///Useful for temporarily getting around bugs in vulkan validation layers (I use breakpoints to debug these)
       static void enableValidationReports(bool b);
@@ -103,8 +145,8 @@ namespace vgl
       VkInstance instance;
       VkDevice device;
       VkPhysicalDevice physicalDevice;
-      VkQueue graphicsQueue;
-      VkCommandPool transferCommandPool;
+      VkQueue graphicsQueue, transferQueue = VK_NULL_HANDLE;
+      VkCommandPool transferCommandPool, transferQueueCommandPool = VK_NULL_HANDLE;
       std::pair<VkCommandBuffer, VkFence> currentTransferCommandBuffer = { VK_NULL_HANDLE, VK_NULL_HANDLE };
       VkCommandBuffer currentRenderingCommandBuffer = VK_NULL_HANDLE;
       VkPipelineCache pipelineCache;
@@ -116,8 +158,17 @@ namespace vgl
       VulkanSwapChain *swapChain = nullptr;
       VulkanMemoryManager *memoryManager = nullptr;
       VulkanAsyncResourceMonitor *resourceMonitor = nullptr;
+      VulkanUploadRing *uploadRing = nullptr;
+      VulkanUploadBatcher *uploadBatcher = nullptr;
+      VulkanTextureStreamer *textureStreamer = nullptr;
+      VulkanReadbackPool *readbackPool = nullptr;
+      VulkanMipmapGenerator *mipmapGenerator = nullptr;
+      std::map<VkFormat, VkFormatFeatureFlags> formatFeatures;
+      std::mutex formatFeaturesLock;
+      VkDeviceSize uploadRingSize = 32*1024*1024;
+      VkDeviceSize hostImportAlignment = 0;
       
-      int graphicsQueueFamily = -1;
+      int graphicsQueueFamily = -1, transferQueueFamily = -1;
       VulkanConfig launchConfig;
 
       void getRequiredInstanceExtensions();
@@ -130,7 +181,7 @@ namespace vgl
       void setupPipelineCache();
 
       bool checkValidationLayers();
-      int findQueueFamilies(VkPhysicalDevice device);
+      int findQueueFamilies(VkPhysicalDevice device, int *transferFamily=nullptr);
 
       std::vector<const char *> validationLayers;
       std::vector<const char *> instanceExtensions;
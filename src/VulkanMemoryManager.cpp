@@ -18,8 +18,14 @@ limitations under the License.
 #include <cassert>
 #include <iostream>
 #include <algorithm>
+#include <chrono>
+#include <sstream>
 #include "VulkanMemoryManager.h"
 
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 #ifdef VGL_VULKAN_CORE_USE_VMA
 #define VMA_IMPLEMENTATION
 #include "vk_mem_alloc.h"
@@ -31,8 +37,107 @@ namespace vgl
 {
   namespace core
   {
+    double VulkanMemoryStats::Usage::fragmentation() const
+    {
+      return (freeBytes > 0) ? 1.0 - (double)largestFreeRegion/freeBytes : 0.0;
+    }
+
+    double VulkanMemoryStats::Usage::utilization() const
+    {
+      return (blockBytes > 0) ? (double)usedBytes/blockBytes : 0.0;
+    }
+
+    void VulkanMemoryStats::Usage::addSuballocation(VkDeviceSize size)
+    {
+      int bucket = 0;
+
+      for(VkDeviceSize s = size >> 7; s && bucket < HistogramBuckets-1; s >>= 1)
+        bucket++;
+      sizeHistogram[bucket]++;
+      suballocations++;
+      usedBytes += size;
+    }
+
+    void VulkanMemoryStats::Usage::addFreeRegion(VkDeviceSize size)
+    {
+      freeRegions++;
+      freeBytes += size;
+      largestFreeRegion = max(largestFreeRegion, size);
+    }
+
+    void VulkanMemoryStats::Usage::add(const Usage &other)
+    {
+      blocks += other.blocks;
+      suballocations += other.suballocations;
+      freeRegions += other.freeRegions;
+      blockBytes += other.blockBytes;
+      usedBytes += other.usedBytes;
+      freeBytes += other.freeBytes;
+      largestFreeRegion = max(largestFreeRegion, other.largestFreeRegion);
+      for(int i = 0; i < HistogramBuckets; i++)
+        sizeHistogram[i] += other.sizeHistogram[i];
+    }
+
+    static void writeUsageJson(ostream &out, const VulkanMemoryStats::Usage &usage)
+    {
+      out << "{\"blocks\":" << usage.blocks << ",\"blockBytes\":" << usage.blockBytes << ",\"suballocations\":" << usage.suballocations
+          << ",\"usedBytes\":" << usage.usedBytes << ",\"freeBytes\":" << usage.freeBytes << ",\"freeRegions\":" << usage.freeRegions
+          << ",\"largestFreeRegion\":" << usage.largestFreeRegion << ",\"fragmentation\":" << usage.fragmentation()
+          << ",\"utilization\":" << usage.utilization() << ",\"sizeHistogram\":[";
+      for(int i = 0; i < VulkanMemoryStats::HistogramBuckets; i++)
+        out << (i ? "," : "") << usage.sizeHistogram[i];
+      out << "]}";
+    }
+
+    string VulkanMemoryStats::toJson() const
+    {
+      static const char *tierNames[TIER_COUNT] = { "small", "med", "large", "dedicated" };
+      static const char *poolNames[POOL_COUNT] = { "static", "dynamic", "transient" };
+      ostringstream out;
+
+      out << "{\"total\":";
+      writeUsageJson(out, total);
+
+      out << ",\"heaps\":[";
+      for(size_t i = 0; i < heaps.size(); i++)
+      {
+        const auto &heap = heaps[i];
+
+        out << (i ? "," : "") << "{\"index\":" << i << ",\"size\":" << heap.size << ",\"flags\":" << heap.flags
+            << ",\"budget\":" << heap.budget << ",\"budgetUsage\":" << heap.budgetUsage << ",\"usage\":";
+        writeUsageJson(out, heap.usage);
+        out << "}";
+      }
+
+      out << "],\"memoryTypes\":[";
+      for(size_t i = 0; i < memoryTypes.size(); i++)
+      {
+        const auto &memoryType = memoryTypes[i];
+
+        out << (i ? "," : "") << "{\"index\":" << i << ",\"heap\":" << memoryType.heapIndex << ",\"flags\":" << memoryType.propertyFlags << ",\"usage\":";
+        writeUsageJson(out, memoryType.usage);
+        out << ",\"tiers\":{";
+        for(int t = 0; t < TIER_COUNT; t++)
+        {
+          out << (t ? "," : "") << "\"" << tierNames[t] << "\":";
+          writeUsageJson(out, memoryType.tiers[t]);
+        }
+        out << "},\"pools\":{";
+        for(int p = 0; p < POOL_COUNT; p++)
+        {
+          out << (p ? "," : "") << "\"" << poolNames[p] << "\":";
+          writeUsageJson(out, memoryType.pools[p]);
+        }
+        out << "}}";
+      }
+      out << "]}";
+
+      return out.str();
+    }
+
 #ifdef VGL_VULKAN_CORE_USE_VMA
     VulkanMemoryManager::VulkanMemoryManager(VkPhysicalDevice physicalDevice, VkDevice device)
+      : device(device)
     {
       auto instanceHasDedicatedAlloc = [] {
         const auto &enabledExt = VulkanInstance::currentInstance().getEnabledDeviceExtensions();
@@ -56,6 +161,9 @@ namespace vgl
 
       vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
       memset(pools, 0, sizeof(VmaPool)*MaxPools);
+      memset(poolMemoryTypes, 0, sizeof(poolMemoryTypes));
+      for(auto &typeHistogram : sizeHistogram) for(auto &count : typeHistogram)
+        count = 0;
     }
 
     void VulkanMemoryManager::makePool(uint64_t allocationId, uint32_t memoryTypeIndex, VkDeviceSize blockSize, size_t maxAllocations)
@@ -67,9 +175,27 @@ namespace vgl
 
       assert(allocationId > 0);
       vmaCreatePool(allocator, &poolCreateInfo, &pools[allocationId-1]);      
+      poolMemoryTypes[allocationId-1] = memoryTypeIndex;
+    }
+
+    void VulkanMemoryManager::countSuballocation(const Suballocation &suballocation, bool allocated)
+    {
+      VmaAllocationInfo vmaInfo;
+      VulkanMemoryStats::Usage bucketOf;
+
+      //reuse the stats bucketing so the histogram matches the built-in path's
+      vmaGetAllocationInfo(allocator, suballocation.allocation, &vmaInfo);
+      bucketOf.addSuballocation(vmaInfo.size);
+      for(int i = 0; i < VulkanMemoryStats::HistogramBuckets; i++) if(bucketOf.sizeHistogram[i])
+      {
+        if(allocated)
+          sizeHistogram[vmaInfo.memoryType][i]++;
+        else
+          sizeHistogram[vmaInfo.memoryType][i]--;
+      }
     }
 
-    VulkanMemoryManager::Suballocation VulkanMemoryManager::allocateBuffer(VkMemoryPropertyFlags properties, VkBuffer buffer, uint64_t allocationId)
+    VulkanMemoryManager::Suballocation VulkanMemoryManager::allocateBuffer(VkMemoryPropertyFlags properties, VkBuffer buffer, uint64_t allocationId, Lifetime lifetime)
     {
       VulkanMemoryManager::Suballocation result;
 
@@ -77,14 +203,20 @@ namespace vgl
       allocInfo.requiredFlags = properties;
       if(properties == 0)
         allocInfo.preferredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+      if(properties & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+        allocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+      if(lifetime == LT_TRANSIENT)
+        allocInfo.flags |= VMA_ALLOCATION_CREATE_STRATEGY_MIN_TIME_BIT;
       if(allocationId > 0)
         allocInfo.pool = pools[allocationId-1];
 
       result.allocationResult = vmaAllocateMemoryForBuffer(allocator, buffer, &allocInfo, &result.allocation, nullptr);
+      if(result)
+        countSuballocation(result, true);
       return result;
     }
 
-    VulkanMemoryManager::Suballocation VulkanMemoryManager::allocateImage(VkMemoryPropertyFlags properties, VkImage image, uint64_t allocationId)
+    VulkanMemoryManager::Suballocation VulkanMemoryManager::allocateImage(VkMemoryPropertyFlags properties, VkImage image, uint64_t allocationId, Lifetime lifetime)
     {
       VulkanMemoryManager::Suballocation result;
 
@@ -92,13 +224,52 @@ namespace vgl
       allocInfo.requiredFlags = properties;
       if(properties == 0)
         allocInfo.preferredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+      if(properties & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+        allocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+      if(lifetime == LT_TRANSIENT)
+        allocInfo.flags |= VMA_ALLOCATION_CREATE_STRATEGY_MIN_TIME_BIT;
       if(allocationId > 0)
         allocInfo.pool = pools[allocationId-1];
 
       result.allocationResult = vmaAllocateMemoryForImage(allocator, image, &allocInfo, &result.allocation, nullptr);
+      if(result)
+        countSuballocation(result, true);
       return result;
     }
 
+    VulkanMemoryManager::Suballocation VulkanMemoryManager::allocateTransientBuffer(VkMemoryPropertyFlags properties, VkBuffer buffer, uint64_t frameId)
+    {
+      return allocateBuffer(properties, buffer);
+    }
+
+    VkDeviceMemory VulkanMemoryManager::importHostMemory(uint32_t typeFilter, VkMemoryPropertyFlags properties, void *hostPointer, VkDeviceSize size)
+    {
+      uint32_t memoryType = findMemoryType(typeFilter, properties);
+      if(memoryType == VK_MAX_MEMORY_TYPES)
+        return VK_NULL_HANDLE;
+
+      VkImportMemoryHostPointerInfoEXT importInfo = {};
+      importInfo.sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_HOST_POINTER_INFO_EXT;
+      importInfo.handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
+      importInfo.pHostPointer = hostPointer;
+
+      VkMemoryAllocateInfo allocInfo = {};
+      allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+      allocInfo.pNext = &importInfo;
+      allocInfo.allocationSize = size;
+      allocInfo.memoryTypeIndex = memoryType;
+
+      VkDeviceMemory memory = VK_NULL_HANDLE;
+      if(vkAllocateMemory(device, &allocInfo, nullptr, &memory) != VK_SUCCESS)
+        return VK_NULL_HANDLE;
+      return memory;
+    }
+
+    void VulkanMemoryManager::freeImportedMemory(VkDeviceMemory memory)
+    {
+      vkFreeMemory(device, memory, nullptr);
+    }
+
     pair<VmaPool, uint64_t> VulkanMemoryManager::allocateDedicated(uint32_t typeFilter, VkMemoryPropertyFlags properties, VkDeviceSize blockSize, size_t maxBlocks, bool allowSuballocation, bool imageOptimal)
     {
       auto getFreePool = [=]() -> uint64_t {
@@ -153,12 +324,25 @@ namespace vgl
       result.offset = vmaInfo.offset;
       result.size = vmaInfo.size;
       result.allocationId = 0;
+      result.mappedData = vmaInfo.pMappedData;
 
       return result;
     }
 
+    void VulkanMemoryManager::flushAllocation(const Suballocation &suballocation, VkDeviceSize offset, VkDeviceSize size)
+    {
+      vmaFlushAllocation(allocator, suballocation.allocation, offset, size);
+    }
+
+    void VulkanMemoryManager::invalidateAllocation(const Suballocation &suballocation, VkDeviceSize offset, VkDeviceSize size)
+    {
+      vmaInvalidateAllocation(allocator, suballocation.allocation, offset, size);
+    }
+
     void VulkanMemoryManager::free(const Suballocation &suballocation)
     {
+      if(suballocation)
+        countSuballocation(suballocation, false);
       vmaFreeMemory(allocator, suballocation.allocation);
     }
 
@@ -174,6 +358,12 @@ namespace vgl
       return (memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) ? true : false;
     }
 
+    bool VulkanMemoryManager::isAllocationDeviceLocal(const Suballocation &suballocation)
+    {
+      auto info = getAllocationInfo(suballocation);
+      return (memoryProperties.memoryTypes[info.memoryType].propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) ? true : false;
+    }
+
     uint32_t VulkanMemoryManager::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties)
     {
       for(uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
@@ -197,6 +387,81 @@ namespace vgl
       vmaFreeStatsString(allocator, stats);
     }
 
+    VulkanMemoryStats VulkanMemoryManager::getStats()
+    {
+      VulkanMemoryStats stats;
+      VmaStats vmaStats;
+
+      auto toUsage = [](const VmaStatInfo &info) {
+        VulkanMemoryStats::Usage usage;
+
+        usage.blocks = info.blockCount;
+        usage.suballocations = info.allocationCount;
+        usage.freeRegions = info.unusedRangeCount;
+        usage.usedBytes = info.usedBytes;
+        usage.freeBytes = info.unusedBytes;
+        usage.blockBytes = info.usedBytes + info.unusedBytes;
+        usage.largestFreeRegion = info.unusedRangeSizeMax;
+        return usage;
+      };
+
+      vmaCalculateStats(allocator, &vmaStats);
+
+      stats.memoryTypes.resize(memoryProperties.memoryTypeCount);
+      for(uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
+      {
+        auto &memoryType = stats.memoryTypes[i];
+
+        memoryType.heapIndex = memoryProperties.memoryTypes[i].heapIndex;
+        memoryType.propertyFlags = memoryProperties.memoryTypes[i].propertyFlags;
+        memoryType.usage = toUsage(vmaStats.memoryType[i]);
+        for(int b = 0; b < VulkanMemoryStats::HistogramBuckets; b++)
+          memoryType.usage.sizeHistogram[b] = sizeHistogram[i][b];
+      }
+
+      //vma doesn't expose its block size classes, so the only tier we can break out is our own dedicated pools
+      for(int i = 0; i < MaxPools; i++) if(pools[i])
+      {
+        VmaPoolStats poolStats;
+        auto &tier = stats.memoryTypes[poolMemoryTypes[i]].tiers[VulkanMemoryStats::TIER_DEDICATED];
+
+        vmaGetPoolStats(allocator, pools[i], &poolStats);
+        tier.blocks += (uint32_t)poolStats.blockCount;
+        tier.suballocations += (uint32_t)poolStats.allocationCount;
+        tier.freeRegions += (uint32_t)poolStats.unusedRangeCount;
+        tier.blockBytes += poolStats.size;
+        tier.usedBytes += poolStats.size - poolStats.unusedSize;
+        tier.freeBytes += poolStats.unusedSize;
+        tier.largestFreeRegion = max(tier.largestFreeRegion, poolStats.unusedRangeSizeMax);
+      }
+
+      stats.heaps.resize(memoryProperties.memoryHeapCount);
+      for(uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++)
+      {
+        auto &heap = stats.heaps[i];
+
+        heap.size = memoryProperties.memoryHeaps[i].size;
+        heap.flags = memoryProperties.memoryHeaps[i].flags;
+        heap.usage = toUsage(vmaStats.memoryHeap[i]);
+        heap.budget = heap.size;
+        heap.budgetUsage = heap.usage.blockBytes;
+      }
+      for(auto &memoryType : stats.memoryTypes)
+      {
+        for(int b = 0; b < VulkanMemoryStats::HistogramBuckets; b++)
+          stats.heaps[memoryType.heapIndex].usage.sizeHistogram[b] += memoryType.usage.sizeHistogram[b];
+      }
+
+      stats.total = toUsage(vmaStats.total);
+      for(auto &heap : stats.heaps)
+      {
+        for(int b = 0; b < VulkanMemoryStats::HistogramBuckets; b++)
+          stats.total.sizeHistogram[b] += heap.usage.sizeHistogram[b];
+      }
+
+      return stats;
+    }
+
     VulkanMemoryManager::~VulkanMemoryManager()
     {
       for(int i = 0; i < MaxPools; i++) if(pools[i])
@@ -206,7 +471,13 @@ namespace vgl
 #else
     VulkanMemoryManager::AllocationStrategy VulkanMemoryManager::allocationStrategy = VulkanMemoryManager::AS_DESKTOP;
     VulkanMemoryManager::FreeMode VulkanMemoryManager::freeMode = VulkanMemoryManager::FM_MANUAL;
+    VulkanMemoryManager::FreeRegionStrategy VulkanMemoryManager::freeRegionStrategy = VulkanMemoryManager::FRS_TLSF;
+    bool VulkanMemoryManager::slabsEnabled = true;
     VkDeviceSize VulkanMemoryManager::allocSizeBoundaries[2][3];
+    const float VulkanMemoryManager::budgetPromoteMargin = 0.1f;
+    const float VulkanMemoryManager::budgetFallbackFraction = 0.8f;
+    const VkDeviceSize VulkanMemoryManager::transientChunkSize;
+    const uint32_t VulkanMemoryManager::TlsfIndex::NullRegion;
 
     static const uint32_t NO_MEMORY_TYPE = VK_MAX_MEMORY_TYPES;
 
@@ -215,11 +486,46 @@ namespace vgl
 
     static inline uint64_t fastCeil(uint64_t x, uint64_t y) { return (1 + ((x - 1) / y)); }
 
+    static inline VkDeviceSize align(VkDeviceSize size, VkDeviceSize alignment)
+    {
+      VkDeviceSize m = size % alignment;
+      return m ? (size + (alignment - m)) : size;
+    }
+
+    static inline int bitScanForward(uint32_t x)
+    {
+#ifdef _MSC_VER
+      unsigned long index;
+      _BitScanForward(&index, x);
+      return (int)index;
+#else
+      return __builtin_ctz(x);
+#endif
+    }
+
+    static inline int bitScanReverse(uint32_t x)
+    {
+#ifdef _MSC_VER
+      unsigned long index;
+      _BitScanReverse(&index, x);
+      return (int)index;
+#else
+      return 31 - __builtin_clz(x);
+#endif
+    }
+
+    static inline int bitScanForward64(uint64_t x)
+    {
+      uint32_t low = (uint32_t)x;
+      return low ? bitScanForward(low) : 32 + bitScanForward((uint32_t)(x >> 32));
+    }
+
     VulkanMemoryManager::VulkanMemoryManager(VkPhysicalDevice physicalDevice, VkDevice device)
-      : physicalDevice(physicalDevice), device(device)
+      : threadCachingEnabled(true), physicalDevice(physicalDevice), device(device)
     {
       //I'd rather use up the memory now, than deal with yet another group of structs going on the heap
       allocationsPool = new Allocation[maxAllocations];
+      handleChunks[0] = new HandleSlot[handleChunkSize];
 
       switch(allocationStrategy)
       {
@@ -245,53 +551,351 @@ namespace vgl
       }
 
       vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+      //slab slots are aligned to their own size, so the smallest one has to satisfy every buffer offset & flush alignment
+      VkPhysicalDeviceProperties properties;
+      vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+      bufferOffsetAlignment = max({ (VkDeviceSize)1, properties.limits.minUniformBufferOffsetAlignment, 
+        properties.limits.minStorageBufferOffsetAlignment, properties.limits.nonCoherentAtomSize });
+      nonCoherentAtomSize = max((VkDeviceSize)1, properties.limits.nonCoherentAtomSize);
+      slabBaseSlotSize = max((VkDeviceSize)slabMinSlotSize, bufferOffsetAlignment);
+
+      for(uint32_t i = 0; i < VK_MAX_MEMORY_HEAPS; i++)
+      {
+        heapBlockBytes[i] = 0;
+        heapUsedBytes[i] = 0;
+        heapRetiringBytes[i] = 0;
+        queriedHeapUsage[i] = queriedHeapBudget[i] = queriedHeapBlockBytes[i] = 0;
+      }
+
+      //residency balancing demotes out of device local heaps into whatever other types a resource allows
+      for(uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
+      {
+        if(memoryProperties.memoryHeaps[memoryProperties.memoryTypes[i].heapIndex].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+          deviceLocalTypes |= (1u << i);
+        else
+          hostTypes |= (1u << i);
+      }
     }
 
     VulkanMemoryManager::~VulkanMemoryManager()
     {
+      endTrace();
+
+      {
+        //threads may outlive us, so their caches must no longer point back here
+        lock_guard<mutex> locker(threadCachesLock);
+        for(auto &cache : threadCaches)
+        {
+          lock_guard<mutex> cacheLocker(cache->lock);
+          cache->owner = nullptr;
+          cache->entries.clear();
+        }
+      }
+
       for(uint32_t i = 0; i < VK_MAX_MEMORY_TYPES; i++)
       {
         for(auto &allocation : allocations[i]) if(allocation->memory)
           vkFreeMemory(device, allocation->memory, nullptr);
       }
       delete []allocationsPool;
+      for(auto chunk : handleChunks)
+        delete []chunk;
+    }
+
+    static inline VulkanMemoryManager::Suballocation makeHandle(uint32_t slot, uint32_t generation)
+    {
+      VulkanMemoryManager::Suballocation handle;
+      handle.slot = slot;
+      handle.generation = generation;
+      return handle;
+    }
+
+    VulkanMemoryManager::SuballocationRecord *VulkanMemoryManager::recordFor(const Suballocation &suballocation)
+    {
+      if(!suballocation || suballocation.slot >= handleSlotCount)
+        return nullptr;
+
+      auto &slot = handleSlot(suballocation.slot);
+      return (slot.generation == suballocation.generation) ? &slot.record : nullptr;
+    }
+
+    //caller holds the type lock of record.memoryType
+    VulkanMemoryManager::Suballocation VulkanMemoryManager::newHandleLocked(const SuballocationRecord &record)
+    {
+      if(!record)
+        return nullptr;
+
+      auto &freeSlots = freeHandleSlots[record.memoryType];
+      uint32_t slot;
+
+      if(!freeSlots.empty())
+      {
+        slot = freeSlots.back();
+        freeSlots.pop_back();
+      }
+      else
+      {
+        lock_guard<mutex> locker(managerLock);
+
+        slot = handleSlotCount;
+        if(!handleChunks[slot / handleChunkSize])
+        {
+          if(slot / handleChunkSize >= maxHandleChunks)
+            throw vgl_runtime_error("Over the suballocation handle limit in VulkanMemoryManager");
+          handleChunks[slot / handleChunkSize] = new HandleSlot[handleChunkSize];
+        }
+        handleSlotCount = slot+1;
+      }
+
+      auto &handle = handleSlot(slot);
+      handle.record = record;
+      return makeHandle(slot, handle.generation);
+    }
+
+    //caller holds the type lock of the handle's memory type
+    void VulkanMemoryManager::releaseHandleLocked(const Suballocation &suballocation)
+    {
+      auto &slot = handleSlot(suballocation.slot);
+
+      slot.generation = suballocation.generation+1;
+      freeHandleSlots[slot.record.memoryType].push_back(suballocation.slot);
+    }
+
+    void VulkanMemoryManager::setFreeRegionStrategy(FreeRegionStrategy strategy)
+    {
+      freeRegionStrategy = strategy;
+    }
+
+    void VulkanMemoryManager::setAllocationStrategy(AllocationStrategy strategy)
+    {
+      allocationStrategy = strategy;
+    }
+
+    void VulkanMemoryManager::setFreeMode(FreeMode mode)
+    {
+      freeMode = mode;
+    }
+
+    void VulkanMemoryManager::setSlabAllocationEnabled(bool enabled)
+    {
+      slabsEnabled = enabled;
+    }
+
+    void VulkanMemoryManager::setThreadCachingEnabled(bool enabled)
+    {
+      threadCachingEnabled = enabled;
+      if(!enabled)
+        drainThreadCaches();
+    }
+
+    VulkanMemoryManager::ThreadCache *VulkanMemoryManager::currentThreadCache()
+    {
+      static thread_local unordered_map<VulkanMemoryManager *, shared_ptr<ThreadCache>> caches;
+      auto &cache = caches[this];
+
+      //a different manager may have since been created at this same address
+      if(!cache || cache->owner != this)
+      {
+        cache = make_shared<ThreadCache>();
+        cache->owner = this;
+
+        lock_guard<mutex> locker(threadCachesLock);
+        threadCaches.push_back(cache);
+      }
+
+      return cache.get();
+    }
+
+    static inline uint64_t threadCacheKey(uint32_t memoryType, uint32_t sizeInPages, bool imageOptimal, uint8_t lifetime)
+    {
+      return (uint64_t)memoryType | ((uint64_t)sizeInPages << 8) | ((uint64_t)imageOptimal << 40) | ((uint64_t)lifetime << 41);
+    }
+
+    bool VulkanMemoryManager::threadCacheAllocate(uint32_t memoryType, VkDeviceSize requiredSize, VkDeviceSize requiredAlignment, bool imageOptimal, Lifetime lifetime, 
+      Suballocation &result)
+    {
+      uint32_t sizeInPages = (uint32_t)fastCeil(requiredSize, pageSize);
+
+      if(!threadCachingEnabled || freeMode == FM_SYNCHRONOUS || sizeInPages > threadCacheMaxPages)
+        return false;
+
+      ThreadCache *cache = currentThreadCache();
+      lock_guard<mutex> locker(cache->lock);
+
+      auto it = cache->entries.find(threadCacheKey(memoryType, sizeInPages, imageOptimal, lifetime));
+      if(it == cache->entries.end() || it->second.empty())
+        return false;
+
+      auto &bucket = it->second;
+      if(requiredAlignment > 0 && handleSlot(bucket.back().slot).record.offset % requiredAlignment)
+        return false;
+
+      result = bucket.back();
+      bucket.pop_back();
+
+      return true;
+    }
+
+    bool VulkanMemoryManager::threadCacheFree(const Suballocation &suballocation, const SuballocationRecord &record)
+    {
+      //only plain small-tier suballocations are worth holding onto, dedicated ones must be able to free their memory
+      //(and while defragment() is evacuating allocations, anything freed must go straight back so they can empty).
+      //list strategy suballocations can start pages into their region for alignment, so their page count doesn't say what they can hold
+      if(!threadCachingEnabled || freeMode == FM_SYNCHRONOUS || freeRegionStrategy != FRS_TLSF || record.allocationType != AT_SMALL || 
+        record.size > threadCacheMaxPages || defragSources > 0)
+      {
+        return false;
+      }
+
+      //a cached suballocation must no longer be relocatable or count as retiring, since it can be handed to another owner before it's drained.
+      //that bookkeeping needs the type lock, which is only taken for allocations that hold any such suballocations
+      auto allocation = allocationForId(record.allocationId);
+      if(!allocation)
+        return false;
+      if(allocation->trackedSuballocations > 0)
+      {
+        lock_guard<mutex> typeLocker(typeLocks[record.memoryType]);
+        eraseRelocatableLocked(*allocation, record.subregionId);
+        retireLocked(record, false);
+      }
+
+      ThreadCache *cache = currentThreadCache();
+      lock_guard<mutex> locker(cache->lock);
+
+      auto &bucket = cache->entries[threadCacheKey(record.memoryType, record.size, record.imageOptimal, record.lifetime)];
+      if(bucket.size() >= threadCacheMaxEntries)
+        return false;
+
+      //the slot stays with the cache, bumping its generation is enough to make the freed handle stale
+      uint32_t generation = suballocation.generation+1;
+      handleSlot(suballocation.slot).generation = generation;
+      bucket.push_back(makeHandle(suballocation.slot, generation));
+
+      return true;
+    }
+
+    void VulkanMemoryManager::drainThreadCaches()
+    {
+      vector<Suballocation> drained;
+
+      {
+        lock_guard<mutex> locker(threadCachesLock);
+        for(auto &cache : threadCaches)
+        {
+          lock_guard<mutex> cacheLocker(cache->lock);
+          for(auto &bucket : cache->entries)
+          {
+            drained.insert(drained.end(), bucket.second.begin(), bucket.second.end());
+            bucket.second.clear();
+          }
+        }
+
+        //caches only referenced from here belong to threads that have exited
+        threadCaches.erase(remove_if(threadCaches.begin(), threadCaches.end(), [](const shared_ptr<ThreadCache> &c) { return c.use_count() == 1; }), threadCaches.end());
+      }
+
+      //these frees were already traced when they went into the caches
+      freeGrouped(drained.data(), drained.size());
     }
 
-    VulkanMemoryManager::Suballocation VulkanMemoryManager::allocateBuffer(VkMemoryPropertyFlags properties, VkBuffer buffer, uint64_t allocationId)
+    VulkanMemoryManager::Suballocation VulkanMemoryManager::allocateBuffer(VkMemoryPropertyFlags properties, VkBuffer buffer, uint64_t allocationId, Lifetime lifetime)
     {
       VkMemoryRequirements memRequirements;
       vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
 
-      return allocate(memRequirements.memoryTypeBits, properties, memRequirements.size, memRequirements.alignment, false, allocationId);
+      return allocate(memRequirements.memoryTypeBits, properties, memRequirements.size, memRequirements.alignment, false, allocationId, lifetime);
     }
 
-    VulkanMemoryManager::Suballocation VulkanMemoryManager::allocateImage(VkMemoryPropertyFlags properties, VkImage image, uint64_t allocationId)
+    VulkanMemoryManager::Suballocation VulkanMemoryManager::allocateImage(VkMemoryPropertyFlags properties, VkImage image, uint64_t allocationId, Lifetime lifetime)
     {
       VkMemoryRequirements memRequirements;
       vkGetImageMemoryRequirements(device, image, &memRequirements);
 
-      return allocate(memRequirements.memoryTypeBits, properties, memRequirements.size, memRequirements.alignment, true, allocationId);
+      return allocate(memRequirements.memoryTypeBits, properties, memRequirements.size, memRequirements.alignment, true, allocationId, lifetime);
     }
 
     void VulkanMemoryManager::bindBufferMemory(VkBuffer buffer, VulkanMemoryManager::Suballocation alloc)
     {
-      if(alloc)
-        vkBindBufferMemory(device, buffer, alloc.memory, alloc.offset);
+      if(auto record = recordFor(alloc))
+        vkBindBufferMemory(device, buffer, record->memory, record->offset);
     }
 
     void VulkanMemoryManager::bindImageMemory(VkImage image, VulkanMemoryManager::Suballocation alloc)
     {
-      if(alloc)
-        vkBindImageMemory(device, image, alloc.memory, alloc.offset);
+      if(auto record = recordFor(alloc))
+        vkBindImageMemory(device, image, record->memory, record->offset);
     }
 
-    VulkanMemoryManager::Suballocation VulkanMemoryManager::allocate(uint32_t typeFilter, VkMemoryPropertyFlags properties, VkDeviceSize requiredSize, VkDeviceSize requiredAlignment, bool imageOptimal, uint64_t allocationId)
+    VulkanMemoryManager::Suballocation VulkanMemoryManager::allocate(uint32_t typeFilter, VkMemoryPropertyFlags properties, VkDeviceSize requiredSize, VkDeviceSize requiredAlignment, 
+      bool imageOptimal, uint64_t allocationId, Lifetime lifetime)
     {     
-      lock_guard<mutex> locker(managerLock);
       if(requiredSize == 0)
         return {};
 
+      uint32_t memoryType = findMemoryType(typeFilter, properties);
+      if(memoryType == NO_MEMORY_TYPE)
+        return {};
+
+      Suballocation suballoc = nullptr;
+      if(allocationId != Any || !threadCacheAllocate(memoryType, requiredSize, requiredAlignment, imageOptimal, lifetime, suballoc))
+      {
+        lock_guard<mutex> locker(typeLocks[memoryType]);
+        suballoc = newHandleLocked(allocateLocked(memoryType, requiredSize, requiredAlignment, imageOptimal, allocationId, lifetime));
+      }
+
+      if(tracing)
+        traceAllocation(memoryType, requiredSize, requiredAlignment, imageOptimal, allocationId, lifetime, suballoc);
+
+      return suballoc;
+    }
+
+    void VulkanMemoryManager::allocateMany(VkMemoryPropertyFlags properties, const VkMemoryRequirements *requirements, size_t count, 
+      Suballocation *results, bool imageOptimal, uint64_t allocationId, Lifetime lifetime)
+    {
+      //group the requests by memory type so that each type's lock is only taken once
+      vector<pair<uint32_t, size_t>> order(count);
+      for(size_t i = 0; i < count; i++)
+      {
+        results[i] = nullptr;
+        order[i] = { findMemoryType(requirements[i].memoryTypeBits, properties), i };
+      }
+      sort(order.begin(), order.end());
+
+      for(size_t i = 0; i < count && order[i].first != NO_MEMORY_TYPE;)
+      {
+        const uint32_t memoryType = order[i].first;
+        lock_guard<mutex> locker(typeLocks[memoryType]);
+
+        for(; i < count && order[i].first == memoryType; i++)
+        {
+          auto &req = requirements[order[i].second];
+          if(req.size)
+            results[order[i].second] = newHandleLocked(allocateLocked(memoryType, req.size, req.alignment, imageOptimal, allocationId, lifetime));
+        }
+      }
+
+      if(tracing)
+      {
+        for(auto &entry : order) if(entry.first != NO_MEMORY_TYPE && requirements[entry.second].size)
+        {
+          auto &req = requirements[entry.second];
+          traceAllocation(entry.first, req.size, req.alignment, imageOptimal, allocationId, lifetime, results[entry.second]);
+        }
+      }
+    }
+
+    VulkanMemoryManager::SuballocationRecord VulkanMemoryManager::allocateLocked(uint32_t memoryType, VkDeviceSize requiredSize, VkDeviceSize requiredAlignment, bool imageOptimal, 
+      uint64_t allocationId, Lifetime lifetime)
+    {
       AllocationType allocType = AT_DEDICATED;
+
+      //tiny buffers share page runs instead of each rounding up to a whole page
+      if(slabsEnabled && allocationId == 0 && !imageOptimal && requiredSize <= slabMaxSlotSize && requiredAlignment <= slabMaxSlotSize)
+      {
+        if(auto suballoc = slabAllocateLocked(memoryType, requiredSize, requiredAlignment, lifetime))
+          return suballoc;
+      }
         
       if(allocationId == 0)
       {
@@ -299,13 +903,8 @@ namespace vgl
 
         if(requiredSize > allocSizeBoundaries[0][2])
         {
-          uint32_t memoryType = findMemoryType(typeFilter, properties);
-
           allocType = AT_DEDICATED;
-          if(memoryType != NO_MEMORY_TYPE)
-            allocationId = allocateDedicated(memoryType, (VkDeviceSize)requiredSize, true, imageOptimal).second;
-          else
-            return {};
+          allocationId = allocateDedicated(memoryType, (VkDeviceSize)requiredSize, true, imageOptimal, lifetime).second;
         }
         else if(requiredSize > allocSizeBoundaries[0][1])
         {
@@ -320,15 +919,12 @@ namespace vgl
         //vout << "Current allocation total: " << (allocatedBytes >> 20) << " mb" << endl;
       }
 
-      uint32_t memoryType = findMemoryType(typeFilter, properties);
-      if(memoryType == NO_MEMORY_TYPE)
-        return {};
-      Suballocation suballoc = findSuballocation(memoryType, requiredSize, requiredAlignment, allocType, imageOptimal, allocationId);
+      SuballocationRecord suballoc = findSuballocation(memoryType, requiredSize, requiredAlignment, allocType, imageOptimal, allocationId, lifetime);
 
       if(!suballoc && allocationId == 0)
       {
         //have to create a new allocation
-        if(!makeNewAllocation(memoryType, allocType, imageOptimal))
+        if(!makeNewAllocation(memoryType, allocType, imageOptimal, lifetime))
         {
           const uint64_t memoryTypeBit = (1ull<<memoryType);
 
@@ -336,14 +932,14 @@ namespace vgl
           if(allocType == AT_LARGE && requiredSize < allocSizeBoundaries[1][(int)AT_MED])
           {
             allocType = AT_MED;
-            suballoc = findSuballocation(memoryType, requiredSize, requiredAlignment, allocType, imageOptimal, allocationId);
+            suballoc = findSuballocation(memoryType, requiredSize, requiredAlignment, allocType, imageOptimal, allocationId, lifetime);
 
             if(suballoc)
             {
               return suballoc;
             }
 
-            if(!makeNewAllocation(memoryType, allocType, imageOptimal))
+            if(!makeNewAllocation(memoryType, allocType, imageOptimal, lifetime))
             {
               if((lowMemoryFlags & memoryTypeBit) == 0)
               {
@@ -369,7 +965,7 @@ namespace vgl
             }
           }
         }
-        suballoc = findSuballocation(memoryType, requiredSize, requiredAlignment, allocType, imageOptimal, allocationId);
+        suballoc = findSuballocation(memoryType, requiredSize, requiredAlignment, allocType, imageOptimal, allocationId, lifetime);
 
 #ifdef DEBUG
         //this shouldn't be possible
@@ -386,37 +982,117 @@ namespace vgl
 
     void VulkanMemoryManager::free(const Suballocation &suballocation)
     {
-      lock_guard<mutex> locker(managerLock);
-      auto &allocMap = allocationsMap[suballocation.memoryType];
-      auto ai = allocMap.find(suballocation.allocationId);
+      //transient handles go stale as soon as their frame completes, so stale handles are ignored rather than treated as errors
+      auto record = recordFor(suballocation);
+      if(!record || record->allocationType == AT_TRANSIENT)
+        return;
+      if(record->allocationType == AT_ALIASED)
+      {
+        freeAliased(suballocation, *record);
+        return;
+      }
+      if(tracing)
+        traceRecord({ 0, 0, record->allocationId, record->subregionId, record->tlsfRegion, 0, TO_FREE, (uint8_t)record->memoryType, 0, 0, 0 });
+      if(threadCacheFree(suballocation, *record))
+        return;
+
+      lock_guard<mutex> locker(typeLocks[record->memoryType]);
+      freeLocked(*record);
+      releaseHandleLocked(suballocation);
+    }
+
+    void VulkanMemoryManager::freeMany(const Suballocation *suballocations, size_t count)
+    {
+      for(size_t i = 0; i < count; i++)
+      {
+        auto record = recordFor(suballocations[i]);
+
+        if(!record || record->allocationType == AT_TRANSIENT)
+          continue;
+        if(record->allocationType == AT_ALIASED)
+          freeAliased(suballocations[i], *record);
+        else if(tracing)
+          traceRecord({ 0, 0, record->allocationId, record->subregionId, record->tlsfRegion, 0, TO_FREE, (uint8_t)record->memoryType, 0, 0, 0 });
+      }
+
+      freeGrouped(suballocations, count);
+    }
+
+    void VulkanMemoryManager::freeGrouped(const Suballocation *suballocations, size_t count)
+    {
+      vector<pair<uint32_t, size_t>> order;
+      order.reserve(count);
+      for(size_t i = 0; i < count; i++)
+      {
+        auto record = recordFor(suballocations[i]);
+        if(record && record->allocationType != AT_ALIASED && record->allocationType != AT_TRANSIENT)
+          order.push_back({ record->memoryType, i });
+      }
+      sort(order.begin(), order.end());
+
+      for(size_t i = 0; i < order.size();)
+      {
+        const uint32_t memoryType = order[i].first;
+        lock_guard<mutex> locker(typeLocks[memoryType]);
+
+        for(; i < order.size() && order[i].first == memoryType; i++)
+        {
+          auto &suballocation = suballocations[order[i].second];
+          freeLocked(handleSlot(suballocation.slot).record);
+          releaseHandleLocked(suballocation);
+        }
+      }
+    }
+
+    void VulkanMemoryManager::freeLocked(const SuballocationRecord &suballocation)
+    {
+      if(suballocation.allocationType == AT_SLAB)
+      {
+        slabFreeLocked(suballocation);
+        return;
+      }
+      else if(suballocation.allocationType == AT_TRANSIENT)
+      {
+        //reset along with the rest of its frame
+        return;
+      }
+
+      auto allocationPtr = allocationForId(suballocation.allocationId);
       bool freed = false;
-      auto srIt = suballocation.subregionIt;
 
-      if(ai != allocMap.end())
+      if(allocationPtr)
       {
-        auto &allocation = *allocations[suballocation.memoryType][ai->second];
+        auto &allocation = *allocationPtr;
 
-        if(allocation.suballocationCount > 0)
-        {        
-          if(suballocation.subregionId < invalidatedSubregionIds)
+        eraseRelocatableLocked(allocation, suballocation.subregionId);
+        retireLocked(suballocation, false);
+
+        if(allocation.suballocationCount > 0 && !allocation.tlsf.empty())
+        {
+          if(allocation.tlsf.region(suballocation.tlsfRegion).id == suballocation.subregionId)
           {
-            //we can't use the iterator in this case (yayyy)
-            for(auto it = allocation.regions.begin(); it != allocation.regions.end(); it++)
+            freed = true;
+            allocation.suballocationCount--;
+            allocation.tlsf.free(suballocation.tlsfRegion);
+
+            if(allocation.suballocationCount == 0 && (allocation.type == AT_DEDICATED || freeMode == FM_SYNCHRONOUS || allocation.defragSource))
             {
-              if(it->id == suballocation.subregionId)
-              {
-                srIt = it;
-                break;
-              }
+              releaseAllocationMemory(allocation);
+              endDefragSource(allocation);
             }
           }
+        }
+        else if(allocation.suballocationCount > 0)
+        {        
+          auto ri = allocation.regionsById.find(suballocation.subregionId);
+          auto srIt = (ri != allocation.regionsById.end()) ? ri->second : allocation.regions.end();
 
           //auto srPrev = (srIt != allocation.regions.begin()) ? prev(srIt) : allocation.regions.end();
           //auto srNext = next(srIt);
-          auto sr = &(*srIt);
 
-          if(sr->id == suballocation.subregionId)
+          if(srIt != allocation.regions.end() && !srIt->free)
           {
+            auto sr = &(*srIt);
             bool anyMerged = false;
 
             freed = true;
@@ -442,51 +1118,981 @@ namespace vgl
               anyMerged = true;
             }*/
 
-            if(!anyMerged)
-              allocation.freeRegions.insert({ sr, srIt });
-            
-            if(allocation.suballocationCount == 0)
+            if(!anyMerged)
+              allocation.freeRegions.insert({ sr, srIt });
+            
+            if(allocation.suballocationCount == 0)
+            {
+              //dedicated allocations are a special case and will be freed immediately on last free suballoc
+              //(as are allocations that defragment() has emptied out)
+              if(allocation.type == AT_DEDICATED || freeMode == FM_SYNCHRONOUS || allocation.defragSource)
+              {
+                //this entire allocation is freed now
+                releaseAllocationMemory(allocation);
+                endDefragSource(allocation);
+              }
+            }
+          }
+        }          
+      }
+
+      if(freed)
+        heapUsedBytes[memoryProperties.memoryTypes[suballocation.memoryType].heapIndex] -= (VkDeviceSize)suballocation.size*pageSize;
+
+#ifdef DEBUG
+      if(!freed)
+      {
+        throw vgl_runtime_error("VulkanMemoryManager::free() failed!");
+      }
+#endif
+    }
+
+    VulkanMemoryManager::SuballocationRecord VulkanMemoryManager::slabAllocateLocked(uint32_t memoryType, VkDeviceSize requiredSize, VkDeviceSize requiredAlignment, Lifetime lifetime)
+    {
+      VkDeviceSize slotSize = slabBaseSlotSize;
+      int slabClass = bitScanForward((uint32_t)(slabBaseSlotSize/slabMinSlotSize));
+
+      while(slotSize < requiredSize || slotSize < requiredAlignment)
+      {
+        slotSize <<= 1;
+        slabClass++;
+      }
+      if(slotSize > slabMaxSlotSize)
+        return {};
+
+      auto &partial = partialSlabs[memoryType][lifetime][slabClass];
+      if(partial.empty())
+      {
+        //runs are ordinary (non image optimal) suballocations, so slots never end up within bufferImageGranularity of an optimal image
+        SuballocationRecord run = allocateLocked(memoryType, slotSize*slabSlotCount, pageSize, false, Any, lifetime);
+        if(!run)
+          return {};
+
+        //each slot's subregion id is its slab's id plus its slot index, so slots are told apart by id alone and still lead back to their slab
+        uint64_t slabId = subregionIds.fetch_add(slabSlotCount);
+        slabs[memoryType][slabId] = { run, ~0ull, (uint32_t)slotSize, lifetime };
+        partial.push_back(slabId);
+        slabRunBytes += slotSize*slabSlotCount;
+      }
+
+      uint64_t slabId = partial.back();
+      auto &slab = slabs[memoryType][slabId];
+      int slot = bitScanForward64(slab.freeSlots);
+
+      slab.freeSlots &= ~(1ull << slot);
+      if(!slab.freeSlots)
+        partial.pop_back();
+
+      SuballocationRecord result = slab.run;
+      result.offset = slab.run.offset + slot*slotSize;
+      result.size = (uint32_t)slotSize;
+      result.subregionId = slabId + slot;
+      result.tlsfRegion = (uint32_t)slot;
+      result.allocationType = AT_SLAB;
+      slabLiveSlots++;
+      slabSlotBytes += slotSize;
+
+      return result;
+    }
+
+    void VulkanMemoryManager::slabFreeLocked(const SuballocationRecord &suballocation)
+    {
+      auto &typeSlabs = slabs[suballocation.memoryType];
+      auto it = (suballocation.tlsfRegion < slabSlotCount) ? typeSlabs.find(suballocation.subregionId - suballocation.tlsfRegion) : typeSlabs.end();
+      const uint64_t slotBit = (1ull << (suballocation.tlsfRegion % slabSlotCount));
+
+      if(it == typeSlabs.end() || (it->second.freeSlots & slotBit))
+      {
+#ifdef DEBUG
+        throw vgl_runtime_error("VulkanMemoryManager::free() failed!");
+#endif
+        return;
+      }
+
+      auto &slab = it->second;
+      auto &partial = partialSlabs[suballocation.memoryType][slab.lifetime][bitScanForward(slab.slotSize/slabMinSlotSize)];
+
+      if(!slab.freeSlots)
+        partial.push_back(it->first);
+      slab.freeSlots |= slotBit;
+      slabLiveSlots--;
+      slabSlotBytes -= slab.slotSize;
+
+      //keep one empty slab around per size class so alternating allocate/free doesn't thrash page runs
+      if(slab.freeSlots == ~0ull && partial.size() > 1)
+        releaseSlabLocked(suballocation.memoryType, it->first);
+    }
+
+    void VulkanMemoryManager::releaseSlabLocked(uint32_t memoryType, uint64_t slabId)
+    {
+      auto it = slabs[memoryType].find(slabId);
+      auto &partial = partialSlabs[memoryType][it->second.lifetime][bitScanForward(it->second.slotSize/slabMinSlotSize)];
+
+      partial.erase(find(partial.begin(), partial.end(), slabId));
+      slabRunBytes -= (VkDeviceSize)it->second.slotSize*slabSlotCount;
+      freeLocked(it->second.run);
+      slabs[memoryType].erase(it);
+    }
+
+    VulkanMemoryManager::Suballocation VulkanMemoryManager::allocateTransient(uint32_t typeFilter, VkMemoryPropertyFlags properties, VkDeviceSize requiredSize, 
+      VkDeviceSize requiredAlignment, uint64_t frameId)
+    {
+      if(requiredSize == 0)
+        return {};
+
+      uint32_t memoryType = findMemoryType(typeFilter, properties);
+      if(memoryType == NO_MEMORY_TYPE)
+        return {};
+
+      VkDeviceSize alignment = max(requiredAlignment, bufferOffsetAlignment);
+      lock_guard<mutex> locker(typeLocks[memoryType]);
+
+      auto &frame = transientFrames[memoryType][frameId];
+      auto &chunks = frame.chunks;
+      if(chunks.empty() || align(chunks.back().block.offset+chunks.back().head, alignment)+requiredSize > chunks.back().block.offset+chunks.back().size)
+      {
+        TransientChunk chunk = {};
+        auto &freeChunks = transientFreeChunks[memoryType];
+
+        if(requiredSize+alignment <= transientChunkSize && !freeChunks.empty())
+        {
+          chunk = freeChunks.back();
+          freeChunks.pop_back();
+        }
+        else
+        {
+          //oversized requests get a chunk of their own
+          chunk.size = max(requiredSize+alignment, transientChunkSize);
+          chunk.block = allocateLocked(memoryType, chunk.size, pageSize, false, Any, LT_TRANSIENT);
+          if(!chunk.block)
+            return {};
+        }
+
+        chunk.head = 0;
+        chunks.push_back(chunk);
+      }
+
+      auto &chunk = chunks.back();
+      VkDeviceSize offset = align(chunk.block.offset+chunk.head, alignment);
+      chunk.head = offset+requiredSize-chunk.block.offset;
+
+      SuballocationRecord record = chunk.block;
+      record.offset = offset;
+      record.size = (uint32_t)requiredSize;
+      record.allocationType = AT_TRANSIENT;
+
+      Suballocation result = newHandleLocked(record);
+      frame.handles.push_back(result);
+
+      return result;
+    }
+
+    VulkanMemoryManager::Suballocation VulkanMemoryManager::allocateTransientBuffer(VkMemoryPropertyFlags properties, VkBuffer buffer, uint64_t frameId)
+    {
+      VkMemoryRequirements memRequirements;
+      vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+
+      return allocateTransient(memRequirements.memoryTypeBits, properties, memRequirements.size, memRequirements.alignment, frameId);
+    }
+
+    void VulkanMemoryManager::completeFrame(uint64_t completedFrameId)
+    {
+      if(tracing)
+        traceRecord({ 0, completedFrameId, 0, 0, 0, 0, TO_FRAME, 0, 0, 0, 0 });
+
+      for(uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
+      {
+        lock_guard<mutex> locker(typeLocks[i]);
+
+        auto &frames = transientFrames[i];
+        auto end = frames.lower_bound(completedFrameId);
+
+        for(auto it = frames.begin(); it != end; it++)
+        {
+          for(auto &handle : it->second.handles)
+            releaseHandleLocked(handle);
+          for(auto &chunk : it->second.chunks)
+          {
+            if(chunk.size == transientChunkSize && transientFreeChunks[i].size() < transientMaxFreeChunks)
+              transientFreeChunks[i].push_back(chunk);
+            else
+              freeLocked(chunk.block);
+          }
+        }
+        frames.erase(frames.begin(), end);
+      }
+    }
+
+    uint64_t VulkanMemoryManager::newAliasId()
+    {
+      return aliasIds++;
+    }
+
+    VulkanMemoryManager::Suballocation VulkanMemoryManager::allocateAliasedImage(VkMemoryPropertyFlags properties, VkImage image, uint64_t aliasId)
+    {
+      VkMemoryRequirements memRequirements;
+      vkGetImageMemoryRequirements(device, image, &memRequirements);
+
+      lock_guard<mutex> locker(aliasLock);
+
+      //each member gets its own handle, so freeing one never invalidates another's
+      auto newMember = [this](const SuballocationRecord &shared) {
+        SuballocationRecord member = shared;
+        member.allocationType = AT_ALIASED;
+
+        lock_guard<mutex> typeLocker(typeLocks[member.memoryType]);
+        return newHandleLocked(member);
+      };
+
+      auto group = aliasGroups.find(aliasId);
+      if(group != aliasGroups.end())
+      {
+        auto &range = aliasedRanges[group->second];
+        const auto &shared = *recordFor(range.shared);
+        auto typeFlags = memoryProperties.memoryTypes[shared.memoryType].propertyFlags;
+
+        if((memRequirements.memoryTypeBits & (1u << shared.memoryType)) && (typeFlags & properties) == properties &&
+          memRequirements.size <= range.size && shared.offset % memRequirements.alignment == 0)
+        {
+          range.refCount++;
+          return newMember(shared);
+        }
+      }
+
+      Suballocation shared = allocate(memRequirements.memoryTypeBits, properties, memRequirements.size, memRequirements.alignment, true);
+      if(!shared)
+        return nullptr;
+
+      const auto &sharedRecord = *recordFor(shared);
+      aliasedRanges[sharedRecord.subregionId] = { shared, memRequirements.size, 1 };
+      aliasGroups[aliasId] = sharedRecord.subregionId;
+
+      return newMember(sharedRecord);
+    }
+
+    void VulkanMemoryManager::freeAliased(const Suballocation &suballocation, const SuballocationRecord &record)
+    {
+      Suballocation shared = nullptr;
+      const uint64_t subregionId = record.subregionId; //record belongs to the handle's slot, which is recycled below
+
+      {
+        lock_guard<mutex> locker(aliasLock);
+
+        auto it = aliasedRanges.find(subregionId);
+        auto sharedRecord = (it != aliasedRanges.end()) ? recordFor(it->second.shared) : nullptr;
+        if(!sharedRecord || sharedRecord->allocationId != record.allocationId)
+          throw vgl_runtime_error("Attempted to free an aliased suballocation that isn't live in VulkanMemoryManager::free()");
+
+        {
+          lock_guard<mutex> typeLocker(typeLocks[record.memoryType]);
+          releaseHandleLocked(suballocation);
+        }
+
+        if(--it->second.refCount == 0)
+        {
+          shared = it->second.shared;
+          aliasedRanges.erase(it);
+
+          for(auto group = aliasGroups.begin(); group != aliasGroups.end(); group++) if(group->second == subregionId)
+          {
+            aliasGroups.erase(group);
+            break;
+          }
+        }
+      }
+
+      if(shared)
+        free(shared);
+    }
+
+    VulkanMemoryManager::SlabStats VulkanMemoryManager::getSlabStats()
+    {
+      SlabStats stats;
+
+      stats.liveSlots = slabLiveSlots;
+      stats.slotBytes = slabSlotBytes;
+      stats.runBytes = slabRunBytes;
+      stats.pageGranularBytes = (VkDeviceSize)stats.liveSlots*pageSize; //every slot request would have rounded up to one page
+
+      return stats;
+    }
+
+    VulkanMemoryStats VulkanMemoryManager::getStats()
+    {
+      VulkanMemoryStats stats;
+
+      stats.memoryTypes.resize(memoryProperties.memoryTypeCount);
+      for(uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
+      {
+        auto &memoryType = stats.memoryTypes[i];
+        lock_guard<mutex> locker(typeLocks[i]);
+
+        memoryType.heapIndex = memoryProperties.memoryTypes[i].heapIndex;
+        memoryType.propertyFlags = memoryProperties.memoryTypes[i].propertyFlags;
+        for(auto &allocation : allocations[i]) if(allocation->memory)
+        {
+          auto tier = (allocation->type <= AT_DEDICATED) ? (VulkanMemoryStats::Tier)allocation->type : VulkanMemoryStats::TIER_DEDICATED;
+          VulkanMemoryStats::Usage usage;
+          
+          auto addRegion = [&usage](uint32_t sizeInPages, bool free) {
+            if(free)
+              usage.addFreeRegion((VkDeviceSize)sizeInPages*pageSize);
+            else
+              usage.addSuballocation((VkDeviceSize)sizeInPages*pageSize);
+          };
+
+          usage.blocks = 1;
+          usage.blockBytes = (VkDeviceSize)allocation->size*pageSize;
+          for(auto &region : allocation->regions)
+            addRegion(region.size, region.free);
+          allocation->tlsf.enumerate([&addRegion](const TlsfIndex::Region &region) {
+            addRegion(region.size, region.free);
+          });
+
+          memoryType.tiers[tier].add(usage);
+          memoryType.pools[allocation->lifetime].add(usage);
+          memoryType.usage.add(usage);
+        }
+      }
+
+      {
+        //imported host memory counts as fully used dedicated blocks
+        lock_guard<mutex> locker(managerLock);
+        for(auto &imported : importedMemory)
+        {
+          VulkanMemoryStats::Usage usage;
+          usage.blocks = 1;
+          usage.blockBytes = imported.second.size;
+          usage.addSuballocation(imported.second.size);
+
+          auto &memoryType = stats.memoryTypes[imported.second.memoryType];
+          memoryType.tiers[VulkanMemoryStats::TIER_DEDICATED].add(usage);
+          memoryType.usage.add(usage);
+        }
+      }
+
+      stats.heaps.resize(memoryProperties.memoryHeapCount);
+      for(uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++)
+      {
+        auto &heap = stats.heaps[i];
+        auto budget = getHeapBudget(i);
+
+        heap.size = memoryProperties.memoryHeaps[i].size;
+        heap.flags = memoryProperties.memoryHeaps[i].flags;
+        heap.budget = budget.budget;
+        heap.budgetUsage = budget.usage;
+      }
+      for(auto &memoryType : stats.memoryTypes)
+        stats.heaps[memoryType.heapIndex].usage.add(memoryType.usage);
+      for(auto &heap : stats.heaps)
+        stats.total.add(heap.usage);
+
+      return stats;
+    }
+
+    bool VulkanMemoryManager::beginTrace(const string &path)
+    {
+      endTrace();
+
+      lock_guard<mutex> locker(traceLock);
+      traceFile.open(path, ios::binary | ios::trunc);
+      if(!traceFile)
+        return false;
+
+      VkPhysicalDeviceProperties properties;
+      vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+      TraceHeader header = { { 'V', 'G', 'L', 'T' }, TraceVersion, memoryProperties, properties.limits.minUniformBufferOffsetAlignment, 
+        properties.limits.minStorageBufferOffsetAlignment, properties.limits.nonCoherentAtomSize, properties.limits.bufferImageGranularity };
+      traceFile.write((const char *)&header, sizeof(header));
+
+      traceBuffer.reserve(traceBufferRecords);
+      traceStart = chrono::steady_clock::now();
+      tracing = true;
+
+      return true;
+    }
+
+    void VulkanMemoryManager::endTrace()
+    {
+      lock_guard<mutex> locker(traceLock);
+
+      if(tracing)
+      {
+        tracing = false;
+        flushTraceLocked();
+        traceFile.close();
+      }
+    }
+
+    void VulkanMemoryManager::traceRecord(TraceRecord record)
+    {
+      lock_guard<mutex> locker(traceLock);
+
+      //tracing could have ended since the caller checked
+      if(!tracing)
+        return;
+
+      record.timestamp = (uint64_t)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now()-traceStart).count();
+      traceBuffer.push_back(record);
+      if(traceBuffer.size() >= traceBufferRecords)
+        flushTraceLocked();
+    }
+
+    void VulkanMemoryManager::traceAllocation(uint32_t memoryType, VkDeviceSize requiredSize, VkDeviceSize requiredAlignment, bool imageOptimal, 
+      uint64_t allocationId, Lifetime lifetime, const Suballocation &result)
+    {
+      TraceRecord record = { 0, requiredSize, allocationId, 0, 0, (uint32_t)requiredAlignment, TO_ALLOCATE, (uint8_t)memoryType, imageOptimal, 0, lifetime };
+
+      if(auto resultRecord = recordFor(result))
+      {
+        record.handle = resultRecord->subregionId;
+        record.slot = resultRecord->tlsfRegion;
+      }
+      traceRecord(record);
+    }
+
+    void VulkanMemoryManager::flushTraceLocked()
+    {
+      if(!traceBuffer.empty())
+        traceFile.write((const char *)traceBuffer.data(), traceBuffer.size()*sizeof(TraceRecord));
+      traceBuffer.clear();
+    }
+
+    void VulkanMemoryManager::reclaimMemory()
+    {
+      if(tracing)
+        traceRecord({ 0, 0, 0, 0, 0, 0, TO_RECLAIM, 0, 0, 0, 0 });
+      drainThreadCaches();
+
+      //reclaiming moves allocations around in the pool, so everything has to be locked down here
+      unique_lock<mutex> typeLockers[VK_MAX_MEMORY_TYPES];
+      for(uint32_t i = 0; i < VK_MAX_MEMORY_TYPES; i++)
+        typeLockers[i] = unique_lock<mutex>(typeLocks[i]);
+      lock_guard<mutex> locker(managerLock);
+
+      //the empty slab kept per size class (and spare transient chunks) are only held onto between reclaims
+      for(uint32_t i = 0; i < VK_MAX_MEMORY_TYPES; i++)
+      {
+        for(auto &chunk : transientFreeChunks[i])
+          freeLocked(chunk.block);
+        transientFreeChunks[i].clear();
+
+        vector<uint64_t> emptySlabs;
+        for(auto &slab : slabs[i]) if(slab.second.freeSlots == ~0ull)
+          emptySlabs.push_back(slab.first);
+        for(auto slabId : emptySlabs)
+          releaseSlabLocked(i, slabId);
+      }
+
+      if(freeMode == FM_MANUAL)
+      {
+        for(uint32_t i = 0; i < VK_MAX_MEMORY_TYPES; i++)
+        {
+          for(auto &alloc : allocations[i])
+          {
+            if(alloc->suballocationCount == 0 && alloc->memory)
+              releaseAllocationMemory(*alloc);
+          }
+        }
+      }
+
+      cleanupAllocations();
+    }
+
+    void VulkanMemoryManager::setRelocationDelegate(const Suballocation &suballocation, RelocationDelegate *delegate, VkDeviceSize requiredAlignment,
+      uint32_t memoryTypeBits)
+    {
+      //dedicated allocations are never defragmented
+      auto record = recordFor(suballocation);
+      if(!record || (int)record->allocationType > (int)AT_LARGE)
+        return;
+
+      lock_guard<mutex> locker(typeLocks[record->memoryType]);
+
+      auto allocationPtr = allocationForId(record->allocationId);
+      if(!allocationPtr)
+        return;
+
+      auto &allocation = *allocationPtr;
+      if(delegate)
+        setRelocatableLocked(allocation, record->subregionId, { delegate, suballocation, requiredAlignment, memoryTypeBits ? memoryTypeBits : (1u << record->memoryType) });
+      else
+        eraseRelocatableLocked(allocation, record->subregionId);
+    }
+
+    void VulkanMemoryManager::setRelocatableLocked(Allocation &allocation, uint64_t subregionId, const Relocatable &relocatable)
+    {
+      auto &entry = allocation.relocatables[subregionId];
+
+      if(!entry.delegate)
+        allocation.trackedSuballocations++;
+      else if(isPromotable(allocation.memoryType, entry.memoryTypeBits))
+        promotableRelocatables--;
+      entry = relocatable;
+      if(isPromotable(allocation.memoryType, entry.memoryTypeBits))
+        promotableRelocatables++;
+    }
+
+    void VulkanMemoryManager::eraseRelocatableLocked(Allocation &allocation, uint64_t subregionId)
+    {
+      auto it = allocation.relocatables.find(subregionId);
+
+      if(it != allocation.relocatables.end())
+      {
+        if(isPromotable(allocation.memoryType, it->second.memoryTypeBits))
+          promotableRelocatables--;
+        allocation.relocatables.erase(it);
+        allocation.trackedSuballocations--;
+      }
+    }
+
+    bool VulkanMemoryManager::isPromotable(uint32_t memoryType, uint32_t memoryTypeBits)
+    {
+      return ((hostTypes & (1u << memoryType)) && (memoryTypeBits & deviceLocalTypes));
+    }
+
+    VkDeviceSize VulkanMemoryManager::defragment(VkCommandBuffer commandBuffer, VkDeviceSize maxBytesMoved, double maxMilliseconds)
+    {
+      struct Move
+      {
+        Relocatable relocatable;
+        Suballocation newSuballocation;
+        uint64_t sourceAllocationId;
+        VkDeviceSize size;
+        bool accepted;
+      };
+
+      auto startTime = chrono::steady_clock::now();
+      auto outOfTime = [&]() {
+        return (maxMilliseconds > 0 && chrono::duration<double, milli>(chrono::steady_clock::now()-startTime).count() >= maxMilliseconds);
+      };
+      VkDeviceSize bytesMoved = 0;
+
+      //cached suballocations still count as live, which would keep their allocations from ever qualifying
+      drainThreadCaches();
+
+      for(uint32_t i = 0; i < memoryProperties.memoryTypeCount && bytesMoved < maxBytesMoved && !outOfTime(); i++)
+      {
+        vector<Move> moves;
+
+        {
+          lock_guard<mutex> locker(typeLocks[i]);
+
+          //allocations already being evacuated come first, then the sparsest ones that are entirely relocatable
+          vector<pair<uint64_t, Allocation *>> candidates;
+          for(auto &alloc : allocations[i])
+          {
+            auto &allocation = *alloc;
+
+            if(!allocation.memory || (int)allocation.type > (int)AT_LARGE || allocation.relocatables.empty())
+              continue;
+
+            if(allocation.defragSource)
+            {
+              candidates.push_back({ 0, alloc });
+            }
+            else if(allocation.relocatables.size() == allocation.suballocationCount)
+            {
+              uint64_t usedPages = 0;
+              //registered handles are always live, freeing one unregisters it under this same lock
+              for(auto &r : allocation.relocatables)
+                usedPages += handleSlot(r.second.suballocation.slot).record.size;
+
+              //no point moving more than half an allocation's worth of data to free it
+              if(usedPages*2 <= allocation.size)
+                candidates.push_back({ usedPages, alloc });
+            }
+          }
+          sort(candidates.begin(), candidates.end());
+
+          for(auto &candidate : candidates)
+          {
+            auto &allocation = *candidate.second;
+            bool stuck = false;
+
+            if(!allocation.defragSource)
+            {
+              allocation.defragSource = true;
+              defragSources++;
+            }
+
+            while(!allocation.relocatables.empty() && bytesMoved < maxBytesMoved && !outOfTime())
+            {
+              auto it = allocation.relocatables.begin();
+              VkDeviceSize size = (VkDeviceSize)handleSlot(it->second.suballocation.slot).record.size*pageSize;
+
+              //sources are skipped by findSuballocation(), and no new allocations are made here
+              auto newSuballocation = findSuballocation(i, size, it->second.alignment, allocation.type, allocation.imageOptimal, Any, allocation.lifetime);
+              if(!newSuballocation)
+              {
+                stuck = true;
+                break;
+              }
+
+              moves.push_back({ it->second, newHandleLocked(newSuballocation), allocation.id, size, false });
+              eraseRelocatableLocked(allocation, it->first);
+              bytesMoved += size;
+            }
+
+            if(stuck)
+            {
+              //nowhere left to put the rest, so this allocation goes back to normal use
+              endDefragSource(allocation);
+              break;
+            }
+            if(bytesMoved >= maxBytesMoved || outOfTime())
+              break;
+          }
+        }
+
+        //delegates create resources & release old handles (which can free), so the type lock can't be held here
+        for(auto &move : moves)
+          move.accepted = move.relocatable.delegate->relocate(move.relocatable.suballocation, move.newSuballocation, commandBuffer);
+
+        lock_guard<mutex> locker(typeLocks[i]);
+        for(auto &move : moves)
+        {
+          auto newRecord = recordFor(move.newSuballocation);
+
+          if(move.accepted)
+          {
+            auto allocation = newRecord ? allocationForId(newRecord->allocationId) : nullptr;
+            if(allocation)
+            {
+              Relocatable relocatable = move.relocatable;
+              relocatable.suballocation = move.newSuballocation;
+              setRelocatableLocked(*allocation, newRecord->subregionId, relocatable);
+            }
+          }
+          else
+          {
+            //the owner is responsible for re-registering a declined suballocation, and its allocation can no longer be emptied
+            bytesMoved -= move.size;
+            if(newRecord)
+            {
+              freeLocked(*newRecord);
+              releaseHandleLocked(move.newSuballocation);
+            }
+
+            if(auto allocation = allocationForId(move.sourceAllocationId))
+              endDefragSource(*allocation);
+          }
+        }
+      }
+
+      return bytesMoved;
+    }
+
+    void VulkanMemoryManager::endDefragSource(Allocation &allocation)
+    {
+      if(allocation.defragSource)
+      {
+        allocation.defragSource = false;
+        defragSources--;
+      }
+    }
+
+    void VulkanMemoryManager::releaseAllocationMemory(Allocation &allocation)
+    {
+      //freeing implicitly unmaps
+      vkFreeMemory(device, allocation.memory, nullptr);
+      allocation.memory = VK_NULL_HANDLE;
+      allocation.mapped = nullptr;
+      heapBlockBytes[memoryProperties.memoryTypes[allocation.memoryType].heapIndex] -= (VkDeviceSize)allocation.size*pageSize;
+    }
+
+    void VulkanMemoryManager::retireLocked(const SuballocationRecord &suballocation, bool retiring)
+    {
+      auto &retiringMap = retiringSuballocations[suballocation.memoryType];
+      auto &retiringBytes = heapRetiringBytes[memoryProperties.memoryTypes[suballocation.memoryType].heapIndex];
+      auto allocation = allocationForId(suballocation.allocationId);
+
+      if(retiring)
+      {
+        VkDeviceSize size = (VkDeviceSize)suballocation.size*pageSize;
+        if(retiringMap.insert({ suballocation.subregionId, size }).second)
+        {
+          retiringBytes += size;
+          if(allocation)
+            allocation->trackedSuballocations++;
+        }
+      }
+      else if(!retiringMap.empty())
+      {
+        auto it = retiringMap.find(suballocation.subregionId);
+        if(it != retiringMap.end())
+        {
+          retiringBytes -= it->second;
+          retiringMap.erase(it);
+          if(allocation)
+            allocation->trackedSuballocations--;
+        }
+      }
+    }
+
+    void VulkanMemoryManager::enableMemoryBudget(PFN_vkGetPhysicalDeviceMemoryProperties2KHR getMemoryProperties2)
+    {
+      this->getMemoryProperties2 = getMemoryProperties2;
+      updateBudget();
+    }
+
+    void VulkanMemoryManager::setBudgetSoftLimit(float fraction)
+    {
+      budgetSoftLimit = fraction;
+    }
+
+    void VulkanMemoryManager::updateBudget()
+    {
+      if(!getMemoryProperties2)
+        return;
+
+      VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties = {};
+      budgetProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+
+      VkPhysicalDeviceMemoryProperties2KHR properties = {};
+      properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2_KHR;
+      properties.pNext = &budgetProperties;
+      getMemoryProperties2(physicalDevice, &properties);
+
+      lock_guard<mutex> locker(budgetLock);
+      for(uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++)
+      {
+        queriedHeapUsage[i] = budgetProperties.heapUsage[i];
+        queriedHeapBudget[i] = budgetProperties.heapBudget[i];
+        queriedHeapBlockBytes[i] = heapBlockBytes[i];
+      }
+    }
+
+    VulkanMemoryManager::HeapBudget VulkanMemoryManager::getHeapBudget(uint32_t heapIndex)
+    {
+      HeapBudget result = { heapBlockBytes[heapIndex], (VkDeviceSize)(memoryProperties.memoryHeaps[heapIndex].size*budgetFallbackFraction) };
+
+      if(getMemoryProperties2)
+      {
+        lock_guard<mutex> locker(budgetLock);
+
+        if(queriedHeapBudget[heapIndex])
+        {
+          //the driver's numbers are only as fresh as the last query, so add on whatever we've allocated or freed since
+          VkDeviceSize usage = queriedHeapUsage[heapIndex] + result.usage;
+          result.usage = (usage > queriedHeapBlockBytes[heapIndex]) ? usage - queriedHeapBlockBytes[heapIndex] : 0;
+          result.budget = queriedHeapBudget[heapIndex];
+        }
+      }
+
+      return result;
+    }
+
+    VkDeviceSize VulkanMemoryManager::heapPressure(uint32_t heapIndex, const HeapBudget &budget)
+    {
+      //free pages within our own allocations can still be handed out, and retiring suballocations are already on their way out
+      VkDeviceSize blockBytes = heapBlockBytes[heapIndex], usedBytes = heapUsedBytes[heapIndex], retiringBytes = heapRetiringBytes[heapIndex];
+      VkDeviceSize otherBytes = budget.usage - min(budget.usage, blockBytes);
+
+      return otherBytes + usedBytes - min(usedBytes, retiringBytes);
+    }
+
+    bool VulkanMemoryManager::residencyBalanceNeeded()
+    {
+      //nothing to demote into (or out of) on unified memory architectures
+      if(!deviceLocalTypes || !hostTypes)
+        return false;
+
+      updateBudget();
+
+      for(uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++)
+      {
+        if(!(memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT))
+          continue;
+
+        auto budget = getHeapBudget(i);
+        VkDeviceSize pressure = heapPressure(i, budget);
+        VkDeviceSize softLimit = (VkDeviceSize)(budget.budget*budgetSoftLimit);
+        VkDeviceSize lowWater = (VkDeviceSize)(budget.budget*max(0.0f, budgetSoftLimit-budgetPromoteMargin));
+
+        if(pressure > softLimit)
+          return true;
+        if(promotableRelocatables > 0 && pressure < lowWater)
+          return true;
+
+        //over the limit only because of free space within our allocations, give back whatever is entirely empty
+        if(budget.usage > softLimit)
+          releaseEmptyAllocations(i);
+      }
+
+      return false;
+    }
+
+    void VulkanMemoryManager::releaseEmptyAllocations(uint32_t heapIndex)
+    {
+      for(uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) if(memoryProperties.memoryTypes[i].heapIndex == heapIndex)
+      {
+        lock_guard<mutex> locker(typeLocks[i]);
+
+        //slots are compacted by the next reclaimMemory(), just as with FM_SYNCHRONOUS
+        for(auto &alloc : allocations[i])
+        {
+          if(alloc->memory && alloc->suballocationCount == 0 && (int)alloc->type <= (int)AT_LARGE)
+            releaseAllocationMemory(*alloc);
+        }
+      }
+    }
+
+    VkDeviceSize VulkanMemoryManager::balanceResidency(VkCommandBuffer commandBuffer, VkDeviceSize maxBytesMoved)
+    {
+      struct Candidate
+      {
+        uint64_t lastUsedFrameId;
+        uint32_t memoryType, targetTypes;
+        Relocatable relocatable;
+        SuballocationRecord record; //copied while registered, the handle may be freed by the time the candidate is moved
+      };
+
+      VkDeviceSize bytesMoved = 0;
+      if(!deviceLocalTypes || !hostTypes)
+        return 0;
+
+      //as with defragment(), cached suballocations would keep emptied allocations from being released
+      drainThreadCaches();
+
+      //a move allocates at the target, unregisters the source, lets the delegate copy (no locks held), then registers the result
+      auto moveRelocatable = [&](const Candidate &candidate, VkMemoryPropertyFlags preferredProperties) -> bool {
+        const Relocatable &relocatable = candidate.relocatable;
+        const SuballocationRecord &oldSuballocation = candidate.record;
+        SuballocationRecord newRecord = nullptr;
+        Suballocation newSuballocation = nullptr;
+
+        uint32_t targetType = findMemoryType(candidate.targetTypes, preferredProperties);
+        if(targetType == NO_MEMORY_TYPE)
+          targetType = findMemoryType(candidate.targetTypes, 0);
+        if(targetType == NO_MEMORY_TYPE)
+          return false;
+
+        {
+          lock_guard<mutex> locker(typeLocks[targetType]);
+          newRecord = allocateLocked(targetType, (VkDeviceSize)oldSuballocation.size*pageSize, relocatable.alignment, oldSuballocation.imageOptimal, Any, 
+            oldSuballocation.lifetime);
+          newSuballocation = newHandleLocked(newRecord);
+        }
+        if(!newSuballocation)
+          return false;
+
+        bool registered = false;
+        {
+          lock_guard<mutex> locker(typeLocks[candidate.memoryType]);
+
+          if(auto allocation = allocationForId(oldSuballocation.allocationId))
+          {
+            auto it = allocation->relocatables.find(oldSuballocation.subregionId);
+
+            if(it != allocation->relocatables.end() && it->second.delegate == relocatable.delegate && it->second.suballocation == relocatable.suballocation)
+            {
+              eraseRelocatableLocked(*allocation, oldSuballocation.subregionId);
+              retireLocked(oldSuballocation, true);
+              registered = true;
+            }
+          }
+        }
+
+        bool accepted = registered && relocatable.delegate->relocate(relocatable.suballocation, newSuballocation, commandBuffer);
+
+        {
+          lock_guard<mutex> locker(typeLocks[targetType]);
+
+          if(accepted)
+          {
+            auto allocation = allocationForId(newRecord.allocationId);
+            if(allocation && (int)newRecord.allocationType <= (int)AT_LARGE && recordFor(newSuballocation))
             {
-              //dedicated allocations are a special case and will be freed immediately on last free suballoc
-              if(allocation.type == AT_DEDICATED || freeMode == FM_SYNCHRONOUS)
-              {
-                //this entire allocation is freed now
-                vkFreeMemory(device, allocation.memory, nullptr);
-                allocation.memory = VK_NULL_HANDLE;
-              }
+              Relocatable moved = relocatable;
+              moved.suballocation = newSuballocation;
+              setRelocatableLocked(*allocation, newRecord.subregionId, moved);
             }
           }
-        }          
-      }
+          else
+          {
+            freeLocked(newRecord);
+            releaseHandleLocked(newSuballocation);
+          }
+        }
 
-#ifdef DEBUG
-      if(!freed)
-      {
-        throw vgl_runtime_error("VulkanMemoryManager::free() failed!");
-      }
-#endif
-    }
+        if(registered && !accepted)
+        {
+          //as with defragment(), the owner is responsible for re-registering a declined suballocation
+          lock_guard<mutex> locker(typeLocks[candidate.memoryType]);
+          retireLocked(oldSuballocation, false);
+        }
 
-    void VulkanMemoryManager::reclaimMemory()
-    {
-      lock_guard<mutex> locker(managerLock);
+        return accepted;
+      };
 
-      if(freeMode == FM_MANUAL)
+      updateBudget();
+
+      for(uint32_t heap = 0; heap < memoryProperties.memoryHeapCount && bytesMoved < maxBytesMoved; heap++)
       {
-        for(uint32_t i = 0; i < VK_MAX_MEMORY_TYPES; i++)
+        if(!(memoryProperties.memoryHeaps[heap].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT))
+          continue;
+
+        auto budget = getHeapBudget(heap);
+        VkDeviceSize softLimit = (VkDeviceSize)(budget.budget*budgetSoftLimit);
+        VkDeviceSize lowWater = (VkDeviceSize)(budget.budget*max(0.0f, budgetSoftLimit-budgetPromoteMargin));
+
+        //allocations emptied by earlier demotions (or plain frees) are what actually gives memory back to the heap
+        if(budget.usage > softLimit)
+          releaseEmptyAllocations(heap);
+
+        VkDeviceSize pressure = heapPressure(heap, budget);
+        bool demote = (pressure > softLimit);
+        if(!demote && (pressure >= lowWater || promotableRelocatables == 0))
+          continue;
+
+        uint32_t heapTypes = 0;
+        for(uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) if(memoryProperties.memoryTypes[i].heapIndex == heap)
+          heapTypes |= (1u << i);
+
+        //demotion candidates live in this heap & can live outside of device local heaps, promotion candidates are the reverse
+        vector<Candidate> candidates;
+        for(uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
         {
-          for(auto &alloc : allocations[i])
+          if(!((demote ? heapTypes : hostTypes) & (1u << i)))
+            continue;
+
+          lock_guard<mutex> locker(typeLocks[i]);
+          for(auto &alloc : allocations[i]) if(alloc->memory && !alloc->defragSource)
           {
-            if(alloc->suballocationCount == 0)
+            for(auto &r : alloc->relocatables)
             {
-              vkFreeMemory(device, alloc->memory, nullptr);
-              alloc->memory = VK_NULL_HANDLE;
+              uint32_t targetTypes = r.second.memoryTypeBits & (demote ? hostTypes : (heapTypes & deviceLocalTypes));
+              if(targetTypes)
+                candidates.push_back({ r.second.delegate->getLastUsedFrameId(), i, targetTypes, r.second, handleSlot(r.second.suballocation.slot).record });
             }
           }
         }
+
+        //least recently used go first when demoting, most recently used first when promoting
+        sort(candidates.begin(), candidates.end(), [demote](const Candidate &a, const Candidate &b) {
+          return demote ? (a.lastUsedFrameId < b.lastUsedFrameId) : (a.lastUsedFrameId > b.lastUsedFrameId);
+        });
+
+        for(auto &candidate : candidates)
+        {
+          VkDeviceSize size = (VkDeviceSize)candidate.record.size*pageSize;
+
+          if(bytesMoved >= maxBytesMoved || (demote && pressure <= softLimit))
+            break;
+          if(!demote && pressure+size > lowWater)
+            continue;
+
+          if(moveRelocatable(candidate, demote ? VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT : VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT))
+          {
+            bytesMoved += size;
+            pressure = demote ? (pressure - min(pressure, size)) : (pressure + size);
+          }
+        }
       }
 
-      cleanupAllocations();
+      return bytesMoved;
     }
 
     uint32_t VulkanMemoryManager::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties)
@@ -504,14 +2110,22 @@ namespace vgl
 
     VkDeviceMemory VulkanMemoryManager::allocateDirect(uint32_t memoryType, VkDeviceSize requiredSize, bool imageOptimal)
     {
-      lock_guard<mutex> locker(managerLock);
+      lock_guard<mutex> locker(typeLocks[memoryType]);
 
-      auto ret = allocateDedicated(memoryType, requiredSize, 1, false, imageOptimal);
+      auto ret = allocateDedicated(memoryType, requiredSize, false, imageOptimal);
 
       if(ret.first)
       {
         auto &alloc = *allocations[memoryType].back();
         alloc.type = AT_UNKNOWN;
+        if(alloc.mapped)
+        {
+          vkUnmapMemory(device, alloc.memory);
+          alloc.mapped = nullptr;
+        }
+
+        //the caller uses all of it
+        heapUsedBytes[memoryProperties.memoryTypes[memoryType].heapIndex] += (VkDeviceSize)alloc.size*pageSize;
 
         return ret.first;
       }
@@ -519,28 +2133,87 @@ namespace vgl
       return VK_NULL_HANDLE;
     }
 
-    pair<VkDeviceMemory, uint64_t> VulkanMemoryManager::allocateDedicated(uint32_t typeFilter, VkMemoryPropertyFlags properties, VkDeviceSize blockSize, 
-      size_t maxBlocks, bool allowSuballocation, bool imageOptimal)
+    VkDeviceMemory VulkanMemoryManager::importHostMemory(uint32_t typeFilter, VkMemoryPropertyFlags properties, void *hostPointer, VkDeviceSize size)
     {
+      uint32_t memoryType = findMemoryType(typeFilter, properties);
+      if(memoryType == NO_MEMORY_TYPE)
+        return VK_NULL_HANDLE;
+
+      VkImportMemoryHostPointerInfoEXT importInfo = {};
+      importInfo.sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_HOST_POINTER_INFO_EXT;
+      importInfo.handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
+      importInfo.pHostPointer = hostPointer;
+
+      VkMemoryAllocateInfo allocInfo = {};
+      allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+      allocInfo.pNext = &importInfo;
+      allocInfo.allocationSize = size;
+      allocInfo.memoryTypeIndex = memoryType;
+
+      VkDeviceMemory memory = VK_NULL_HANDLE;
+      if(vkAllocateMemory(device, &allocInfo, nullptr, &memory) != VK_SUCCESS)
+        return VK_NULL_HANDLE;
+
+      //nothing else lives in it, so all of it is used
+      uint32_t heapIndex = memoryProperties.memoryTypes[memoryType].heapIndex;
+      heapBlockBytes[heapIndex] += size;
+      heapUsedBytes[heapIndex] += size;
+
       lock_guard<mutex> locker(managerLock);
+      importedMemory[memory] = { memoryType, size };
+
+      return memory;
+    }
+
+    void VulkanMemoryManager::freeImportedMemory(VkDeviceMemory memory)
+    {
+      if(!memory)
+        return;
+
+      {
+        lock_guard<mutex> locker(managerLock);
+        auto imported = importedMemory.find(memory);
+        if(imported != importedMemory.end())
+        {
+          uint32_t heapIndex = memoryProperties.memoryTypes[imported->second.memoryType].heapIndex;
+          heapBlockBytes[heapIndex] -= imported->second.size;
+          heapUsedBytes[heapIndex] -= imported->second.size;
+          importedMemory.erase(imported);
+        }
+      }
+
+      vkFreeMemory(device, memory, nullptr);
+    }
 
+    pair<VkDeviceMemory, uint64_t> VulkanMemoryManager::allocateDedicated(uint32_t typeFilter, VkMemoryPropertyFlags properties, VkDeviceSize blockSize, 
+      size_t maxBlocks, bool allowSuballocation, bool imageOptimal)
+    {
       uint32_t memoryType = findMemoryType(typeFilter, properties);
 
       if(memoryType != NO_MEMORY_TYPE)
-        return allocateDedicated(memoryType, blockSize*maxBlocks + 8192, allowSuballocation, imageOptimal);
+      {
+        pair<VkDeviceMemory, uint64_t> result;
+        {
+          lock_guard<mutex> locker(typeLocks[memoryType]);
+          result = allocateDedicated(memoryType, blockSize*maxBlocks + 8192, allowSuballocation, imageOptimal);
+        }
+
+        if(tracing)
+          traceRecord({ 0, blockSize*maxBlocks, result.second, 0, 0, 0, TO_DEDICATED, (uint8_t)memoryType, imageOptimal, allowSuballocation, LT_STATIC });
+        return result;
+      }
 
       return { VK_NULL_HANDLE, 0 };
     }
 
     bool VulkanMemoryManager::isAllocationCoherent(const Suballocation &suballocation)
     {
-      return (memoryProperties.memoryTypes[suballocation.memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) ? true : false;
+      return (memoryPropertiesFor(suballocation) & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) ? true : false;
     }
 
     bool VulkanMemoryManager::isAllocationCoherent(uint64_t allocationId)
     {      
-      auto &allocation = *allocationForId(allocationId);
-      return (memoryProperties.memoryTypes[allocation.memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) ? true : false;
+      return (memoryPropertiesForId(allocationId) & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) ? true : false;
     }
 
     bool VulkanMemoryManager::isAllocationTypeCoherent(uint32_t typeFilter, VkMemoryPropertyFlags properties)
@@ -551,51 +2224,101 @@ namespace vgl
 
     bool VulkanMemoryManager::isAllocationHostCached(const Suballocation &suballocation)
     {
-      return (memoryProperties.memoryTypes[suballocation.memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_CACHED_BIT) ? true : false;
+      return (memoryPropertiesFor(suballocation) & VK_MEMORY_PROPERTY_HOST_CACHED_BIT) ? true : false;
     }
 
     bool VulkanMemoryManager::isAllocationHostCached(uint64_t allocationId)
     {
-      auto &allocation = *allocationForId(allocationId);
-      return (memoryProperties.memoryTypes[allocation.memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_CACHED_BIT) ? true : false;
+      return (memoryPropertiesForId(allocationId) & VK_MEMORY_PROPERTY_HOST_CACHED_BIT) ? true : false;
     }
 
     bool VulkanMemoryManager::isAllocationHostVisible(const Suballocation &suballocation)
     {
-      return (memoryProperties.memoryTypes[suballocation.memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) ? true : false;
+      return (memoryPropertiesFor(suballocation) & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) ? true : false;
     }
 
     bool VulkanMemoryManager::isAllocationHostVisible(uint64_t allocationId)
     {
-      auto &allocation = *allocationForId(allocationId);
-      return (memoryProperties.memoryTypes[allocation.memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) ? true : false;
+      return (memoryPropertiesForId(allocationId) & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) ? true : false;
     }
 
     bool VulkanMemoryManager::isAllocationDeviceLocal(const Suballocation &suballocation)
     {
-      return (memoryProperties.memoryTypes[suballocation.memoryType].propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) ? true : false;
+      return (memoryPropertiesFor(suballocation) & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) ? true : false;
     }
 
     bool VulkanMemoryManager::isAllocationDeviceLocal(uint64_t allocationId)
     {
-      auto &allocation = *allocationForId(allocationId);
-      return (memoryProperties.memoryTypes[allocation.memoryType].propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) ? true : false;
+      return (memoryPropertiesForId(allocationId) & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) ? true : false;
     }
 
     VulkanMemoryManager::AllocationInfo VulkanMemoryManager::getAllocationInfo(Suballocation alloc)
     {
-      AllocationInfo result;
+      AllocationInfo result = {};
+
+      //neither the handle slot nor the pool slot of a live suballocation ever moves or changes, so this doesn't need a lock
+      auto record = recordFor(alloc);
+      if(!record)
+        return result;
 
-      result.memory = alloc.memory;
-      result.memoryType = alloc.memoryType;
-      result.offset = alloc.offset;
-      result.size = alloc.size*pageSize;
-      result.allocationId = alloc.allocationId;
+      result.memory = record->memory;
+      result.memoryType = record->memoryType;
+      result.offset = record->offset;
+      result.size = (record->allocationType == AT_SLAB || record->allocationType == AT_TRANSIENT) ? record->size : record->size*pageSize;
+      result.allocationId = record->allocationId;
+
+      void *mapped = allocationsPool[(uint32_t)record->allocationId - 1].mapped;
+      result.mappedData = (mapped) ? (uint8_t *)mapped + record->offset : nullptr;
 
       return result;
     }
 
-    pair<VkDeviceMemory, uint64_t> VulkanMemoryManager::allocateDedicated(uint32_t memoryType, VkDeviceSize requiredSize, bool allowSuballocation, bool imageOptimal)
+    bool VulkanMemoryManager::mappedRange(const SuballocationRecord &suballocation, VkDeviceSize offset, VkDeviceSize size, VkMappedMemoryRange &range)
+    {
+      auto typeFlags = memoryProperties.memoryTypes[suballocation.memoryType].propertyFlags;
+      if((typeFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) || !(typeFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT))
+        return false;
+
+      const Allocation &allocation = allocationsPool[(uint32_t)suballocation.allocationId - 1];
+      VkDeviceSize suballocationSize = (suballocation.allocationType == AT_SLAB || suballocation.allocationType == AT_TRANSIENT) ? 
+        suballocation.size : (VkDeviceSize)suballocation.size*pageSize;
+      if(size == VK_WHOLE_SIZE)
+        size = suballocationSize - offset;
+
+      //ranges must start & end on atom boundaries, except that the end of the memory object is always allowed
+      VkDeviceSize start = suballocation.offset + offset;
+      VkDeviceSize end = align(start + size, nonCoherentAtomSize);
+      start -= start % nonCoherentAtomSize;
+
+      range = {};
+      range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+      range.memory = suballocation.memory;
+      range.offset = start;
+      range.size = (end >= allocation.bytes) ? VK_WHOLE_SIZE : end - start;
+
+      return true;
+    }
+
+    void VulkanMemoryManager::flushAllocation(const Suballocation &suballocation, VkDeviceSize offset, VkDeviceSize size)
+    {
+      VkMappedMemoryRange range;
+      auto record = recordFor(suballocation);
+
+      if(record && mappedRange(*record, offset, size, range))
+        vkFlushMappedMemoryRanges(device, 1, &range);
+    }
+
+    void VulkanMemoryManager::invalidateAllocation(const Suballocation &suballocation, VkDeviceSize offset, VkDeviceSize size)
+    {
+      VkMappedMemoryRange range;
+      auto record = recordFor(suballocation);
+
+      if(record && mappedRange(*record, offset, size, range))
+        vkInvalidateMappedMemoryRanges(device, 1, &range);
+    }
+
+    pair<VkDeviceMemory, uint64_t> VulkanMemoryManager::allocateDedicated(uint32_t memoryType, VkDeviceSize requiredSize, bool allowSuballocation, bool imageOptimal,
+      Lifetime lifetime)
     {
       pair<VkDeviceMemory, uint64_t> result = { VK_NULL_HANDLE, 0 };
       VkMemoryAllocateInfo allocInfo = {};
@@ -603,38 +2326,37 @@ namespace vgl
       allocInfo.allocationSize = requiredSize;
       allocInfo.memoryTypeIndex = memoryType;
 
-      if(ai+1 > maxAllocations)
-      {
-        throw vgl_runtime_error("Over the allocations pool limit in VulkanMemoryManager");
-      }
+      Allocation *poolAllocation = reservePoolAllocation(memoryType);
 
       if(vkAllocateMemory(device, &allocInfo, nullptr, &result.first) == VK_SUCCESS)
       {
-        allocations[memoryType].push_back(&allocationsPool[ai++]);
+        allocations[memoryType].push_back(poolAllocation);
 
         auto &alloc = *allocations[memoryType].back();
         alloc.memory = result.first;
+        alloc.bytes = requiredSize;
         alloc.size = (uint32_t)fastCeil(requiredSize, pageSize);
-        alloc.id = allocationIds++;
         alloc.type = AT_DEDICATED;
-        alloc.memoryType = memoryType;
+        alloc.lifetime = lifetime;
         alloc.suballocationCount = 0;
-        alloc.regions = { { 0, alloc.size, allowSuballocation, subregionIds++ } };
-        if(allowSuballocation)
-          alloc.freeRegions = { { &alloc.regions.back(), alloc.regions.begin() } };
-        else
-          alloc.freeRegions = { };
+        initRegions(alloc, allowSuballocation);
         alloc.imageOptimal = imageOptimal;
-        allocationsMap[memoryType][alloc.id] = allocations[memoryType].size()-1;
+        mapAllocation(alloc);
 
         result.second = alloc.id;
         allocatedBytes += requiredSize;
+        heapBlockBytes[memoryProperties.memoryTypes[memoryType].heapIndex] += (VkDeviceSize)alloc.size*pageSize;
+      }
+      else
+      {
+        lock_guard<mutex> locker(managerLock);
+        releasePoolAllocation(poolAllocation);
       }
 
       return result;
     }
 
-    VkDeviceMemory VulkanMemoryManager::makeNewAllocation(uint32_t memoryType, AllocationType type, bool imageOptimal)
+    VkDeviceMemory VulkanMemoryManager::makeNewAllocation(uint32_t memoryType, AllocationType type, bool imageOptimal, Lifetime lifetime)
     {
       if(type == AT_UNKNOWN)
         throw vgl_runtime_error("Unknown allocation type requested in VulkanMemoryManager::makeNewAllocation()");
@@ -646,50 +2368,168 @@ namespace vgl
       allocInfo.allocationSize = size;
       allocInfo.memoryTypeIndex = memoryType;
 
-      if(ai+1 > maxAllocations)
-      {
-        throw vgl_runtime_error("Over the allocations pool limit in VulkanMemoryManager");
-      }
+      Allocation *poolAllocation = reservePoolAllocation(memoryType);
 
       if(vkAllocateMemory(device, &allocInfo, nullptr, &result) != VK_SUCCESS)
       {
+        lock_guard<mutex> locker(managerLock);
+        releasePoolAllocation(poolAllocation);
         return VK_NULL_HANDLE;
       }
       else
       {
-        allocations[memoryType].push_back(&allocationsPool[ai++]);
+        allocations[memoryType].push_back(poolAllocation);
 
         auto &alloc = *allocations[memoryType].back();
         alloc.memory = result;
+        alloc.bytes = size;
         alloc.size = (uint32_t)fastCeil(size, pageSize);
-        alloc.id = allocationIds++;
         alloc.type = type;
-        alloc.memoryType = memoryType;
+        alloc.lifetime = lifetime;
         alloc.suballocationCount = 0;
-        alloc.regions = { { 0, alloc.size, true, subregionIds++ } };
-        alloc.freeRegions = { { &alloc.regions.back(), alloc.regions.begin() } };
+        initRegions(alloc, true);
         alloc.imageOptimal = imageOptimal;
-        allocationsMap[memoryType][alloc.id] = allocations[memoryType].size()-1;       
+        mapAllocation(alloc);
 
         allocatedBytes += size;
+        heapBlockBytes[memoryProperties.memoryTypes[memoryType].heapIndex] += (VkDeviceSize)alloc.size*pageSize;
       }
       return result;
     }
 
-    static inline VkDeviceSize align(VkDeviceSize size, VkDeviceSize alignment)
+    void VulkanMemoryManager::mapAllocation(Allocation &allocation)
     {
-      VkDeviceSize m = size % alignment;
-      return m ? (size + (alignment - m)) : size;
+      allocation.mapped = nullptr;
+      if(!(memoryProperties.memoryTypes[allocation.memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT))
+        return;
+
+      //mapping the whole block once means transfers never map/unmap, and suballocations never map the same memory twice
+      if(vkMapMemory(device, allocation.memory, 0, VK_WHOLE_SIZE, 0, &allocation.mapped) != VK_SUCCESS)
+      {
+        verr << "VulkanMemoryManager:  unable to map host visible memory block" << endl;
+        allocation.mapped = nullptr;
+      }
+    }
+
+    VulkanMemoryManager::Allocation *VulkanMemoryManager::reservePoolAllocation(uint32_t memoryType)
+    {
+      lock_guard<mutex> locker(managerLock);
+      uint32_t slot;
+
+      if(!freeAllocationSlots.empty())
+      {
+        slot = freeAllocationSlots.back();
+        freeAllocationSlots.pop_back();
+      }
+      else
+      {
+        if(ai+1 > maxAllocations)
+        {
+          throw vgl_runtime_error("Over the allocations pool limit in VulkanMemoryManager");
+        }
+
+        slot = ai++;
+        allocationsPool[slot].generation = 0;
+      }
+
+      //the id packs the slot & its generation, so lookups are O(1) and ids of recycled slots never match again
+      Allocation *allocation = &allocationsPool[slot];
+      allocation->memory = VK_NULL_HANDLE;
+      allocation->mapped = nullptr;
+      allocation->memoryType = memoryType;
+      allocation->id = ((uint64_t)allocation->generation << 32) | (slot+1);
+
+      return allocation;
+    }
+
+    //caller holds managerLock
+    void VulkanMemoryManager::releasePoolAllocation(Allocation *allocation)
+    {
+      allocation->memory = VK_NULL_HANDLE;
+      allocation->mapped = nullptr;
+      allocation->id = 0;
+      allocation->generation++;
+      allocation->regions.clear();
+      allocation->freeRegions.clear();
+      allocation->regionsById.clear();
+      allocation->relocatables.clear();
+      allocation->tlsf = {};
+      freeAllocationSlots.push_back((uint32_t)(allocation - allocationsPool));
+    }
+
+    VulkanMemoryManager::Allocation *VulkanMemoryManager::allocationForId(uint64_t allocationId)
+    {
+      uint32_t slot = (uint32_t)allocationId - 1;
+
+      if(!allocationId || slot >= ai || allocationsPool[slot].id != allocationId)
+        return nullptr;
+
+      return &allocationsPool[slot];
+    }
+
+    void VulkanMemoryManager::initRegions(Allocation &allocation, bool free)
+    {
+      allocation.defragSource = false;
+      allocation.relocatables.clear();
+      allocation.trackedSuballocations = 0;
+
+      if(freeRegionStrategy == FRS_TLSF)
+      {
+        allocation.regions.clear();
+        allocation.freeRegions.clear();
+        allocation.regionsById.clear();
+        allocation.tlsf.reset(allocation.size, free, subregionIds++);
+      }
+      else
+      {
+        allocation.regions = { { 0, allocation.size, free, subregionIds++ } };
+        if(free)
+          allocation.freeRegions = { { &allocation.regions.back(), allocation.regions.begin() } };
+        else
+          allocation.freeRegions = { };
+        allocation.regionsById = { { allocation.regions.back().id, allocation.regions.begin() } };
+        allocation.tlsf = {};
+      }
     }
 
-    VulkanMemoryManager::Suballocation VulkanMemoryManager::findSuballocation(uint32_t memoryType, VkDeviceSize requiredSize, VkDeviceSize requiredAlignment, AllocationType type, bool imageOptimal, uint64_t allocationId)
+    VulkanMemoryManager::SuballocationRecord VulkanMemoryManager::findSuballocation(uint32_t memoryType, VkDeviceSize requiredSize, VkDeviceSize requiredAlignment, AllocationType type, 
+      bool imageOptimal, uint64_t allocationId, Lifetime lifetime)
     {
       uint32_t requiredPageSize = (uint32_t)fastCeil(requiredSize, pageSize);
-      Suballocation result = nullptr;
+      SuballocationRecord result = nullptr;
       
       auto searchAllocation = [=](Allocation *targetAllocation) {
         auto &allocation = *targetAllocation;
-        Suballocation result = nullptr;
+        SuballocationRecord result = nullptr;
+
+        if(!allocation.tlsf.empty())
+        {
+          //vulkan alignments are powers of two, so anything larger than a page is a whole number of pages
+          uint32_t alignmentInPages = (requiredAlignment > pageSize) ? (uint32_t)(requiredAlignment / pageSize) : 1;
+          uint32_t region = allocation.tlsf.allocate(requiredPageSize, alignmentInPages, subregionIds++);
+
+          if(region != TlsfIndex::NullRegion)
+          {
+            auto &sr = allocation.tlsf.region(region);
+
+            result.memory = allocation.memory;
+            result.offset = (VkDeviceSize)sr.startPage*pageSize;
+            result.size = sr.size;
+            result.memoryType = memoryType;
+            result.allocationId = allocation.id;
+            result.subregionId = sr.id;
+            result.tlsfRegion = region;
+            result.allocationType = allocation.type;
+            result.imageOptimal = allocation.imageOptimal;
+            result.lifetime = allocation.lifetime;
+            allocation.suballocationCount++;
+            heapUsedBytes[memoryProperties.memoryTypes[memoryType].heapIndex] += (VkDeviceSize)result.size*pageSize;
+
+            VGL_CORE_PERF_WARNING_DEBUG(allocation.tlsf.regionCount() > 1024, "Vulkan memory manager moderate heap fragmentation detected!")
+          }
+
+          return result;
+        }
 
         for(auto srIt = allocation.freeRegions.begin(); srIt != allocation.freeRegions.end(); srIt++)
         {
@@ -714,9 +2554,13 @@ namespace vgl
             result.allocationId = allocation.id;
 
             auto region = divideSubregion(allocation, srIt->second, alignedRequiredPageSz);
-            result.subregionIt = region;
             result.subregionId = region->id;
+            result.tlsfRegion = TlsfIndex::NullRegion;
+            result.allocationType = allocation.type;
+            result.imageOptimal = allocation.imageOptimal;
+            result.lifetime = allocation.lifetime;
             allocation.suballocationCount++;
+            heapUsedBytes[memoryProperties.memoryTypes[memoryType].heapIndex] += (VkDeviceSize)result.size*pageSize;
             
             return result;
           }
@@ -730,12 +2574,15 @@ namespace vgl
       {
         auto &allocation = *alloc;
 
+        if(allocation.defragSource)
+          continue;
+
         //find by type
         if(!allocationId)
         {
           if((lowMemoryFlags & (1ull<<memoryType)) == 0)
           {
-            if(allocation.memory && allocation.type == type && allocation.imageOptimal == imageOptimal)
+            if(allocation.memory && allocation.type == type && allocation.imageOptimal == imageOptimal && allocation.lifetime == lifetime)
             {
               if(auto potentialResult = searchAllocation(alloc))
               {
@@ -745,8 +2592,8 @@ namespace vgl
           }
           else
           {
-            //widen our search to larger allocation types
-            if((int)allocation.type <= (int)AT_LARGE && (int)allocation.type >= (int)type)
+            //widen our search to larger allocation types (of any lifetime)
+            if(allocation.memory && (int)allocation.type <= (int)AT_LARGE && (int)allocation.type >= (int)type)
             {
               if(auto potentialResult = searchAllocation(alloc))
               {
@@ -788,11 +2635,13 @@ namespace vgl
       newRegion->startPage = region->startPage;
       newRegion->size = sizeInPages;
       newRegion->free = false;
+      allocation.regionsById[newRegion->id] = newRegionIter;
       
       if(region->size-sizeInPages == 0)
       {
         //right side is now empty, so we remove that region entirely
         allocation.freeRegions.erase(freeRegionKey);
+        allocation.regionsById.erase(region->id);
         allocation.regions.erase(region);
       }
       else
@@ -815,112 +2664,262 @@ namespace vgl
       assert(region1->free && region2->free);
       region2->startPage -= region1->size;
       region2->size += region1->size;
+      allocation.regionsById.erase(region1->id);
       allocation.regions.erase(region1);
     }
 
-    VulkanMemoryManager::Allocation *VulkanMemoryManager::allocationForId(uint64_t allocationId)
+    VkMemoryPropertyFlags VulkanMemoryManager::memoryPropertiesForId(uint64_t allocationId)
+    {
+      lock_guard<mutex> locker(managerLock);
+
+      if(auto allocation = allocationForId(allocationId))
+        return memoryProperties.memoryTypes[allocation->memoryType].propertyFlags;
+
+      return 0;
+    }
+
+    VkMemoryPropertyFlags VulkanMemoryManager::memoryPropertiesFor(const Suballocation &suballocation)
+    {
+      auto record = recordFor(suballocation);
+      return (record) ? memoryProperties.memoryTypes[record->memoryType].propertyFlags : 0;
+    }
+
+    void VulkanMemoryManager::cleanupAllocations()
     {
+      //pool slots never move, so this only has to drop released allocations from the per type lists and recycle their slots
       for(uint32_t i = 0; i < VK_MAX_MEMORY_TYPES; i++)
       {
-        auto ait = allocationsMap[i].find(allocationId);
+        auto &v = allocations[i];
+        auto removed = stable_partition(v.begin(), v.end(), [](const Allocation *a) { return (a->memory != VK_NULL_HANDLE); });
 
-        if(ait != allocationsMap[i].end())
-          return allocations[i][ait->second];
+        for(auto it = removed; it != v.end(); it++)
+          releasePoolAllocation(*it);
+        v.erase(removed, v.end());
       }
+    }
 
-      return nullptr;
+    //We use this as an opportunity to keep our free regions list sorted by increasing size
+    bool VulkanMemoryManager::FreeRegionComparator::operator()(const Subregion *a, const Subregion *b) const
+    {
+      return (a->size == b->size) ? (a < b) : (a->size < b->size);
     }
 
-    void VulkanMemoryManager::cleanupAllocations()
+    void VulkanMemoryManager::TlsfIndex::reset(uint32_t sizeInPages, bool free, uint64_t id)
     {
-      /*** As it currently stands, this is the most expensive operation you can call within the entire memory manager ***/
+      regions.clear();
+      unusedRegions.clear();
+      freeHeads.assign(FlCount*SlCount, NullRegion);
+      flBitmap = 0;
+      memset(slBitmaps, 0, sizeof(slBitmaps));
+
+      regions.push_back({ 0, sizeInPages, NullRegion, NullRegion, NullRegion, NullRegion, id, free });
+      if(free)
+        insertFree(0);
+    }
 
-      for(uint32_t i = 0; i < VK_MAX_MEMORY_TYPES; i++)
+    //first level is the power of two, second level linearly subdivides that range into SlCount classes
+    //sizes below SlCount pages each get their own exact class in the first row
+    void VulkanMemoryManager::TlsfIndex::mapping(uint32_t size, int &fl, int &sl)
+    {
+      if(size < SlCount)
       {
-        auto &v = allocations[i];
-        v.erase(remove_if(v.begin(), v.end(), [](const Allocation *a) { return (a->memory == VK_NULL_HANDLE); }), v.end());
+        fl = 0;
+        sl = (int)size;
+      }
+      else
+      {
+        int msb = bitScanReverse(size);
+        fl = msb - SlLog2 + 1;
+        sl = (int)(size >> (msb - SlLog2)) ^ SlCount;
+      }
+    }
+
+    uint32_t VulkanMemoryManager::TlsfIndex::findFree(uint32_t size)
+    {
+      int fl, sl;
+
+      //round up to the next class boundary so that any region found in the class is guaranteed to fit
+      if(size >= SlCount)
+      {
+        uint64_t rounded = (uint64_t)size + (1ull << (bitScanReverse(size) - SlLog2)) - 1;
+        if(rounded > 0xFFFFFFFF)
+          return NullRegion;
+        size = (uint32_t)rounded;
+      }
+      mapping(size, fl, sl);
+      if(fl >= FlCount)
+        return NullRegion;
+
+      uint32_t slMap = slBitmaps[fl] & (~0u << sl);
+      if(!slMap)
+      {
+        uint32_t flMap = (fl+1 < 32) ? (flBitmap & (~0u << (fl+1))) : 0;
+        if(!flMap)
+          return NullRegion;
 
-        allocationsMap[i].clear();
-        for(size_t j = 0; j < allocations[i].size(); j++)
-          allocationsMap[i][allocations[i][j]->id] = j;
+        fl = bitScanForward(flMap);
+        slMap = slBitmaps[fl];
       }
+      sl = bitScanForward(slMap);
+
+      return freeHeads[fl*SlCount + sl];
+    }
+
+    void VulkanMemoryManager::TlsfIndex::insertFree(uint32_t region)
+    {
+      auto &r = regions[region];
+      int fl, sl;
+
+      mapping(r.size, fl, sl);
+      uint32_t &head = freeHeads[fl*SlCount + sl];
+
+      r.free = true;
+      r.prevFree = NullRegion;
+      r.nextFree = head;
+      if(head != NullRegion)
+        regions[head].prevFree = region;
+      head = region;
+
+      flBitmap |= (1u << fl);
+      slBitmaps[fl] |= (1u << sl);
+    }
 
-      int newAi = 0;
-      auto newAllocationsPool = new Allocation[maxAllocations];
-      for(int i = 0; i < ai; i++)
+    void VulkanMemoryManager::TlsfIndex::removeFree(uint32_t region)
+    {
+      auto &r = regions[region];
+      int fl, sl;
+
+      mapping(r.size, fl, sl);
+      uint32_t &head = freeHeads[fl*SlCount + sl];
+
+      if(r.prevFree != NullRegion)
+        regions[r.prevFree].nextFree = r.nextFree;
+      if(r.nextFree != NullRegion)
+        regions[r.nextFree].prevFree = r.prevFree;
+
+      if(head == region)
       {
-        if(allocationsPool[i].memory)
+        head = r.nextFree;
+        if(head == NullRegion)
         {
-          bool found = false;
+          slBitmaps[fl] &= ~(1u << sl);
+          if(!slBitmaps[fl])
+            flBitmap &= ~(1u << fl);
+        }
+      }
 
-          newAllocationsPool[newAi] = allocationsPool[i];
+      r.free = false;
+      r.prevFree = r.nextFree = NullRegion;
+    }
 
-          //need to fix references within free regions now
-          //Note:  this operation could be quite slow for certain situations O(n^2)
-          newAllocationsPool[newAi].freeRegions.clear();
-          for(auto &fr : allocationsPool[i].freeRegions)
-          {
-            auto &regions = newAllocationsPool[newAi].regions;
+    uint32_t VulkanMemoryManager::TlsfIndex::newRegion()
+    {
+      if(!unusedRegions.empty())
+      {
+        uint32_t region = unusedRegions.back();
+        unusedRegions.pop_back();
+        return region;
+      }
 
-            found = false;
-            for(auto srIt = regions.begin(); srIt != regions.end(); srIt++)
-            {
-              if(srIt->id == fr.first->id)
-              {
-                auto sr = &(*srIt);
+      regions.push_back({});
+      return (uint32_t)regions.size()-1;
+    }
 
-                newAllocationsPool[newAi].freeRegions[sr] = srIt;
-                found = true;
-                break;
-              }
-            }
+    //splits off everything past leftSize into a new (not yet indexed) region and returns it
+    uint32_t VulkanMemoryManager::TlsfIndex::split(uint32_t region, uint32_t leftSize)
+    {
+      uint32_t right = newRegion();
+      auto &l = regions[region], &r = regions[right];
+
+      r.startPage = l.startPage + leftSize;
+      r.size = l.size - leftSize;
+      r.prevPhysical = region;
+      r.nextPhysical = l.nextPhysical;
+      r.prevFree = r.nextFree = NullRegion;
+      r.id = 0;
+      r.free = false;
+      if(l.nextPhysical != NullRegion)
+        regions[l.nextPhysical].prevPhysical = right;
+
+      l.size = leftSize;
+      l.nextPhysical = right;
+
+      return right;
+    }
 
-            if(DebugBuild() && !found)
-              throw vgl_runtime_error("Internal error in VulkanMemoryManager::cleanupAllocations()");
-          }
+    void VulkanMemoryManager::TlsfIndex::absorb(uint32_t left, uint32_t right)
+    {
+      auto &l = regions[left], &r = regions[right];
 
-          //and now we need to find and replace all the pointers in the allocations arrays
-          //unfortunately, we don't store memory type index inside allocations struct
-          found = false;
-          for(uint32_t mi = 0; mi < VK_MAX_MEMORY_TYPES; mi++)
-          {
-            for(auto &allocPtr : allocations[mi])
-            {
-              if(allocPtr->id == newAllocationsPool[newAi].id)
-              {
-                allocPtr = &newAllocationsPool[newAi];
-                found = true;
-                break;
-              }
-            }            
-          }
+      l.size += r.size;
+      l.nextPhysical = r.nextPhysical;
+      if(r.nextPhysical != NullRegion)
+        regions[r.nextPhysical].prevPhysical = left;
+
+      unusedRegions.push_back(right);
+    }
+
+    uint32_t VulkanMemoryManager::TlsfIndex::allocate(uint32_t sizeInPages, uint32_t alignmentInPages, uint64_t id)
+    {
+      //over-allocate by the worst case padding so that an aligned start is always available within the region
+      uint32_t searchSize = sizeInPages + ((alignmentInPages > 1) ? alignmentInPages-1 : 0);
+      uint32_t region = findFree(searchSize);
+
+      if(region == NullRegion)
+        return NullRegion;
+      removeFree(region);
 
-          if(DebugBuild() && !found)
-            throw vgl_runtime_error("Internal error in VulkanMemoryManager::cleanupAllocations()");
+      if(alignmentInPages > 1)
+      {
+        uint32_t padding = (alignmentInPages - regions[region].startPage % alignmentInPages) % alignmentInPages;
 
-          newAi++;
+        if(padding)
+        {
+          //left neighbor is never free (it would have been merged) so the padding can go straight back in
+          uint32_t aligned = split(region, padding);
+          insertFree(region);
+          region = aligned;
         }
       }
 
-      delete []allocationsPool;
-      allocationsPool = newAllocationsPool;
-      ai = newAi;
+      if(regions[region].size > sizeInPages)
+        insertFree(split(region, sizeInPages));
+
+      regions[region].id = id;
+      regions[region].free = false;
 
-      //any freed subregions less than this id won't be able to use their list iterators
-      //(this is why you should avoid calling reclaimMemory often)
-      invalidatedSubregionIds = subregionIds;
+      return region;
     }
 
-    //We use this as an opportunity to keep our free regions list sorted by increasing size
-    bool VulkanMemoryManager::FreeRegionComparator::operator()(const Subregion *a, const Subregion *b) const
+    void VulkanMemoryManager::TlsfIndex::free(uint32_t region)
     {
-      return (a->size == b->size) ? (a < b) : (a->size < b->size);
+      uint32_t next = regions[region].nextPhysical;
+      uint32_t prev = regions[region].prevPhysical;
+
+      //clearing the id lets the manager detect stale frees of regions that have since been merged away
+      regions[region].id = 0;
+      regions[region].free = true;
+      if(next != NullRegion && regions[next].free)
+      {
+        removeFree(next);
+        absorb(region, next);
+      }
+      if(prev != NullRegion && regions[prev].free)
+      {
+        removeFree(prev);
+        absorb(prev, region);
+        region = prev;
+      }
+
+      insertFree(region);
     }
 
     void VulkanMemoryManager::dumpAllocationsInfo()
     {
       for(uint32_t i = 0; i < VK_MAX_MEMORY_TYPES; i++)
       {
+        lock_guard<mutex> locker(typeLocks[i]);
+
         vout << "--- Memory type: " << i << "---" << endl;
         for(auto &allocation : allocations[i]) if(allocation->memory)
         {
@@ -930,9 +2929,16 @@ namespace vgl
           {
             vout << "\t( start: " << region.startPage << ", size: " << region.size << ", free: " << region.free << ")" << endl;
           }          
+          allocation->tlsf.enumerate([](const TlsfIndex::Region &region) {
+            vout << "\t( start: " << region.startPage << ", size: " << region.size << ", free: " << region.free << ")" << endl;
+          });
           vout << "]" << endl;
         }
       }
+
+      auto slabStats = getSlabStats();
+      vout << "--- Slab tier: " << slabStats.liveSlots << " slots using " << (slabStats.slotBytes >> 10) << " kb of " << (slabStats.runBytes >> 10) 
+           << " kb page runs, saving " << (((int64_t)slabStats.pageGranularBytes - (int64_t)slabStats.runBytes) / 1024) << " kb over page granular suballocation ---" << endl;
     }
 #endif
   }
@@ -20,6 +20,12 @@ limitations under the License.
 #include <map>
 #include <list>
 #include <mutex>
+#include <atomic>
+#include <memory>
+#include <unordered_map>
+#include <string>
+#include <fstream>
+#include <chrono>
 #include "vulkan.h"
 
 #ifdef VGL_VULKAN_CORE_USE_VMA
@@ -30,6 +36,59 @@ namespace vgl
 {
   namespace core
   {
+    ///Snapshot of memory usage per heap & memory type, returned by VulkanMemoryManager::getStats() on both the built-in & VMA paths
+    struct VulkanMemoryStats
+    {
+      ///Suballocation size histogram buckets, bucket i counts sizes in [64 << i, 64 << (i+1)) bytes (the first & last buckets are open ended)
+      static const int HistogramBuckets = 20;
+
+      struct Usage
+      {
+        uint32_t blocks = 0, suballocations = 0, freeRegions = 0;
+        VkDeviceSize blockBytes = 0, usedBytes = 0, freeBytes = 0, largestFreeRegion = 0;
+        uint32_t sizeHistogram[HistogramBuckets] = {};
+
+        ///0 when all free space is a single region, approaching 1 as it splinters into many small ones
+        double fragmentation() const;
+        double utilization() const;
+
+        void addSuballocation(VkDeviceSize size);
+        void addFreeRegion(VkDeviceSize size);
+        void add(const Usage &other);
+      };
+
+      ///Block size tiers of the built-in manager (AT_SMALL, AT_MED, AT_LARGE & AT_DEDICATED), on the VMA path only the 
+      ///dedicated pools made by allocateDedicated() are broken out
+      enum Tier { TIER_SMALL = 0, TIER_MED, TIER_LARGE, TIER_DEDICATED, TIER_COUNT };
+
+      ///Lifetime pools of the built-in manager (indexed by VulkanMemoryManager::Lifetime), left empty on the VMA path
+      enum Pool { POOL_STATIC = 0, POOL_DYNAMIC, POOL_TRANSIENT, POOL_COUNT };
+
+      struct MemoryType
+      {
+        uint32_t heapIndex;
+        VkMemoryPropertyFlags propertyFlags;
+        Usage usage;
+        Usage tiers[TIER_COUNT];
+        Usage pools[POOL_COUNT];
+      };
+
+      struct Heap
+      {
+        VkDeviceSize size;
+        VkMemoryHeapFlags flags;
+        VkDeviceSize budget, budgetUsage; //from VulkanMemoryManager::getHeapBudget() where tracked, otherwise the heap size & our own usage
+        Usage usage;
+      };
+
+      std::vector<Heap> heaps;
+      std::vector<MemoryType> memoryTypes;
+      Usage total;
+
+      ///Compact single line JSON, suitable for logging once per frame
+      std::string toJson() const;
+    };
+
 #ifdef VGL_VULKAN_CORE_USE_VMA
     class VulkanMemoryManager
     {
@@ -39,6 +98,9 @@ namespace vgl
 
       static const uint64_t Any = 0;
 
+      ///On this path lifetimes aren't given pools of their own, transient allocations just ask VMA for its fastest placement strategy
+      enum Lifetime : uint8_t { LT_STATIC = 0, LT_DYNAMIC, LT_TRANSIENT };
+
       struct Suballocation
       {
       public:
@@ -50,6 +112,7 @@ namespace vgl
         void operator =(nullptr_t null) { allocationResult = VK_NOT_READY; }
         operator bool() const { return (allocationResult == VK_SUCCESS); }
         bool operator !() const { return (allocationResult != VK_SUCCESS); }
+        bool operator ==(const Suballocation &other) const { return (allocation == other.allocation); }
       };
 
       struct AllocationInfo
@@ -60,32 +123,78 @@ namespace vgl
 
         uint32_t size; //size in bytes
         uint32_t memoryType;
+        void *mappedData; //host address of offset (null unless the memory is host visible)
       };
 
-      Suballocation allocateBuffer(VkMemoryPropertyFlags properties, VkBuffer buffer, uint64_t allocationId=Any);
-      Suballocation allocateImage(VkMemoryPropertyFlags properties, VkImage image, uint64_t allocationId=Any);
+      Suballocation allocateBuffer(VkMemoryPropertyFlags properties, VkBuffer buffer, uint64_t allocationId=Any, Lifetime lifetime=LT_STATIC);
+      Suballocation allocateImage(VkMemoryPropertyFlags properties, VkImage image, uint64_t allocationId=Any, Lifetime lifetime=LT_STATIC);
       void free(const Suballocation &suballocation);
 
+      ///On this path, transient allocations are ordinary allocations that are freed along with their resource handles
+      Suballocation allocateTransientBuffer(VkMemoryPropertyFlags properties, VkBuffer buffer, uint64_t frameId);
+      inline void completeFrame(uint64_t completedFrameId) {}
+
+      ///Aliasing is not wired up on this path, every aliased image gets an ordinary allocation of its own
+      inline uint64_t newAliasId() { return aliasIds++; }
+      inline Suballocation allocateAliasedImage(VkMemoryPropertyFlags properties, VkImage image, uint64_t aliasId) { return allocateImage(properties, image); }
+
       void bindBufferMemory(VkBuffer buffer, Suballocation alloc);
       void bindImageMemory(VkImage image, Suballocation alloc);
 
       AllocationInfo getAllocationInfo(Suballocation alloc);
 
+      ///Host visible suballocations are persistently mapped by VMA, these forward to vmaFlushAllocation() & vmaInvalidateAllocation()
+      void flushAllocation(const Suballocation &suballocation, VkDeviceSize offset=0, VkDeviceSize size=VK_WHOLE_SIZE);
+      void invalidateAllocation(const Suballocation &suballocation, VkDeviceSize offset=0, VkDeviceSize size=VK_WHOLE_SIZE);
+
       void reclaimMemory();
 
+      class RelocationDelegate
+      {
+      public:
+        virtual ~RelocationDelegate() = default;
+        virtual bool relocate(const Suballocation &oldSuballocation, const Suballocation &newSuballocation, VkCommandBuffer commandBuffer) = 0;
+        virtual uint64_t getLastUsedFrameId() { return 0; }
+      };
+
+      ///Relocation is not wired up to VMA's own defragmentation yet, so these are no-ops on this path
+      inline void setRelocationDelegate(const Suballocation &suballocation, RelocationDelegate *delegate, VkDeviceSize requiredAlignment=0, 
+        uint32_t memoryTypeBits=0) {}
+      inline VkDeviceSize defragment(VkCommandBuffer commandBuffer, VkDeviceSize maxBytesMoved, double maxMilliseconds=0) { return 0; }
+
+      ///Residency balancing is not wired up to VMA's budget tracking yet, so these are no-ops on this path
+      inline void enableMemoryBudget(PFN_vkGetPhysicalDeviceMemoryProperties2KHR getMemoryProperties2) {}
+      inline void setBudgetSoftLimit(float fraction) {}
+      inline bool residencyBalanceNeeded() { return false; }
+      inline VkDeviceSize balanceResidency(VkCommandBuffer commandBuffer, VkDeviceSize maxBytesMoved) { return 0; }
+
       std::pair<VmaPool, uint64_t> allocateDedicated(uint32_t typeFilter, VkMemoryPropertyFlags properties, VkDeviceSize blockSize, 
         size_t maxBlocks, bool allowSuballocation=true, bool imageOptimal=false);
 
+      ///Memory type is picked like allocate() would, but on this path imported memory isn't counted by VMA's budgets or getStats()
+      VkDeviceMemory importHostMemory(uint32_t typeFilter, VkMemoryPropertyFlags properties, void *hostPointer, VkDeviceSize size);
+      void freeImportedMemory(VkDeviceMemory memory);
+
       bool isAllocationCoherent(const Suballocation &suballocation);
       bool isAllocationTypeCoherent(uint32_t typeFilter, VkMemoryPropertyFlags properties);
+      bool isAllocationDeviceLocal(const Suballocation &suballocation);
+
+      ///Cheap enough to call every frame, VMA's own statistics plus a size histogram of our suballocations
+      VulkanMemoryStats getStats();
 
       void dumpAllocationsInfo();
     protected:
       VmaAllocator allocator;
+      VkDevice device;
 
       //only used for (rare) dedicated allocations
       static const int MaxPools = 16;
       VmaPool pools[MaxPools];
+      uint32_t poolMemoryTypes[MaxPools];
+
+      std::atomic<uint32_t> sizeHistogram[VK_MAX_MEMORY_TYPES][VulkanMemoryStats::HistogramBuckets];
+      std::atomic<uint64_t> aliasIds = { 1 };
+      void countSuballocation(const Suballocation &suballocation, bool allocated);
 
       VkPhysicalDeviceMemoryProperties memoryProperties;
 
@@ -110,13 +219,30 @@ namespace vgl
         FM_SYNCHRONOUS
       };
 
+      ///How free pages are tracked and searched within each device memory allocation
+      enum FreeRegionStrategy
+      {
+        FRS_BEST_FIT_LIST,  //original sorted map of std::list regions (no merging)
+        FRS_TLSF            //two-level segregated fit, O(1) allocate & free with neighbor merging
+      };
+
       VulkanMemoryManager(VkPhysicalDevice physicalDevice, VkDevice device);
       ~VulkanMemoryManager();
 
+      ///Must be called before any memory manager is created to have an effect
+      static void setFreeRegionStrategy(FreeRegionStrategy strategy);
+      static void setAllocationStrategy(AllocationStrategy strategy);
+      static void setFreeMode(FreeMode mode);
+
+      ///When enabled, buffer requests smaller than half a page are packed into power-of-two sized slots carved out of shared page runs
+      ///instead of each taking a whole page.  Must be called before any memory manager is created to have an effect.
+      ///Currently, the default behavior is true
+      static void setSlabAllocationEnabled(bool enabled);
+
     protected:
-      enum AllocationType
+      enum AllocationType : uint8_t
       {
-        AT_SMALL = 0, AT_MED, AT_LARGE, AT_DEDICATED, AT_UNKNOWN
+        AT_SMALL = 0, AT_MED, AT_LARGE, AT_DEDICATED, AT_UNKNOWN, AT_SLAB, AT_TRANSIENT, AT_ALIASED
       };
 
       struct Subregion
@@ -135,39 +261,83 @@ namespace vgl
         bool operator()(const Subregion *a, const Subregion *b) const;
       };
 
-      struct Allocation
+      ///Two-level segregated fit index over the pages of one allocation.  Regions are referenced by index 
+      ///(not pointer or iterator) so suballocations stay small & can be validated against the region's id
+      class TlsfIndex
       {
-        VkDeviceMemory memory;
-        uint32_t size; //in pages
-        uint32_t suballocationCount;
-        uint32_t memoryType;
-        uint64_t id;
-        AllocationType type;
-        bool imageOptimal; //for now, the easiest way to deal with bufferImageGranularity & aliasing
-        std::list<Subregion> regions;
-        std::map<Subregion *, std::list<Subregion>::iterator, FreeRegionComparator> freeRegions;
+      public:
+        static const uint32_t NullRegion = 0xFFFFFFFF;
+
+        struct Region
+        {
+          uint32_t startPage, size;
+          uint32_t prevPhysical, nextPhysical;
+          uint32_t prevFree, nextFree;
+          uint64_t id;
+          bool free;
+        };
+
+        void reset(uint32_t sizeInPages, bool free, uint64_t id);
+        uint32_t allocate(uint32_t sizeInPages, uint32_t alignmentInPages, uint64_t id);
+        void free(uint32_t region);
+
+        inline bool empty() const { return regions.empty(); }
+        inline const Region &region(uint32_t r) const { return regions[r]; }
+        inline size_t regionCount() const { return regions.size()-unusedRegions.size(); }
+
+        ///Regions are enumerated in physical (page) order
+        template <typename F> void enumerate(F func) const
+        {
+          for(uint32_t r = (regions.empty() ? NullRegion : 0); r != NullRegion; r = regions[r].nextPhysical)
+            func(regions[r]);
+        }
+
+      protected:
+        static const int SlLog2 = 4, SlCount = (1<<SlLog2), FlCount = 29;
+
+        std::vector<Region> regions;
+        std::vector<uint32_t> unusedRegions;
+        std::vector<uint32_t> freeHeads;
+        uint32_t flBitmap = 0;
+        uint32_t slBitmaps[FlCount];
+
+        static void mapping(uint32_t size, int &fl, int &sl);
+        uint32_t findFree(uint32_t size);
+        void insertFree(uint32_t region);
+        void removeFree(uint32_t region);
+        uint32_t split(uint32_t region, uint32_t leftSize);
+        void absorb(uint32_t left, uint32_t right);
+        uint32_t newRegion();
       };
 
     public:
       static const uint64_t Any = 0;
 
+      ///How long an allocation is expected to live.  Each lifetime is placed in its own blocks so that frequently recreated
+      ///(dynamic) and short lived (transient) suballocations don't splinter the free space between long lived (static) ones
+      enum Lifetime : uint8_t
+      {
+        LT_STATIC = 0,  //meshes, textures & other resources that live until their owner is destroyed
+        LT_DYNAMIC,     //resources that are regularly reallocated or resized
+        LT_TRANSIENT    //staging & readback memory that is released within a few frames
+      };
+      static const int LifetimeCount = 3;
+
       ///Allocation & Freeing of suballocations /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+      ///A handle into the manager's slot table, which holds the memory, offset & size it refers to (see getAllocationInfo()).
+      ///Freeing a suballocation bumps its slot's generation, so stale copies of the handle are detected rather than followed
       struct Suballocation
       {
       public:
-        VkDeviceMemory memory;
-        VkDeviceSize offset;
-
-        uint32_t size; //size in pages
-        uint32_t memoryType;
-        uint64_t allocationId, subregionId;
-        std::list<Subregion>::iterator subregionIt;
+        uint32_t slot; //0 is null
+        uint32_t generation;
         
         Suballocation() = default;
-        Suballocation(nullptr_t null) : memory(VK_NULL_HANDLE) {}
-        void operator =(nullptr_t null) { memory = VK_NULL_HANDLE; }
-        operator bool() const { return (memory != VK_NULL_HANDLE); }
-        bool operator !() const { return (memory == VK_NULL_HANDLE); }
+        Suballocation(nullptr_t null) : slot(0), generation(0) {}
+        void operator =(nullptr_t null) { slot = 0; generation = 0; }
+        operator bool() const { return (slot != 0); }
+        bool operator !() const { return (slot == 0); }
+        bool operator ==(const Suballocation &other) const { return (slot == other.slot && generation == other.generation); }
       };
 
       struct AllocationInfo
@@ -178,29 +348,122 @@ namespace vgl
 
         uint32_t size; //size in bytes
         uint32_t memoryType;
+        void *mappedData; //host address of offset (null unless the memory is host visible)
       };
 
-      Suballocation allocateBuffer(VkMemoryPropertyFlags properties, VkBuffer buffer, uint64_t allocationId=Any);
-      Suballocation allocateImage(VkMemoryPropertyFlags properties, VkImage image, uint64_t allocationId=Any);
+      Suballocation allocateBuffer(VkMemoryPropertyFlags properties, VkBuffer buffer, uint64_t allocationId=Any, Lifetime lifetime=LT_STATIC);
+      Suballocation allocateImage(VkMemoryPropertyFlags properties, VkImage image, uint64_t allocationId=Any, Lifetime lifetime=LT_STATIC);
 
       void bindBufferMemory(VkBuffer buffer, Suballocation alloc);
       void bindImageMemory(VkImage image, Suballocation alloc);
 
       AllocationInfo getAllocationInfo(Suballocation alloc);
 
+      ///Host visible blocks are mapped once when they're made and stay mapped until they're freed, so AllocationInfo::mappedData can be used
+      ///directly instead of mapping per transfer.  For non-coherent memory types, flush after writing & invalidate before reading.  
+      ///offset & size are relative to the suballocation and are rounded out to nonCoherentAtomSize, both do nothing for coherent types
+      void flushAllocation(const Suballocation &suballocation, VkDeviceSize offset=0, VkDeviceSize size=VK_WHOLE_SIZE);
+      void invalidateAllocation(const Suballocation &suballocation, VkDeviceSize offset=0, VkDeviceSize size=VK_WHOLE_SIZE);
+
+      ///lifetime is ignored when allocating within a given allocationId
       Suballocation allocate(uint32_t typeFilter, VkMemoryPropertyFlags properties, VkDeviceSize requiredSize, VkDeviceSize requiredAlignment=0,
-        bool imageOptimal=false, uint64_t allocationId=Any);
+        bool imageOptimal=false, uint64_t allocationId=Any, Lifetime lifetime=LT_STATIC);
       void free(const Suballocation &suballocation);
 
+      ///Batched versions of allocate() & free() that only take each memory type's lock once for the entire batch.
+      ///Results are written in the same order as the requirements (null for any that failed)
+      void allocateMany(VkMemoryPropertyFlags properties, const VkMemoryRequirements *requirements, size_t count, Suballocation *results,
+        bool imageOptimal=false, uint64_t allocationId=Any, Lifetime lifetime=LT_STATIC);
+      void freeMany(const Suballocation *suballocations, size_t count);
+
+      ///Linearly allocates memory that only has to live until the given swapchain frame completes (staging buffers and the like).
+      ///Each allocation is a pointer bump within chunks owned by that frame, free() on the result does nothing, and all of a 
+      ///frame's allocations are reset at once by completeFrame()
+      Suballocation allocateTransient(uint32_t typeFilter, VkMemoryPropertyFlags properties, VkDeviceSize requiredSize, VkDeviceSize requiredAlignment, 
+        uint64_t frameId);
+      Suballocation allocateTransientBuffer(VkMemoryPropertyFlags properties, VkBuffer buffer, uint64_t frameId);
+
+      ///Resets the transient allocations of every frame id below completedFrameId (the swapchain calls this as frames complete)
+      void completeFrame(uint64_t completedFrameId);
+
+      ///Images that are never in use at the same time (such as render targets of passes that never overlap) can share memory.
+      ///Every image allocated with the same alias id is bound to the same suballocation, which is made for the first of them, so
+      ///allocate the largest first (an image that doesn't fit starts a new shared suballocation that later members then join).
+      ///The shared memory is freed along with the last image bound to it.  Contents are undefined whenever another alias was
+      ///used in between, see VulkanTexture::aliasBarrier()
+      uint64_t newAliasId();
+      Suballocation allocateAliasedImage(VkMemoryPropertyFlags properties, VkImage image, uint64_t aliasId);
+
+      ///Small suballocations freed on a thread are held in a per-thread cache and handed back to that thread's next matching allocate().
+      ///Cached suballocations are only returned to their allocations by reclaimMemory().  Has no effect in FM_SYNCHRONOUS mode or with FRS_BEST_FIT_LIST.
+      ///Currently, the default behavior is true
+      void setThreadCachingEnabled(bool enabled);
+
+      ///Implemented by the owners of suballocations that defragment() is allowed to move
+      class RelocationDelegate
+      {
+      public:
+        virtual ~RelocationDelegate() = default;
+
+        ///Should create & bind a replacement resource at newSuballocation, record a copy from the old one into commandBuffer, 
+        ///then retire the old resource (its memory is freed whenever its handle is finally released).  Return false to decline the move.
+        virtual bool relocate(const Suballocation &oldSuballocation, const Suballocation &newSuballocation, VkCommandBuffer commandBuffer) = 0;
+
+        ///Swapchain frame id the delegate's resources were last used in, balanceResidency() demotes the longest unused first
+        virtual uint64_t getLastUsedFrameId() { return 0; }
+      };
+
+      ///Marks a live suballocation as movable by defragment() & balanceResidency().  Pass a null delegate to unmark it again 
+      ///(freeing a suballocation also unmarks it).  requiredAlignment & memoryTypeBits should match the resource's memory requirements,
+      ///a memoryTypeBits of 0 keeps the suballocation within its current memory type
+      void setRelocationDelegate(const Suballocation &suballocation, RelocationDelegate *delegate, VkDeviceSize requiredAlignment=0,
+        uint32_t memoryTypeBits=0);
+
+      ///Incrementally empties sparsely used allocations by moving their suballocations into free space elsewhere within the same tier.
+      ///Only allocations whose suballocations all have relocation delegates are considered.  Copies are recorded into commandBuffer, 
+      ///which must be submitted before the current frame completes.  Stops once maxBytesMoved (or maxMilliseconds if non-zero) is used up
+      ///and returns the number of bytes moved.  Call this once per frame, emptied allocations are freed as their last old resource is released.
+      VkDeviceSize defragment(VkCommandBuffer commandBuffer, VkDeviceSize maxBytesMoved, double maxMilliseconds=0);
+
+      ///Memory budget & residency /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+      ///Uses VK_EXT_memory_budget for heap budgets & usage (the instance calls this when the extension is enabled).  Otherwise budgets 
+      ///are a fixed fraction of each heap's size, and only this manager's own allocations count towards usage
+      void enableMemoryBudget(PFN_vkGetPhysicalDeviceMemoryProperties2KHR getMemoryProperties2);
+
+      struct HeapBudget
+      {
+        VkDeviceSize usage;  //bytes allocated from the heap (by the entire process when the budget extension is used)
+        VkDeviceSize budget; //bytes the heap can hold before the driver starts paging things out
+      };
+      HeapBudget getHeapBudget(uint32_t heapIndex);
+
+      ///Fraction of each device local heap's budget that balanceResidency() keeps usage below.  Currently, the default is 0.9
+      void setBudgetSoftLimit(float fraction);
+
+      ///Re-queries heap budgets and returns true if a device local heap is over its soft limit, or has room to take demoted suballocations back
+      bool residencyBalanceNeeded();
+
+      ///Demotes the least recently used relocatable suballocations of device local heaps over their soft limit to host memory, and promotes 
+      ///the most recently used ones back once usage drops well below it.  Moves go through the relocation delegates just like defragment(), 
+      ///so commandBuffer must be submitted before the current frame completes.  Returns the number of bytes moved.
+      VkDeviceSize balanceResidency(VkCommandBuffer commandBuffer, VkDeviceSize maxBytesMoved);
+
       ///If free mode is set to AT_MANUAL, you'll need to call this before any actual Vulkan allocations are freed.  
-      ///Use caution when calling during event loop however, this can be a very expensive operation.
+      ///Outstanding suballocations stay valid across reclaims, so this is cheap enough to call once per frame.
       void reclaimMemory();
 
-      ///When using this function, the caller is entirely responsible for the returned memory object
+      ///When using this function, the caller is entirely responsible for the returned memory object (it is not mapped)
       VkDeviceMemory allocateDirect(uint32_t memoryType, VkDeviceSize requiredSize, bool imageOptimal=false);   
       std::pair<VkDeviceMemory, uint64_t> allocateDedicated(uint32_t typeFilter, VkMemoryPropertyFlags properties, VkDeviceSize blockSize, 
         size_t maxBlocks, bool allowSuballocation=true, bool imageOptimal=false);
 
+      ///Imports host memory through VK_EXT_external_memory_host (hostPointer must stay valid until the memory is freed).  The memory type is
+      ///picked among typeFilter just like allocate() picks one, and returns VK_NULL_HANDLE if none has the given properties.  Imported memory 
+      ///counts towards its heap's budget usage & the dedicated tier of getStats() until freeImportedMemory(), but isn't recorded in traces
+      VkDeviceMemory importHostMemory(uint32_t typeFilter, VkMemoryPropertyFlags properties, void *hostPointer, VkDeviceSize size);
+      void freeImportedMemory(VkDeviceMemory memory);
+
       ///Utilities to determine what kind of memory properties a suballocation has //////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
       ///If an allocation is coherent, it is not necessary to manually flush for CPU-made changes to reflect on the GPU
@@ -214,24 +477,183 @@ namespace vgl
       bool isAllocationDeviceLocal(const Suballocation &suballocation);
       bool isAllocationDeviceLocal(uint64_t allocationId);
 
+      struct SlabStats
+      {
+        size_t liveSlots;
+        VkDeviceSize slotBytes;         //bytes handed out in slots
+        VkDeviceSize runBytes;          //bytes of page runs the slots are carved from
+        VkDeviceSize pageGranularBytes; //bytes the same suballocations would take without slabs
+      };
+
+      ///Memory saved by the slab tier is pageGranularBytes - runBytes
+      SlabStats getSlabStats();
+
+      ///Walks the regions of every allocation (locking one memory type at a time), so it can be called every frame without stopping the app.
+      ///Slab page runs & transient chunks count as single suballocations
+      VulkanMemoryStats getStats();
+
       void dumpAllocationsInfo();
 
+      ///Allocation tracing /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+      enum TraceOp : uint8_t
+      {
+        TO_ALLOCATE = 0, TO_FREE, TO_DEDICATED, TO_RECLAIM, TO_FRAME
+      };
+
+      static const uint32_t TraceVersion = 2;
+
+      ///Written once at the start of a trace so it can be replayed against the same memory types & limits
+      struct TraceHeader
+      {
+        char magic[4]; //"VGLT"
+        uint32_t version;
+        VkPhysicalDeviceMemoryProperties memoryProperties;
+        VkDeviceSize minUniformBufferOffsetAlignment, minStorageBufferOffsetAlignment, nonCoherentAtomSize, bufferImageGranularity;
+      };
+
+      struct TraceRecord
+      {
+        uint64_t timestamp;    //nanoseconds since beginTrace()
+        uint64_t size;         //requested bytes (TO_DEDICATED: block size * max blocks, TO_FRAME: completed frame id)
+        uint64_t allocationId; //requested allocation id (TO_DEDICATED: the one created)
+        uint64_t handle;       //subregion id of the result (0 if it failed), pairs each TO_ALLOCATE with its TO_FREE
+        uint32_t slot;         //tlsf region or slab slot of the result
+        uint32_t alignment;
+        TraceOp op;
+        uint8_t memoryType, imageOptimal, allowSuballocation, lifetime;
+      };
+
+      ///Records every allocate(), free(), allocateDedicated(), reclaimMemory() & completeFrame() into a compact binary trace 
+      ///(a TraceHeader followed by TraceRecords) for tools/memreplay.  Transient allocations are not recorded.  Returns false if path can't be written
+      bool beginTrace(const std::string &path);
+      void endTrace();
+
     protected:
       static const int pageSize = 4096;
 
+      ///What a Suballocation handle refers to, only ever used within the manager
+      struct SuballocationRecord
+      {
+        VkDeviceMemory memory;
+        VkDeviceSize offset;
+
+        uint32_t size; //size in pages (in bytes for slab slots & transient allocations)
+        uint32_t memoryType;
+
+        //allocation ids are generational handles into the allocations pool, subregion ids are checked against the region they name
+        //so stale records are detected rather than followed
+        uint64_t allocationId, subregionId;
+        uint32_t tlsfRegion;
+        AllocationType allocationType;
+        bool imageOptimal;
+        Lifetime lifetime;
+
+        SuballocationRecord() = default;
+        SuballocationRecord(nullptr_t) : memory(VK_NULL_HANDLE) {}
+        operator bool() const { return (memory != VK_NULL_HANDLE); }
+        bool operator !() const { return (memory == VK_NULL_HANDLE); }
+      };
+
+      //handles index into chunks of slots that are never moved, so the record of a live handle can be read without a lock.
+      //each memory type recycles its own free slots under its type lock, new chunks are made under managerLock
+      struct HandleSlot
+      {
+        SuballocationRecord record;
+        std::atomic<uint32_t> generation = { 0 };
+      };
+
+      static const uint32_t handleChunkSize = 4096, maxHandleChunks = 4096;
+      HandleSlot *handleChunks[maxHandleChunks] = {};
+      std::atomic<uint32_t> handleSlotCount = { 1 };
+      std::vector<uint32_t> freeHandleSlots[VK_MAX_MEMORY_TYPES];
+
+      inline HandleSlot &handleSlot(uint32_t slot) { return handleChunks[slot / handleChunkSize][slot % handleChunkSize]; }
+      SuballocationRecord *recordFor(const Suballocation &suballocation);
+      Suballocation newHandleLocked(const SuballocationRecord &record);
+      void releaseHandleLocked(const Suballocation &suballocation);
+
+      struct Relocatable
+      {
+        RelocationDelegate *delegate;
+        Suballocation suballocation;
+        VkDeviceSize alignment;
+        uint32_t memoryTypeBits;
+      };
+
+      struct Allocation
+      {
+        VkDeviceMemory memory;
+        VkDeviceSize bytes; //size of memory, size below is rounded up to pages
+        void *mapped; //host visible blocks stay mapped for their entire life
+        uint32_t size; //in pages
+        uint32_t suballocationCount;
+        uint32_t memoryType;
+        uint32_t generation; //bumped each time the pool slot is recycled
+        uint64_t id;
+        AllocationType type;
+        Lifetime lifetime; //only suballocations of the same lifetime share an allocation (unless the heap runs low)
+        bool imageOptimal; //for now, the easiest way to deal with bufferImageGranularity & aliasing
+        bool defragSource; //being evacuated by defragment(), nothing new is placed here
+        std::list<Subregion> regions;
+        std::map<Subregion *, std::list<Subregion>::iterator, FreeRegionComparator> freeRegions;
+        std::unordered_map<uint64_t, std::list<Subregion>::iterator> regionsById;
+        TlsfIndex tlsf;
+        std::map<uint64_t, Relocatable> relocatables; //keyed by subregion id
+        std::atomic<uint32_t> trackedSuballocations; //relocatable or retiring suballocations within, read by threadCacheFree() without the type lock
+      };
+
       static AllocationStrategy allocationStrategy;
       static FreeMode freeMode;
+      static FreeRegionStrategy freeRegionStrategy;
       static VkDeviceSize allocSizeBoundaries[2][3];
 
-      //calls to all public methods will be synchronized across threads
+      //allocate() & free() only lock the memory type they operate on, managerLock guards the allocations pool
+      //(lock order is always type locks in ascending order, then managerLock)
+      std::mutex typeLocks[VK_MAX_MEMORY_TYPES];
       std::mutex managerLock;
 
+      struct ThreadCache
+      {
+        std::mutex lock;
+        VulkanMemoryManager *owner;
+        std::unordered_map<uint64_t, std::vector<Suballocation>> entries;
+      };
+
+      static const uint32_t threadCacheMaxPages = 16, threadCacheMaxEntries = 32;
+      std::mutex threadCachesLock;
+      std::vector<std::shared_ptr<ThreadCache>> threadCaches;
+      std::atomic<bool> threadCachingEnabled;
+
+      ThreadCache *currentThreadCache();
+      bool threadCacheAllocate(uint32_t memoryType, VkDeviceSize requiredSize, VkDeviceSize requiredAlignment, bool imageOptimal, Lifetime lifetime, 
+        Suballocation &result);
+      bool threadCacheFree(const Suballocation &suballocation, const SuballocationRecord &record);
+      void drainThreadCaches();
+
       uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
-      VkDeviceMemory makeNewAllocation(uint32_t memoryType, AllocationType type, bool imageOptimal);
-      Suballocation findSuballocation(uint32_t memoryType, VkDeviceSize requiredSize, VkDeviceSize requiredAlignment, AllocationType type, bool imageOptimal, uint64_t allocationId);
+      VkDeviceMemory makeNewAllocation(uint32_t memoryType, AllocationType type, bool imageOptimal, Lifetime lifetime);
+      SuballocationRecord allocateLocked(uint32_t memoryType, VkDeviceSize requiredSize, VkDeviceSize requiredAlignment, bool imageOptimal, uint64_t allocationId, 
+        Lifetime lifetime);
+      void freeLocked(const SuballocationRecord &suballocation);
+      void freeGrouped(const Suballocation *suballocations, size_t count);
+      SuballocationRecord findSuballocation(uint32_t memoryType, VkDeviceSize requiredSize, VkDeviceSize requiredAlignment, AllocationType type, bool imageOptimal, 
+        uint64_t allocationId, Lifetime lifetime);
       void cleanupAllocations();
+      void initRegions(Allocation &allocation, bool free);
+      void endDefragSource(Allocation &allocation);
+      void releaseAllocationMemory(Allocation &allocation);
+      void setRelocatableLocked(Allocation &allocation, uint64_t subregionId, const Relocatable &relocatable);
+      void eraseRelocatableLocked(Allocation &allocation, uint64_t subregionId);
+      bool isPromotable(uint32_t memoryType, uint32_t memoryTypeBits);
+      Allocation *reservePoolAllocation(uint32_t memoryType);
+      void releasePoolAllocation(Allocation *allocation);
+      Allocation *allocationForId(uint64_t allocationId);
 
-      std::pair<VkDeviceMemory, uint64_t> allocateDedicated(uint32_t memoryType, VkDeviceSize requiredSize, bool allowSuballocation=true, bool imageOptimal=false);
+      std::pair<VkDeviceMemory, uint64_t> allocateDedicated(uint32_t memoryType, VkDeviceSize requiredSize, bool allowSuballocation=true, bool imageOptimal=false,
+        Lifetime lifetime=LT_STATIC);
+      void mapAllocation(Allocation &allocation);
+      bool mappedRange(const SuballocationRecord &suballocation, VkDeviceSize offset, VkDeviceSize size, VkMappedMemoryRange &range);
 
       VkPhysicalDevice physicalDevice;
       VkPhysicalDeviceMemoryProperties memoryProperties;
@@ -239,16 +661,116 @@ namespace vgl
       std::list<Subregion>::iterator divideSubregion(Allocation &allocation, std::list<Subregion>::iterator region, uint32_t sizeInPages);
       void mergeSubregions(Allocation &allocation, std::list<Subregion>::iterator region1, std::list<Subregion>::iterator region2);
 
-      Allocation *allocationForId(uint64_t allocationId);
+      VkMemoryPropertyFlags memoryPropertiesForId(uint64_t allocationId);
+      VkMemoryPropertyFlags memoryPropertiesFor(const Suballocation &suballocation);
 
       VkDevice device;
-      Allocation *allocationsPool;
+      Allocation *allocationsPool; //fixed slots, never moved (so region pointers & iterators within them stay valid)
+      std::vector<uint32_t> freeAllocationSlots;
       std::vector<Allocation *> allocations[VK_MAX_MEMORY_TYPES];
-      std::map<uint64_t, uint64_t> allocationsMap[VK_MAX_MEMORY_TYPES];
-      uint64_t lowMemoryFlags = 0;
-      size_t allocatedBytes = 0; //across all heaps
+
+      struct ImportedMemory
+      {
+        uint32_t memoryType;
+        VkDeviceSize size;
+      };
+      std::unordered_map<VkDeviceMemory, ImportedMemory> importedMemory; //guarded by managerLock
+      std::atomic<uint64_t> lowMemoryFlags = { 0 };
+      std::atomic<size_t> allocatedBytes = { 0 }; //across all heaps
+      std::atomic<uint32_t> defragSources = { 0 };
       //std::vector<Subregion> subregionPools[VK_MAX_MEMORY_TYPES];
-      uint64_t allocationIds = 1, subregionIds = 1, ai = 0, invalidatedSubregionIds = 0;
+      std::atomic<uint64_t> subregionIds = { 1 };
+
+      //slab slots of each size class are carved from page runs of slabSlotCount slots, one bit per slot.  A slab reserves a block of
+      //slabSlotCount subregion ids starting at its own, one per slot
+      static bool slabsEnabled;
+      static const uint32_t slabMinSlotSize = 64, slabMaxSlotSize = pageSize/2, slabClassCount = 6, slabSlotCount = 64;
+
+      struct Slab
+      {
+        SuballocationRecord run;
+        uint64_t freeSlots;
+        uint32_t slotSize;
+        Lifetime lifetime; //the partial list it's on (the run itself may have landed in another lifetime's block when memory is low)
+      };
+
+      VkDeviceSize bufferOffsetAlignment = 1, slabBaseSlotSize = slabMinSlotSize, nonCoherentAtomSize = 1;
+      std::unordered_map<uint64_t, Slab> slabs[VK_MAX_MEMORY_TYPES];
+      std::vector<uint64_t> partialSlabs[VK_MAX_MEMORY_TYPES][LifetimeCount][slabClassCount];
+      std::atomic<size_t> slabLiveSlots = { 0 };
+      std::atomic<VkDeviceSize> slabSlotBytes = { 0 }, slabRunBytes = { 0 };
+
+      SuballocationRecord slabAllocateLocked(uint32_t memoryType, VkDeviceSize requiredSize, VkDeviceSize requiredAlignment, Lifetime lifetime);
+      void slabFreeLocked(const SuballocationRecord &suballocation);
+      void releaseSlabLocked(uint32_t memoryType, uint64_t slabId);
+
+      //transient allocations bump through chunks owned by their frame, chunks return to a small free list when the frame completes
+      static const VkDeviceSize transientChunkSize = (4<<20);
+      static const size_t transientMaxFreeChunks = 4;
+
+      struct TransientChunk
+      {
+        SuballocationRecord block;
+        VkDeviceSize size, head;
+      };
+
+      struct TransientFrame
+      {
+        std::vector<TransientChunk> chunks;
+        std::vector<Suballocation> handles; //released along with the chunks
+      };
+
+      std::map<uint64_t, TransientFrame> transientFrames[VK_MAX_MEMORY_TYPES];
+      std::vector<TransientChunk> transientFreeChunks[VK_MAX_MEMORY_TYPES];
+
+      //aliased images each get their own handle to a copy of a shared suballocation (marked AT_ALIASED), which is freed once its last copy is
+      //(lock order is aliasLock, then type locks)
+      struct AliasedRange
+      {
+        Suballocation shared;
+        VkDeviceSize size;
+        uint32_t refCount;
+      };
+
+      std::mutex aliasLock;
+      std::unordered_map<uint64_t, AliasedRange> aliasedRanges; //keyed by subregion id of the shared suballocation
+      std::unordered_map<uint64_t, uint64_t> aliasGroups; //alias id -> subregion id of the range new members join
+      std::atomic<uint64_t> aliasIds = { 1 };
+
+      void freeAliased(const Suballocation &suballocation, const SuballocationRecord &record);
+
+      //per heap accounting for budgets, block bytes are whole device memory allocations, used bytes are live suballocations within them.
+      //suballocations moved by balanceResidency() are retiring until their old resource is released, and no longer count as used
+      static const float budgetPromoteMargin, budgetFallbackFraction;
+      PFN_vkGetPhysicalDeviceMemoryProperties2KHR getMemoryProperties2 = nullptr;
+      float budgetSoftLimit = 0.9f;
+      uint32_t deviceLocalTypes = 0, hostTypes = 0;
+
+      std::atomic<VkDeviceSize> heapBlockBytes[VK_MAX_MEMORY_HEAPS], heapUsedBytes[VK_MAX_MEMORY_HEAPS], heapRetiringBytes[VK_MAX_MEMORY_HEAPS];
+      std::atomic<size_t> promotableRelocatables = { 0 };
+      std::unordered_map<uint64_t, VkDeviceSize> retiringSuballocations[VK_MAX_MEMORY_TYPES]; //keyed by subregion id
+
+      //trace records are buffered & written out in batches by traceRecord()
+      static const size_t traceBufferRecords = 4096;
+      std::atomic<bool> tracing = { false };
+      std::mutex traceLock;
+      std::ofstream traceFile;
+      std::vector<TraceRecord> traceBuffer;
+      std::chrono::steady_clock::time_point traceStart;
+
+      void traceRecord(TraceRecord record);
+      void traceAllocation(uint32_t memoryType, VkDeviceSize requiredSize, VkDeviceSize requiredAlignment, bool imageOptimal, uint64_t allocationId, Lifetime lifetime, 
+        const Suballocation &result);
+      void flushTraceLocked();
+
+      std::mutex budgetLock;
+      VkDeviceSize queriedHeapUsage[VK_MAX_MEMORY_HEAPS], queriedHeapBudget[VK_MAX_MEMORY_HEAPS], queriedHeapBlockBytes[VK_MAX_MEMORY_HEAPS];
+
+      void updateBudget();
+      VkDeviceSize heapPressure(uint32_t heapIndex, const HeapBudget &budget);
+      void releaseEmptyAllocations(uint32_t heapIndex);
+      void retireLocked(const SuballocationRecord &suballocation, bool retiring);
+      std::atomic<uint32_t> ai = { 0 };
     };
 #endif
   }
@@ -0,0 +1,248 @@
+/*********************************************************************
+Copyright 2018 VERTO STUDIO LLC.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+***************************************************************************/
+
+#include "pch.h"
+#include <fstream>
+#ifdef WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include "VulkanInstance.h"
+#include "VulkanBufferGroup.h"
+#include "VulkanMeshFile.h"
+
+using namespace std;
+
+namespace vgl
+{
+  namespace core
+  {
+    VulkanMeshFile::VulkanMeshFile()
+    {
+    }
+
+    VulkanMeshFile::~VulkanMeshFile()
+    {
+      close();
+    }
+
+    bool VulkanMeshFile::open(const string &path)
+    {
+      close();
+
+#ifdef WIN32
+      HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+      if(file == INVALID_HANDLE_VALUE)
+        return false;
+
+      LARGE_INTEGER fileSize;
+      HANDLE mapping = nullptr;
+      if(GetFileSizeEx(file, &fileSize) && fileSize.QuadPart >= (LONGLONG)sizeof(Header))
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+      if(!mapping)
+      {
+        CloseHandle(file);
+        return false;
+      }
+
+      fileHandle = file;
+      mappingHandle = mapping;
+      mappedSize = (size_t)fileSize.QuadPart;
+      mappedData = (const uint8_t *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+      int fd = ::open(path.c_str(), O_RDONLY);
+      if(fd < 0)
+        return false;
+
+      struct stat fileStat;
+      if(fstat(fd, &fileStat) != 0 || fileStat.st_size < (off_t)sizeof(Header))
+      {
+        ::close(fd);
+        return false;
+      }
+
+      void *mapping = mmap(nullptr, (size_t)fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      //the mapping keeps the file referenced on its own
+      ::close(fd);
+      if(mapping == MAP_FAILED)
+        return false;
+
+      //streams are read front to back once, so ask for aggressive read-ahead
+      madvise(mapping, (size_t)fileStat.st_size, MADV_SEQUENTIAL);
+      mappedSize = (size_t)fileStat.st_size;
+      mappedData = (const uint8_t *)mapping;
+#endif
+
+      if(!mappedData || !validate())
+      {
+        if(mappedData)
+          verr << "VulkanMeshFile:  " << path << " is not a valid mesh file" << endl;
+        close();
+        return false;
+      }
+
+      return true;
+    }
+
+    void VulkanMeshFile::close()
+    {
+#ifdef WIN32
+      if(mappedData)
+        UnmapViewOfFile(mappedData);
+      if(mappingHandle)
+        CloseHandle((HANDLE)mappingHandle);
+      if(fileHandle)
+        CloseHandle((HANDLE)fileHandle);
+#else
+      if(mappedData)
+        munmap((void *)mappedData, mappedSize);
+#endif
+
+      mappedData = nullptr;
+      mappedSize = 0;
+      fileHandle = mappingHandle = nullptr;
+    }
+
+    bool VulkanMeshFile::validate()
+    {
+      auto &header = getHeader();
+      auto fits = [this](uint64_t offset, uint64_t size) {
+        return offset <= mappedSize && size <= mappedSize - offset;
+      };
+
+      if(header.magic != magic || header.version != version)
+        return false;
+      if(!fits(sizeof(Header), (uint64_t)header.streamCount * sizeof(Stream)))
+        return false;
+
+      for(uint32_t i = 0; i < header.streamCount; i++)
+      {
+        auto &stream = getStream(i);
+        if((stream.offset % dataAlignment) || stream.size != (uint64_t)stream.stride * header.vertexCount || !fits(stream.offset, stream.size))
+          return false;
+      }
+
+      if(header.indexCount)
+      {
+        if((header.indexSize != 2 && header.indexSize != 4) || (header.indexOffset % dataAlignment) || 
+          !fits(header.indexOffset, (uint64_t)header.indexCount * header.indexSize))
+          return false;
+      }
+
+      if(header.lodCount)
+      {
+        if((header.lodOffset % alignof(Lod)) || !fits(header.lodOffset, (uint64_t)header.lodCount * sizeof(Lod)))
+          return false;
+
+        auto lods = getLods();
+        for(uint32_t i = 0; i < header.lodCount; i++)
+        {
+          if((uint64_t)lods[i].firstIndex + lods[i].indexCount > header.indexCount)
+            return false;
+        }
+      }
+
+      return true;
+    }
+
+    void VulkanMeshFile::upload(VulkanBufferGroup *vertexBuffers, VulkanBufferGroup *indexBuffer, int firstBufferIndex, size_t chunkBytes)
+    {
+      if(!isOpen())
+        throw vgl_runtime_error("VulkanMeshFile::upload() called without an open mesh file");
+
+      //one batch for the whole mesh, unless its streams overflow the upload ring
+      auto batcher = VulkanInstance::currentInstance().getUploadBatcher();
+      batcher->begin();
+
+      auto &header = getHeader();
+      if(vertexBuffers)
+      {
+        for(uint32_t i = 0; i < header.streamCount; i++)
+          vertexBuffers->streamData(firstBufferIndex + (int)i, getStreamData(i), (size_t)getStream(i).size, chunkBytes);
+      }
+      if(indexBuffer && header.indexCount)
+        indexBuffer->streamData(0, getIndexData(), (size_t)header.indexCount * header.indexSize, chunkBytes);
+
+      batcher->end();
+    }
+
+    bool VulkanMeshFile::write(const string &path, uint32_t vertexCount, const vector<StreamData> &streams, const void *indices, 
+      uint32_t indexCount, uint32_t indexSize, const vector<Lod> &lods)
+    {
+      auto align = [](uint64_t offset) { return (offset + dataAlignment - 1) / dataAlignment * dataAlignment; };
+
+      Header header = {};
+      header.magic = magic;
+      header.version = version;
+      header.vertexCount = vertexCount;
+      header.indexCount = indexCount;
+      header.streamCount = (uint32_t)streams.size();
+      header.lodCount = (uint32_t)lods.size();
+      header.indexSize = indexSize;
+
+      //the small tables come first, then each data block on its own page
+      header.lodOffset = sizeof(Header) + streams.size() * sizeof(Stream);
+      uint64_t offset = align(header.lodOffset + lods.size() * sizeof(Lod));
+
+      vector<Stream> streamTable;
+      for(auto &source : streams)
+      {
+        Stream stream = {};
+        stream.format = (uint32_t)source.format;
+        stream.stride = source.stride;
+        stream.offset = offset;
+        stream.size = (uint64_t)source.stride * vertexCount;
+        streamTable.push_back(stream);
+        offset = align(offset + stream.size);
+      }
+      header.indexOffset = offset;
+
+      ofstream outf(path, ios::binary);
+      if(!outf)
+        return false;
+
+      auto pad = [&outf](uint64_t to) {
+        static const char zeros[dataAlignment] = {};
+        uint64_t at = (uint64_t)outf.tellp();
+        if(to > at)
+          outf.write(zeros, (streamsize)(to - at));
+      };
+
+      outf.write((const char *)&header, sizeof(Header));
+      outf.write((const char *)streamTable.data(), (streamsize)(streamTable.size() * sizeof(Stream)));
+      outf.write((const char *)lods.data(), (streamsize)(lods.size() * sizeof(Lod)));
+      for(size_t i = 0; i < streams.size(); i++)
+      {
+        pad(streamTable[i].offset);
+        outf.write((const char *)streams[i].data, (streamsize)streamTable[i].size);
+      }
+      if(indexCount)
+      {
+        pad(header.indexOffset);
+        outf.write((const char *)indices, (streamsize)((uint64_t)indexCount * indexSize));
+      }
+
+      return (bool)outf;
+    }
+  }
+}
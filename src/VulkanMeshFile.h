@@ -0,0 +1,102 @@
+/*********************************************************************
+Copyright 2018 VERTO STUDIO LLC.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+***************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <string>
+#include "vulkan.h"
+
+namespace vgl
+{
+  namespace core
+  {
+    class VulkanBufferGroup;
+
+    ///A memory mapped .vglmesh file:  a header, a table of vertex streams, page aligned vertex & index data and an optional LOD table.
+    ///Streams are read straight out of the mapping (the OS pages them in as they're copied to the GPU), so loading a mesh is bounded by 
+    ///disk bandwidth and never holds a second CPU copy of it.  All values are little endian
+    class VulkanMeshFile
+    {
+    public:
+      static const uint32_t magic = 0x4d4c4756; //"VGLM"
+      static const uint32_t version = 1;
+      static const uint64_t dataAlignment = 4096;
+
+      struct Header
+      {
+        uint32_t magic, version;
+        uint32_t vertexCount, indexCount;
+        uint32_t streamCount, lodCount;
+        uint32_t indexSize, reserved; //2 or 4 bytes per index
+        uint64_t indexOffset, lodOffset;
+      };
+
+      ///One per vertex attribute stream, each holding vertexCount elements of stride bytes
+      struct Stream
+      {
+        uint32_t format, stride; //format is a VkFormat
+        uint64_t offset, size;
+      };
+
+      ///Index range of one level of detail, finest first
+      struct Lod
+      {
+        uint32_t firstIndex, indexCount;
+        float error; //object space error of this level, for picking one by screen size
+        uint32_t reserved;
+      };
+
+      ///Source data for write()
+      struct StreamData
+      {
+        VkFormat format;
+        uint32_t stride;
+        const void *data;
+      };
+
+      VulkanMeshFile();
+      ~VulkanMeshFile();
+
+      ///Maps the file, returns false if it can't be opened or isn't a valid mesh file
+      bool open(const std::string &path);
+      void close();
+      inline bool isOpen() { return mappedData != nullptr; }
+
+      inline const Header &getHeader() { return *(const Header *)mappedData; }
+      inline const Stream &getStream(int streamIndex) { return ((const Stream *)(mappedData + sizeof(Header)))[streamIndex]; }
+      inline const void *getStreamData(int streamIndex) { return mappedData + getStream(streamIndex).offset; }
+      inline const void *getIndexData() { return mappedData + getHeader().indexOffset; }
+      inline const Lod *getLods() { return (const Lod *)(mappedData + getHeader().lodOffset); }
+
+      ///Streams each vertex stream into its own buffer of vertexBuffers (starting at firstBufferIndex) and the indices into buffer 0 of 
+      ///indexBuffer (may be null).  The file can be closed as soon as this returns
+      void upload(VulkanBufferGroup *vertexBuffers, VulkanBufferGroup *indexBuffer, int firstBufferIndex=0, size_t chunkBytes=4*1024*1024);
+
+      ///Writes a mesh file, indexSize is the size of each index in bytes (2 or 4)
+      static bool write(const std::string &path, uint32_t vertexCount, const std::vector<StreamData> &streams, const void *indices, 
+        uint32_t indexCount, uint32_t indexSize, const std::vector<Lod> &lods={});
+
+    protected:
+      const uint8_t *mappedData = nullptr;
+      size_t mappedSize = 0;
+      void *fileHandle = nullptr, *mappingHandle = nullptr;
+
+      bool validate();
+    };
+  }
+}
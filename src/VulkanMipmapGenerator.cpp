@@ -0,0 +1,386 @@
+/*********************************************************************
+Copyright 2018 VERTO STUDIO LLC.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+***************************************************************************/
+
+#include "pch.h"
+#include <algorithm>
+#include "VulkanInstance.h"
+#include "VulkanMipmapGenerator.h"
+#include "VulkanAsyncResourceHandle.h"
+#include "VulkanShaderProgram.h"
+#include "VulkanDescriptorSetLayout.h"
+#include "VulkanPipeline.h"
+
+using namespace std;
+
+namespace vgl
+{
+  namespace core
+  {
+    VulkanMipmapGenerator::VulkanMipmapGenerator(VkDevice device)
+      : device(device)
+    {
+    }
+
+    VulkanMipmapGenerator::~VulkanMipmapGenerator()
+    {
+      for(auto &downsampler : downsamplers) if(downsampler.second.pipeline)
+      {
+        delete downsampler.second.pipeline;
+        delete downsampler.second.setLayout;
+        delete downsampler.second.shader;
+      }
+    }
+
+    //image formats the downsampling shader can be compiled for (sRGB & compressed formats can't be storage images anyway)
+    static const char *glslImageFormat(VkFormat format)
+    {
+      switch(format)
+      {
+        case VK_FORMAT_R8_UNORM: return "r8";
+        case VK_FORMAT_R8G8_UNORM: return "rg8";
+        case VK_FORMAT_R8G8B8A8_UNORM: return "rgba8";
+        case VK_FORMAT_R16_SFLOAT: return "r16f";
+        case VK_FORMAT_R16G16_SFLOAT: return "rg16f";
+        case VK_FORMAT_R16G16B16A16_SFLOAT: return "rgba16f";
+        case VK_FORMAT_R16G16B16A16_UNORM: return "rgba16";
+        case VK_FORMAT_R32_SFLOAT: return "r32f";
+        case VK_FORMAT_R32G32_SFLOAT: return "rg32f";
+        case VK_FORMAT_R32G32B32A32_SFLOAT: return "rgba32f";
+        case VK_FORMAT_A2B10G10R10_UNORM_PACK32: return "rgb10_a2";
+        case VK_FORMAT_B10G11R11_UFLOAT_PACK32: return "r11f_g11f_b10f";
+        default: return nullptr;
+      }
+    }
+
+    VulkanMipmapGenerator::Method VulkanMipmapGenerator::methodFor(VkFormat format)
+    {
+      auto features = VulkanInstance::currentInstance().getFormatFeatures(format);
+      bool blittable = (features & VK_FORMAT_FEATURE_BLIT_SRC_BIT) && (features & VK_FORMAT_FEATURE_BLIT_DST_BIT);
+
+      if(blittable && (features & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT))
+        return M_LINEAR_BLIT;
+#ifdef VGL_VULKAN_USE_SHADERC
+      if((features & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT) && glslImageFormat(format))
+        return M_COMPUTE;
+#endif
+      if(blittable)
+        return M_NEAREST_BLIT;
+
+      return M_UNSUPPORTED;
+    }
+
+    bool VulkanMipmapGenerator::needsStorageUsage(VkFormat format)
+    {
+      return (methodFor(format) == M_COMPUTE);
+    }
+
+    VulkanAsyncResourceHandle *VulkanMipmapGenerator::generate(VkCommandBuffer commandBuffer, VkImage image, VkFormat format, uint32_t width, 
+      uint32_t height, uint32_t numLevels, uint32_t baseLayer, uint32_t layerCount)
+    {
+      //a single level has nothing to downsample, the blit path just hands it to the shaders
+      auto method = (numLevels > 1) ? methodFor(format) : M_LINEAR_BLIT;
+
+      switch(method)
+      {
+        case M_COMPUTE:
+          if(auto downsampler = downsamplerFor(format))
+            return downsample(commandBuffer, downsampler, image, format, width, height, numLevels, baseLayer, layerCount);
+
+          //the shader didn't build, so there's no filtering left but nearest (when the format can at least be blitted)
+          if(!(VulkanInstance::currentInstance().getFormatFeatures(format) & VK_FORMAT_FEATURE_BLIT_SRC_BIT))
+            throw vgl_runtime_error("Unable to build the mipmap downsampling shader for this texture format!");
+          blit(commandBuffer, image, width, height, numLevels, baseLayer, layerCount, VK_FILTER_NEAREST);
+          return nullptr;
+        case M_NEAREST_BLIT:
+          blit(commandBuffer, image, width, height, numLevels, baseLayer, layerCount, VK_FILTER_NEAREST);
+          return nullptr;
+        case M_UNSUPPORTED:
+          throw vgl_runtime_error("Texture image format does not support blitting or compute downsampling for mipmaps!");
+        default:
+          blit(commandBuffer, image, width, height, numLevels, baseLayer, layerCount, VK_FILTER_LINEAR);
+          return nullptr;
+      }
+    }
+
+    void VulkanMipmapGenerator::blit(VkCommandBuffer commandBuffer, VkImage image, uint32_t width, uint32_t height, uint32_t numLevels, 
+      uint32_t baseLayer, uint32_t layerCount, VkFilter filter)
+    {
+      VkImageMemoryBarrier barrier = {};
+      barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+      barrier.image = image;
+      barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+      barrier.subresourceRange.baseArrayLayer = baseLayer;
+      barrier.subresourceRange.layerCount = layerCount;
+      barrier.subresourceRange.levelCount = 1;
+      barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+      barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+      barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+      barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+      VkImageBlit blit = {};
+      blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+      blit.srcSubresource.baseArrayLayer = baseLayer;
+      blit.srcSubresource.layerCount = layerCount;
+      blit.dstSubresource = blit.srcSubresource;
+
+      int32_t mipWidth = width;
+      int32_t mipHeight = height;
+
+      //one barrier & one blit per level, covering every layer
+      for(uint32_t i = 1; i < numLevels; i++) 
+      {
+        barrier.subresourceRange.baseMipLevel = i - 1;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+        blit.srcSubresource.mipLevel = i - 1;
+        blit.srcOffsets[1] = { mipWidth, mipHeight, 1 };
+        blit.dstSubresource.mipLevel = i;
+        blit.dstOffsets[1] = { (mipWidth > 1) ? mipWidth / 2 : 1, (mipHeight > 1) ? mipHeight / 2 : 1, 1 };
+        vkCmdBlitImage(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, filter);
+
+        if(mipWidth > 1) 
+          mipWidth /= 2;
+        if(mipHeight > 1) 
+          mipHeight /= 2;
+      }
+
+      //then every level is handed to the shaders at once, the last one straight from being written
+      VkImageMemoryBarrier readBarriers[2] = { barrier, barrier };
+      uint32_t numReadBarriers = 0;
+
+      if(numLevels > 1)
+      {
+        auto &sourceLevels = readBarriers[numReadBarriers++];
+        sourceLevels.subresourceRange.baseMipLevel = 0;
+        sourceLevels.subresourceRange.levelCount = numLevels - 1;
+        sourceLevels.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        sourceLevels.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        sourceLevels.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        sourceLevels.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+      }
+
+      auto &lastLevel = readBarriers[numReadBarriers++];
+      lastLevel.subresourceRange.baseMipLevel = numLevels - 1;
+      lastLevel.subresourceRange.levelCount = 1;
+      lastLevel.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+      lastLevel.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+      lastLevel.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+      lastLevel.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+      vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 
+        0, 0, nullptr, 0, nullptr, numReadBarriers, readBarriers);
+    }
+
+    VulkanMipmapGenerator::ComputeDownsampler *VulkanMipmapGenerator::downsamplerFor(VkFormat format)
+    {
+      lock_guard<mutex> locker(lock);
+
+      string imageFormat = glslImageFormat(format);
+      auto it = downsamplers.find(imageFormat);
+      if(it != downsamplers.end())
+        return (it->second.pipeline) ? &it->second : nullptr;
+
+      //a failed build is remembered too, so it isn't retried for every texture
+      auto &downsampler = downsamplers[imageFormat];
+      downsampler = {};
+
+#ifdef VGL_VULKAN_USE_SHADERC
+      //box filters each 2x2 block of the level above (clamped at odd edges) for every layer
+      string source = 
+        "#version 450\n"
+        "layout(local_size_x = 8, local_size_y = 8) in;\n"
+        "layout(set = 0, binding = 0, " + imageFormat + ") uniform readonly image2DArray srcLevel;\n"
+        "layout(set = 0, binding = 1, " + imageFormat + ") uniform writeonly image2DArray dstLevel;\n"
+        "void main()\n"
+        "{\n"
+        "  ivec3 dst = ivec3(gl_GlobalInvocationID);\n"
+        "  ivec3 dstSize = imageSize(dstLevel);\n"
+        "  if(dst.x >= dstSize.x || dst.y >= dstSize.y)\n"
+        "    return;\n"
+        "  ivec2 srcMax = imageSize(srcLevel).xy - 1;\n"
+        "  ivec2 src = dst.xy*2;\n"
+        "  vec4 sum = imageLoad(srcLevel, ivec3(min(src, srcMax), dst.z)) + imageLoad(srcLevel, ivec3(min(src + ivec2(1, 0), srcMax), dst.z)) +\n"
+        "    imageLoad(srcLevel, ivec3(min(src + ivec2(0, 1), srcMax), dst.z)) + imageLoad(srcLevel, ivec3(min(src + ivec2(1, 1), srcMax), dst.z));\n"
+        "  imageStore(dstLevel, dst, sum*0.25);\n"
+        "}\n";
+
+      auto shader = new VulkanShaderProgram(device);
+      if(!shader->addShaderGLSL(VulkanShaderProgram::ST_COMPUTE, source))
+      {
+        verr << "Vulkan Warning:  Could not build the mipmap downsampling shader:  " << shader->getShaderCompilationLogs() << endl;
+        delete shader;
+        return nullptr;
+      }
+
+      VkDescriptorSetLayoutBinding bindings[2] = {};
+      for(uint32_t i = 0; i < 2; i++)
+      {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+      }
+
+      VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+      layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+      layoutInfo.bindingCount = 2;
+      layoutInfo.pBindings = bindings;
+
+      downsampler.shader = shader;
+      downsampler.setLayout = new VulkanDescriptorSetLayout(device, layoutInfo);
+      downsampler.pipeline = new VulkanPipeline(device, nullptr, VK_NULL_HANDLE, shader, nullptr, &downsampler.setLayout, 1,
+        VulkanInstance::currentInstance().getPipelineCache());
+
+      return &downsampler;
+#else
+      return nullptr;
+#endif
+    }
+
+    VulkanAsyncResourceHandle *VulkanMipmapGenerator::downsample(VkCommandBuffer commandBuffer, ComputeDownsampler *downsampler, VkImage image, 
+      VkFormat format, uint32_t width, uint32_t height, uint32_t numLevels, uint32_t baseLayer, uint32_t layerCount)
+    {
+      //one view & descriptor set per level, living until the commands complete
+      uint32_t numSets = numLevels - 1;
+      vector<VkImageView> views(numLevels, VK_NULL_HANDLE);
+      VkDescriptorPool pool = VK_NULL_HANDLE;
+
+      auto destroyViews = [this, &views] {
+        for(auto view : views) if(view)
+          vkDestroyImageView(device, view, nullptr);
+      };
+
+      VkImageViewCreateInfo viewInfo = {};
+      viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+      viewInfo.image = image;
+      viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+      viewInfo.format = format;
+      viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+      viewInfo.subresourceRange.levelCount = 1;
+      viewInfo.subresourceRange.baseArrayLayer = baseLayer;
+      viewInfo.subresourceRange.layerCount = layerCount;
+
+      for(uint32_t i = 0; i < numLevels; i++)
+      {
+        viewInfo.subresourceRange.baseMipLevel = i;
+        if(vkCreateImageView(device, &viewInfo, nullptr, &views[i]) != VK_SUCCESS)
+        {
+          views[i] = VK_NULL_HANDLE;
+          destroyViews();
+          throw vgl_runtime_error("Failed to create mipmap level image view!");
+        }
+      }
+
+      VkDescriptorPoolSize poolSize = {};
+      poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+      poolSize.descriptorCount = 2*numSets;
+
+      VkDescriptorPoolCreateInfo poolInfo = {};
+      poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+      poolInfo.poolSizeCount = 1;
+      poolInfo.pPoolSizes = &poolSize;
+      poolInfo.maxSets = numSets;
+
+      vector<VkDescriptorSet> sets(numSets);
+      vector<VkDescriptorSetLayout> setLayouts(numSets, downsampler->setLayout->get());
+      VkDescriptorSetAllocateInfo allocInfo = {};
+      allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+      allocInfo.descriptorSetCount = numSets;
+      allocInfo.pSetLayouts = setLayouts.data();
+
+      if(vkCreateDescriptorPool(device, &poolInfo, nullptr, &pool) == VK_SUCCESS)
+      {
+        allocInfo.descriptorPool = pool;
+        if(vkAllocateDescriptorSets(device, &allocInfo, sets.data()) != VK_SUCCESS)
+        {
+          vkDestroyDescriptorPool(device, pool, nullptr);
+          pool = VK_NULL_HANDLE;
+        }
+      }
+      if(!pool)
+      {
+        destroyViews();
+        throw vgl_runtime_error("Failed to allocate mipmap downsampling descriptor sets!");
+      }
+
+      vector<VkDescriptorImageInfo> imageInfos(numLevels);
+      vector<VkWriteDescriptorSet> writes(2*numSets);
+      for(uint32_t i = 0; i < numLevels; i++)
+        imageInfos[i] = { VK_NULL_HANDLE, views[i], VK_IMAGE_LAYOUT_GENERAL };
+      for(uint32_t i = 0; i < 2*numSets; i++)
+      {
+        auto &write = writes[i];
+        write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        write.dstSet = sets[i/2];
+        write.dstBinding = i%2;
+        write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        write.descriptorCount = 1;
+        write.pImageInfo = &imageInfos[i/2 + i%2];
+      }
+      vkUpdateDescriptorSets(device, (uint32_t)writes.size(), writes.data(), 0, nullptr);
+
+      VkImageMemoryBarrier barrier = {};
+      barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+      barrier.image = image;
+      barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+      barrier.subresourceRange.baseArrayLayer = baseLayer;
+      barrier.subresourceRange.layerCount = layerCount;
+      barrier.subresourceRange.levelCount = numLevels;
+      barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+      barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+      barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+      barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+      vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+      auto pipeline = downsampler->pipeline;
+      vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline->get());
+
+      //each level's writes are made visible to the next level's reads with one barrier covering every layer
+      VkMemoryBarrier levelBarrier = {};
+      levelBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+      levelBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+      levelBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+      for(uint32_t i = 1; i < numLevels; i++)
+      {
+        uint32_t mipWidth = max(width >> i, 1u), mipHeight = max(height >> i, 1u);
+
+        if(i > 1)
+          vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &levelBarrier, 0, nullptr, 0, nullptr);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline->getLayout(), 0, 1, &sets[i-1], 0, nullptr);
+        vkCmdDispatch(commandBuffer, (mipWidth + 7) / 8, (mipHeight + 7) / 8, layerCount);
+      }
+
+      barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+      barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+      barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+      barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+      vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 
+        0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+      auto &instance = VulkanInstance::currentInstance();
+      return VulkanAsyncResourceHandle::newFunction(instance.getResourceMonitor(), device, [device = device, views, pool] {
+        for(auto view : views)
+          vkDestroyImageView(device, view, nullptr);
+        vkDestroyDescriptorPool(device, pool, nullptr);
+      });
+    }
+  }
+}
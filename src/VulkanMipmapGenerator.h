@@ -0,0 +1,73 @@
+/*********************************************************************
+Copyright 2018 VERTO STUDIO LLC.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+***************************************************************************/
+
+#pragma once
+
+#include <map>
+#include <string>
+#include <mutex>
+#include "vulkan.h"
+
+namespace vgl
+{
+  namespace core
+  {
+    class VulkanAsyncResourceHandle;
+    class VulkanShaderProgram;
+    class VulkanDescriptorSetLayout;
+    class VulkanPipeline;
+
+    ///Builds texture mip chains, owned by the instance.  Each level is blitted for every layer (or cube face) at once behind one merged
+    ///barrier.  Formats that can't be linearly blitted are downsampled by a compute shader instead (when built with shaderc) and 
+    ///failing that, blitted with nearest filtering
+    class VulkanMipmapGenerator
+    {
+    public:
+      VulkanMipmapGenerator(VkDevice device);
+      ~VulkanMipmapGenerator();
+
+      ///True if images of this format need storage usage for generate() to downsample them with compute
+      bool needsStorageUsage(VkFormat format);
+
+      ///Records the chain of layers [baseLayer, baseLayer+layerCount) of an image whose levels are all in transfer destination layout 
+      ///(with level 0 written), leaving every level shader readable.  The returned handle (if any) must be kept until the commands complete
+      VulkanAsyncResourceHandle *generate(VkCommandBuffer commandBuffer, VkImage image, VkFormat format, uint32_t width, uint32_t height, 
+        uint32_t numLevels, uint32_t baseLayer, uint32_t layerCount);
+
+    protected:
+      enum Method { M_LINEAR_BLIT, M_COMPUTE, M_NEAREST_BLIT, M_UNSUPPORTED };
+
+      struct ComputeDownsampler
+      {
+        VulkanShaderProgram *shader;
+        VulkanDescriptorSetLayout *setLayout;
+        VulkanPipeline *pipeline;
+      };
+
+      VkDevice device;
+      std::map<std::string, ComputeDownsampler> downsamplers; //keyed by glsl image format
+      std::mutex lock;
+
+      Method methodFor(VkFormat format);
+      ComputeDownsampler *downsamplerFor(VkFormat format);
+
+      void blit(VkCommandBuffer commandBuffer, VkImage image, uint32_t width, uint32_t height, uint32_t numLevels, uint32_t baseLayer, 
+        uint32_t layerCount, VkFilter filter);
+      VulkanAsyncResourceHandle *downsample(VkCommandBuffer commandBuffer, ComputeDownsampler *downsampler, VkImage image, VkFormat format, 
+        uint32_t width, uint32_t height, uint32_t numLevels, uint32_t baseLayer, uint32_t layerCount);
+    };
+  }
+}
@@ -0,0 +1,237 @@
+/*********************************************************************
+Copyright 2018 VERTO STUDIO LLC.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+***************************************************************************/
+
+#include "pch.h"
+#include <string.h>
+#include "VulkanReadback.h"
+#include "VulkanInstance.h"
+#include "VulkanTexelConverter.h"
+
+using namespace std;
+
+namespace vgl
+{
+  namespace core
+  {
+    VulkanReadback::VulkanReadback()
+    {
+      ready = false;
+    }
+
+    void VulkanReadback::then(Callback callback)
+    {
+      unique_lock<mutex> locker(lock);
+
+      if(!ready.load())
+      {
+        this->callback = callback;
+        return;
+      }
+      locker.unlock();
+
+      if(callback)
+        callback(data.data(), data.size());
+    }
+
+    void VulkanReadback::resolve(const void *bytes, size_t numBytes)
+    {
+      unique_lock<mutex> locker(lock);
+
+      data.resize(numBytes);
+      if(bgraToRgba)
+      {
+        VulkanTexelConverter::swizzleRedBlue(bytes, data.data(), numBytes/4);
+      }
+      else if(numBytes)
+      {
+        memcpy(data.data(), bytes, numBytes);
+      }
+
+      ready = true;
+      auto resolvedCallback = move(callback);
+      callback = nullptr;
+      locker.unlock();
+
+      if(resolvedCallback)
+        resolvedCallback(data.data(), data.size());
+    }
+
+    VulkanReadbackPool::VulkanReadbackPool(VkDevice device, VulkanMemoryManager *memoryManager, VulkanAsyncResourceMonitor *resourceMonitor, 
+      VulkanUploadBatcher *batcher)
+      : device(device), memoryManager(memoryManager), resourceMonitor(resourceMonitor), batcher(batcher)
+    {
+    }
+
+    VulkanReadbackPool::~VulkanReadbackPool()
+    {
+      trim();
+    }
+
+    void VulkanReadbackPool::trim()
+    {
+      lock_guard<mutex> locker(lock);
+
+      for(auto &entry : freeBuffers)
+        destroy(entry.second);
+      freeBuffers.clear();
+      pooledBytes = 0;
+    }
+
+    void VulkanReadbackPool::destroy(const PooledBuffer &pooledBuffer)
+    {
+      vkDestroyBuffer(device, pooledBuffer.buffer, nullptr);
+      memoryManager->free(pooledBuffer.allocation);
+    }
+
+    void VulkanReadbackPool::acquire(VulkanReadback &readback, VkDeviceSize numBytes)
+    {
+      VkDeviceSize capacity = minCapacity;
+      while(capacity < numBytes)
+        capacity <<= 1;
+
+      PooledBuffer pooledBuffer = {};
+      {
+        lock_guard<mutex> locker(lock);
+
+        auto it = freeBuffers.find(capacity);
+        if(it != freeBuffers.end())
+        {
+          pooledBuffer = it->second;
+          pooledBytes -= capacity;
+          freeBuffers.erase(it);
+        }
+      }
+
+      if(!pooledBuffer.buffer)
+      {
+        VkBufferCreateInfo bufferInfo = {};
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.size = capacity;
+        bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+        if(vkCreateBuffer(device, &bufferInfo, nullptr, &pooledBuffer.buffer) != VK_SUCCESS)
+          throw vgl_runtime_error("Failed to create readback buffer!");
+
+        //cached memory makes the host's reads of the results fast, coherent memory will do where there isn't any
+        pooledBuffer.allocation = memoryManager->allocateBuffer(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT, 
+          pooledBuffer.buffer, VulkanMemoryManager::Any, VulkanMemoryManager::LT_DYNAMIC);
+        if(!pooledBuffer.allocation)
+        {
+          pooledBuffer.allocation = memoryManager->allocateBuffer(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 
+            pooledBuffer.buffer, VulkanMemoryManager::Any, VulkanMemoryManager::LT_DYNAMIC);
+        }
+        if(!pooledBuffer.allocation)
+        {
+          vkDestroyBuffer(device, pooledBuffer.buffer, nullptr);
+          throw vgl_runtime_error("Failed to allocate readback buffer!");
+        }
+        memoryManager->bindBufferMemory(pooledBuffer.buffer, pooledBuffer.allocation);
+
+        pooledBuffer.mappedData = (uint8_t *)memoryManager->getAllocationInfo(pooledBuffer.allocation).mappedData;
+        if(!pooledBuffer.mappedData)
+          throw vgl_runtime_error("Unable to map readback buffer!");
+      }
+
+      readback.buffer = pooledBuffer.buffer;
+      readback.allocation = pooledBuffer.allocation;
+      readback.mappedData = pooledBuffer.mappedData;
+      readback.size = numBytes;
+      readback.capacity = capacity;
+    }
+
+    void VulkanReadbackPool::resolve(const shared_ptr<VulkanReadback> &readback)
+    {
+      memoryManager->invalidateAllocation(readback->allocation, 0, readback->size);
+      readback->resolve(readback->mappedData, (size_t)readback->size);
+
+      PooledBuffer pooledBuffer = { readback->buffer, readback->allocation, readback->mappedData };
+      readback->buffer = VK_NULL_HANDLE;
+      readback->allocation = nullptr;
+      readback->mappedData = nullptr;
+
+      lock_guard<mutex> locker(lock);
+      if(pooledBytes + readback->capacity > maxPooledBytes)
+      {
+        destroy(pooledBuffer);
+      }
+      else
+      {
+        freeBuffers.emplace(readback->capacity, pooledBuffer);
+        pooledBytes += readback->capacity;
+      }
+    }
+
+    shared_ptr<VulkanReadback> VulkanReadbackPool::read(VkDeviceSize numBytes, VkCommandBuffer commandBuffer, bool frame, 
+      const vector<VulkanAsyncResourceHandle *> &sources, RecordCopy recordCopy, bool bgraToRgba)
+    {
+      auto readback = make_shared<VulkanReadback>();
+      readback->bgraToRgba = bgraToRgba;
+      acquire(*readback, numBytes);
+
+      //a readback without a command buffer gets a batch submit of its own, so the transfers batched before & after it (whose 
+      //batch barriers order them around it) can't write what it reads too early or too late
+      bool standalone = !commandBuffer;
+      if(standalone)
+      {
+        batcher->begin();
+        batcher->flush();
+        commandBuffer = batcher->record();
+      }
+
+      VkMemoryBarrier barrier = {};
+      barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+      barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+      barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+      vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+      recordCopy(commandBuffer, readback->buffer);
+
+      barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+      barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+      vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+      //the readback resolves (and hands its buffer back) when the monitor lets go of this
+      auto pool = this;
+      auto resolveHandle = VulkanAsyncResourceHandle::newFunction(resourceMonitor, device, [pool, readback] {
+        pool->resolve(readback);
+      });
+      auto handles = sources;
+      handles.push_back(resolveHandle);
+
+      if(standalone)
+      {
+        batcher->track(handles);
+        batcher->flush();
+        batcher->end();
+      }
+      else if(frame)
+      {
+        uint64_t frameId = VulkanInstance::currentInstance().getSwapChain()->getCurrentFrameId();
+        VulkanAsyncResourceCollection frameResources(resourceMonitor, frameId, handles);
+        resourceMonitor->append(move(frameResources));
+      }
+      else
+      {
+        //committed to the transfer command buffer, whose fence is provided when it's finally submitted
+        VulkanAsyncResourceCollection transferResources(resourceMonitor, (VulkanAsyncResourceHandle *)nullptr, handles);
+        resourceMonitor->append(move(transferResources));
+      }
+      resolveHandle->release();
+
+      return readback;
+    }
+  }
+}
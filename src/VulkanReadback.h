@@ -0,0 +1,114 @@
+/*********************************************************************
+Copyright 2018 VERTO STUDIO LLC.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+***************************************************************************/
+
+#pragma once
+
+#include "vulkan.h"
+#include "VulkanMemoryManager.h"
+#include "VulkanAsyncResourceHandle.h"
+#include "VulkanUploadBatcher.h"
+#include <vector>
+#include <map>
+#include <mutex>
+#include <memory>
+#include <atomic>
+#include <functional>
+
+namespace vgl
+{
+  namespace core
+  {
+    ///The pending result of VulkanBufferGroup::readDataAsync() or VulkanTexture::readImageDataAsync().  It resolves once the commands 
+    ///copying it complete (as noticed by the resource monitor's poll), so the thread recording the copy never waits on the GPU
+    class VulkanReadback
+    {
+    public:
+      typedef std::function<void(const void *data, size_t numBytes)> Callback;
+
+      VulkanReadback();
+
+      inline bool isReady() { return ready.load(); }
+
+      ///The bytes read back, empty until isReady()
+      inline const std::vector<uint8_t> &getData() { return data; }
+
+      ///Calls back from the thread polling the resource monitor once resolved (right away if it already has)
+      void then(Callback callback);
+
+    protected:
+      std::vector<uint8_t> data;
+      std::atomic_bool ready;
+      Callback callback;
+      std::mutex lock;
+
+      VkBuffer buffer = VK_NULL_HANDLE;
+      VulkanMemoryManager::Suballocation allocation = nullptr;
+      VkDeviceSize size = 0, capacity = 0;
+      uint8_t *mappedData = nullptr;
+      bool bgraToRgba = false;
+
+      void resolve(const void *bytes, size_t numBytes);
+
+      friend class VulkanReadbackPool;
+    };
+
+    ///Host cached buffers that readbacks are copied into, so repeated readbacks (screenshots, picking) reuse the same memory.
+    ///Buffers are bucketed by power of two capacity and return to the pool as their readbacks resolve
+    class VulkanReadbackPool
+    {
+    public:
+      VulkanReadbackPool(VkDevice device, VulkanMemoryManager *memoryManager, VulkanAsyncResourceMonitor *resourceMonitor, VulkanUploadBatcher *batcher);
+      ~VulkanReadbackPool();
+
+      typedef std::function<void(VkCommandBuffer commandBuffer, VkBuffer dst)> RecordCopy;
+
+      ///Records a readback of numBytes, with recordCopy filling the pooled buffer (from offset 0) between barriers ordering it after earlier 
+      ///writes & before host reads.  sources are retained until the copy completes.  commandBuffer must be the instance's transfer command 
+      ///buffer, frame=true ties completion to the current frame instead, and without one the copy is submitted right away (or with the current batch)
+      std::shared_ptr<VulkanReadback> read(VkDeviceSize numBytes, VkCommandBuffer commandBuffer, bool frame, 
+        const std::vector<VulkanAsyncResourceHandle *> &sources, RecordCopy recordCopy, bool bgraToRgba=false);
+
+      ///Pooled buffers beyond this many bytes are freed instead of kept
+      inline void setMaxPooledBytes(VkDeviceSize bytes) { maxPooledBytes = bytes; }
+
+      ///Frees every pooled buffer not currently in use
+      void trim();
+
+    protected:
+      struct PooledBuffer
+      {
+        VkBuffer buffer;
+        VulkanMemoryManager::Suballocation allocation;
+        uint8_t *mappedData;
+      };
+
+      VkDevice device;
+      VulkanMemoryManager *memoryManager;
+      VulkanAsyncResourceMonitor *resourceMonitor;
+      VulkanUploadBatcher *batcher;
+
+      std::multimap<VkDeviceSize, PooledBuffer> freeBuffers; //keyed by capacity
+      VkDeviceSize pooledBytes = 0, maxPooledBytes = 64*1024*1024;
+      std::mutex lock;
+
+      static const VkDeviceSize minCapacity = 65536;
+
+      void acquire(VulkanReadback &readback, VkDeviceSize numBytes);
+      void resolve(const std::shared_ptr<VulkanReadback> &readback);
+      void destroy(const PooledBuffer &pooledBuffer);
+    };
+  }
+}
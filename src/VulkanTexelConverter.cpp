@@ -0,0 +1,824 @@
+/*********************************************************************
+Copyright 2018 VERTO STUDIO LLC.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+***************************************************************************/
+
+#include "pch.h"
+#include <string.h>
+#include <math.h>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+#include "VulkanTexelConverter.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define VGL_TEXEL_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define VGL_TEXEL_TARGET(isa)
+#else
+#include <cpuid.h>
+#define VGL_TEXEL_TARGET(isa) __attribute__((target(isa)))
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+#define VGL_TEXEL_NEON
+#include <arm_neon.h>
+#endif
+
+using namespace std;
+
+namespace vgl
+{
+  namespace core
+  {
+    typedef VulkanTexelConverter TC;
+
+    static atomic<int> maxSimdLevel(TC::SL_NEON);
+    static atomic<size_t> parallelThreshold(4*1024*1024);
+    static atomic<unsigned> maxThreads(max(1u, min(thread::hardware_concurrency(), 8u)));
+
+    static TC::SimdLevel detectSimdLevel()
+    {
+#if defined(VGL_TEXEL_X86)
+      int info[4] = {};
+      auto cpuid = [&info](int leaf) {
+#ifdef _MSC_VER
+        __cpuidex(info, leaf, 0);
+#else
+        unsigned a, b, c, d;
+        __cpuid_count(leaf, 0, a, b, c, d);
+        info[0] = (int)a; info[1] = (int)b; info[2] = (int)c; info[3] = (int)d;
+#endif
+      };
+
+      cpuid(0);
+      int maxLeaf = info[0];
+      cpuid(1);
+      bool sse2 = (info[3] & (1 << 26)) != 0, ssse3 = (info[2] & (1 << 9)) != 0;
+      bool osxsave = (info[2] & (1 << 27)) != 0, avx = (info[2] & (1 << 28)) != 0, f16c = (info[2] & (1 << 29)) != 0;
+      bool avx2 = false;
+      if(maxLeaf >= 7)
+      {
+        cpuid(7);
+        avx2 = (info[1] & (1 << 5)) != 0;
+      }
+
+      //the OS also has to save the ymm registers across context switches
+      bool ymmSaved = false;
+      if(osxsave && avx)
+      {
+#ifdef _MSC_VER
+        ymmSaved = (_xgetbv(0) & 6) == 6;
+#else
+        unsigned lo, hi;
+        __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+        ymmSaved = (lo & 6) == 6;
+#endif
+      }
+
+      if(avx2 && f16c && ymmSaved)
+        return TC::SL_AVX2;
+      if(ssse3)
+        return TC::SL_SSSE3;
+      if(sse2)
+        return TC::SL_SSE2;
+      return TC::SL_SCALAR;
+#elif defined(VGL_TEXEL_NEON)
+      return TC::SL_NEON;
+#else
+      return TC::SL_SCALAR;
+#endif
+    }
+
+    static int simdLevel()
+    {
+      static const int detected = (int)detectSimdLevel();
+      return min(detected, maxSimdLevel.load());
+    }
+
+    ///Runs convert over [0, count) on up to maxThreads threads once the output is large enough to be worth it
+    static void parallelFor(size_t count, size_t outputBytesPerItem, const function<void(size_t begin, size_t end)> &convert)
+    {
+      unsigned threads = maxThreads.load();
+      if(threads <= 1 || count*outputBytesPerItem <= parallelThreshold.load())
+      {
+        convert(0, count);
+        return;
+      }
+
+      //items are split in multiples of 64 so that threads never share a cache line of output
+      size_t perThread = ((count + threads - 1) / threads + 63) & ~(size_t)63;
+      vector<thread> workers;
+      size_t begin = perThread;
+      for(; begin < count; begin += perThread)
+      {
+        size_t end = min(begin + perThread, count);
+        workers.emplace_back([&convert, begin, end] { convert(begin, end); });
+      }
+      convert(0, min(perThread, count));
+
+      for(auto &worker : workers)
+        worker.join();
+    }
+
+    //ranges writing more than this won't still be cached by the time they're read, so the x86 kernels of conversions that are otherwise
+    //bound by memory bandwidth write them with non-temporal stores (which skip reading in each destination line before it's overwritten)
+    static const size_t streamingStoreBytes = 2*1024*1024;
+
+    ///Returns true if a range of n pixels should be streamed, along with the number of pixels to convert first to bring dst to 32 byte alignment
+    static bool streamingHead(const void *dst, size_t n, size_t outputBytesPerPixel, size_t &head)
+    {
+      auto address = (uintptr_t)dst;
+      if(n*outputBytesPerPixel < streamingStoreBytes || address % outputBytesPerPixel)
+        return false;
+
+      head = ((32 - (address & 31)) & 31) / outputBytesPerPixel;
+      return true;
+    }
+
+    //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    //8 bit channel shuffles, each SIMD kernel returns the number of pixels it converted and the scalar loop finishes the rest
+
+#ifdef VGL_TEXEL_X86
+    VGL_TEXEL_TARGET("avx2") static size_t rgbToRgbaAvx2(const uint8_t *src, uint8_t *dst, size_t n, uint8_t alpha)
+    {
+      const __m256i mask = _mm256_setr_epi8(0, 1, 2, -128, 3, 4, 5, -128, 6, 7, 8, -128, 9, 10, 11, -128,
+        0, 1, 2, -128, 3, 4, 5, -128, 6, 7, 8, -128, 9, 10, 11, -128);
+      const __m256i alphaBits = _mm256_set1_epi32((int)((uint32_t)alpha << 24));
+      size_t i = 0;
+
+      //each half loads 16 bytes for its 12, so stop while the second load still stays within src
+      for(; i + 10 <= n; i += 8)
+      {
+        __m128i lo = _mm_loadu_si128((const __m128i *)(src + i*3));
+        __m128i hi = _mm_loadu_si128((const __m128i *)(src + i*3 + 12));
+        __m256i rgb = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+        _mm256_storeu_si256((__m256i *)(dst + i*4), _mm256_or_si256(_mm256_shuffle_epi8(rgb, mask), alphaBits));
+      }
+      return i;
+    }
+
+    VGL_TEXEL_TARGET("ssse3") static size_t rgbToRgbaSsse3(const uint8_t *src, uint8_t *dst, size_t n, uint8_t alpha)
+    {
+      const __m128i mask = _mm_setr_epi8(0, 1, 2, -128, 3, 4, 5, -128, 6, 7, 8, -128, 9, 10, 11, -128);
+      const __m128i alphaBits = _mm_set1_epi32((int)((uint32_t)alpha << 24));
+      size_t i = 0;
+
+      for(; i + 16 <= n; i += 16)
+      {
+        const uint8_t *s = src + i*3;
+        __m128i a = _mm_loadu_si128((const __m128i *)s);
+        __m128i b = _mm_loadu_si128((const __m128i *)(s + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *)(s + 32));
+        __m128i *d = (__m128i *)(dst + i*4);
+
+        _mm_storeu_si128(d, _mm_or_si128(_mm_shuffle_epi8(a, mask), alphaBits));
+        _mm_storeu_si128(d + 1, _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(b, a, 12), mask), alphaBits));
+        _mm_storeu_si128(d + 2, _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(c, b, 8), mask), alphaBits));
+        _mm_storeu_si128(d + 3, _mm_or_si128(_mm_shuffle_epi8(_mm_srli_si128(c, 4), mask), alphaBits));
+      }
+      return i;
+    }
+
+    VGL_TEXEL_TARGET("ssse3") static size_t rgbaToRgbSsse3(const uint8_t *src, uint8_t *dst, size_t n)
+    {
+      const __m128i mask = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -128, -128, -128, -128);
+      size_t i = 0;
+
+      for(; i + 16 <= n; i += 16)
+      {
+        const __m128i *s = (const __m128i *)(src + i*4);
+        __m128i p0 = _mm_shuffle_epi8(_mm_loadu_si128(s), mask);
+        __m128i p1 = _mm_shuffle_epi8(_mm_loadu_si128(s + 1), mask);
+        __m128i p2 = _mm_shuffle_epi8(_mm_loadu_si128(s + 2), mask);
+        __m128i p3 = _mm_shuffle_epi8(_mm_loadu_si128(s + 3), mask);
+        __m128i *d = (__m128i *)(dst + i*3);
+
+        _mm_storeu_si128(d, _mm_or_si128(p0, _mm_slli_si128(p1, 12)));
+        _mm_storeu_si128(d + 1, _mm_or_si128(_mm_srli_si128(p1, 4), _mm_slli_si128(p2, 8)));
+        _mm_storeu_si128(d + 2, _mm_or_si128(_mm_srli_si128(p2, 8), _mm_slli_si128(p3, 4)));
+      }
+      return i;
+    }
+
+    VGL_TEXEL_TARGET("avx2") static size_t swizzleRedBlueAvx2(const uint8_t *src, uint8_t *dst, size_t n, bool stream)
+    {
+      const __m256i mask = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+        2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+      size_t i = 0;
+
+      for(; i + 8 <= n; i += 8)
+      {
+        __m256i v = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(src + i*4)), mask);
+        if(stream)
+          _mm256_stream_si256((__m256i *)(dst + i*4), v);
+        else
+          _mm256_storeu_si256((__m256i *)(dst + i*4), v);
+      }
+      if(stream)
+        _mm_sfence();
+      return i;
+    }
+
+    VGL_TEXEL_TARGET("ssse3") static size_t swizzleRedBlueSsse3(const uint8_t *src, uint8_t *dst, size_t n, bool stream)
+    {
+      const __m128i mask = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+      size_t i = 0;
+
+      for(; i + 4 <= n; i += 4)
+      {
+        __m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + i*4)), mask);
+        if(stream)
+          _mm_stream_si128((__m128i *)(dst + i*4), v);
+        else
+          _mm_storeu_si128((__m128i *)(dst + i*4), v);
+      }
+      if(stream)
+        _mm_sfence();
+      return i;
+    }
+
+    VGL_TEXEL_TARGET("sse2") static size_t swizzleRedBlueSse2(const uint8_t *src, uint8_t *dst, size_t n, bool stream)
+    {
+      const __m128i greenAlpha = _mm_set1_epi32((int)0xff00ff00), redBlue = _mm_set1_epi32(0x00ff00ff);
+      size_t i = 0;
+
+      for(; i + 4 <= n; i += 4)
+      {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i*4));
+        __m128i rb = _mm_and_si128(v, redBlue);
+        rb = _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16));
+        v = _mm_or_si128(_mm_and_si128(v, greenAlpha), rb);
+        if(stream)
+          _mm_stream_si128((__m128i *)(dst + i*4), v);
+        else
+          _mm_storeu_si128((__m128i *)(dst + i*4), v);
+      }
+      if(stream)
+        _mm_sfence();
+      return i;
+    }
+#endif
+
+#ifdef VGL_TEXEL_NEON
+    static size_t rgbToRgbaNeon(const uint8_t *src, uint8_t *dst, size_t n, uint8_t alpha)
+    {
+      size_t i = 0;
+
+      for(; i + 16 <= n; i += 16)
+      {
+        uint8x16x3_t rgb = vld3q_u8(src + i*3);
+        uint8x16x4_t rgba;
+        rgba.val[0] = rgb.val[0];
+        rgba.val[1] = rgb.val[1];
+        rgba.val[2] = rgb.val[2];
+        rgba.val[3] = vdupq_n_u8(alpha);
+        vst4q_u8(dst + i*4, rgba);
+      }
+      return i;
+    }
+
+    static size_t rgbaToRgbNeon(const uint8_t *src, uint8_t *dst, size_t n)
+    {
+      size_t i = 0;
+
+      for(; i + 16 <= n; i += 16)
+      {
+        uint8x16x4_t rgba = vld4q_u8(src + i*4);
+        uint8x16x3_t rgb;
+        rgb.val[0] = rgba.val[0];
+        rgb.val[1] = rgba.val[1];
+        rgb.val[2] = rgba.val[2];
+        vst3q_u8(dst + i*3, rgb);
+      }
+      return i;
+    }
+
+    static size_t swizzleRedBlueNeon(const uint8_t *src, uint8_t *dst, size_t n)
+    {
+      size_t i = 0;
+
+      for(; i + 16 <= n; i += 16)
+      {
+        uint8x16x4_t v = vld4q_u8(src + i*4);
+        uint8x16_t red = v.val[0];
+        v.val[0] = v.val[2];
+        v.val[2] = red;
+        vst4q_u8(dst + i*4, v);
+      }
+      return i;
+    }
+#endif
+
+    static void rgbToRgbaRange(const uint8_t *src, uint8_t *dst, size_t n, uint8_t alpha)
+    {
+      size_t i = 0;
+      int level = simdLevel();
+
+#if defined(VGL_TEXEL_X86)
+      if(level >= TC::SL_AVX2)
+        i = rgbToRgbaAvx2(src, dst, n, alpha);
+      else if(level >= TC::SL_SSSE3)
+        i = rgbToRgbaSsse3(src, dst, n, alpha);
+#elif defined(VGL_TEXEL_NEON)
+      if(level >= TC::SL_NEON)
+        i = rgbToRgbaNeon(src, dst, n, alpha);
+#endif
+
+      for(; i < n; i++)
+      {
+        dst[i*4] = src[i*3];
+        dst[i*4 + 1] = src[i*3 + 1];
+        dst[i*4 + 2] = src[i*3 + 2];
+        dst[i*4 + 3] = alpha;
+      }
+    }
+
+    static void rgbaToRgbRange(const uint8_t *src, uint8_t *dst, size_t n)
+    {
+      size_t i = 0;
+      int level = simdLevel();
+
+#if defined(VGL_TEXEL_X86)
+      if(level >= TC::SL_SSSE3)
+        i = rgbaToRgbSsse3(src, dst, n);
+#elif defined(VGL_TEXEL_NEON)
+      if(level >= TC::SL_NEON)
+        i = rgbaToRgbNeon(src, dst, n);
+#endif
+
+      for(; i < n; i++)
+      {
+        dst[i*3] = src[i*4];
+        dst[i*3 + 1] = src[i*4 + 1];
+        dst[i*3 + 2] = src[i*4 + 2];
+      }
+    }
+
+    static inline void swizzleRedBlueScalar(const uint8_t *src, uint8_t *dst, size_t begin, size_t end)
+    {
+      for(size_t i = begin; i < end; i++)
+      {
+        uint32_t val;
+        memcpy(&val, src + i*4, 4);
+        val = (val & 0xff00ff00) | ((val & 0x00ff0000) >> 16) | ((val & 0x000000ff) << 16);
+        memcpy(dst + i*4, &val, 4);
+      }
+    }
+
+    static void swizzleRedBlueRange(const uint8_t *src, uint8_t *dst, size_t n)
+    {
+      size_t i = 0;
+      int level = simdLevel();
+
+      //compilers vectorize the scalar loop well enough that a shuffle alone only wins while everything is cached
+#if defined(VGL_TEXEL_X86)
+      size_t head = 0;
+      bool stream = (level >= TC::SL_SSE2 && streamingHead(dst, n, 4, head));
+      swizzleRedBlueScalar(src, dst, 0, head);
+
+      if(level >= TC::SL_AVX2)
+        i = head + swizzleRedBlueAvx2(src + head*4, dst + head*4, n - head, stream);
+      else if(level >= TC::SL_SSSE3)
+        i = head + swizzleRedBlueSsse3(src + head*4, dst + head*4, n - head, stream);
+      else if(level >= TC::SL_SSE2)
+        i = head + swizzleRedBlueSse2(src + head*4, dst + head*4, n - head, stream);
+#elif defined(VGL_TEXEL_NEON)
+      if(level >= TC::SL_NEON)
+        i = swizzleRedBlueNeon(src, dst, n);
+#endif
+
+      swizzleRedBlueScalar(src, dst, i, n);
+    }
+
+    //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    //half floats
+
+    static inline uint16_t floatToHalfScalar(float f)
+    {
+      uint32_t x;
+      memcpy(&x, &f, 4);
+      uint32_t sign = (x >> 16) & 0x8000;
+      x &= 0x7fffffff;
+
+      uint32_t h;
+      if(x >= 0x47800000)
+      {
+        //too large for a half (or already inf/nan)
+        h = (x > 0x7f800000) ? 0x7e00 : 0x7c00;
+      }
+      else if(x < 0x38800000)
+      {
+        //subnormal (or zero) halves, adding this magic float lines the 10 mantissa bits up at the bottom & rounds them to nearest even
+        const uint32_t denormMagicBits = ((127 - 15) + (23 - 10) + 1) << 23;
+        float denormMagic, v;
+        memcpy(&denormMagic, &denormMagicBits, 4);
+        memcpy(&v, &x, 4);
+        v += denormMagic;
+        memcpy(&h, &v, 4);
+        h -= denormMagicBits;
+      }
+      else
+      {
+        //rebias the exponent, then round to nearest even by adding 0xfff (plus one when the kept mantissa is odd) before truncating
+        uint32_t mantissaOdd = (x >> 13) & 1;
+        x += ((uint32_t)(15 - 127) << 23) + 0xfff + mantissaOdd;
+        h = x >> 13;
+      }
+
+      return (uint16_t)(h | sign);
+    }
+
+    static inline float halfToFloatScalar(uint16_t h)
+    {
+      const uint32_t shiftedExponent = 0x7c00 << 13;
+      uint32_t x = ((uint32_t)h & 0x7fff) << 13;
+      uint32_t exponent = x & shiftedExponent;
+      float f;
+
+      x += (127 - 15) << 23;
+      if(exponent == shiftedExponent)
+      {
+        //inf/nan
+        x += (128 - 16) << 23;
+        memcpy(&f, &x, 4);
+      }
+      else if(exponent == 0)
+      {
+        //zero/subnormal, renormalize
+        const uint32_t magicBits = 113 << 23;
+        float magic;
+        memcpy(&magic, &magicBits, 4);
+        x += 1 << 23;
+        memcpy(&f, &x, 4);
+        f -= magic;
+      }
+      else
+      {
+        memcpy(&f, &x, 4);
+      }
+
+      if(h & 0x8000)
+        f = -f;
+      return f;
+    }
+
+#ifdef VGL_TEXEL_X86
+    VGL_TEXEL_TARGET("avx2,f16c") static size_t floatToHalfF16c(const float *src, uint16_t *dst, size_t n)
+    {
+      size_t i = 0;
+
+      for(; i + 8 <= n; i += 8)
+        _mm_storeu_si128((__m128i *)(dst + i), _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT));
+      return i;
+    }
+
+    VGL_TEXEL_TARGET("avx2,f16c") static size_t halfToFloatF16c(const uint16_t *src, float *dst, size_t n)
+    {
+      size_t i = 0;
+
+      for(; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(src + i))));
+      return i;
+    }
+#endif
+
+#if defined(VGL_TEXEL_NEON) && (defined(__aarch64__) || defined(_M_ARM64))
+    static size_t floatToHalfNeon(const float *src, uint16_t *dst, size_t n)
+    {
+      size_t i = 0;
+
+      for(; i + 4 <= n; i += 4)
+        vst1_u16(dst + i, vreinterpret_u16_f16(vcvt_f16_f32(vld1q_f32(src + i))));
+      return i;
+    }
+
+    static size_t halfToFloatNeon(const uint16_t *src, float *dst, size_t n)
+    {
+      size_t i = 0;
+
+      for(; i + 4 <= n; i += 4)
+        vst1q_f32(dst + i, vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(src + i))));
+      return i;
+    }
+#endif
+
+    static void floatToHalfRange(const float *src, uint16_t *dst, size_t n)
+    {
+      size_t i = 0;
+      int level = simdLevel();
+
+#if defined(VGL_TEXEL_X86)
+      if(level >= TC::SL_AVX2)
+        i = floatToHalfF16c(src, dst, n);
+#elif defined(VGL_TEXEL_NEON) && (defined(__aarch64__) || defined(_M_ARM64))
+      if(level >= TC::SL_NEON)
+        i = floatToHalfNeon(src, dst, n);
+#endif
+
+      for(; i < n; i++)
+        dst[i] = floatToHalfScalar(src[i]);
+    }
+
+    static void halfToFloatRange(const uint16_t *src, float *dst, size_t n)
+    {
+      size_t i = 0;
+      int level = simdLevel();
+
+#if defined(VGL_TEXEL_X86)
+      if(level >= TC::SL_AVX2)
+        i = halfToFloatF16c(src, dst, n);
+#elif defined(VGL_TEXEL_NEON) && (defined(__aarch64__) || defined(_M_ARM64))
+      if(level >= TC::SL_NEON)
+        i = halfToFloatNeon(src, dst, n);
+#endif
+
+      for(; i < n; i++)
+        dst[i] = halfToFloatScalar(src[i]);
+    }
+
+    //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    //sRGB
+
+    //linear values are bucketed by their float bits (256 buckets per power of two from 2^-13 up to 1), each bucket holds the sRGB value at its
+    //start and the curve is flat enough that at most one more threshold falls within a bucket, so one compare gives the exactly rounded value
+    static const uint32_t srgbMinBits = (127 - 13) << 23, srgbMaxBits = 0x3f7fffff;
+    static const int srgbBucketShift = 23 - 8, srgbBucketCount = 13 << 8;
+
+    struct SrgbTables
+    {
+      int32_t bucketStart[srgbBucketCount];
+      float thresholds[257]; //smallest linear value encoding to each sRGB value
+      float toLinear[256];
+
+      SrgbTables()
+      {
+        auto decode = [](double s) {
+          return (s <= 0.04045) ? s / 12.92 : pow((s + 0.055) / 1.055, 2.4);
+        };
+
+        //rounded up to the next float, so that the floats right below a threshold don't compare as reaching it
+        thresholds[0] = 0;
+        for(int v = 1; v < 256; v++)
+        {
+          double threshold = decode((v - 0.5) / 255.0);
+          thresholds[v] = (float)threshold;
+          if(thresholds[v] < threshold)
+            thresholds[v] = nextafterf(thresholds[v], INFINITY);
+        }
+        thresholds[256] = INFINITY;
+
+        int v = 0;
+        for(int b = 0; b < srgbBucketCount; b++)
+        {
+          uint32_t bits = srgbMinBits + ((uint32_t)b << srgbBucketShift);
+          float start;
+          memcpy(&start, &bits, 4);
+          while(start >= thresholds[v + 1])
+            v++;
+          bucketStart[b] = v;
+        }
+
+        for(int s = 0; s < 256; s++)
+          toLinear[s] = (float)decode(s / 255.0);
+      }
+    };
+
+    static const SrgbTables &srgbTables()
+    {
+      static const SrgbTables tables;
+      return tables;
+    }
+
+    static inline uint8_t linearToSrgbScalar(float x, const SrgbTables &tables)
+    {
+      float lo, hi;
+      memcpy(&lo, &srgbMinBits, 4);
+      memcpy(&hi, &srgbMaxBits, 4);
+
+      //written so that nans land on lo
+      if(!(x > lo))
+        x = lo;
+      if(x > hi)
+        x = hi;
+
+      uint32_t bits;
+      memcpy(&bits, &x, 4);
+      int v = tables.bucketStart[(bits - srgbMinBits) >> srgbBucketShift];
+      v += (x >= tables.thresholds[v + 1]);
+      return (uint8_t)v;
+    }
+
+    static inline uint8_t linearToUnorm8(float x)
+    {
+      if(!(x > 0))
+        x = 0;
+      if(x > 1)
+        x = 1;
+      return (uint8_t)lrintf(x*255.0f);
+    }
+
+#ifdef VGL_TEXEL_X86
+    VGL_TEXEL_TARGET("avx2") static size_t linearToSrgbAvx2(const float *src, uint8_t *dst, size_t n, const SrgbTables &tables)
+    {
+      const __m256 lo = _mm256_castsi256_ps(_mm256_set1_epi32((int)srgbMinBits)), hi = _mm256_castsi256_ps(_mm256_set1_epi32((int)srgbMaxBits));
+      const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f), scale = _mm256_set1_ps(255.0f);
+      const __m256i minBits = _mm256_set1_epi32((int)srgbMinBits);
+      const __m256i alphaLanes = _mm256_setr_epi32(0, 0, 0, -1, 0, 0, 0, -1);
+      size_t i = 0;
+
+      //two pixels at a time
+      for(; i + 2 <= n; i += 2)
+      {
+        __m256 x = _mm256_loadu_ps(src + i*4);
+
+        //max returns its second operand for nans
+        __m256 c = _mm256_min_ps(_mm256_max_ps(x, lo), hi);
+        __m256i bucket = _mm256_srli_epi32(_mm256_sub_epi32(_mm256_castps_si256(c), minBits), srgbBucketShift);
+        __m256i v = _mm256_i32gather_epi32(tables.bucketStart, bucket, 4);
+        __m256 next = _mm256_i32gather_ps(tables.thresholds + 1, v, 4);
+        v = _mm256_sub_epi32(v, _mm256_castps_si256(_mm256_cmp_ps(c, next, _CMP_GE_OQ)));
+
+        __m256i alpha = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_min_ps(_mm256_max_ps(x, zero), one), scale));
+        v = _mm256_blendv_epi8(v, alpha, alphaLanes);
+
+        __m128i packed = _mm_packus_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+        _mm_storel_epi64((__m128i *)(dst + i*4), _mm_packus_epi16(packed, packed));
+      }
+      return i;
+    }
+#endif
+
+    static void linearToSrgbRange(const float *src, uint8_t *dst, size_t n)
+    {
+      auto &tables = srgbTables();
+      size_t i = 0;
+
+#if defined(VGL_TEXEL_X86)
+      if(simdLevel() >= TC::SL_AVX2)
+        i = linearToSrgbAvx2(src, dst, n, tables);
+#endif
+
+      for(; i < n; i++)
+      {
+        dst[i*4] = linearToSrgbScalar(src[i*4], tables);
+        dst[i*4 + 1] = linearToSrgbScalar(src[i*4 + 1], tables);
+        dst[i*4 + 2] = linearToSrgbScalar(src[i*4 + 2], tables);
+        dst[i*4 + 3] = linearToUnorm8(src[i*4 + 3]);
+      }
+    }
+
+    static inline void srgbToLinearScalar(const uint8_t *src, float *dst, size_t begin, size_t end, const SrgbTables &tables)
+    {
+      for(size_t i = begin; i < end; i++)
+      {
+        dst[i*4] = tables.toLinear[src[i*4]];
+        dst[i*4 + 1] = tables.toLinear[src[i*4 + 1]];
+        dst[i*4 + 2] = tables.toLinear[src[i*4 + 2]];
+        dst[i*4 + 3] = src[i*4 + 3] * (1.0f / 255.0f);
+      }
+    }
+
+#ifdef VGL_TEXEL_X86
+    VGL_TEXEL_TARGET("avx2") static size_t srgbToLinearAvx2(const uint8_t *src, float *dst, size_t n, const SrgbTables &tables, bool stream)
+    {
+      const __m256 alphaScale = _mm256_set1_ps(1.0f / 255.0f);
+      size_t i = 0;
+
+      //two pixels at a time, color channels are gathered from the same table the scalar loop reads & alpha is scaled
+      for(; i + 2 <= n; i += 2)
+      {
+        __m256i v = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src + i*4)));
+        __m256 color = _mm256_i32gather_ps(tables.toLinear, v, 4);
+        __m256 alpha = _mm256_mul_ps(_mm256_cvtepi32_ps(v), alphaScale);
+        __m256 rgba = _mm256_blend_ps(color, alpha, 0x88);
+        if(stream)
+          _mm256_stream_ps(dst + i*4, rgba);
+        else
+          _mm256_storeu_ps(dst + i*4, rgba);
+      }
+      if(stream)
+        _mm_sfence();
+      return i;
+    }
+#endif
+
+    static void srgbToLinearRange(const uint8_t *src, float *dst, size_t n)
+    {
+      auto &tables = srgbTables();
+      size_t i = 0;
+
+      //output is 4x the size of the input, so past the cache this is mostly bound by writing it out
+#if defined(VGL_TEXEL_X86)
+      if(simdLevel() >= TC::SL_AVX2)
+      {
+        size_t head = 0;
+        bool stream = streamingHead(dst, n, 16, head);
+        srgbToLinearScalar(src, dst, 0, head, tables);
+        i = head + srgbToLinearAvx2(src + head*4, dst + head*4, n - head, tables, stream);
+      }
+#endif
+
+      srgbToLinearScalar(src, dst, i, n, tables);
+    }
+
+    //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+    void VulkanTexelConverter::rgbToRgba(const void *src, void *dst, size_t numPixels, uint8_t alpha)
+    {
+      auto s = (const uint8_t *)src;
+      auto d = (uint8_t *)dst;
+      parallelFor(numPixels, 4, [=](size_t begin, size_t end) {
+        rgbToRgbaRange(s + begin*3, d + begin*4, end - begin, alpha);
+      });
+    }
+
+    void VulkanTexelConverter::rgbaToRgb(const void *src, void *dst, size_t numPixels)
+    {
+      auto s = (const uint8_t *)src;
+      auto d = (uint8_t *)dst;
+      parallelFor(numPixels, 3, [=](size_t begin, size_t end) {
+        rgbaToRgbRange(s + begin*4, d + begin*3, end - begin);
+      });
+    }
+
+    void VulkanTexelConverter::swizzleRedBlue(const void *src, void *dst, size_t numPixels)
+    {
+      auto s = (const uint8_t *)src;
+      auto d = (uint8_t *)dst;
+      parallelFor(numPixels, 4, [=](size_t begin, size_t end) {
+        swizzleRedBlueRange(s + begin*4, d + begin*4, end - begin);
+      });
+    }
+
+    void VulkanTexelConverter::floatToHalf(const float *src, uint16_t *dst, size_t count)
+    {
+      parallelFor(count, 2, [=](size_t begin, size_t end) {
+        floatToHalfRange(src + begin, dst + begin, end - begin);
+      });
+    }
+
+    void VulkanTexelConverter::halfToFloat(const uint16_t *src, float *dst, size_t count)
+    {
+      parallelFor(count, 4, [=](size_t begin, size_t end) {
+        halfToFloatRange(src + begin, dst + begin, end - begin);
+      });
+    }
+
+    void VulkanTexelConverter::linearToSrgb(const float *src, uint8_t *dst, size_t numPixels)
+    {
+      parallelFor(numPixels, 4, [=](size_t begin, size_t end) {
+        linearToSrgbRange(src + begin*4, dst + begin*4, end - begin);
+      });
+    }
+
+    void VulkanTexelConverter::srgbToLinear(const uint8_t *src, float *dst, size_t numPixels)
+    {
+      parallelFor(numPixels, 16, [=](size_t begin, size_t end) {
+        srgbToLinearRange(src + begin*4, dst + begin*4, end - begin);
+      });
+    }
+
+    VulkanTexelConverter::SimdLevel VulkanTexelConverter::getSimdLevel()
+    {
+      return (SimdLevel)simdLevel();
+    }
+
+    const char *VulkanTexelConverter::getSimdLevelName(SimdLevel level)
+    {
+      switch(level)
+      {
+        case SL_SSE2: return "SSE2";
+        case SL_SSSE3: return "SSSE3";
+        case SL_AVX2: return "AVX2+F16C";
+        case SL_NEON: return "NEON";
+        default: return "scalar";
+      }
+    }
+
+    void VulkanTexelConverter::setMaxSimdLevel(SimdLevel level)
+    {
+      maxSimdLevel = (int)level;
+    }
+
+    void VulkanTexelConverter::setThreading(size_t threshold, unsigned threads)
+    {
+      parallelThreshold = threshold;
+      maxThreads = max(threads, 1u);
+    }
+  }
+}
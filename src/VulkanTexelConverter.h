@@ -0,0 +1,65 @@
+/*********************************************************************
+Copyright 2018 VERTO STUDIO LLC.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+***************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace vgl
+{
+  namespace core
+  {
+    ///Texel conversions done on the CPU while uploading & reading back textures.  Each one picks the widest instruction set this CPU
+    ///supports at runtime (SSE2/SSSE3/AVX2+F16C on x86, NEON on ARM) and conversions of large images are split across threads.
+    ///Unless noted otherwise, src & dst must not overlap.  This class has no vulkan dependencies so tools can build it on its own
+    class VulkanTexelConverter
+    {
+    public:
+      ///8 bit RGB -> RGBA (or BGR -> BGRA), filling in the given alpha
+      static void rgbToRgba(const void *src, void *dst, size_t numPixels, uint8_t alpha=0xff);
+
+      ///8 bit RGBA -> RGB (or BGRA -> BGR), dropping alpha
+      static void rgbaToRgb(const void *src, void *dst, size_t numPixels);
+
+      ///Swaps the red & blue channels of 8 bit 4 channel texels (BGRA <-> RGBA).  src may equal dst
+      static void swizzleRedBlue(const void *src, void *dst, size_t numPixels);
+
+      ///IEEE 754 half floats, rounding to nearest even.  Infinities are kept and NaNs stay NaNs
+      static void floatToHalf(const float *src, uint16_t *dst, size_t count);
+      static void halfToFloat(const uint16_t *src, float *dst, size_t count);
+
+      ///Linear float RGBA -> sRGB encoded 8 bit RGBA (alpha stays linear), clamping to [0, 1] and rounding exactly like the sRGB curve would
+      static void linearToSrgb(const float *src, uint8_t *dst, size_t numPixels);
+
+      ///sRGB encoded 8 bit RGBA -> linear float RGBA (alpha stays linear)
+      static void srgbToLinear(const uint8_t *src, float *dst, size_t numPixels);
+
+      enum SimdLevel { SL_SCALAR=0, SL_SSE2, SL_SSSE3, SL_AVX2, SL_NEON };
+
+      ///The instruction set conversions currently use (the best one this CPU supports, unless capped below)
+      static SimdLevel getSimdLevel();
+      static const char *getSimdLevelName(SimdLevel level);
+
+      ///Caps the instruction set conversions use, SL_SCALAR forces the plain loops.  Mostly for benchmarking & testing
+      static void setMaxSimdLevel(SimdLevel level);
+
+      ///Conversions writing more than this many bytes are split across up to maxThreads threads (the calling thread included).
+      ///Currently, the defaults are 4 MB and the number of hardware threads (at most 8).  Pass maxThreads=1 to never use threads
+      static void setThreading(size_t parallelThreshold, unsigned maxThreads);
+    };
+  }
+}
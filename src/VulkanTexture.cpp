@@ -21,6 +21,7 @@ limitations under the License.
 #include <algorithm>
 #include "VulkanInstance.h"
 #include "VulkanTexture.h"
+#include "VulkanTexelConverter.h"
 #include "VulkanMemoryManager.h"
 #include "VulkanAsyncResourceHandle.h"
 #include "VulkanFrameBuffer.h"
@@ -75,11 +76,15 @@ namespace vgl
     {
       auto &mm = *instance->getMemoryManager();
 
+      if(isStreaming())
+        stopStreaming();
+
       //trying out a new policy of always keeping outgoing-handles around until next frame completes
       if(imageHandle)
       {
         uint64_t frameId = instance->getSwapChain()->getCurrentFrameId();
         retainResourcesUntilFrameCompletion(frameId);
+        mm.setRelocationDelegate(imageAllocation, nullptr);
       }
 
       if(imageHandle && imageHandle->release())
@@ -164,10 +169,43 @@ namespace vgl
       return (VkSampleCountFlagBits)numSamples;
     }
 
+    static bool isCompressedTextureFormat(VkFormat format);
+
+    //3 channel formats are rarely supported for sampling, so they're stored with 4 channels instead
+    static VkFormat expandedRgbFormat(VkFormat format)
+    {
+      switch(format)
+      {
+        case VK_FORMAT_R8G8B8_UNORM: return VK_FORMAT_R8G8B8A8_UNORM;
+        case VK_FORMAT_R8G8B8_SRGB: return VK_FORMAT_R8G8B8A8_SRGB;
+        case VK_FORMAT_B8G8R8_UNORM: return VK_FORMAT_B8G8R8A8_UNORM;
+        case VK_FORMAT_B8G8R8_SRGB: return VK_FORMAT_B8G8R8A8_SRGB;
+        default: return VK_FORMAT_UNDEFINED;
+      }
+    }
+
     void VulkanTexture::imageData(uint32_t width, uint32_t height, uint32_t depth, VkFormat format, const void *data, size_t numBytes, uint32_t layerIndex, uint32_t level, uint32_t numSamples, VkCommandBuffer transferCommandBuffer)
     {
       bool shouldReinit = false, newImage = false;
 
+      if(isStreaming())
+        stopStreaming();
+
+      //3 channel texels are expanded (with opaque alpha) as they're copied into staging
+      bool expandRgb = false;
+      if(expandedRgbFormat(format) != VK_FORMAT_UNDEFINED)
+      {
+        format = expandedRgbFormat(format);
+        numBytes = numBytes / 3 * 4;
+        expandRgb = true;
+      }
+      auto stageTexels = [&](uint8_t *dst) {
+        if(expandRgb)
+          VulkanTexelConverter::rgbToRgba(data, dst, numBytes / 4);
+        else
+          memcpy(dst, data, numBytes);
+      };
+
       if(image)
       {
         if(type == TT_CUBE_MAP)
@@ -183,6 +221,7 @@ namespace vgl
         {
           uint64_t frameId = instance->getSwapChain()->getCurrentFrameId();
           retainResourcesUntilFrameCompletion(frameId);
+          instance->getMemoryManager()->setRelocationDelegate(imageAllocation, nullptr);
         }
 
         if(stagingBufferHandle && stagingBufferHandle->release())
@@ -211,7 +250,33 @@ namespace vgl
       {
         if(stagingBufferHandle && stagingBufferHandle->release())
           delete stagingBufferHandle;
-        createStagingBuffer(false);
+        stagingBufferHandle = nullptr;
+
+        //staging released right after an upload whose completion is tracked can be a range of the shared upload ring
+        VulkanUploadRing *uploadRing = nullptr;
+        if(autoReleaseStaging && !readbackEnabled && !deferImageCreation && 
+          (!transferCommandBuffer || transferCommandBuffer == instance->getCurrentTransferCommandBuffer()))
+          uploadRing = instance->getUploadRing();
+
+        if(uploadRing)
+        {
+          //copy offsets must be multiples of both 4 & the texel (or compressed block) size
+          VkDeviceSize texelSize = max<VkDeviceSize>(numBytes / max<VkDeviceSize>((VkDeviceSize)width*height*depth, 1), 1);
+          VkDeviceSize alignment = (isCompressedTextureFormat(format)) ? 16 : texelSize*4;
+
+          //the range is released as soon as this layer is copied, so it only needs to hold one layer
+          if(auto range = uploadRing->allocate(numBytes, alignment))
+          {
+            stagingBuffer = range.buffer;
+            stagingBufferHandle = range.handle;
+            stagingBufferAllocation = nullptr;
+            stagingBufferOffset = range.offset;
+            stagingRingData = range.mappedData;
+          }
+        }
+
+        if(!stagingBuffer)
+          createStagingBuffer(false);
       }
 
       if(!imageHandle)
@@ -233,14 +298,22 @@ namespace vgl
 
       alloc = stagingBufferAllocation;
 
-      auto allocInfo = instance->getMemoryManager()->getAllocationInfo(alloc);
-      void *mappedPtr;
-      if(vkMapMemory(device, allocInfo.memory, allocInfo.offset + numBytes*layerIndex, numBytes, 0, &mappedPtr) != VK_SUCCESS)
+      auto memoryManager = instance->getMemoryManager();
+      if(stagingRingData)
       {
-        throw vgl_runtime_error("Unable to map staging buffer in VulkanBufferGroup::data()!");
+        stageTexels(stagingRingData);
+        instance->getUploadRing()->flush(stagingBufferOffset, numBytes);
+      }
+      else
+      {
+        auto allocInfo = memoryManager->getAllocationInfo(alloc);
+        if(!allocInfo.mappedData)
+        {
+          throw vgl_runtime_error("Unable to map staging buffer in VulkanTexture::imageData()!");
+        }
+        stageTexels((uint8_t *)allocInfo.mappedData + numBytes*layerIndex);
+        memoryManager->flushAllocation(alloc, numBytes*layerIndex, numBytes);
       }
-      memcpy(mappedPtr, data, numBytes);
-      vkUnmapMemory(device, allocInfo.memory);
 
       isShaderRsrc = true;
 
@@ -265,6 +338,9 @@ namespace vgl
     {
       bool shouldReinit = false;
 
+      if(isStreaming())
+        stopStreaming();
+
       if(type == TT_CUBE_MAP)
         shouldReinit = (this->width != width || this->height != height || this->format != format);
       else
@@ -284,6 +360,7 @@ namespace vgl
           //trying out a new policy of always keeping outgoing-handles around until next frame completes
           uint64_t frameId = instance->getSwapChain()->getCurrentFrameId();
           retainResourcesUntilFrameCompletion(frameId);
+          instance->getMemoryManager()->setRelocationDelegate(imageAllocation, nullptr);
 
           if(imageHandle->release())
           {
@@ -350,6 +427,8 @@ namespace vgl
         imageInfo.usage |= VK_IMAGE_USAGE_SAMPLED_BIT;
       if(readbackEnabled)
         imageInfo.usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+      if(transientAttachment && !(imageInfo.usage & (VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT)))
+        imageInfo.usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
 
       imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
       imageInfo.samples = samplesToSampleCountBits(numSamples);
@@ -376,13 +455,21 @@ namespace vgl
       if(vkCreateImage(device, &imageInfo, nullptr, &image) != VK_SUCCESS)
         throw std::runtime_error("Failed to create Vulkan image!");
 
-      VulkanMemoryManager::Suballocation alloc;
+      auto memoryManager = instance->getMemoryManager();
+      auto allocateImage = [&](VkMemoryPropertyFlags properties) {
+        return (aliasId) ? memoryManager->allocateAliasedImage(properties, image, aliasId) : memoryManager->allocateImage(properties, image, VulkanMemoryManager::Any, lifetime);
+      };
+      VulkanMemoryManager::Suballocation alloc = nullptr;
 
-      alloc = instance->getMemoryManager()->allocateImage(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image);
+      //devices without lazily allocated memory types just get ordinary device local memory
+      if(imageInfo.usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT)
+        alloc = allocateImage(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT);
+      if(!alloc)
+        alloc = allocateImage(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
       if(!alloc)
       {
         //must be out of GPU memory, fallback on whater we can use
-        alloc = instance->getMemoryManager()->allocateImage(0, image);
+        alloc = allocateImage(0);
         isResident = false;
       }
       else
@@ -391,7 +478,7 @@ namespace vgl
       }
       imageAllocation = alloc;
 
-      instance->getMemoryManager()->bindImageMemory(image, alloc);
+      memoryManager->bindImageMemory(image, alloc);
       
       VkImageLayout layout = (!isDepth) ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
@@ -400,6 +487,7 @@ namespace vgl
         layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
         isShaderRsrc = true;
       }
+      initialImageLayout = layout;
 
       auto commandBuffer = transferCommandBuffer;
       if(!transferCommandBuffer)
@@ -414,69 +502,296 @@ namespace vgl
       imageHandle = VulkanAsyncResourceHandle::newImage(instance->getResourceMonitor(), device, image, imageView, imageAllocation);
     }
 
-    void VulkanTexture::readImageData(uint32_t x, uint32_t y, uint32_t readWidth, uint32_t readHeight, uint32_t layer, uint32_t level, void *data)
+    static VkDeviceSize readbackBytesPerPixel(VkFormat format)
     {
-      //TODO: use blitting in here to speed this up!
-      VkDeviceSize bytesPerPixel = 0;
-      VkDeviceSize linearCopySize = 0;
-      
       switch(format)
       {
         case VK_FORMAT_R8G8B8A8_UNORM:
+        case VK_FORMAT_R8G8B8A8_SRGB:
         case VK_FORMAT_B8G8R8A8_UNORM:
-          linearCopySize = readWidth*readHeight*4;
-          bytesPerPixel = 4;
-        break;
+        case VK_FORMAT_B8G8R8A8_SRGB:
+        case VK_FORMAT_R32_SFLOAT:
+          return 4;
         case VK_FORMAT_R8_UNORM:
-          linearCopySize = readWidth*readHeight;
-          bytesPerPixel = 1;
-        break;
+          return 1;
+        case VK_FORMAT_R16_SFLOAT:
+          return 2;
+        case VK_FORMAT_R16G16B16A16_SFLOAT:
+          return 8;
+        case VK_FORMAT_R32G32B32A32_SFLOAT:
+          return 16;
         default:
           throw vgl_runtime_error("Unsupported image format for VulkanTexture::readImageData()");
-        break;
       }
+    }
+
+    static bool isBgraFormat(VkFormat format)
+    {
+      return (format == VK_FORMAT_B8G8R8A8_UNORM || format == VK_FORMAT_B8G8R8A8_SRGB);
+    }
+
+    void VulkanTexture::readImageData(uint32_t x, uint32_t y, uint32_t readWidth, uint32_t readHeight, uint32_t layer, uint32_t level, void *data)
+    {
+      VkDeviceSize bytesPerPixel = readbackBytesPerPixel(format);
+      VkDeviceSize linearCopySize = readWidth*readHeight*bytesPerPixel;
 
-      if(!stagingBufferHandle)
+      //a staging buffer created just for this read is waited on below, so it can live in the frame's linear allocator
+      bool transientStaging = !stagingBufferHandle;
+      if(transientStaging)
       {
         size = width*height*bytesPerPixel;
-        createStagingBuffer(true);
+        createStagingBuffer(true, true);
       }
 
       copyFromImage(x, y, readWidth, readHeight, layer, level, VK_NULL_HANDLE, true);
 
-      auto allocInfo = instance->getMemoryManager()->getAllocationInfo(stagingBufferAllocation);
-      void *mappedPtr;
-      if(vkMapMemory(device, allocInfo.memory, allocInfo.offset + size*layer, linearCopySize, 0, &mappedPtr) != VK_SUCCESS)
+      auto memoryManager = instance->getMemoryManager();
+      auto allocInfo = memoryManager->getAllocationInfo(stagingBufferAllocation);
+      if(!allocInfo.mappedData)
       {
-        throw vgl_runtime_error("Unable to map staging buffer in VulkanBufferGroup::data()!");
+        throw vgl_runtime_error("Unable to map staging buffer in VulkanTexture::readImageData()!");
       }
+      memoryManager->invalidateAllocation(stagingBufferAllocation, size*layer, linearCopySize);
+      void *mappedPtr = (uint8_t *)allocInfo.mappedData + size*layer;
 
-      if(format == VK_FORMAT_B8G8R8A8_UNORM)
+      if(isBgraFormat(format))
       {
-        uint32_t *srcPixel = (uint32_t *)mappedPtr;
-        uint32_t *dstPixel = (uint32_t *)data;
-
-        for(int i = 0; i < linearCopySize/4; i++)
-        {
-          uint32_t val = *srcPixel;
-          
-          //BGRA -> RGBA
-          val = ((((val) & 0xff000000)) |
-            (((val) & 0x00ff0000) >> 16) |
-            (((val) & 0x0000ff00)) |
-            (((val) & 0x000000ff) << 16));
-          *dstPixel = val;
-
-          srcPixel++;
-          dstPixel++;
-        }
+        //BGRA -> RGBA
+        VulkanTexelConverter::swizzleRedBlue(mappedPtr, data, (size_t)(linearCopySize/4));
       }
       else
       {
         memcpy(data, mappedPtr, linearCopySize);
       }
 
-      vkUnmapMemory(device, allocInfo.memory);
+      if(transientStaging)
+        releaseStagingBuffers();
+    }
+
+    shared_ptr<VulkanReadback> VulkanTexture::readImageDataAsync(uint32_t x, uint32_t y, uint32_t readWidth, uint32_t readHeight, uint32_t layer, uint32_t level, 
+      VkCommandBuffer transferCommandBuffer, bool frame)
+    {
+      VkDeviceSize numBytes = (VkDeviceSize)readWidth*readHeight*readbackBytesPerPixel(format);
+      auto restingLayout = (isSwapchainImage) ? VK_IMAGE_LAYOUT_PRESENT_SRC_KHR : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+      return instance->getReadbackPool()->read(numBytes, transferCommandBuffer, frame, { imageHandle }, [&](VkCommandBuffer commandBuffer, VkBuffer dst) {
+        VkBufferImageCopy region = {};
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = level;
+        region.imageSubresource.baseArrayLayer = layer;
+        region.imageSubresource.layerCount = 1;
+        region.imageOffset = { (int32_t)x, (int32_t)y, 0 };
+        region.imageExtent = { readWidth, readHeight, 1 };
+
+        transitionLayout(restingLayout, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, layer, commandBuffer);
+        vkCmdCopyImageToBuffer(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, dst, 1, &region);
+        transitionLayout(VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, restingLayout, layer, commandBuffer);
+      }, isBgraFormat(format));
+    }
+
+    //each blit at most halves the image, so large reductions are averaged over every source texel instead of skipping most of them
+    static vector<VkExtent2D> scaledReadSteps(uint32_t readWidth, uint32_t readHeight, uint32_t dstWidth, uint32_t dstHeight)
+    {
+      if(!readWidth || !readHeight || !dstWidth || !dstHeight)
+        throw vgl_runtime_error("VulkanTexture::readImageDataScaled() needs a nonempty source region & destination size!");
+
+      vector<VkExtent2D> steps;
+      VkExtent2D extent = { readWidth, readHeight };
+
+      do
+      {
+        extent.width = (extent.width/2 > dstWidth) ? extent.width/2 : dstWidth;
+        extent.height = (extent.height/2 > dstHeight) ? extent.height/2 : dstHeight;
+        steps.push_back(extent);
+      } while(extent.width != dstWidth || extent.height != dstHeight);
+
+      return steps;
+    }
+
+    VulkanAsyncResourceHandle *VulkanTexture::createScaledReadImage(VkExtent2D extent, VkFormat format)
+    {
+      VkImageCreateInfo imageInfo = {};
+      imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+      imageInfo.imageType = VK_IMAGE_TYPE_2D;
+      imageInfo.extent = { extent.width, extent.height, 1 };
+      imageInfo.format = format;
+      imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+      imageInfo.arrayLayers = 1;
+      imageInfo.mipLevels = 1;
+      imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+      imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+      imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+      imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+
+      VkImage scaledImage;
+      if(vkCreateImage(device, &imageInfo, nullptr, &scaledImage) != VK_SUCCESS)
+        throw vgl_runtime_error("Failed to create Vulkan image!");
+
+      auto memoryManager = instance->getMemoryManager();
+      auto alloc = memoryManager->allocateImage(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, scaledImage, VulkanMemoryManager::Any, VulkanMemoryManager::LT_TRANSIENT);
+      if(!alloc)
+        alloc = memoryManager->allocateImage(0, scaledImage, VulkanMemoryManager::Any, VulkanMemoryManager::LT_TRANSIENT);
+      if(!alloc)
+      {
+        vkDestroyImage(device, scaledImage, nullptr);
+        throw vgl_runtime_error("Unable to allocate memory for VulkanTexture::readImageDataScaled()!");
+      }
+      memoryManager->bindImageMemory(scaledImage, alloc);
+
+      return VulkanAsyncResourceHandle::newImage(instance->getResourceMonitor(), device, scaledImage, VK_NULL_HANDLE, alloc);
+    }
+
+    VkImage VulkanTexture::recordScaledBlits(VkCommandBuffer commandBuffer, const vector<VkExtent2D> &steps, VulkanAsyncResourceHandle *const scaledImages[2],
+      VkFormat dstFormat, uint32_t x, uint32_t y, uint32_t readWidth, uint32_t readHeight, uint32_t layer, uint32_t level)
+    {
+      if(numMultiSamples != 1)
+        throw vgl_runtime_error("VulkanTexture::readImageDataScaled() cannot read multisampled images!");
+
+      //formats that can't be linearly filtered are still scaled & converted, just with nearest filtering
+      auto filterFor = [this](VkFormat blitFormat, bool dst) {
+        auto features = instance->getFormatFeatures(blitFormat);
+        if(!(features & ((dst) ? VK_FORMAT_FEATURE_BLIT_DST_BIT : VK_FORMAT_FEATURE_BLIT_SRC_BIT)))
+          throw vgl_runtime_error("Image format does not support blitting in VulkanTexture::readImageDataScaled()!");
+        return (features & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT) ? VK_FILTER_LINEAR : VK_FILTER_NEAREST;
+      };
+      auto srcFilter = filterFor(format, false), dstFilter = filterFor(dstFormat, true);
+
+      VkImageMemoryBarrier barrier = {};
+      barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+      barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+      barrier.subresourceRange.levelCount = 1;
+      barrier.subresourceRange.layerCount = 1;
+
+      auto imageBarrier = [&](VkImage barrierImage, VkImageLayout oldLayout, VkImageLayout newLayout, VkAccessFlags srcAccess, VkAccessFlags dstAccess) {
+        barrier.image = barrierImage;
+        barrier.oldLayout = oldLayout;
+        barrier.newLayout = newLayout;
+        barrier.srcAccessMask = srcAccess;
+        barrier.dstAccessMask = dstAccess;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+      };
+
+      VkImageBlit blit = {};
+      blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+      blit.srcSubresource.layerCount = 1;
+      blit.dstSubresource = blit.srcSubresource;
+
+      //the first step reads this texture, then the two scaled images take turns reading each other
+      auto restingLayout = (isSwapchainImage) ? VK_IMAGE_LAYOUT_PRESENT_SRC_KHR : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+      transitionLayout(restingLayout, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, layer, commandBuffer);
+      imageBarrier(scaledImages[0]->image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0, VK_ACCESS_TRANSFER_WRITE_BIT);
+
+      blit.srcSubresource.mipLevel = level;
+      blit.srcSubresource.baseArrayLayer = layer;
+      blit.srcOffsets[0] = { (int32_t)x, (int32_t)y, 0 };
+      blit.srcOffsets[1] = { (int32_t)(x + readWidth), (int32_t)(y + readHeight), 1 };
+      blit.dstOffsets[1] = { (int32_t)steps[0].width, (int32_t)steps[0].height, 1 };
+      vkCmdBlitImage(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, scaledImages[0]->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, srcFilter);
+
+      transitionLayout(VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, restingLayout, layer, commandBuffer);
+
+      blit.srcSubresource.mipLevel = 0;
+      blit.srcSubresource.baseArrayLayer = 0;
+      for(size_t i = 1; i < steps.size(); i++)
+      {
+        auto src = scaledImages[(i-1)%2]->image, dst = scaledImages[i%2]->image;
+
+        imageBarrier(src, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+        imageBarrier(dst, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_ACCESS_TRANSFER_READ_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+
+        blit.srcOffsets[0] = { 0, 0, 0 };
+        blit.srcOffsets[1] = { (int32_t)steps[i-1].width, (int32_t)steps[i-1].height, 1 };
+        blit.dstOffsets[1] = { (int32_t)steps[i].width, (int32_t)steps[i].height, 1 };
+        vkCmdBlitImage(commandBuffer, src, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, dst, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, dstFilter);
+      }
+
+      auto result = scaledImages[(steps.size()-1)%2]->image;
+      imageBarrier(result, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+
+      return result;
+    }
+
+    void VulkanTexture::readImageDataScaled(uint32_t x, uint32_t y, uint32_t readWidth, uint32_t readHeight, uint32_t layer, uint32_t level, 
+      uint32_t dstWidth, uint32_t dstHeight, void *data, VkFormat dstFormat)
+    {
+      VkDeviceSize numBytes = (VkDeviceSize)dstWidth*dstHeight*readbackBytesPerPixel(dstFormat);
+      auto steps = scaledReadSteps(readWidth, readHeight, dstWidth, dstHeight);
+      VulkanAsyncResourceHandle *scaledImages[2] = { createScaledReadImage(steps[0], dstFormat), (steps.size() > 1) ? createScaledReadImage(steps[1], dstFormat) : nullptr };
+
+      VkBufferCreateInfo bufferInfo = {};
+      bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+      bufferInfo.size = numBytes;
+      bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+      VkBuffer readBuffer;
+      if(vkCreateBuffer(device, &bufferInfo, nullptr, &readBuffer) != VK_SUCCESS)
+        throw vgl_runtime_error("Failed to create readback buffer!");
+
+      auto memoryManager = instance->getMemoryManager();
+      auto alloc = memoryManager->allocateBuffer(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, readBuffer, VulkanMemoryManager::Any, 
+        VulkanMemoryManager::LT_TRANSIENT);
+      if(!alloc)
+      {
+        vkDestroyBuffer(device, readBuffer, nullptr);
+        throw vgl_runtime_error("Unable to allocate memory for VulkanTexture::readImageDataScaled()!");
+      }
+      memoryManager->bindBufferMemory(readBuffer, alloc);
+      auto readBufferHandle = VulkanAsyncResourceHandle::newBuffer(instance->getResourceMonitor(), device, readBuffer, alloc);
+
+      auto commandBuffer = startOneTimeCommandBuffer();
+      auto scaledImage = recordScaledBlits(commandBuffer, steps, scaledImages, dstFormat, x, y, readWidth, readHeight, layer, level);
+
+      VkBufferImageCopy region = {};
+      region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+      region.imageSubresource.layerCount = 1;
+      region.imageExtent = { dstWidth, dstHeight, 1 };
+      vkCmdCopyImageToBuffer(commandBuffer, scaledImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readBuffer, 1, &region);
+
+      //submit and wait
+      submitOneTimeCommandBuffer(commandBuffer, true);
+
+      auto allocInfo = memoryManager->getAllocationInfo(alloc);
+      if(!allocInfo.mappedData)
+      {
+        throw vgl_runtime_error("Unable to map readback buffer in VulkanTexture::readImageDataScaled()!");
+      }
+      memoryManager->invalidateAllocation(alloc, 0, numBytes);
+
+      if(isBgraFormat(dstFormat))
+        VulkanTexelConverter::swizzleRedBlue(allocInfo.mappedData, data, (size_t)(numBytes/4));
+      else
+        memcpy(data, allocInfo.mappedData, numBytes);
+
+      //the submit was waited on, so these can go right away
+      for(auto handle : { scaledImages[0], scaledImages[1], readBufferHandle }) if(handle && handle->release())
+        delete handle;
+    }
+
+    shared_ptr<VulkanReadback> VulkanTexture::readImageDataScaledAsync(uint32_t x, uint32_t y, uint32_t readWidth, uint32_t readHeight, uint32_t layer, uint32_t level, 
+      uint32_t dstWidth, uint32_t dstHeight, VkFormat dstFormat, VkCommandBuffer transferCommandBuffer, bool frame)
+    {
+      VkDeviceSize numBytes = (VkDeviceSize)dstWidth*dstHeight*readbackBytesPerPixel(dstFormat);
+      auto steps = scaledReadSteps(readWidth, readHeight, dstWidth, dstHeight);
+      VulkanAsyncResourceHandle *scaledImages[2] = { createScaledReadImage(steps[0], dstFormat), (steps.size() > 1) ? createScaledReadImage(steps[1], dstFormat) : nullptr };
+
+      auto readback = instance->getReadbackPool()->read(numBytes, transferCommandBuffer, frame, { imageHandle, scaledImages[0], scaledImages[1] }, 
+        [&](VkCommandBuffer commandBuffer, VkBuffer dst) {
+        auto scaledImage = recordScaledBlits(commandBuffer, steps, scaledImages, dstFormat, x, y, readWidth, readHeight, layer, level);
+
+        VkBufferImageCopy region = {};
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.layerCount = 1;
+        region.imageExtent = { dstWidth, dstHeight, 1 };
+        vkCmdCopyImageToBuffer(commandBuffer, scaledImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, dst, 1, &region);
+      }, isBgraFormat(dstFormat));
+
+      //the readback holds its own references until the copy completes
+      for(auto scaledImage : scaledImages) if(scaledImage && scaledImage->release())
+        delete scaledImage;
+
+      return readback;
     }
 
     void VulkanTexture::setFilters(SamplerFilterType min, SamplerFilterType mag)
@@ -542,6 +857,8 @@ namespace vgl
         delete stagingBufferHandle;
       stagingBufferHandle = nullptr;
       stagingBuffer = VK_NULL_HANDLE;
+      stagingBufferOffset = 0;
+      stagingRingData = nullptr;
     }
   
     void VulkanTexture::setWrapMode(WrapMode uMode, WrapMode vMode, WrapMode wMode)
@@ -585,86 +902,17 @@ namespace vgl
       }
     }
 
-    void VulkanTexture::generateMipmaps(uint32_t layerIndex, VkCommandBuffer transferCommandBuffer)
+    void VulkanTexture::generateMipmaps(uint32_t baseLayer, uint32_t layerCount, VkCommandBuffer transferCommandBuffer)
     {
-      static bool checkedFilterSupport = false;
+      auto scratch = instance->getMipmapGenerator()->generate(transferCommandBuffer, image, format, width, height, numMipLevels, baseLayer, layerCount);
 
-      if(!checkedFilterSupport)
+      //kept with this transfer's other resources until it completes
+      if(scratch)
       {
-        auto physicalDevice = instance->getPhysicalDevice();
-
-        VkFormatProperties formatProperties;
-        vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &formatProperties);
-        if(!(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT)) 
-          throw vgl_runtime_error("Texture image format does not support linear blitting!");        
-
-        checkedFilterSupport = true;
+        if(mipScratchHandle && mipScratchHandle->release())
+          delete mipScratchHandle;
+        mipScratchHandle = scratch;
       }
-
-      VkImageMemoryBarrier barrier = {};
-      barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-      barrier.image = image;
-      barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-      barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-      barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-      barrier.subresourceRange.baseArrayLayer = layerIndex;
-      barrier.subresourceRange.layerCount = 1;
-      barrier.subresourceRange.levelCount = 1;
-
-      int32_t mipWidth = width;
-      int32_t mipHeight = height;
-
-      for(uint32_t i = 1; i < numMipLevels; i++) 
-      {
-        barrier.subresourceRange.baseMipLevel = i - 1;
-        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-
-        auto srcStage = VK_PIPELINE_STAGE_TRANSFER_BIT, dstStage = srcStage;
-        vkCmdPipelineBarrier(transferCommandBuffer, srcStage, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
-
-        VkImageBlit blit = {};
-        blit.srcOffsets[0] = { 0, 0, 0 };
-        blit.srcOffsets[1] = { mipWidth, mipHeight, 1 };
-        blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        blit.srcSubresource.mipLevel = i - 1;
-        blit.srcSubresource.baseArrayLayer = layerIndex;
-        blit.srcSubresource.layerCount = 1;
-        blit.dstOffsets[0] = { 0, 0, 0 };
-        blit.dstOffsets[1] = { (mipWidth > 1) ? mipWidth / 2 : 1, (mipHeight > 1) ? mipHeight / 2 : 1, 1 };
-        blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        blit.dstSubresource.mipLevel = i;
-        blit.dstSubresource.baseArrayLayer = layerIndex;
-        blit.dstSubresource.layerCount = 1;
-
-        auto srcLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-        auto dstLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-        vkCmdBlitImage(transferCommandBuffer, image, srcLayout, image, dstLayout, 1, &blit, VK_FILTER_LINEAR);
-
-        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-        barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-        barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-        srcStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-        dstStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-        vkCmdPipelineBarrier(transferCommandBuffer, srcStage, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
-
-        if(mipWidth > 1) 
-          mipWidth /= 2;
-        if(mipHeight > 1) 
-          mipHeight /= 2;
-      }
-
-      auto srcStage = VK_PIPELINE_STAGE_TRANSFER_BIT, dstStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-      barrier.subresourceRange.baseMipLevel = numMipLevels - 1;
-      barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-      barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-      barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-      barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-      vkCmdPipelineBarrier(transferCommandBuffer, srcStage, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
     }
 
     void VulkanTexture::setReadbackEnabled(bool enabled)
@@ -844,8 +1092,59 @@ namespace vgl
       transitionLayout(oldLayout, newLayout, 0xFFFFFFFF, transferCommandBuffer);
     }
 
+    void VulkanTexture::aliasBarrier(VkCommandBuffer commandBuffer)
+    {
+      if(!image || initialImageLayout == VK_IMAGE_LAYOUT_UNDEFINED)
+        return;
+
+      const VkPipelineStageFlags stages = VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | 
+        VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+        VK_PIPELINE_STAGE_TRANSFER_BIT;
+      VkImageMemoryBarrier barrier = {};
+
+      barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+      barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT |
+        VK_ACCESS_TRANSFER_WRITE_BIT;
+      switch(initialImageLayout)
+      {
+        case VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL:
+          barrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        break;
+        case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL:
+          barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        break;
+        default:
+          barrier.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        break;
+      }
+
+      //the previous alias left its own layout & contents behind, so we start over from undefined
+      barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+      barrier.newLayout = initialImageLayout;
+      barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.image = image;
+      barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+      if(isDepth)
+      {
+        barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+        if(format == VK_FORMAT_D32_SFLOAT_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT)
+          barrier.subresourceRange.aspectMask |= VK_IMAGE_ASPECT_STENCIL_BIT;
+      }
+      barrier.subresourceRange.baseMipLevel = 0;
+      barrier.subresourceRange.levelCount = numMipLevels;
+      barrier.subresourceRange.baseArrayLayer = 0;
+      barrier.subresourceRange.layerCount = numArrayLayers;
+
+      vkCmdPipelineBarrier(commandBuffer, stages, stages, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+    }
+
     VkCommandBuffer VulkanTexture::startOneTimeCommandBuffer()
     {
+      auto batcher = instance->getUploadBatcher();
+      if(batcher->isBatching(queue))
+        return batcher->record();
+
       VkCommandBufferAllocateInfo allocInfo = {};
       allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
       allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
@@ -865,6 +1164,15 @@ namespace vgl
 
     void VulkanTexture::submitOneTimeCommandBuffer(VkCommandBuffer commandBuffer, bool wait)
     {
+      auto batcher = instance->getUploadBatcher();
+      if(batcher->isBatching(queue) && commandBuffer == batcher->getCommandBuffer())
+      {
+        batcher->track({ stagingBufferHandle, imageHandle, mipScratchHandle });
+        if(wait)
+          batcher->flush(true);
+        return;
+      }
+
       VkFence transferFence;
       VkFenceCreateInfo fenceInfo = {};
       fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
@@ -888,7 +1196,7 @@ namespace vgl
         auto fenceHandle = VulkanAsyncResourceHandle::newFence(resourceMonitor, device, transferFence);
         auto cmdBufHandle = VulkanAsyncResourceHandle::newCommandBuffer(resourceMonitor, device, commandBuffer, commandPool);
         VulkanAsyncResourceCollection transferResources(resourceMonitor, fenceHandle, {
-          stagingBufferHandle, imageHandle,
+          stagingBufferHandle, imageHandle, mipScratchHandle,
           cmdBufHandle, fenceHandle
           });
         resourceMonitor->append(move(transferResources));
@@ -903,7 +1211,7 @@ namespace vgl
       }
     }
 
-    void VulkanTexture::createStagingBuffer(bool needsTransferDest)
+    void VulkanTexture::createStagingBuffer(bool needsTransferDest, bool transient)
     {
       VkBufferCreateInfo bufferInfo = {};
       VulkanMemoryManager::Suballocation alloc;
@@ -917,13 +1225,26 @@ namespace vgl
         bufferInfo.usage |= VK_BUFFER_USAGE_TRANSFER_DST_BIT;
         stagingBufferTransferDst = true;
       }
+      stagingBufferOffset = 0;
+      stagingRingData = nullptr;
 
       if(vkCreateBuffer(device, &bufferInfo, nullptr, &stagingBuffer) != VK_SUCCESS)
       {
         throw vgl_runtime_error("Failed to create vertex buffer!");
       }
 
-      alloc = instance->getMemoryManager()->allocateBuffer(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer);
+      auto memoryManager = instance->getMemoryManager();
+      auto swapChain = instance->getSwapChain();
+      alloc = nullptr;
+
+      if(transient && swapChain)
+        alloc = memoryManager->allocateTransientBuffer(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, swapChain->getCurrentFrameId());
+      if(!alloc)
+      {
+        //staging that's released after the upload is short lived, otherwise it lives as long as the texture itself
+        auto stagingLifetime = (autoReleaseStaging && !readbackEnabled) ? VulkanMemoryManager::LT_TRANSIENT : lifetime;
+        alloc = memoryManager->allocateBuffer(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, VulkanMemoryManager::Any, stagingLifetime);
+      }
       stagingBufferAllocation = alloc;
 
       instance->getMemoryManager()->bindBufferMemory(stagingBuffer, alloc);
@@ -975,10 +1296,8 @@ namespace vgl
       return false;
     }
 
-    void VulkanTexture::createImage()
+    void VulkanTexture::makeImageCreateInfo(VkImageCreateInfo &imageInfo)
     {
-      VkImageCreateInfo imageInfo = {};
-
       imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
       switch(type)
       {
@@ -1007,18 +1326,28 @@ namespace vgl
       if(type == TT_CUBE_MAP)
         imageInfo.flags = VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT;
 
-      if((mipmapEnabled && !isCompressedTextureFormat(format) && autoGenerateMipmaps) || readbackEnabled)
-        imageInfo.usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+      //transfer source is needed for mip generation & readback, and always so that defragment() can copy this image elsewhere
+      imageInfo.usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+
+      //formats without linear blits have their mip chains written by a compute shader
+      if(numMipLevels > 1 && instance->getMipmapGenerator()->needsStorageUsage(format))
+        imageInfo.usage |= VK_IMAGE_USAGE_STORAGE_BIT;
+    }
+
+    void VulkanTexture::createImage()
+    {
+      VkImageCreateInfo imageInfo = {};
+      makeImageCreateInfo(imageInfo);
 
       if(vkCreateImage(device, &imageInfo, nullptr, &image) != VK_SUCCESS)
         throw std::runtime_error("Failed to create Vulkan image!");
 
-      auto alloc = instance->getMemoryManager()->allocateImage(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image);
+      auto alloc = instance->getMemoryManager()->allocateImage(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, VulkanMemoryManager::Any, lifetime);
 
       if(!alloc)
       {
         //must be out of GPU memory, fallback on whatever we can use
-        alloc = instance->getMemoryManager()->allocateImage(0, image);
+        alloc = instance->getMemoryManager()->allocateImage(0, image, VulkanMemoryManager::Any, lifetime);
         isResident = false;
       }
       else
@@ -1028,6 +1357,86 @@ namespace vgl
 
       imageAllocation = alloc;
       instance->getMemoryManager()->bindImageMemory(image, alloc);
+      unfilledLayers = (1u << numArrayLayers) - 1;
+      pendingMipLayers = 0;
+
+      VkMemoryRequirements memRequirements;
+      vkGetImageMemoryRequirements(device, image, &memRequirements);
+      instance->getMemoryManager()->setRelocationDelegate(alloc, this, memRequirements.alignment, memRequirements.memoryTypeBits);
+
+      if(auto swapChain = instance->getSwapChain())
+        lastUsedFrameId = swapChain->getCurrentFrameId();
+    }
+
+    bool VulkanTexture::relocate(const VulkanMemoryManager::Suballocation &oldSuballocation, const VulkanMemoryManager::Suballocation &newSuballocation, 
+      VkCommandBuffer commandBuffer)
+    {
+      if(!imageHandle || isSwapchainImage || !(imageAllocation == oldSuballocation))
+        return false;
+
+      //layers that were never uploaded are still undefined and ones awaiting their mip chain are still transfer destinations,
+      //so partially filled textures are left where they are until every layer is in place (defragment() simply moves on)
+      if(unfilledLayers || pendingMipLayers)
+        return false;
+
+      auto memoryManager = instance->getMemoryManager();
+      VkImage oldImage = image, newImage = VK_NULL_HANDLE;
+
+      VkImageCreateInfo imageInfo = {};
+      makeImageCreateInfo(imageInfo);
+      if(vkCreateImage(device, &imageInfo, nullptr, &newImage) != VK_SUCCESS)
+        return false;
+      memoryManager->bindImageMemory(newImage, newSuballocation);
+
+      //every level & layer of an imageData() texture rests in shader read only layout
+      transitionLayout(VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, commandBuffer);
+      image = newImage;
+      transitionLayout(VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, commandBuffer);
+
+      vector<VkImageCopy> regions(numMipLevels);
+      for(uint32_t level = 0; level < numMipLevels; level++)
+      {
+        auto &region = regions[level];
+
+        region = {};
+        region.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.srcSubresource.mipLevel = level;
+        region.srcSubresource.baseArrayLayer = 0;
+        region.srcSubresource.layerCount = numArrayLayers;
+        region.dstSubresource = region.srcSubresource;
+        region.extent = { max(width >> level, 1u), max(height >> level, 1u), max(depth >> level, 1u) };
+      }
+      vkCmdCopyImage(commandBuffer, oldImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, newImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 
+        (uint32_t)regions.size(), regions.data());
+
+      transitionLayout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, commandBuffer);
+
+      //descriptors written earlier this frame may still sample the old image
+      image = oldImage;
+      transitionLayout(VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, commandBuffer);
+      image = newImage;
+
+      createImageView();
+      imageAllocation = newSuballocation;
+      isResident = memoryManager->isAllocationDeviceLocal(newSuballocation);
+
+      auto oldImageHandle = imageHandle;
+      imageHandle = VulkanAsyncResourceHandle::newImage(instance->getResourceMonitor(), device, image, imageView, imageAllocation);
+
+      //the old image (and its memory) goes away once the frame recording this copy completes
+      uint64_t frameId = instance->getSwapChain()->getCurrentFrameId();
+      auto resourceMonitor = instance->getResourceMonitor();
+      VulkanAsyncResourceCollection frameResources(resourceMonitor, frameId, { oldImageHandle, imageHandle });
+      resourceMonitor->append(move(frameResources));
+
+      if(oldImageHandle->release())
+        delete oldImageHandle;
+
+      safeUnbind();
+      if(relocationCallback)
+        relocationCallback();
+
+      return true;
     }
 
     void VulkanTexture::createImageView()
@@ -1090,7 +1499,8 @@ namespace vgl
         samplerState.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
         //samplerState.compareEnable = VK_TRUE;
         //samplerState.compareOp = VK_COMPARE_OP_ALWAYS;
-        samplerState.minLod = 0;
+        //while streaming, levels finer than the resident one hold nothing yet
+        samplerState.minLod = (float)residentMipLevel;
         if(mipmapEnabled)
           samplerState.maxLod = (float)numMipLevels;
 
@@ -1115,7 +1525,10 @@ namespace vgl
       }
 
       VkBufferImageCopy region = {};
-      region.bufferOffset = (size / numArrayLayers) * layerIndex;
+      if(stagingRingData)
+        region.bufferOffset = stagingBufferOffset;
+      else
+        region.bufferOffset = (size / numArrayLayers) * layerIndex;
       region.bufferRowLength = 0;
       region.bufferImageHeight = 0;
 
@@ -1129,52 +1542,40 @@ namespace vgl
 
       transitionLayout(VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, layerIndex, copyCommandBuffer);
       vkCmdCopyBufferToImage(copyCommandBuffer, stagingBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+      unfilledLayers &= ~(1u << layerIndex);
       if(!mipmapEnabled || !autoGenerateMipmaps || isCompressedTextureFormat(format))
       {
         transitionLayout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, layerIndex, copyCommandBuffer);
       }
       else
       {
-        //this is insanely inefficent for the layerCount > 1 (cubemap) case
-        generateMipmaps(layerIndex, copyCommandBuffer);
+        //the faces of a new cube map usually arrive back to back, so its chain is generated once for all of them after the last one
+        pendingMipLayers |= (1u << layerIndex);
+        if(!unfilledLayers)
+        {
+          uint32_t baseLayer = 0, layerCount = 0;
+          while(!(pendingMipLayers & (1u << baseLayer)))
+            baseLayer++;
+          while(pendingMipLayers & (1u << (baseLayer + layerCount)))
+            layerCount++;
+
+          generateMipmaps(baseLayer, layerCount, copyCommandBuffer);
+          pendingMipLayers = 0;
+        }
       }
 
       if(!transferCommandBuffer)
       {
         submitOneTimeCommandBuffer(copyCommandBuffer);
       }
-      else if(instance->getCurrentTransferCommandBuffer())
+      else
       {
-        bool frame = false;
-
-#ifndef VGL_VULKAN_CORE_STANDALONE
-        auto csm = static_cast<vgl::CoreStateMachine *>(instance->getParentRenderer());
-
-        if(csm->isInsideFrame())
-          frame = true;
-#endif
-
-        if(frame)
-        {
-          uint64_t frameId = instance->getSwapChain()->getCurrentFrameId();
-          auto resourceMonitor = instance->getResourceMonitor();
-
-          VulkanAsyncResourceCollection frameResources(resourceMonitor, frameId, {
-            stagingBufferHandle, imageHandle,
-          });
-          resourceMonitor->append(move(frameResources));
-        }
-        else
-        {
-          //by passing a null fence, we mark these resources as committed to a command buffer that hasn't
-          //been submitted yet, and the fence will be provided when the transfer buffer is finally submitted
-          auto resourceMonitor = instance->getResourceMonitor();
-          VulkanAsyncResourceCollection frameResources(resourceMonitor, (VulkanAsyncResourceHandle *)nullptr, {
-            stagingBufferHandle, imageHandle,
-          });
-          resourceMonitor->append(move(frameResources));
-        }
+        retainTransferResources();
       }
+
+      if(mipScratchHandle && mipScratchHandle->release())
+        delete mipScratchHandle;
+      mipScratchHandle = nullptr;
     }
 
     void VulkanTexture::copyFromImage(uint32_t x, uint32_t y, uint32_t copyWidth, uint32_t copyHeight, uint32_t layerIndex, uint32_t level, VkCommandBuffer transferCommandBuffer, bool wait)
@@ -1227,37 +1628,45 @@ namespace vgl
         //submit and wait
         submitOneTimeCommandBuffer(copyCommandBuffer, true);
       }
-      else if(instance->getCurrentTransferCommandBuffer())
+      else
       {
-        bool frame = false;
+        retainTransferResources();
+      }
+    }
+
+    void VulkanTexture::retainTransferResources()
+    {
+      if(!instance->getCurrentTransferCommandBuffer())
+        return;
+
+      bool frame = false;
 
 #ifndef VGL_VULKAN_CORE_STANDALONE
-        auto csm = static_cast<vgl::CoreStateMachine *>(instance->getParentRenderer());
+      auto csm = static_cast<vgl::CoreStateMachine *>(instance->getParentRenderer());
 
-        if(csm->isInsideFrame())
-          frame = true;
+      if(csm->isInsideFrame())
+        frame = true;
 #endif
 
-        if(frame)
-        {
-          uint64_t frameId = instance->getSwapChain()->getCurrentFrameId();
-          auto resourceMonitor = instance->getResourceMonitor();
+      if(frame)
+      {
+        uint64_t frameId = instance->getSwapChain()->getCurrentFrameId();
+        auto resourceMonitor = instance->getResourceMonitor();
 
-          VulkanAsyncResourceCollection frameResources(resourceMonitor, frameId, {
-            stagingBufferHandle, imageHandle,
-          });
-          resourceMonitor->append(move(frameResources));
-        }
-        else
-        {
-          //by passing a null fence, we mark these resources as committed to a command buffer that hasn't
-          //been submitted yet, and the fence will be provided when the transfer buffer is finally submitted
-          auto resourceMonitor = instance->getResourceMonitor();
-          VulkanAsyncResourceCollection frameResources(resourceMonitor, (VulkanAsyncResourceHandle *)nullptr, {
-            stagingBufferHandle, imageHandle,
-          });
-          resourceMonitor->append(move(frameResources));
-        }
+        VulkanAsyncResourceCollection frameResources(resourceMonitor, frameId, {
+          stagingBufferHandle, imageHandle, mipScratchHandle,
+        });
+        resourceMonitor->append(move(frameResources));
+      }
+      else
+      {
+        //by passing a null fence, we mark these resources as committed to a command buffer that hasn't
+        //been submitted yet, and the fence will be provided when the transfer buffer is finally submitted
+        auto resourceMonitor = instance->getResourceMonitor();
+        VulkanAsyncResourceCollection frameResources(resourceMonitor, (VulkanAsyncResourceHandle *)nullptr, {
+          stagingBufferHandle, imageHandle, mipScratchHandle,
+        });
+        resourceMonitor->append(move(frameResources));
       }
     }
 
@@ -1266,6 +1675,186 @@ namespace vgl
       deferImageCreation = defer;
     }
 
+    void VulkanTexture::streamImageData(uint32_t width, uint32_t height, VkFormat format, const vector<size_t> &levelSizes, MipLevelSource levelData, 
+      float priority, VkCommandBuffer transferCommandBuffer)
+    {
+      if(type == TT_CUBE_MAP)
+        throw vgl_runtime_error("VulkanTexture::streamImageData() does not support cube maps!");
+
+      if(isStreaming())
+        stopStreaming();
+      if(levelSizes.empty() || !levelData || width == 0 || height == 0)
+        return;
+
+      if(imageHandle)
+      {
+        //trying out a new policy of always keeping outgoing-handles around until next frame completes
+        uint64_t frameId = instance->getSwapChain()->getCurrentFrameId();
+        retainResourcesUntilFrameCompletion(frameId);
+        instance->getMemoryManager()->setRelocationDelegate(imageAllocation, nullptr);
+
+        if(imageHandle->release())
+          delete imageHandle;
+        imageHandle = nullptr;
+        safeUnbind();
+      }
+      releaseStagingBuffers();
+
+      this->width = width;
+      this->height = height;
+      this->depth = 1;
+      this->format = format;
+      numMultiSamples = 1;
+      numArrayLayers = 1;
+      numMipLevels = min((uint32_t)levelSizes.size(), (uint32_t)(log2(max(width, height))) + 1);
+      setMipmap(true, samplerState.mipLodBias);
+
+      streamLevelSizes.assign(levelSizes.begin(), levelSizes.begin() + numMipLevels);
+      streamSource = move(levelData);
+      streamPriority = priority;
+      residentMipLevel = numMipLevels;
+      isShaderRsrc = true;
+
+      createImage();
+      createImageView();
+      imageHandle = VulkanAsyncResourceHandle::newImage(instance->getResourceMonitor(), device, image, imageView, imageAllocation);
+
+      streamNextLevel(transferCommandBuffer);
+      createSampler();
+
+      if(isStreaming())
+        instance->getTextureStreamer()->add(this);
+    }
+
+    VkDeviceSize VulkanTexture::streamNextLevel(VkCommandBuffer transferCommandBuffer)
+    {
+      if(!isStreaming() || residentMipLevel == 0)
+        return 0;
+
+      uint32_t level = residentMipLevel - 1;
+      size_t numBytes = streamLevelSizes[level];
+      const void *data = streamSource(level);
+      if(!data)
+        throw vgl_runtime_error("Mip level source returned no data in VulkanTexture::streamNextLevel()!");
+
+      //each level gets its own staging, released as soon as the copy is recorded
+      releaseStagingBuffers();
+      size = numBytes;
+
+      if(!transferCommandBuffer || transferCommandBuffer == instance->getCurrentTransferCommandBuffer())
+      {
+        if(auto uploadRing = instance->getUploadRing())
+        {
+          VkDeviceSize levelTexels = (VkDeviceSize)max(width >> level, 1u) * max(height >> level, 1u);
+          VkDeviceSize texelSize = max<VkDeviceSize>(numBytes / levelTexels, 1);
+          VkDeviceSize alignment = (isCompressedTextureFormat(format)) ? 16 : texelSize*4;
+
+          if(auto range = uploadRing->allocate(numBytes, alignment))
+          {
+            stagingBuffer = range.buffer;
+            stagingBufferHandle = range.handle;
+            stagingBufferAllocation = nullptr;
+            stagingBufferOffset = range.offset;
+            stagingRingData = range.mappedData;
+          }
+        }
+      }
+
+      if(stagingRingData)
+      {
+        memcpy(stagingRingData, data, numBytes);
+        instance->getUploadRing()->flush(stagingBufferOffset, numBytes);
+      }
+      else
+      {
+        auto memoryManager = instance->getMemoryManager();
+
+        createStagingBuffer(false);
+        auto allocInfo = memoryManager->getAllocationInfo(stagingBufferAllocation);
+        if(!allocInfo.mappedData)
+          throw vgl_runtime_error("Unable to map staging buffer in VulkanTexture::streamNextLevel()!");
+        memcpy(allocInfo.mappedData, data, numBytes);
+        memoryManager->flushAllocation(stagingBufferAllocation, 0, numBytes);
+      }
+
+      auto copyCommandBuffer = transferCommandBuffer;
+      if(!transferCommandBuffer)
+        copyCommandBuffer = startOneTimeCommandBuffer();
+
+      //every level rests in shader read only layout from the start, the ones that aren't resident yet are simply never sampled
+      if(level == numMipLevels - 1)
+      {
+        transitionLayout(VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, copyCommandBuffer);
+        unfilledLayers = 0;
+      }
+
+      VkImageMemoryBarrier barrier = {};
+      barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+      barrier.image = image;
+      barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+      barrier.subresourceRange.baseMipLevel = level;
+      barrier.subresourceRange.levelCount = 1;
+      barrier.subresourceRange.baseArrayLayer = 0;
+      barrier.subresourceRange.layerCount = 1;
+
+      barrier.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+      barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+      barrier.srcAccessMask = 0;
+      barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+      vkCmdPipelineBarrier(copyCommandBuffer, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+      VkBufferImageCopy region = {};
+      region.bufferOffset = stagingBufferOffset;
+      region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+      region.imageSubresource.mipLevel = level;
+      region.imageSubresource.baseArrayLayer = 0;
+      region.imageSubresource.layerCount = 1;
+      region.imageOffset = { 0, 0, 0 };
+      region.imageExtent = { max(width >> level, 1u), max(height >> level, 1u), 1 };
+      vkCmdCopyBufferToImage(copyCommandBuffer, stagingBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+      barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+      barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+      barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+      barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+      vkCmdPipelineBarrier(copyCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+      if(!transferCommandBuffer)
+        submitOneTimeCommandBuffer(copyCommandBuffer);
+      else
+        retainTransferResources();
+      releaseStagingBuffers();
+
+      residentMipLevel = level;
+      if(level == 0)
+      {
+        streamSource = nullptr;
+        streamLevelSizes.clear();
+      }
+
+      //the new level can't be sampled until the sampler's minLod drops, which means rewriting the descriptors that hold the old sampler
+      if(samplerHandle)
+      {
+        samplerDirty = true;
+        safeUnbind();
+        if(relocationCallback)
+          relocationCallback();
+      }
+
+      return numBytes;
+    }
+
+    void VulkanTexture::stopStreaming()
+    {
+      instance->getTextureStreamer()->remove(this);
+      streamSource = nullptr;
+      streamLevelSizes.clear();
+      residentMipLevel = 0;
+      samplerDirty = true;
+    }
+
     void VulkanTexture::retainResourcesUntilFrameCompletion(uint64_t frameId)
     {
       auto resourceMonitor = instance->getResourceMonitor();
@@ -1274,8 +1863,9 @@ namespace vgl
 
       VulkanAsyncResourceCollection frameResources(resourceMonitor, frameId, handles);
       resourceMonitor->append(move(frameResources));
-    }
 
+      lastUsedFrameId = max(lastUsedFrameId, frameId);
+    }
 #ifndef VGL_VULKAN_CORE_STANDALONE
     void VulkanTexture::bind(int binding)
     {
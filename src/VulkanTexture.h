@@ -17,16 +17,19 @@ limitations under the License.
 #pragma once
 
 #include <vector>
+#include <functional>
 #include "vulkan.h"
 #include "VulkanInstance.h"
 #include "VulkanMemoryManager.h"
 #include "VulkanAsyncResourceHandle.h"
+#include "VulkanTextureStreamer.h"
+#include "VulkanMipmapGenerator.h"
 
 namespace vgl
 {
   namespace core
   {
-    class VulkanTexture
+    class VulkanTexture : public VulkanMemoryManager::RelocationDelegate
     {
     public:
       enum TextureType { TT_1D=0, TT_2D, TT_CUBE_MAP };
@@ -63,7 +66,40 @@ namespace vgl
       };
       void initImage(uint32_t width, uint32_t height, uint32_t depth, VkFormat format, uint32_t usage=U_SAMPLED_IMAGE, uint32_t layerIndex=0, uint32_t numSamples = 1, VkCommandBuffer transferCommandBuffer=nullptr);
 
+      ///Attachments that are never sampled, read back or stored by a render pass (such as MSAA targets) can be transient.
+      ///They're placed in lazily allocated memory where the device has it (which may never be backed by actual memory on tiled GPUs).
+      ///This must be set BEFORE initImage() to have an effect
+      inline void setTransientAttachment(bool transient) { transientAttachment = transient; }
+
+      ///Textures given the same alias id (see VulkanMemoryManager::newAliasId()) share memory, so they must never be in use at the same time.
+      ///This must be set BEFORE initImage() to have an effect, initialize the largest of the group first
+      inline void setAliasId(uint64_t id) { aliasId = id; }
+      inline uint64_t getAliasId() { return aliasId; }
+
+      ///Hints how long this texture lives, so textures that are frequently recreated (such as resizable render targets) are kept out
+      ///of the memory of long lived ones.  This must be set BEFORE initImage() to have an effect.  Currently, the default is LT_STATIC
+      inline void setLifetime(VulkanMemoryManager::Lifetime lt) { lifetime = lt; }
+
+      ///Records the barrier that hands aliased memory over to this texture, call it before this texture is first used after another alias.
+      ///Waits on attachment, shader & transfer writes of the previous alias and discards its contents (returning this texture to its initImage() layout)
+      void aliasBarrier(VkCommandBuffer commandBuffer);
+
       void readImageData(uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint32_t layer, uint32_t level, void *data);
+
+      ///Like readImageData() without stalling:  the copy is recorded and the returned readback resolves (with RGBA pixels) once it completes.
+      ///Pass the instance's transfer command buffer to record into it (frame=true to tie it to the current frame), otherwise it's submitted right away
+      std::shared_ptr<VulkanReadback> readImageDataAsync(uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint32_t layer, uint32_t level, 
+        VkCommandBuffer transferCommandBuffer=nullptr, bool frame=false);
+
+      ///Reads back a region scaled to dstWidth x dstHeight & converted to dstFormat on the GPU first, so only the small result is copied 
+      ///to the host (thumbnails & previews).  Reductions are blitted in linearly filtered halving steps so every source texel contributes. 
+      ///Both formats must support blitting, and like readImageData() BGRA formats are handed back as RGBA
+      void readImageDataScaled(uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint32_t layer, uint32_t level, 
+        uint32_t dstWidth, uint32_t dstHeight, void *data, VkFormat dstFormat=VK_FORMAT_R8G8B8A8_UNORM);
+
+      ///Like readImageDataScaled() without stalling, see readImageDataAsync()
+      std::shared_ptr<VulkanReadback> readImageDataScaledAsync(uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint32_t layer, uint32_t level, 
+        uint32_t dstWidth, uint32_t dstHeight, VkFormat dstFormat=VK_FORMAT_R8G8B8A8_UNORM, VkCommandBuffer transferCommandBuffer=nullptr, bool frame=false);
       
       enum SamplerFilterType { ST_LINEAR, ST_NEAREST, ST_LINEAR_MIPMAP_LINEAR, ST_LINEAR_MIPMAP_NEAREST };
       void setFilters(SamplerFilterType minFilter, SamplerFilterType magFilter);
@@ -103,7 +139,7 @@ namespace vgl
       inline VkSampleCountFlagBits getMultiSamples() { return (VkSampleCountFlagBits)numMultiSamples; }
       inline TextureType getType() { return type; }
 
-      ///True if this texture is currently resident on the device
+      ///True if this texture is currently resident on the device (the memory manager may demote it to host memory under memory pressure)
       inline bool isDeviceResident() { return isResident; }
 
       ///True if this texture was created with the notion that it would be used for sampled images inside shaders
@@ -117,9 +153,37 @@ namespace vgl
       ///(has to be enabled BEFORE imageData is called for it to have an effect)
       void setDeferImageCreation(bool defer);
 
+      ///Returns the bytes of a mip level, only needs to stay valid until the next call (so levels can be loaded or decoded on demand)
+      typedef std::function<const void *(uint32_t level)> MipLevelSource;
+
+      ///Streams a mip chain into this texture from the coarsest level to the finest.  The coarsest level is uploaded right away so the 
+      ///texture can be sampled immediately, the rest are uploaded by the instance's VulkanTextureStreamer under its per frame byte budget.
+      ///The sampler's minLod is clamped to the finest resident level meanwhile, so descriptors are rewritten (see setRelocationCallback) 
+      ///as levels land.  levelSizes holds the byte size of each level, finest (level 0) first.  Cube maps can't be streamed yet
+      void streamImageData(uint32_t width, uint32_t height, VkFormat format, const std::vector<size_t> &levelSizes, MipLevelSource levelData, 
+        float priority=0, VkCommandBuffer transferCommandBuffer=nullptr);
+
+      ///Textures with a higher priority get their finer levels first, this can be changed at any time (such as by screen coverage)
+      inline void setStreamingPriority(float priority) { streamPriority = priority; }
+      inline float getStreamingPriority() { return streamPriority; }
+
+      ///True while streamImageData() still has finer levels to upload
+      inline bool isStreaming() { return (bool)streamSource; }
+
+      ///The finest mip level that can currently be sampled (always 0 unless streaming)
+      inline uint32_t getResidentMipLevel() { return residentMipLevel; }
+
       ///Explicitly retains the async resource handles this class manages for the given frame id (you should never need to call this)
       void retainResourcesUntilFrameCompletion(uint64_t frameId);
 
+      ///Sampled textures created by imageData() may be moved by VulkanMemoryManager::defragment(), after which the image & image view change.
+      ///Use this to rewrite any descriptor sets that reference this texture
+      inline void setRelocationCallback(std::function<void()> callback) { relocationCallback = callback; }
+
+      ///Called by VulkanMemoryManager::defragment() & balanceResidency() (you should never need to call this)
+      bool relocate(const VulkanMemoryManager::Suballocation &oldSuballocation, const VulkanMemoryManager::Suballocation &newSuballocation, VkCommandBuffer commandBuffer) override;
+      inline uint64_t getLastUsedFrameId() override { return lastUsedFrameId; }
+
 #ifndef VGL_VULKAN_CORE_STANDALONE
       void bind(int binding);
 #endif
@@ -133,6 +197,8 @@ namespace vgl
       VulkanAsyncResourceHandle *imageHandle = nullptr, *stagingBufferHandle = nullptr, *samplerHandle = nullptr;
       VkImage image = VK_NULL_HANDLE;
       VkBuffer stagingBuffer = VK_NULL_HANDLE;
+      VkDeviceSize stagingBufferOffset = 0; //nonzero when the staging data is a range of the instance's upload ring (holding a single layer)
+      uint8_t *stagingRingData = nullptr;
       VkImageView imageView = VK_NULL_HANDLE;
       VkSampler sampler = VK_NULL_HANDLE;
       VulkanMemoryManager::Suballocation imageAllocation = nullptr, stagingBufferAllocation = nullptr;
@@ -145,12 +211,25 @@ namespace vgl
       bool deferImageCreation = false;
       bool isDepth = false, isStencil = false, isShaderRsrc = false, isSwapchainImage = false, stagingBufferTransferDst = false;
       bool isResident = false;
+      uint64_t lastUsedFrameId = 0;
       bool autoReleaseStaging = true;
+      bool transientAttachment = false;
+      uint64_t aliasId = 0;
+      VulkanMemoryManager::Lifetime lifetime = VulkanMemoryManager::LT_STATIC;
+      VkImageLayout initialImageLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 
       SamplerFilterType minFilter = ST_LINEAR, magFilter = ST_LINEAR;
       VkSamplerCreateInfo samplerState;
       bool mipmapEnabled = false, readbackEnabled = false;
       bool samplerDirty = true;
+      std::function<void()> relocationCallback;
+
+      MipLevelSource streamSource;
+      std::vector<size_t> streamLevelSizes;
+      uint32_t residentMipLevel = 0;
+      uint32_t unfilledLayers = 0, pendingMipLayers = 0; //bitmasks of array layers awaiting their first upload & mip generation
+      VulkanAsyncResourceHandle *mipScratchHandle = nullptr;
+      float streamPriority = 0;
 
       int bufferCount;
       TextureType type;
@@ -158,17 +237,28 @@ namespace vgl
       VkCommandBuffer startOneTimeCommandBuffer();
       void submitOneTimeCommandBuffer(VkCommandBuffer commandBuffer, bool wait=false);
 
-      void createStagingBuffer(bool needsTransferDest);
+      void createStagingBuffer(bool needsTransferDest, bool transient=false);
+      void makeImageCreateInfo(VkImageCreateInfo &imageInfo);
       void createImage();
       void createImageView();
       void createSampler();
       void copyToImage(uint32_t layerIndex, uint32_t level, VkCommandBuffer transferCommandBuffer);
       void copyFromImage(uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint32_t layerIndex, uint32_t level, VkCommandBuffer transferCommandBuffer, bool wait);
-      void generateMipmaps(uint32_t layerIndex, VkCommandBuffer transferCommandBuffer);
+      void generateMipmaps(uint32_t baseLayer, uint32_t layerCount, VkCommandBuffer transferCommandBuffer);
+
+      VulkanAsyncResourceHandle *createScaledReadImage(VkExtent2D extent, VkFormat format);
+      VkImage recordScaledBlits(VkCommandBuffer commandBuffer, const std::vector<VkExtent2D> &steps, VulkanAsyncResourceHandle *const scaledImages[2],
+        VkFormat dstFormat, uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint32_t layer, uint32_t level);
 
       void releaseStagingBuffers();
+      void retainTransferResources();
+
+      VkDeviceSize streamNextLevel(VkCommandBuffer transferCommandBuffer);
+      void stopStreaming();
 
       void safeUnbind();
+
+      friend class VulkanTextureStreamer;
     };
 
     typedef VulkanTexture Texture;
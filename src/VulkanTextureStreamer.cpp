@@ -0,0 +1,102 @@
+/*********************************************************************
+Copyright 2018 VERTO STUDIO LLC.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+***************************************************************************/
+
+#include "pch.h"
+#include <algorithm>
+#include "VulkanInstance.h"
+#include "VulkanTexture.h"
+#include "VulkanTextureStreamer.h"
+#include "VulkanAsyncResourceHandle.h"
+
+using namespace std;
+
+namespace vgl
+{
+  namespace core
+  {
+    VulkanTextureStreamer::VulkanTextureStreamer(VkDeviceSize bytesPerFrame)
+      : bytesPerFrame(bytesPerFrame)
+    {
+    }
+
+    void VulkanTextureStreamer::add(VulkanTexture *texture)
+    {
+      if(find(textures.begin(), textures.end(), texture) == textures.end())
+        textures.push_back(texture);
+    }
+
+    void VulkanTextureStreamer::remove(VulkanTexture *texture)
+    {
+      textures.erase(std::remove(textures.begin(), textures.end(), texture), textures.end());
+    }
+
+    VkDeviceSize VulkanTextureStreamer::getPendingBytes()
+    {
+      VkDeviceSize bytes = 0;
+
+      for(auto texture : textures)
+      {
+        for(uint32_t level = 0; level < texture->residentMipLevel && level < texture->streamLevelSizes.size(); level++)
+          bytes += texture->streamLevelSizes[level];
+      }
+
+      return bytes;
+    }
+
+    void VulkanTextureStreamer::pump(VkCommandBuffer transferCommandBuffer)
+    {
+      if(textures.empty())
+        return;
+
+      //stable so that textures of equal priority keep the order they were streamed in
+      stable_sort(textures.begin(), textures.end(), [](VulkanTexture *a, VulkanTexture *b) {
+        return a->streamPriority > b->streamPriority;
+      });
+
+      auto batcher = VulkanInstance::currentInstance().getUploadBatcher();
+      if(!transferCommandBuffer)
+        batcher->begin();
+
+      VkDeviceSize spent = 0;
+      bool progressed = true;
+
+      while(progressed && spent < bytesPerFrame)
+      {
+        progressed = false;
+        for(auto texture : textures)
+        {
+          if(!texture->isStreaming())
+            continue;
+
+          //a level bigger than the whole budget still goes through as the first upload of a frame, otherwise it would never land
+          VkDeviceSize levelBytes = texture->streamLevelSizes[texture->residentMipLevel - 1];
+          if(spent > 0 && spent + levelBytes > bytesPerFrame)
+            continue;
+
+          spent += texture->streamNextLevel(transferCommandBuffer);
+          progressed = true;
+        }
+      }
+
+      if(!transferCommandBuffer)
+        batcher->end();
+
+      textures.erase(remove_if(textures.begin(), textures.end(), [](VulkanTexture *texture) {
+        return !texture->isStreaming();
+      }), textures.end());
+    }
+  }
+}
@@ -0,0 +1,55 @@
+/*********************************************************************
+Copyright 2018 VERTO STUDIO LLC.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+***************************************************************************/
+
+#pragma once
+
+#include <vector>
+#include "vulkan.h"
+
+namespace vgl
+{
+  namespace core
+  {
+    class VulkanTexture;
+
+    ///Uploads the mip chains handed to VulkanTexture::streamImageData() a few levels at a time, owned by the instance.
+    ///Call pump() once per frame (ExampleRenderer does this at the start of each frame)
+    class VulkanTextureStreamer
+    {
+    public:
+      VulkanTextureStreamer(VkDeviceSize bytesPerFrame=4*1024*1024);
+
+      ///Uploads the next finer levels of streaming textures until this frame's byte budget is spent.  Each pass moves every texture 
+      ///one level finer (highest priority first), so the coarse levels of all textures land before the fine levels of any.
+      ///Without a transfer command buffer, the uploads are batched into a single submit
+      void pump(VkCommandBuffer transferCommandBuffer=nullptr);
+
+      inline void setBytesPerFrame(VkDeviceSize bytes) { bytesPerFrame = bytes; }
+      inline VkDeviceSize getBytesPerFrame() { return bytesPerFrame; }
+
+      ///Bytes of mip levels still waiting to be uploaded
+      VkDeviceSize getPendingBytes();
+      inline bool isIdle() { return textures.empty(); }
+
+      void add(VulkanTexture *texture);
+      void remove(VulkanTexture *texture);
+
+    protected:
+      std::vector<VulkanTexture *> textures;
+      VkDeviceSize bytesPerFrame;
+    };
+  }
+}
@@ -0,0 +1,261 @@
+/*********************************************************************
+Copyright 2018 VERTO STUDIO LLC.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+***************************************************************************/
+
+#include "pch.h"
+#include <limits>
+#include "VulkanUploadBatcher.h"
+
+using namespace std;
+
+namespace vgl
+{
+  namespace core
+  {
+    VulkanUploadBatcher::VulkanUploadBatcher(VkDevice device, VkQueue queue, uint32_t queueFamily, VkCommandPool commandPool, VkQueue transferQueue,
+      uint32_t transferQueueFamily, VkCommandPool transferCommandPool, VulkanAsyncResourceMonitor *resourceMonitor)
+      : device(device), queue(queue), transferQueue(transferQueue), queueFamily(queueFamily), transferQueueFamily(transferQueueFamily), 
+        commandPool(commandPool), transferCommandPool(transferCommandPool), resourceMonitor(resourceMonitor)
+    {
+    }
+
+    VulkanUploadBatcher::~VulkanUploadBatcher()
+    {
+      flush(true);
+    }
+
+    void VulkanUploadBatcher::begin()
+    {
+      depth++;
+    }
+
+    void VulkanUploadBatcher::end(bool wait)
+    {
+      if(depth == 0)
+        throw vgl_runtime_error("VulkanUploadBatcher::end() called without a matching begin()!");
+
+      if(--depth == 0)
+        flush(wait);
+    }
+
+    VkCommandBuffer VulkanUploadBatcher::startCommandBuffer(VkCommandPool pool)
+    {
+      VkCommandBufferAllocateInfo allocInfo = {};
+      allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+      allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+      allocInfo.commandPool = pool;
+      allocInfo.commandBufferCount = 1;
+
+      VkCommandBuffer commandBuffer;
+      vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer);
+
+      VkCommandBufferBeginInfo beginInfo = {};
+      beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+      beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+      vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+      return commandBuffer;
+    }
+
+    VkCommandBuffer VulkanUploadBatcher::record()
+    {
+      if(!graphics.commandBuffer)
+      {
+        graphics.commandBuffer = startCommandBuffer(commandPool);
+
+        //stands in for each transfer's own barrier against work submitted before the batch
+        VkMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+        vkCmdPipelineBarrier(graphics.commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+      }
+
+      transfers++;
+      return graphics.commandBuffer;
+    }
+
+    VkCommandBuffer VulkanUploadBatcher::recordUpload(VkBuffer dst, bool unused)
+    {
+      //a buffer the graphics queue may have touched would need its ownership released there first, so those stay on the graphics queue
+      if(!hasTransferQueue() || (!unused && !uploadTargetSet.count(dst)))
+        return record();
+
+      if(!upload.commandBuffer)
+        upload.commandBuffer = startCommandBuffer(transferCommandPool);
+      if(uploadTargetSet.insert(dst).second)
+        uploadTargets.push_back(dst);
+
+      transfers++;
+      stats.transferQueueUploads++;
+      return upload.commandBuffer;
+    }
+
+    void VulkanUploadBatcher::orderTransfer(VkCommandBuffer commandBuffer, VkBuffer src, VkBuffer dst)
+    {
+      auto &lane = (commandBuffer == upload.commandBuffer) ? upload : graphics;
+
+      if((dst && lane.touched.count(dst)) || (src && lane.written.count(src)))
+      {
+        VkMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+        lane.written.clear();
+        lane.touched.clear();
+      }
+
+      if(src)
+        lane.touched.insert(src);
+      if(dst)
+      {
+        lane.written.insert(dst);
+        lane.touched.insert(dst);
+      }
+    }
+
+    void VulkanUploadBatcher::track(const vector<VulkanAsyncResourceHandle *> &handles)
+    {
+      for(auto handle : handles) if(handle)
+      {
+        handle->retain();
+        this->handles.push_back(handle);
+      }
+    }
+
+    void VulkanUploadBatcher::flush(bool wait)
+    {
+      if(!graphics.commandBuffer && !upload.commandBuffer)
+        return;
+
+      auto batchHandles = handles;
+      VkSemaphore uploadSemaphore = VK_NULL_HANDLE;
+      uint32_t submits = 1;
+
+      if(upload.commandBuffer)
+      {
+        //the transfer queue family releases what it wrote..
+        vector<VkBufferMemoryBarrier> barriers(uploadTargets.size());
+        for(size_t i = 0; i < uploadTargets.size(); i++)
+        {
+          auto &barrier = barriers[i];
+          barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+          barrier.buffer = uploadTargets[i];
+          barrier.size = VK_WHOLE_SIZE;
+          barrier.srcQueueFamilyIndex = transferQueueFamily;
+          barrier.dstQueueFamilyIndex = queueFamily;
+          barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+          barrier.dstAccessMask = 0;
+        }
+        vkCmdPipelineBarrier(upload.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 
+          (uint32_t)barriers.size(), barriers.data(), 0, nullptr);
+        vkEndCommandBuffer(upload.commandBuffer);
+
+        VkSemaphoreCreateInfo semaphoreInfo = {};
+        semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+        if(vkCreateSemaphore(device, &semaphoreInfo, nullptr, &uploadSemaphore) != VK_SUCCESS)
+          throw vgl_runtime_error("Could not create Vulkan Semaphore!");
+
+        VkSubmitInfo submitInfo = {};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &upload.commandBuffer;
+        submitInfo.signalSemaphoreCount = 1;
+        submitInfo.pSignalSemaphores = &uploadSemaphore;
+
+        vkQueueSubmit(transferQueue, 1, &submitInfo, VK_NULL_HANDLE);
+        submits++;
+
+        //..and the graphics queue family acquires it, after waiting on the semaphore
+        if(!graphics.commandBuffer)
+          graphics.commandBuffer = startCommandBuffer(commandPool);
+        for(auto &barrier : barriers)
+        {
+          barrier.srcAccessMask = 0;
+          barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+        }
+        vkCmdPipelineBarrier(graphics.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 
+          (uint32_t)barriers.size(), barriers.data(), 0, nullptr);
+
+        batchHandles.push_back(VulkanAsyncResourceHandle::newCommandBuffer(resourceMonitor, device, upload.commandBuffer, transferCommandPool));
+        batchHandles.push_back(VulkanAsyncResourceHandle::newSemaphore(resourceMonitor, device, uploadSemaphore));
+      }
+
+      //and this one for each transfer's barrier against work submitted after the batch
+      VkMemoryBarrier barrier = {};
+      barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+      barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+      barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+      vkCmdPipelineBarrier(graphics.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+      vkEndCommandBuffer(graphics.commandBuffer);
+
+      VkFence transferFence;
+      VkFenceCreateInfo fenceInfo = {};
+      fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+      if(vkCreateFence(device, &fenceInfo, nullptr, &transferFence) != VK_SUCCESS)
+        throw vgl_runtime_error("Could not create Vulkan Fence!");
+
+      VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+      VkSubmitInfo submitInfo = {};
+      submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+      submitInfo.commandBufferCount = 1;
+      submitInfo.pCommandBuffers = &graphics.commandBuffer;
+      if(uploadSemaphore)
+      {
+        submitInfo.waitSemaphoreCount = 1;
+        submitInfo.pWaitSemaphores = &uploadSemaphore;
+        submitInfo.pWaitDstStageMask = &waitStage;
+      }
+
+      vkQueueSubmit(queue, 1, &submitInfo, transferFence);
+
+      //just a note, fences must always be the LAST entry in these collections
+      auto fenceHandle = VulkanAsyncResourceHandle::newFence(resourceMonitor, device, transferFence);
+      auto cmdBufHandle = VulkanAsyncResourceHandle::newCommandBuffer(resourceMonitor, device, graphics.commandBuffer, commandPool);
+      batchHandles.push_back(cmdBufHandle);
+      batchHandles.push_back(fenceHandle);
+      VulkanAsyncResourceCollection transferResources(resourceMonitor, fenceHandle, batchHandles);
+      resourceMonitor->append(move(transferResources));
+
+      //the collection holds its own references now
+      for(size_t i = handles.size(); i < batchHandles.size(); i++)
+        batchHandles[i]->release();
+      for(auto handle : handles)
+      {
+        if(handle->release())
+          delete handle;
+      }
+
+      if(wait)
+        vkWaitForFences(device, 1, &transferFence, VK_TRUE, numeric_limits<uint64_t>::max());
+
+      stats.submits += submits;
+      stats.transfers += transfers;
+      stats.submitsSaved += (transfers > submits) ? transfers-submits : 0;
+
+      graphics = Lane();
+      upload = Lane();
+      uploadTargets.clear();
+      uploadTargetSet.clear();
+      handles.clear();
+      transfers = 0;
+    }
+  }
+}
@@ -0,0 +1,102 @@
+/*********************************************************************
+Copyright 2018 VERTO STUDIO LLC.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+***************************************************************************/
+
+#pragma once
+
+#include "vulkan.h"
+#include "VulkanAsyncResourceHandle.h"
+#include <vector>
+#include <unordered_set>
+
+namespace vgl
+{
+  namespace core
+  {
+    ///Gathers the transfers that buffer groups & textures would otherwise submit one at a time (when given no command buffer) into a
+    ///single command buffer, from begin() until the outermost end() or a flush().  Each flush is one submit tracked by one fence, with 
+    ///one barrier up front ordering the batch after earlier work and one at the end making its writes visible to later work, so work 
+    ///using the uploads must be submitted after the flush.  Like the transfer command buffer, this is meant for the rendering thread only.
+    ///When the device has a separate transfer queue family, uploads into buffers nothing has used yet are recorded for that queue instead, 
+    ///which is submitted first & handed over to the graphics queue family (release/acquire barriers + a semaphore) in the same flush
+    class VulkanUploadBatcher
+    {
+    public:
+      struct Stats
+      {
+        uint64_t submits;              //vkQueueSubmit calls made by flushes
+        uint64_t transfers;            //transfers gathered into those flushes
+        uint64_t submitsSaved;         //submits the transfers would have made on their own, minus the flush submits
+        uint64_t transferQueueUploads; //transfers that ran on the transfer queue
+      };
+
+      VulkanUploadBatcher(VkDevice device, VkQueue queue, uint32_t queueFamily, VkCommandPool commandPool, VkQueue transferQueue, 
+        uint32_t transferQueueFamily, VkCommandPool transferCommandPool, VulkanAsyncResourceMonitor *resourceMonitor);
+      ~VulkanUploadBatcher();
+
+      ///Nested begin/end pairs are fine, only the outermost end() flushes
+      void begin();
+      void end(bool wait=false);
+
+      ///Submits the transfers gathered so far
+      void flush(bool wait=false);
+
+      ///True when a transfer that would be submitted on the given queue should be recorded into the batch instead
+      inline bool isBatching(VkQueue queue) { return depth > 0 && queue == this->queue; }
+      inline bool hasTransferQueue() { return transferQueue != queue; }
+
+      ///Returns the batch command buffer for one more transfer, starting it if needed
+      VkCommandBuffer record();
+      inline VkCommandBuffer getCommandBuffer() { return graphics.commandBuffer; }
+
+      ///Like record(), for a transfer that only writes dst from host written memory.  Buffers that nothing has used yet (unused=true) 
+      ///are filled on the transfer queue when there is one, as are later uploads to them within the same batch
+      VkCommandBuffer recordUpload(VkBuffer dst, bool unused);
+
+      ///Orders a transfer (recorded into commandBuffer) reading src (may be null) & writing dst after the transfers in the batch that 
+      ///touched the same buffers
+      void orderTransfer(VkCommandBuffer commandBuffer, VkBuffer src, VkBuffer dst);
+
+      ///Keeps resources used by recorded transfers alive until the batch completes
+      void track(const std::vector<VulkanAsyncResourceHandle *> &handles);
+
+      inline Stats getStats() { return stats; }
+      inline void resetStats() { stats = {}; }
+
+    protected:
+      struct Lane
+      {
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+        std::unordered_set<VkBuffer> written, touched;
+      };
+
+      VkDevice device;
+      VkQueue queue, transferQueue;
+      uint32_t queueFamily, transferQueueFamily;
+      VkCommandPool commandPool, transferCommandPool;
+      VulkanAsyncResourceMonitor *resourceMonitor;
+
+      Lane graphics, upload;
+      std::vector<VkBuffer> uploadTargets; //buffers written by the upload lane, owned by the transfer queue family until the flush
+      std::unordered_set<VkBuffer> uploadTargetSet;
+      std::vector<VulkanAsyncResourceHandle *> handles;
+      uint64_t transfers = 0;
+      int depth = 0;
+      Stats stats = {};
+
+      VkCommandBuffer startCommandBuffer(VkCommandPool pool);
+    };
+  }
+}
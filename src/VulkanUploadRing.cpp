@@ -0,0 +1,126 @@
+/*********************************************************************
+Copyright 2018 VERTO STUDIO LLC.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+***************************************************************************/
+
+#include "pch.h"
+#include "VulkanUploadRing.h"
+
+using namespace std;
+
+namespace vgl
+{
+  namespace core
+  {
+    VulkanUploadRing::VulkanUploadRing(VkDevice device, VulkanMemoryManager *memoryManager, VulkanAsyncResourceMonitor *resourceMonitor, VkDeviceSize size,
+      const vector<uint32_t> &queueFamilies)
+      : device(device), memoryManager(memoryManager), resourceMonitor(resourceMonitor), size(size)
+    {
+      VkBufferCreateInfo bufferInfo = {};
+      bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+      bufferInfo.size = size;
+      bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+      if(queueFamilies.size() > 1)
+      {
+        bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+        bufferInfo.queueFamilyIndexCount = (uint32_t)queueFamilies.size();
+        bufferInfo.pQueueFamilyIndices = queueFamilies.data();
+      }
+
+      if(vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS)
+        throw vgl_runtime_error("Failed to create upload ring buffer!");
+
+      allocation = memoryManager->allocateBuffer(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, buffer);
+      if(!allocation)
+        throw vgl_runtime_error("Failed to allocate upload ring buffer!");
+      memoryManager->bindBufferMemory(buffer, allocation);
+
+      mappedData = (uint8_t *)memoryManager->getAllocationInfo(allocation).mappedData;
+      if(!mappedData)
+        throw vgl_runtime_error("Unable to map upload ring buffer!");
+    }
+
+    VulkanUploadRing::~VulkanUploadRing()
+    {
+      if(buffer)
+        vkDestroyBuffer(device, buffer, nullptr);
+      if(allocation)
+        memoryManager->free(allocation);
+    }
+
+    VulkanUploadRing::Range VulkanUploadRing::allocate(VkDeviceSize numBytes, VkDeviceSize alignment)
+    {
+      Range range;
+
+      if(!numBytes || numBytes > size)
+        return range;
+
+      lock_guard<mutex> locker(lock);
+      VkDeviceSize offset = (head + alignment - 1) / alignment * alignment;
+
+      if(inFlight.empty())
+      {
+        head = tail = offset = 0;
+      }
+      else if(head > tail)
+      {
+        //not enough room before the end, so wrap around if the oldest range in flight leaves enough room in front of it
+        if(offset + numBytes > size)
+        {
+          offset = 0;
+          if(numBytes > tail)
+            return range;
+        }
+      }
+      else if(offset + numBytes > tail)
+      {
+        return range;
+      }
+
+      uint64_t rangeId = nextRangeId++;
+      head = offset + numBytes;
+      inFlight.push_back({ rangeId, offset, head, false });
+
+      range.buffer = buffer;
+      range.offset = offset;
+      range.size = numBytes;
+      range.mappedData = mappedData + offset;
+      range.handle = VulkanAsyncResourceHandle::newUploadRange(resourceMonitor, device, this, rangeId);
+      return range;
+    }
+
+    void VulkanUploadRing::flush(VkDeviceSize offset, VkDeviceSize numBytes)
+    {
+      memoryManager->flushAllocation(allocation, offset, numBytes);
+    }
+
+    void VulkanUploadRing::release(uint64_t rangeId)
+    {
+      lock_guard<mutex> locker(lock);
+
+      if(inFlight.empty() || rangeId < inFlight.front().id)
+        return;
+      inFlight[rangeId - inFlight.front().id].released = true;
+
+      //ranges can complete out of order, but space is only reclaimed from the oldest one forward
+      while(!inFlight.empty() && inFlight.front().released)
+        inFlight.pop_front();
+
+      if(inFlight.empty())
+        head = tail = 0;
+      else
+        tail = inFlight.front().begin;
+    }
+  }
+}
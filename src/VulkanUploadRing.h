@@ -0,0 +1,85 @@
+/*********************************************************************
+Copyright 2018 VERTO STUDIO LLC.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+***************************************************************************/
+
+#pragma once
+
+#include "vulkan.h"
+#include "VulkanMemoryManager.h"
+#include "VulkanAsyncResourceHandle.h"
+#include <vector>
+#include <deque>
+#include <mutex>
+
+namespace vgl
+{
+  namespace core
+  {
+    ///A single persistently mapped staging buffer that uploads carve their source ranges out of, rather than creating & allocating
+    ///a buffer per upload.  Ranges are handed out in ring order and given back by releasing their handle, which (like any other 
+    ///staging buffer handle) is kept alive by the fence or frame collections of the commands that read it
+    class VulkanUploadRing
+    {
+    public:
+      struct Range
+      {
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VkDeviceSize offset = 0, size = 0;
+        uint8_t *mappedData = nullptr;
+        VulkanAsyncResourceHandle *handle = nullptr;
+
+        inline operator bool() const { return handle != nullptr; }
+      };
+
+      ///The ring buffer is shared concurrently when more than one queue family is given
+      VulkanUploadRing(VkDevice device, VulkanMemoryManager *memoryManager, VulkanAsyncResourceMonitor *resourceMonitor, VkDeviceSize size,
+        const std::vector<uint32_t> &queueFamilies={});
+      ~VulkanUploadRing();
+
+      ///Returns an empty range when numBytes doesn't currently fit, in which case the caller should fall back on its own staging buffer
+      Range allocate(VkDeviceSize numBytes, VkDeviceSize alignment=16);
+
+      ///Makes host writes to the range visible to the device (a no-op for the usual coherent ring memory)
+      void flush(VkDeviceSize offset, VkDeviceSize numBytes);
+
+      ///Called by the range's handle when it's no longer in use
+      void release(uint64_t rangeId);
+
+      inline VkDeviceSize getSize() { return size; }
+      inline VkBuffer get() { return buffer; }
+
+    protected:
+      struct InFlightRange
+      {
+        uint64_t id;
+        VkDeviceSize begin, end;
+        bool released;
+      };
+
+      VkDevice device;
+      VulkanMemoryManager *memoryManager;
+      VulkanAsyncResourceMonitor *resourceMonitor;
+      VkBuffer buffer = VK_NULL_HANDLE;
+      VulkanMemoryManager::Suballocation allocation = nullptr;
+      uint8_t *mappedData = nullptr;
+
+      //free space is [head, size) + [0, tail) when head > tail (or the ring is empty), otherwise [head, tail)
+      VkDeviceSize size, head = 0, tail = 0;
+      std::deque<InFlightRange> inFlight;
+      uint64_t nextRangeId = 1;
+      std::mutex lock;
+    };
+  }
+}
@@ -380,7 +380,9 @@ namespace vgl
         auto pool = instance->getTransferCommandPool();
 
         //the jury is out on whether or not I really would need 1 of these for each swapchain image
+        //(its samples are resolved into the swapchain image & never stored, so it can live in lazily allocated memory)
         msaaColorTarget = new VulkanTexture(device, VulkanTexture::TT_2D, pool, graphicsQueue);
+        msaaColorTarget->setTransientAttachment(true);
         msaaColorTarget->initImage(swapChainExtent.width, swapChainExtent.height, 1, swapChainImageFormat, VulkanTexture::U_COLOR_ATTACHMENT, 0, initParams.multiSamples);
 
         multiSamples = (VkSampleCountFlagBits)initParams.multiSamples;
@@ -450,15 +452,27 @@ namespace vgl
       auto device = instance->getDefaultDevice();
       auto pool = instance->getTransferCommandPool();
 
-      depthAttachment = new VulkanTexture(device, VulkanTexture::TT_2D, pool, graphicsQueue);
-      depthAttachment->initImage(swapChainExtent.width, swapChainExtent.height, 1, depthFormat, VulkanTexture::U_DEPTH_STENCIL_ATTACHMENT);
+      uint64_t depthAliasId = 0;
 
       if(initParams.multiSamples > 1)
       {
         //the jury is out on whether or not I really would need 1 of these for each swapchain image
+        //depth is never stored, and the single sample depth attachment below is never rendered to alongside this one,
+        //so it just aliases this (larger) target's memory
+        depthAliasId = instance->getMemoryManager()->newAliasId();
         msaaDepthTarget = new VulkanTexture(device, VulkanTexture::TT_2D, pool, graphicsQueue);
+        msaaDepthTarget->setTransientAttachment(true);
+        msaaDepthTarget->setAliasId(depthAliasId);
         msaaDepthTarget->initImage(swapChainExtent.width, swapChainExtent.height, 1, depthFormat, VulkanTexture::U_DEPTH_STENCIL_ATTACHMENT, 0, initParams.multiSamples);
       }
+
+      depthAttachment = new VulkanTexture(device, VulkanTexture::TT_2D, pool, graphicsQueue);
+      if(depthAliasId)
+      {
+        depthAttachment->setTransientAttachment(true);
+        depthAttachment->setAliasId(depthAliasId);
+      }
+      depthAttachment->initImage(swapChainExtent.width, swapChainExtent.height, 1, depthFormat, VulkanTexture::U_DEPTH_STENCIL_ATTACHMENT);
     }
 
     void VulkanSwapChain::obtainSwapchainImages()
@@ -499,6 +513,7 @@ namespace vgl
       {
         completedFrameId = frameId;
         instance->getResourceMonitor()->setCompletedFrame(completedFrameId);
+        instance->getMemoryManager()->completeFrame(completedFrameId);
       }
     }
   }
@@ -65,6 +65,7 @@ namespace vgl
       inline VulkanTexture *getMSAADepthTarget() { return msaaDepthTarget; }
 
       inline uint64_t getCurrentFrameId() { return frameId; }
+      static inline int getMaxFramesInFlight() { return MAX_FRAMES_IN_FLIGHT; }
 
       [[deprecated]] uint32_t acquireNextImage();
     protected:
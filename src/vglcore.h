@@ -26,6 +26,7 @@ limitations under the License.
 #include "VulkanShaderProgram.h"
 #include "VulkanTexture.h"
 #include "VulkanBufferGroup.h"
+#include "VulkanMeshFile.h"
 #include "VulkanVertexArray.h"
 #include "VulkanFrameBuffer.h"
 
@@ -0,0 +1,231 @@
+/*********************************************************************
+Copyright 2018 VERTO STUDIO LLC.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+***************************************************************************/
+
+//Times VulkanMemoryManager's allocate() & free() with the TLSF and sorted free-list region strategies over a few synthetic workloads
+//on a mock device (no GPU needed), reporting per call latency, total time & peak device memory for each.
+//
+//  VGLAllocBench [operations] [--slabs]
+
+#include "pch.h"
+#include <vector>
+#include <random>
+#include <chrono>
+#include <iomanip>
+#include <algorithm>
+#include <functional>
+#include "MockVulkanDevice.h"
+
+using namespace std;
+using namespace vgl::core;
+using namespace vgl::memreplay;
+
+static const VkPhysicalDevice mockPhysicalDevice = (VkPhysicalDevice)(uintptr_t)1;
+static const VkDevice mockDevice = (VkDevice)(uintptr_t)1;
+
+struct Strategy
+{
+  const char *name;
+  VulkanMemoryManager::FreeRegionStrategy freeRegionStrategy;
+};
+
+struct Request
+{
+  VkDeviceSize size, alignment;
+  bool imageOptimal;
+};
+
+struct Workload
+{
+  const char *name;
+  size_t workingSet;
+  function<Request(mt19937 &rng)> request;
+};
+
+struct LatencyStats
+{
+  vector<uint32_t> samples; //nanoseconds
+
+  inline void add(chrono::steady_clock::duration d) { samples.push_back((uint32_t)min<int64_t>(chrono::duration_cast<chrono::nanoseconds>(d).count(), UINT32_MAX)); }
+
+  double mean() const
+  {
+    double total = 0;
+    for(auto s : samples)
+      total += s;
+    return samples.empty() ? 0 : total / samples.size();
+  }
+
+  //destructively sorts the samples
+  uint32_t percentile(double p)
+  {
+    if(samples.empty())
+      return 0;
+
+    size_t n = min(samples.size()-1, (size_t)(p*samples.size()));
+    nth_element(samples.begin(), samples.begin()+n, samples.end());
+    return samples[n];
+  }
+};
+
+struct BenchResult
+{
+  LatencyStats allocateLatency, freeLatency;
+  double seconds = 0;
+  VkDeviceSize peakBytes = 0;
+  size_t failures = 0;
+};
+
+static void configureDevice()
+{
+  VulkanMemoryManager::TraceHeader header = {};
+  auto &props = header.memoryProperties;
+
+  //a typical discrete desktop gpu
+  props.memoryHeapCount = 2;
+  props.memoryHeaps[0] = { (8ull<<30), VK_MEMORY_HEAP_DEVICE_LOCAL_BIT };
+  props.memoryHeaps[1] = { (16ull<<30), 0 };
+  props.memoryTypeCount = 2;
+  props.memoryTypes[0] = { VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0 };
+  props.memoryTypes[1] = { VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 1 };
+  header.minUniformBufferOffsetAlignment = header.minStorageBufferOffsetAlignment = 256;
+  header.nonCoherentAtomSize = 64;
+  header.bufferImageGranularity = 1024;
+  MockVulkanDevice::configure(header);
+}
+
+//keeps workload.workingSet suballocations live, each operation frees a random one & allocates its replacement
+static BenchResult run(const Strategy &strategy, const Workload &workload, size_t operations, bool slabs)
+{
+  BenchResult result;
+  mt19937 rng(1234);
+
+  VulkanMemoryManager::setAllocationStrategy(VulkanMemoryManager::AS_DESKTOP);
+  VulkanMemoryManager::setFreeRegionStrategy(strategy.freeRegionStrategy);
+  VulkanMemoryManager::setSlabAllocationEnabled(slabs);
+  MockVulkanDevice::resetCounters();
+
+  {
+    VulkanMemoryManager memoryManager(mockPhysicalDevice, mockDevice);
+    vector<VulkanMemoryManager::Suballocation> live;
+
+    //only the region strategy is measured, so frees go straight back to their allocations
+    memoryManager.setThreadCachingEnabled(false);
+    live.reserve(workload.workingSet);
+
+    auto allocate = [&]() {
+      auto request = workload.request(rng);
+      auto start = chrono::steady_clock::now();
+      auto suballocation = memoryManager.allocate(1, 0, request.size, request.alignment, request.imageOptimal);
+      result.allocateLatency.add(chrono::steady_clock::now()-start);
+
+      if(!suballocation)
+        result.failures++;
+      return suballocation;
+    };
+
+    auto benchStart = chrono::steady_clock::now();
+    for(size_t i = 0; i < workload.workingSet; i++)
+      live.push_back(allocate());
+
+    for(size_t i = 0; i < operations; i++)
+    {
+      auto &victim = live[rng() % live.size()];
+      auto start = chrono::steady_clock::now();
+      memoryManager.free(victim);
+      result.freeLatency.add(chrono::steady_clock::now()-start);
+
+      victim = allocate();
+    }
+
+    memoryManager.freeMany(live.data(), live.size());
+    memoryManager.reclaimMemory();
+    result.seconds = chrono::duration<double>(chrono::steady_clock::now()-benchStart).count();
+    result.peakBytes = MockVulkanDevice::getPeakBytes();
+  }
+
+  return result;
+}
+
+int main(int argc, char **argv)
+{
+  const Strategy strategies[] = {
+    { "tlsf", VulkanMemoryManager::FRS_TLSF },
+    { "list", VulkanMemoryManager::FRS_BEST_FIT_LIST },
+  };
+
+  const Workload workloads[] = {
+    //uniform & vertex buffers of a few pages
+    { "small buffers", 4096, [](mt19937 &rng) -> Request {
+      return { 4096 + rng() % (60<<10), 256, false };
+    } },
+    //mostly small buffers with the odd texture mixed in, the images need coarser alignment
+    { "mixed", 2048, [](mt19937 &rng) -> Request {
+      if(rng() % 8 == 0)
+        return { (VkDeviceSize)(64 + rng() % 4032) << 10, 65536, true };
+      return { 256 + rng() % (256<<10), 256, false };
+    } },
+    //long lived textures of widely varying sizes, which is what splinters free space the most
+    { "textures", 512, [](mt19937 &rng) -> Request {
+      return { (VkDeviceSize)(16 << (rng() % 8)) << 10, 65536, true };
+    } },
+  };
+
+  size_t operations = 50000;
+  bool slabs = false;
+
+  for(int i = 1; i < argc; i++)
+  {
+    string arg = argv[i];
+
+    if(arg == "--slabs")
+      slabs = true;
+    else if(atoi(arg.c_str()) > 0)
+      operations = (size_t)atoi(arg.c_str());
+    else
+    {
+      verr << "usage: " << argv[0] << " [operations] [--slabs]" << endl;
+      return 1;
+    }
+  }
+
+  configureDevice();
+  vout << operations << " operations per workload, slabs " << (slabs ? "on" : "off") << endl << endl;
+  vout << left << setw(16) << "workload" << setw(10) << "strategy" << right << setw(10) << "alloc ns" << setw(9) << "p50" << setw(9) << "p99"
+       << setw(10) << "free ns" << setw(9) << "p99" << setw(10) << "total s" << setw(10) << "peak MB" << setw(7) << "fails" << endl;
+
+  for(auto &workload : workloads)
+  {
+    double baseline = 0;
+
+    for(auto &strategy : strategies)
+    {
+      auto result = run(strategy, workload, operations, slabs);
+      if(!baseline)
+        baseline = result.seconds;
+
+      vout << left << setw(16) << workload.name << setw(10) << strategy.name << right << fixed << setprecision(0)
+           << setw(10) << result.allocateLatency.mean() << setw(9) << result.allocateLatency.percentile(0.5) << setw(9) << result.allocateLatency.percentile(0.99)
+           << setw(10) << result.freeLatency.mean() << setw(9) << result.freeLatency.percentile(0.99)
+           << setprecision(3) << setw(10) << result.seconds << setprecision(1) << setw(10) << (result.peakBytes / (1024.0*1024.0))
+           << setw(7) << result.failures;
+      if(result.seconds != baseline)
+        vout << "  (" << setprecision(1) << result.seconds / baseline << "x tlsf)";
+      vout << endl;
+    }
+  }
+
+  return 0;
+}
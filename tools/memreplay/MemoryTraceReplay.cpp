@@ -0,0 +1,381 @@
+/*********************************************************************
+Copyright 2018 VERTO STUDIO LLC.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+***************************************************************************/
+
+//Replays a trace recorded by VulkanMemoryManager::beginTrace() against every allocation strategy on a mock device (no GPU needed)
+//and reports peak memory, block counts, fragmentation over time & per call latency for each.
+//
+//  VGLMemoryReplay <trace> [--timeline timeline.csv] [--no-slabs]
+//  VGLMemoryReplay --synthesize <trace> [frames]
+
+#include "pch.h"
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <random>
+#include <chrono>
+#include <map>
+#include <unordered_map>
+#include "MockVulkanDevice.h"
+
+using namespace std;
+using namespace vgl::core;
+using namespace vgl::memreplay;
+
+typedef VulkanMemoryManager::TraceHeader TraceHeader;
+typedef VulkanMemoryManager::TraceRecord TraceRecord;
+
+static const VkPhysicalDevice mockPhysicalDevice = (VkPhysicalDevice)(uintptr_t)1;
+static const VkDevice mockDevice = (VkDevice)(uintptr_t)1;
+
+//traces without any frame markers are sampled this often instead
+static const size_t samplePeriod = 1000;
+
+struct Strategy
+{
+  const char *name;
+  VulkanMemoryManager::AllocationStrategy allocationStrategy;
+  VulkanMemoryManager::FreeRegionStrategy freeRegionStrategy;
+};
+
+struct LatencyStats
+{
+  vector<uint32_t> samples; //nanoseconds
+
+  inline void add(chrono::steady_clock::duration d) { samples.push_back((uint32_t)min<int64_t>(chrono::duration_cast<chrono::nanoseconds>(d).count(), UINT32_MAX)); }
+
+  double mean() const
+  {
+    double total = 0;
+    for(auto s : samples)
+      total += s;
+    return samples.empty() ? 0 : total / samples.size();
+  }
+
+  //destructively sorts the samples
+  uint32_t percentile(double p)
+  {
+    if(samples.empty())
+      return 0;
+
+    size_t n = min(samples.size()-1, (size_t)(p*samples.size()));
+    nth_element(samples.begin(), samples.begin()+n, samples.end());
+    return samples[n];
+  }
+};
+
+struct TimelineSample
+{
+  size_t record;
+  uint64_t timestamp;
+  VkDeviceSize deviceBytes, usedBytes;
+  size_t blocks;
+  double fragmentation;
+};
+
+struct ReplayResult
+{
+  LatencyStats allocateLatency, freeLatency, reclaimLatency;
+  vector<TimelineSample> timeline;
+  VkDeviceSize peakBytes = 0;
+  size_t peakBlocks = 0, finalBlocks = 0;
+  size_t failures = 0, unmatchedFrees = 0;
+};
+
+static bool loadTrace(const string &path, TraceHeader &header, vector<TraceRecord> &records)
+{
+  ifstream file(path, ios::ate | ios::binary);
+
+  if(!file.is_open())
+  {
+    verr << "Couldn't open trace " << path << endl;
+    return false;
+  }
+
+  size_t fileSize = (size_t)file.tellg();
+  file.seekg(0);
+  if(fileSize < sizeof(TraceHeader) || !file.read((char *)&header, sizeof(TraceHeader)) || memcmp(header.magic, "VGLT", 4) != 0)
+  {
+    verr << path << " is not a VGL memory trace" << endl;
+    return false;
+  }
+  if(header.version != VulkanMemoryManager::TraceVersion)
+  {
+    verr << path << " is trace version " << header.version << ", expected " << VulkanMemoryManager::TraceVersion << endl;
+    return false;
+  }
+
+  records.resize((fileSize - sizeof(TraceHeader)) / sizeof(TraceRecord));
+  file.read((char *)records.data(), records.size()*sizeof(TraceRecord));
+
+  return true;
+}
+
+static ReplayResult replay(const TraceHeader &header, const vector<TraceRecord> &records, const Strategy &strategy, bool slabs)
+{
+  ReplayResult result;
+  map<pair<uint64_t, uint32_t>, VulkanMemoryManager::Suballocation> live;
+  unordered_map<uint64_t, uint64_t> dedicatedIds;
+
+  VulkanMemoryManager::setAllocationStrategy(strategy.allocationStrategy);
+  VulkanMemoryManager::setFreeRegionStrategy(strategy.freeRegionStrategy);
+  VulkanMemoryManager::setSlabAllocationEnabled(slabs);
+  MockVulkanDevice::configure(header);
+  MockVulkanDevice::resetCounters();
+
+  bool hasFrames = any_of(records.begin(), records.end(), [](const TraceRecord &r) { return r.op == VulkanMemoryManager::TO_FRAME; });
+
+  {
+    VulkanMemoryManager memoryManager(mockPhysicalDevice, mockDevice);
+
+    auto sample = [&](size_t index, uint64_t timestamp) {
+      auto stats = memoryManager.getStats();
+      result.timeline.push_back({ index, timestamp, MockVulkanDevice::getLiveBytes(), stats.total.usedBytes, MockVulkanDevice::getLiveBlocks(),
+        stats.total.fragmentation() });
+    };
+
+    for(size_t i = 0; i < records.size(); i++)
+    {
+      const auto &record = records[i];
+
+      switch(record.op)
+      {
+        case VulkanMemoryManager::TO_ALLOCATE:
+        {
+          uint64_t allocationId = VulkanMemoryManager::Any;
+          if(record.allocationId)
+          {
+            auto it = dedicatedIds.find(record.allocationId);
+            if(it == dedicatedIds.end())
+              break;
+            allocationId = it->second;
+          }
+
+          auto start = chrono::steady_clock::now();
+          auto suballocation = memoryManager.allocate(1u << record.memoryType, 0, record.size, record.alignment, record.imageOptimal != 0, allocationId, 
+            (VulkanMemoryManager::Lifetime)record.lifetime);
+          result.allocateLatency.add(chrono::steady_clock::now()-start);
+
+          if(!suballocation)
+            result.failures++;
+          else if(record.handle)
+            live[{ record.handle, record.slot }] = suballocation;
+          else
+            memoryManager.free(suballocation); //failed when recorded, so nothing will ever free it
+        }
+        break;
+        case VulkanMemoryManager::TO_FREE:
+        {
+          //frees of suballocations made by defragment() or balanceResidency() were never recorded as allocations
+          auto it = live.find({ record.handle, record.slot });
+          if(it == live.end())
+          {
+            result.unmatchedFrees++;
+            break;
+          }
+
+          auto start = chrono::steady_clock::now();
+          memoryManager.free(it->second);
+          result.freeLatency.add(chrono::steady_clock::now()-start);
+          live.erase(it);
+        }
+        break;
+        case VulkanMemoryManager::TO_DEDICATED:
+        {
+          auto dedicated = memoryManager.allocateDedicated(1u << record.memoryType, 0, record.size, 1, record.allowSuballocation != 0, record.imageOptimal != 0);
+          if(dedicated.second)
+            dedicatedIds[record.allocationId] = dedicated.second;
+          else
+            result.failures++;
+        }
+        break;
+        case VulkanMemoryManager::TO_RECLAIM:
+        {
+          auto start = chrono::steady_clock::now();
+          memoryManager.reclaimMemory();
+          result.reclaimLatency.add(chrono::steady_clock::now()-start);
+        }
+        break;
+        case VulkanMemoryManager::TO_FRAME:
+          sample(i, record.timestamp);
+        break;
+      }
+
+      if(!hasFrames && i % samplePeriod == samplePeriod-1)
+        sample(i, record.timestamp);
+    }
+
+    result.peakBytes = MockVulkanDevice::getPeakBytes();
+    result.peakBlocks = MockVulkanDevice::getPeakBlocks();
+    result.finalBlocks = MockVulkanDevice::getLiveBlocks();
+
+    for(auto &entry : live)
+      memoryManager.free(entry.second);
+    memoryManager.reclaimMemory();
+  }
+
+  return result;
+}
+
+static bool synthesize(const string &path, int frames)
+{
+  TraceHeader header = {};
+  auto &props = header.memoryProperties;
+
+  //a typical discrete desktop gpu
+  props.memoryHeapCount = 2;
+  props.memoryHeaps[0] = { (8ull<<30), VK_MEMORY_HEAP_DEVICE_LOCAL_BIT };
+  props.memoryHeaps[1] = { (16ull<<30), 0 };
+  props.memoryTypeCount = 2;
+  props.memoryTypes[0] = { VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0 };
+  props.memoryTypes[1] = { VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 1 };
+  header.minUniformBufferOffsetAlignment = header.minStorageBufferOffsetAlignment = 256;
+  header.nonCoherentAtomSize = 64;
+  header.bufferImageGranularity = 1024;
+  MockVulkanDevice::configure(header);
+  MockVulkanDevice::resetCounters();
+
+  VulkanMemoryManager memoryManager(mockPhysicalDevice, mockDevice);
+  vector<VulkanMemoryManager::Suballocation> buffers, images;
+  mt19937 rng(1);
+
+  if(!memoryManager.beginTrace(path))
+  {
+    verr << "Couldn't write trace " << path << endl;
+    return false;
+  }
+
+  //a steady churn of small buffers & uniform blocks, with textures loaded & unloaded in bursts
+  for(int frame = 0; frame < frames; frame++)
+  {
+    for(int i = 0; i < 40; i++)
+    {
+      VkDeviceSize size = (rng() % 4 == 0) ? (64 << (rng() % 7)) : (4096 + rng() % (1<<20));
+      buffers.push_back(memoryManager.allocate(1u << (rng() % 2), 0, size, 256, false, VulkanMemoryManager::Any, VulkanMemoryManager::LT_DYNAMIC));
+    }
+    while(buffers.size() > 2000)
+    {
+      size_t i = rng() % buffers.size();
+      memoryManager.free(buffers[i]);
+      buffers[i] = buffers.back();
+      buffers.pop_back();
+    }
+
+    if(frame % 30 == 0)
+    {
+      for(int i = 0; i < 20; i++)
+        images.push_back(memoryManager.allocate(1, 0, (VkDeviceSize)(1 + rng() % 16) << 20, 65536, true));
+      while(images.size() > 100)
+      {
+        size_t i = rng() % images.size();
+        memoryManager.free(images[i]);
+        images[i] = images.back();
+        images.pop_back();
+      }
+    }
+
+    if(frame % 60 == 59)
+      memoryManager.reclaimMemory();
+    memoryManager.completeFrame(frame);
+  }
+
+  memoryManager.endTrace();
+  memoryManager.freeMany(buffers.data(), buffers.size());
+  memoryManager.freeMany(images.data(), images.size());
+
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  const Strategy strategies[] = {
+    { "desktop/tlsf", VulkanMemoryManager::AS_DESKTOP, VulkanMemoryManager::FRS_TLSF },
+    { "desktop/list", VulkanMemoryManager::AS_DESKTOP, VulkanMemoryManager::FRS_BEST_FIT_LIST },
+    { "mobile/tlsf", VulkanMemoryManager::AS_MOBILE_CONVERVATIVE, VulkanMemoryManager::FRS_TLSF },
+    { "mobile/list", VulkanMemoryManager::AS_MOBILE_CONVERVATIVE, VulkanMemoryManager::FRS_BEST_FIT_LIST },
+  };
+  string tracePath, timelinePath;
+  bool slabs = true;
+
+  if(argc >= 3 && string(argv[1]) == "--synthesize")
+    return synthesize(argv[2], (argc >= 4) ? atoi(argv[3]) : 1000) ? 0 : 1;
+
+  for(int i = 1; i < argc; i++)
+  {
+    string arg = argv[i];
+
+    if(arg == "--timeline" && i+1 < argc)
+      timelinePath = argv[++i];
+    else if(arg == "--no-slabs")
+      slabs = false;
+    else
+      tracePath = arg;
+  }
+
+  if(tracePath.empty())
+  {
+    verr << "usage: " << argv[0] << " <trace> [--timeline timeline.csv] [--no-slabs]" << endl;
+    verr << "       " << argv[0] << " --synthesize <trace> [frames]" << endl;
+    return 1;
+  }
+
+  TraceHeader header;
+  vector<TraceRecord> records;
+  if(!loadTrace(tracePath, header, records))
+    return 1;
+
+  ofstream timeline;
+  if(!timelinePath.empty())
+  {
+    timeline.open(timelinePath);
+    timeline << "strategy,record,timestamp_ns,device_bytes,used_bytes,blocks,fragmentation" << endl;
+  }
+
+  vout << records.size() << " records from " << tracePath << endl << endl;
+  vout << left << setw(14) << "strategy" << right << setw(10) << "peak MB" << setw(8) << "blocks" << setw(8) << "peak" << setw(8) << "frag"
+       << setw(8) << "max" << setw(10) << "alloc ns" << setw(9) << "p50" << setw(9) << "p99" << setw(10) << "max"
+       << setw(10) << "free ns" << setw(9) << "p99" << setw(12) << "reclaim us" << setw(7) << "fails" << endl;
+
+  for(auto &strategy : strategies)
+  {
+    auto result = replay(header, records, strategy, slabs);
+    double meanFragmentation = 0, maxFragmentation = 0;
+
+    for(auto &sample : result.timeline)
+    {
+      meanFragmentation += sample.fragmentation;
+      maxFragmentation = max(maxFragmentation, sample.fragmentation);
+      if(timeline.is_open())
+      {
+        timeline << strategy.name << "," << sample.record << "," << sample.timestamp << "," << sample.deviceBytes << "," << sample.usedBytes << ","
+                 << sample.blocks << "," << sample.fragmentation << endl;
+      }
+    }
+    if(!result.timeline.empty())
+      meanFragmentation /= result.timeline.size();
+
+    vout << left << setw(14) << strategy.name << right << fixed << setprecision(1) << setw(10) << (result.peakBytes / (1024.0*1024.0))
+         << setw(8) << result.finalBlocks << setw(8) << result.peakBlocks << setprecision(3) << setw(8) << meanFragmentation << setw(8) << maxFragmentation
+         << setprecision(0) << setw(10) << result.allocateLatency.mean() << setw(9) << result.allocateLatency.percentile(0.5)
+         << setw(9) << result.allocateLatency.percentile(0.99) << setw(10) << result.allocateLatency.percentile(1.0)
+         << setw(10) << result.freeLatency.mean() << setw(9) << result.freeLatency.percentile(0.99)
+         << setw(12) << (result.reclaimLatency.mean() / 1000.0) << setw(7) << result.failures << endl;
+
+    if(result.unmatchedFrees)
+      vout << "  (" << result.unmatchedFrees << " frees of relocated suballocations skipped)" << endl;
+  }
+
+  return 0;
+}
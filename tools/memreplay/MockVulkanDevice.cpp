@@ -0,0 +1,180 @@
+/*********************************************************************
+Copyright 2018 VERTO STUDIO LLC.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+***************************************************************************/
+
+#include "pch.h"
+#include <mutex>
+#include <unordered_map>
+#include <algorithm>
+#include "MockVulkanDevice.h"
+
+using namespace std;
+using namespace vgl::core;
+
+namespace vgl
+{
+  namespace memreplay
+  {
+    static mutex deviceLock;
+    static VulkanMemoryManager::TraceHeader deviceHeader = {};
+    static unordered_map<uint64_t, pair<uint32_t, VkDeviceSize>> liveMemory; //handle -> (heap, size)
+    static VkDeviceSize heapBytes[VK_MAX_MEMORY_HEAPS];
+    static uint64_t nextHandle = 1;
+    static size_t peakBlocks = 0;
+    static VkDeviceSize liveBytes = 0, peakBytes = 0;
+
+    void MockVulkanDevice::configure(const VulkanMemoryManager::TraceHeader &header)
+    {
+      lock_guard<mutex> locker(deviceLock);
+      deviceHeader = header;
+    }
+
+    void MockVulkanDevice::resetCounters()
+    {
+      lock_guard<mutex> locker(deviceLock);
+
+      liveMemory.clear();
+      memset(heapBytes, 0, sizeof(heapBytes));
+      peakBlocks = 0;
+      liveBytes = peakBytes = 0;
+    }
+
+    size_t MockVulkanDevice::getLiveBlocks()
+    {
+      lock_guard<mutex> locker(deviceLock);
+      return liveMemory.size();
+    }
+
+    size_t MockVulkanDevice::getPeakBlocks()
+    {
+      lock_guard<mutex> locker(deviceLock);
+      return peakBlocks;
+    }
+
+    VkDeviceSize MockVulkanDevice::getLiveBytes()
+    {
+      lock_guard<mutex> locker(deviceLock);
+      return liveBytes;
+    }
+
+    VkDeviceSize MockVulkanDevice::getPeakBytes()
+    {
+      lock_guard<mutex> locker(deviceLock);
+      return peakBytes;
+    }
+  }
+}
+
+using namespace vgl::memreplay;
+
+extern "C"
+{
+  VKAPI_ATTR VkResult VKAPI_CALL vkAllocateMemory(VkDevice /*device*/, const VkMemoryAllocateInfo *allocateInfo, const VkAllocationCallbacks * /*allocator*/,
+    VkDeviceMemory *memory)
+  {
+    lock_guard<mutex> locker(deviceLock);
+    const auto &props = deviceHeader.memoryProperties;
+
+    if(allocateInfo->memoryTypeIndex >= props.memoryTypeCount)
+      return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+
+    uint32_t heap = props.memoryTypes[allocateInfo->memoryTypeIndex].heapIndex;
+    if(heapBytes[heap] + allocateInfo->allocationSize > props.memoryHeaps[heap].size)
+      return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+
+    uint64_t handle = nextHandle++;
+    liveMemory[handle] = { heap, allocateInfo->allocationSize };
+    heapBytes[heap] += allocateInfo->allocationSize;
+    liveBytes += allocateInfo->allocationSize;
+    peakBytes = max(peakBytes, liveBytes);
+    peakBlocks = max(peakBlocks, liveMemory.size());
+
+    *memory = (VkDeviceMemory)handle;
+    return VK_SUCCESS;
+  }
+
+  VKAPI_ATTR void VKAPI_CALL vkFreeMemory(VkDevice /*device*/, VkDeviceMemory memory, const VkAllocationCallbacks * /*allocator*/)
+  {
+    lock_guard<mutex> locker(deviceLock);
+
+    auto it = liveMemory.find((uint64_t)memory);
+    if(it == liveMemory.end())
+      return;
+
+    heapBytes[it->second.first] -= it->second.second;
+    liveBytes -= it->second.second;
+    liveMemory.erase(it);
+  }
+
+  //replays never touch mapped memory, so a block's "mapping" is just a distinct address that is never dereferenced
+  VKAPI_ATTR VkResult VKAPI_CALL vkMapMemory(VkDevice /*device*/, VkDeviceMemory memory, VkDeviceSize offset, VkDeviceSize /*size*/, VkMemoryMapFlags /*flags*/, 
+    void **data)
+  {
+    *data = (void *)(uintptr_t)(((uint64_t)memory << 40) + offset);
+    return VK_SUCCESS;
+  }
+
+  VKAPI_ATTR void VKAPI_CALL vkUnmapMemory(VkDevice /*device*/, VkDeviceMemory /*memory*/)
+  {
+  }
+
+  VKAPI_ATTR VkResult VKAPI_CALL vkFlushMappedMemoryRanges(VkDevice /*device*/, uint32_t /*memoryRangeCount*/, const VkMappedMemoryRange * /*memoryRanges*/)
+  {
+    return VK_SUCCESS;
+  }
+
+  VKAPI_ATTR VkResult VKAPI_CALL vkInvalidateMappedMemoryRanges(VkDevice /*device*/, uint32_t /*memoryRangeCount*/, const VkMappedMemoryRange * /*memoryRanges*/)
+  {
+    return VK_SUCCESS;
+  }
+
+  VKAPI_ATTR void VKAPI_CALL vkGetPhysicalDeviceMemoryProperties(VkPhysicalDevice /*physicalDevice*/, VkPhysicalDeviceMemoryProperties *memoryProperties)
+  {
+    lock_guard<mutex> locker(deviceLock);
+    *memoryProperties = deviceHeader.memoryProperties;
+  }
+
+  VKAPI_ATTR void VKAPI_CALL vkGetPhysicalDeviceProperties(VkPhysicalDevice /*physicalDevice*/, VkPhysicalDeviceProperties *properties)
+  {
+    lock_guard<mutex> locker(deviceLock);
+
+    memset(properties, 0, sizeof(VkPhysicalDeviceProperties));
+    properties->limits.minUniformBufferOffsetAlignment = deviceHeader.minUniformBufferOffsetAlignment;
+    properties->limits.minStorageBufferOffsetAlignment = deviceHeader.minStorageBufferOffsetAlignment;
+    properties->limits.nonCoherentAtomSize = deviceHeader.nonCoherentAtomSize;
+    properties->limits.bufferImageGranularity = deviceHeader.bufferImageGranularity;
+  }
+
+  //traces only carry raw allocate() calls, so nothing below is reached during a replay
+  VKAPI_ATTR void VKAPI_CALL vkGetBufferMemoryRequirements(VkDevice /*device*/, VkBuffer /*buffer*/, VkMemoryRequirements *memoryRequirements)
+  {
+    memset(memoryRequirements, 0, sizeof(VkMemoryRequirements));
+  }
+
+  VKAPI_ATTR void VKAPI_CALL vkGetImageMemoryRequirements(VkDevice /*device*/, VkImage /*image*/, VkMemoryRequirements *memoryRequirements)
+  {
+    memset(memoryRequirements, 0, sizeof(VkMemoryRequirements));
+  }
+
+  VKAPI_ATTR VkResult VKAPI_CALL vkBindBufferMemory(VkDevice /*device*/, VkBuffer /*buffer*/, VkDeviceMemory /*memory*/, VkDeviceSize /*memoryOffset*/)
+  {
+    return VK_SUCCESS;
+  }
+
+  VKAPI_ATTR VkResult VKAPI_CALL vkBindImageMemory(VkDevice /*device*/, VkImage /*image*/, VkDeviceMemory /*memory*/, VkDeviceSize /*memoryOffset*/)
+  {
+    return VK_SUCCESS;
+  }
+}
@@ -0,0 +1,39 @@
+/*********************************************************************
+Copyright 2018 VERTO STUDIO LLC.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+***************************************************************************/
+
+#pragma once
+
+#include "VulkanMemoryManager.h"
+
+namespace vgl
+{
+  namespace memreplay
+  {
+    ///Stands in for the handful of vulkan entry points the memory manager calls, so allocator logic can run without a GPU.
+    ///Device memory is never actually backed, only counted against the heap sizes of the trace being replayed
+    class MockVulkanDevice
+    {
+    public:
+      static void configure(const core::VulkanMemoryManager::TraceHeader &header);
+      static void resetCounters();
+
+      static size_t getLiveBlocks();
+      static size_t getPeakBlocks();
+      static VkDeviceSize getLiveBytes();
+      static VkDeviceSize getPeakBytes();
+    };
+  }
+}
@@ -0,0 +1,31 @@
+#define _USE_MATH_DEFINES
+#include <math.h>
+#include <string.h>
+#include <vulkan.h>
+
+//only the memory manager is built here, so vglcore.h (and the surface/windowing headers it drags in) is left out
+#include <iostream>
+#include <stdexcept>
+#define verr cerr
+#define vout cout
+#define vgl_runtime_error runtime_error
+
+#ifdef DEBUG
+#define DebugBuild() 1
+#define VGL_CORE_PERF_WARNING_DEBUG(failCondition, message) \
+{                                                           \
+  static bool warned = false;                               \
+  if((failCondition) && !warned)                            \
+  {                                                         \
+    verr << "VGL Performance Warning:  " << message << endl;\
+    warned = true;                                          \
+  }                                                         \
+}
+#else
+#define DebugBuild() 0
+#define VGL_CORE_PERF_WARNING_DEBUG(...)
+#endif
+
+#ifdef max
+#undef max
+#endif
@@ -0,0 +1,191 @@
+/*********************************************************************
+Copyright 2018 VERTO STUDIO LLC.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+***************************************************************************/
+
+//Measures each VulkanTexelConverter conversion in GB/s (bytes read + written) with the scalar loop, the SIMD path on one thread and
+//the SIMD path on all threads, and checks that every path (and every narrower instruction set) produces the scalar loop's exact output.
+//
+//  VGLTexelBench [megapixels]
+
+#include "pch.h"
+#include <vector>
+#include <chrono>
+#include <random>
+#include <iomanip>
+#include <functional>
+#include <thread>
+#include "VulkanTexelConverter.h"
+
+using namespace std;
+using namespace vgl::core;
+
+typedef VulkanTexelConverter TC;
+
+struct Conversion
+{
+  const char *name;
+  size_t srcBytesPerPixel, dstBytesPerPixel;
+  function<void(const void *src, void *dst, size_t numPixels)> run;
+};
+
+static double bestSeconds(const Conversion &conversion, const vector<uint8_t> &src, vector<uint8_t> &dst, size_t numPixels)
+{
+  double best = 1e30;
+
+  for(int i = 0; i < 5; i++)
+  {
+    auto start = chrono::steady_clock::now();
+    conversion.run(src.data(), dst.data(), numPixels);
+    best = min(best, chrono::duration<double>(chrono::steady_clock::now() - start).count());
+  }
+  return best;
+}
+
+static double srgbReference(double x)
+{
+  x = min(max(x, 0.0), 1.0);
+  double s = (x <= 0.0031308) ? x*12.92 : 1.055*pow(x, 1.0/2.4) - 0.055;
+  return floor(s*255.0 + 0.5);
+}
+
+//exactness checks that don't depend on the SIMD paths agreeing with the scalar ones
+static bool checkReferences()
+{
+  bool ok = true;
+
+  //every finite half survives a round trip through float
+  for(uint32_t h = 0; h < 0x10000; h++)
+  {
+    if((h & 0x7c00) == 0x7c00 && (h & 0x03ff))
+      continue;
+
+    uint16_t in = (uint16_t)h, out;
+    float f;
+    TC::halfToFloat(&in, &f, 1);
+    TC::floatToHalf(&f, &out, 1);
+    if(out != in)
+    {
+      cout << "half round trip failed for 0x" << hex << h << dec << endl;
+      ok = false;
+      break;
+    }
+  }
+
+  //sRGB encoding matches the exactly rounded curve over a dense sweep of [0, 1]
+  vector<float> linear;
+  for(float x = 0; x <= 1.0f; x = nextafterf(x, 2.0f) + 1e-7f)
+    linear.push_back(x);
+  while(linear.size() % 4)
+    linear.push_back(1.0f);
+
+  vector<uint8_t> encoded(linear.size());
+  TC::linearToSrgb(linear.data(), encoded.data(), linear.size() / 4);
+  for(size_t i = 0; i < linear.size(); i++)
+  {
+    double expected = (i % 4 == 3) ? nearbyintf(min(max(linear[i], 0.0f), 1.0f)*255.0f) : srgbReference(linear[i]);
+    if(encoded[i] != expected)
+    {
+      cout << "sRGB encoding of " << setprecision(9) << linear[i] << " gave " << (int)encoded[i] << ", expected " << expected << endl;
+      ok = false;
+      break;
+    }
+  }
+
+  return ok;
+}
+
+int main(int argc, char **argv)
+{
+  size_t numPixels = (size_t)(((argc > 1) ? atof(argv[1]) : 16.0) * 1024 * 1024);
+  unsigned hardwareThreads = max(1u, min(thread::hardware_concurrency(), 8u));
+  auto bestLevel = TC::getSimdLevel();
+
+  cout << "SIMD: " << TC::getSimdLevelName(bestLevel) << ", threads: " << hardwareThreads << ", " << numPixels << " pixels" << endl;
+
+  vector<Conversion> conversions = {
+    { "RGB8 -> RGBA8", 3, 4, [](const void *s, void *d, size_t n) { TC::rgbToRgba(s, d, n); } },
+    { "RGBA8 -> RGB8", 4, 3, [](const void *s, void *d, size_t n) { TC::rgbaToRgb(s, d, n); } },
+    { "BGRA8 <-> RGBA8", 4, 4, [](const void *s, void *d, size_t n) { TC::swizzleRedBlue(s, d, n); } },
+    { "RGBA32F -> RGBA16F", 16, 8, [](const void *s, void *d, size_t n) { TC::floatToHalf((const float *)s, (uint16_t *)d, n*4); } },
+    { "RGBA16F -> RGBA32F", 8, 16, [](const void *s, void *d, size_t n) { TC::halfToFloat((const uint16_t *)s, (float *)d, n*4); } },
+    { "RGBA32F -> sRGBA8", 16, 4, [](const void *s, void *d, size_t n) { TC::linearToSrgb((const float *)s, (uint8_t *)d, n); } },
+    { "sRGBA8 -> RGBA32F", 4, 16, [](const void *s, void *d, size_t n) { TC::srgbToLinear((const uint8_t *)s, (float *)d, n); } },
+  };
+
+  mt19937 rng(1234);
+  bool ok = checkReferences();
+
+  cout << endl << left << setw(22) << "conversion" << right << setw(12) << "scalar" << setw(12) << "SIMD" << setw(12) << "threaded" << setw(10) << "speedup" << endl;
+  for(auto &conversion : conversions)
+  {
+    //float inputs are kept in [-0.25, 1.25] so half & sRGB conversions see clamping but no nans
+    vector<uint8_t> src(numPixels*conversion.srcBytesPerPixel);
+    if(conversion.srcBytesPerPixel == 16)
+    {
+      uniform_real_distribution<float> dist(-0.25f, 1.25f);
+      for(size_t i = 0; i < src.size(); i += 4)
+      {
+        float f = dist(rng);
+        memcpy(&src[i], &f, 4);
+      }
+    }
+    else if(conversion.srcBytesPerPixel == 8)
+    {
+      uniform_real_distribution<float> dist(-0.25f, 1.25f);
+      vector<float> floats(numPixels*4);
+      for(auto &f : floats)
+        f = dist(rng);
+      TC::floatToHalf(floats.data(), (uint16_t *)src.data(), floats.size());
+    }
+    else
+    {
+      for(auto &b : src)
+        b = (uint8_t)rng();
+    }
+
+    vector<uint8_t> expected(numPixels*conversion.dstBytesPerPixel), dst(expected.size());
+    double bytes = (double)numPixels*(conversion.srcBytesPerPixel + conversion.dstBytesPerPixel);
+
+    TC::setMaxSimdLevel(TC::SL_SCALAR);
+    TC::setThreading(0, 1);
+    double scalar = bestSeconds(conversion, src, expected, numPixels);
+
+    //the narrower instruction sets this CPU also supports have to agree as well
+    bool same = true;
+    for(int level = TC::SL_SSE2; level < (int)bestLevel; level++)
+    {
+      fill(dst.begin(), dst.end(), 0);
+      TC::setMaxSimdLevel((TC::SimdLevel)level);
+      conversion.run(src.data(), dst.data(), numPixels);
+      same = same && (dst == expected);
+    }
+
+    TC::setMaxSimdLevel(bestLevel);
+    double simd = bestSeconds(conversion, src, dst, numPixels);
+    same = same && (dst == expected);
+
+    fill(dst.begin(), dst.end(), 0);
+    TC::setThreading(4*1024*1024, hardwareThreads);
+    double threaded = bestSeconds(conversion, src, dst, numPixels);
+    same = same && (dst == expected);
+
+    cout << fixed << setprecision(2) << left << setw(22) << conversion.name << right
+      << setw(8) << bytes / scalar / 1e9 << " GB/s" << setw(7) << bytes / simd / 1e9 << " GB/s" << setw(7) << bytes / threaded / 1e9 << " GB/s"
+      << setw(9) << scalar / threaded << "x" << ((same) ? "" : "  MISMATCH") << endl;
+    ok = ok && same;
+  }
+
+  return (ok) ? 0 : 1;
+}
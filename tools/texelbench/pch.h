@@ -0,0 +1,14 @@
+#define _USE_MATH_DEFINES
+#include <math.h>
+#include <string.h>
+
+//only the texel converter is built here, so vglcore.h (and vulkan) is left out
+#include <iostream>
+#include <stdexcept>
+#define verr cerr
+#define vout cout
+#define vgl_runtime_error runtime_error
+
+#ifdef max
+#undef max
+#endif
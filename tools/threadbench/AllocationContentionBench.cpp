@@ -0,0 +1,198 @@
+/*********************************************************************
+Copyright 2018 VERTO STUDIO LLC.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+***************************************************************************/
+
+//Measures VulkanMemoryManager's small allocate() & free() throughput from 1 to 16 threads on a mock device (no GPU needed), comparing
+//the per memory type locks with & without thread caching against every call serialized behind one lock like the manager used to be.
+//
+//  VGLThreadBench [operations per thread]
+
+#include "pch.h"
+#include <vector>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <iomanip>
+#include "MockVulkanDevice.h"
+
+using namespace std;
+using namespace vgl::core;
+using namespace vgl::memreplay;
+
+static const VkPhysicalDevice mockPhysicalDevice = (VkPhysicalDevice)(uintptr_t)1;
+static const VkDevice mockDevice = (VkDevice)(uintptr_t)1;
+static const uint32_t deviceLocalTypes = 4;
+
+struct Configuration
+{
+  const char *name;
+  bool singleLock, threadCaching;
+};
+
+struct BenchResult
+{
+  double seconds = 0;
+  size_t failures = 0;
+};
+
+static void configureDevice()
+{
+  VulkanMemoryManager::TraceHeader header = {};
+  auto &props = header.memoryProperties;
+
+  //several device local types on one heap like many desktop drivers expose, so threads can work on different type locks
+  props.memoryHeapCount = 2;
+  props.memoryHeaps[0] = { (8ull<<30), VK_MEMORY_HEAP_DEVICE_LOCAL_BIT };
+  props.memoryHeaps[1] = { (16ull<<30), 0 };
+  props.memoryTypeCount = deviceLocalTypes+1;
+  for(uint32_t i = 0; i < deviceLocalTypes; i++)
+    props.memoryTypes[i] = { VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0 };
+  props.memoryTypes[deviceLocalTypes] = { VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 1 };
+  header.minUniformBufferOffsetAlignment = header.minStorageBufferOffsetAlignment = 256;
+  header.nonCoherentAtomSize = 64;
+  header.bufferImageGranularity = 1024;
+  MockVulkanDevice::configure(header);
+}
+
+//each thread keeps a working set of small buffers live & replaces a random one per operation, thread i allocates from memory type i % deviceLocalTypes
+static BenchResult run(const Configuration &configuration, uint32_t threadCount, size_t operations)
+{
+  const size_t workingSet = 256;
+  BenchResult result;
+
+  VulkanMemoryManager::setAllocationStrategy(VulkanMemoryManager::AS_DESKTOP);
+  VulkanMemoryManager::setFreeRegionStrategy(VulkanMemoryManager::FRS_TLSF);
+  VulkanMemoryManager::setSlabAllocationEnabled(false);
+  MockVulkanDevice::resetCounters();
+
+  {
+    VulkanMemoryManager memoryManager(mockPhysicalDevice, mockDevice);
+    mutex singleLock;
+    vector<thread> threads;
+    vector<size_t> failures(threadCount, 0);
+
+    memoryManager.setThreadCachingEnabled(configuration.threadCaching);
+
+    auto worker = [&](uint32_t index) {
+      mt19937 rng(1234+index);
+      vector<VulkanMemoryManager::Suballocation> live;
+      uint32_t typeFilter = 1u << (index % deviceLocalTypes);
+
+      auto allocate = [&]() {
+        //4-64k so every request stays within the thread cache's size limit
+        VkDeviceSize size = 4096 + rng() % (60<<10);
+        VulkanMemoryManager::Suballocation suballocation;
+
+        if(configuration.singleLock)
+        {
+          lock_guard<mutex> locker(singleLock);
+          suballocation = memoryManager.allocate(typeFilter, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, size, 256);
+        }
+        else
+        {
+          suballocation = memoryManager.allocate(typeFilter, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, size, 256);
+        }
+
+        if(!suballocation)
+          failures[index]++;
+        return suballocation;
+      };
+      auto free = [&](const VulkanMemoryManager::Suballocation &suballocation) {
+        if(configuration.singleLock)
+        {
+          lock_guard<mutex> locker(singleLock);
+          memoryManager.free(suballocation);
+        }
+        else
+        {
+          memoryManager.free(suballocation);
+        }
+      };
+
+      live.reserve(workingSet);
+      for(size_t i = 0; i < workingSet; i++)
+        live.push_back(allocate());
+
+      for(size_t i = 0; i < operations; i++)
+      {
+        auto &victim = live[rng() % live.size()];
+        free(victim);
+        victim = allocate();
+      }
+
+      for(auto &suballocation : live)
+        free(suballocation);
+    };
+
+    auto start = chrono::steady_clock::now();
+    for(uint32_t i = 0; i < threadCount; i++)
+      threads.emplace_back(worker, i);
+    for(auto &t : threads)
+      t.join();
+    result.seconds = chrono::duration<double>(chrono::steady_clock::now()-start).count();
+
+    for(auto f : failures)
+      result.failures += f;
+    memoryManager.reclaimMemory();
+  }
+
+  return result;
+}
+
+int main(int argc, char **argv)
+{
+  const Configuration configurations[] = {
+    { "single lock", true, false },
+    { "sharded", false, false },
+    { "sharded+cache", false, true },
+  };
+  const uint32_t threadCounts[] = { 1, 2, 4, 8, 16 };
+
+  size_t operations = 50000;
+
+  if(argc > 1)
+  {
+    if(atoi(argv[1]) <= 0)
+    {
+      verr << "usage: " << argv[0] << " [operations per thread]" << endl;
+      return 1;
+    }
+    operations = (size_t)atoi(argv[1]);
+  }
+
+  configureDevice();
+  vout << operations << " alloc/free pairs per thread, " << thread::hardware_concurrency() << " hardware threads" << endl << endl;
+  vout << left << setw(16) << "configuration" << right << setw(9) << "threads" << setw(10) << "total s" << setw(10) << "Mops/s"
+       << setw(10) << "vs single" << setw(7) << "fails" << endl;
+
+  //the first configuration (single lock) is the baseline at each thread count
+  double baseline[sizeof(threadCounts)/sizeof(threadCounts[0])] = {};
+
+  for(auto &configuration : configurations)
+  {
+    for(size_t i = 0; i < sizeof(threadCounts)/sizeof(threadCounts[0]); i++)
+    {
+      auto result = run(configuration, threadCounts[i], operations);
+      double mops = (threadCounts[i] * operations) / result.seconds / 1e6;
+      if(!baseline[i])
+        baseline[i] = mops;
+
+      vout << left << setw(16) << configuration.name << right << setw(9) << threadCounts[i] << fixed << setprecision(3) << setw(10) << result.seconds
+           << setprecision(2) << setw(10) << mops << setw(9) << mops / baseline[i] << "x" << setw(7) << result.failures << endl;
+    }
+  }
+
+  return 0;
+}